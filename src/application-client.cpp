@@ -11,7 +11,7 @@ ApplicationClient::ApplicationClient(
     cycle();
 }
 
-ApplicationClient::~ApplicationClient() {}
+ApplicationClient::~ApplicationClient() { stop(); }
 
 void ApplicationClient::handle_message(MessageWithOwner &msg) { handler(msg); }
 
@@ -5,14 +5,11 @@
 #include <filesystem>
 
 struct MusicInfoCDT {
-    Glib::ustring FileName = "", FilePath, SortFileName, SortTitle,
-                  DurationString = "99:59:59.999", Title = "", Album = "",
-                  Artist = "", Extension;
+    Glib::ustring FileName = "", FilePath, DurationString = "99:59:59.999",
+                  Title = "", Album = "", Artist = "", Extension;
     std::string LRCFilePath = "";
-    int Id = -1, Duration = 0, DurationInMilliseconds = 359999999,
-        SortTitleAlphIndex = -1, SortArtistAlphIndex = -1,
-        SortAlbumAlphIndex = -1, SortDurationInMillisecondsIndex = -1,
-        SortFileNameAlphIndex = -1;
+    // where it is in AllMusicCopy and in the library, -1 for EmptyMusic
+    int Id = -1, Duration = 0, DurationInMilliseconds = 359999999;
     Glib::RefPtr<Gdk::Pixbuf> pIcon;
     bool CoverArt = false, LRC = false, CanonicalWAV = true;
     Glib::ustring Checksum = "";
@@ -53,6 +50,12 @@ MyApplication::MyApplication(const std::string &file, uint16_t port)
                                    Gio::APPLICATION_HANDLES_OPEN) {
 
     gst_init(NULL, NULL);
+    scanner_dispatcher.connect(
+        sigc::mem_fun(*this, &MyApplication::on_scanner_progress));
+    watcher_dispatcher.connect(
+        sigc::mem_fun(*this, &MyApplication::rescan_music_list));
+    network_dispatcher.connect(
+        sigc::mem_fun(*this, &MyApplication::on_network_tracks_arrived));
 
     // it depends on where you invoke the executable
     // if you are invoking it inside the src directory
@@ -260,25 +263,20 @@ Gtk::ApplicationWindow *MyApplication::create_appwindow() {
                                  Gtk::PolicyType::POLICY_ALWAYS);
     pScrolledWindow1->add(*pTreeView1);
 
-    pTreeModelColumnIcon = new Gtk::TreeModelColumn<Glib::RefPtr<Gdk::Pixbuf>>;
-    pTreeModelColumnId = new Gtk::TreeModelColumn<int>;
-    pTreeModelColumnTitle = new Gtk::TreeModelColumn<Glib::ustring>,
-    pTreeModelColumnTime = new Gtk::TreeModelColumn<Glib::ustring>,
-    pTreeModelColumnArtist = new Gtk::TreeModelColumn<Glib::ustring>,
-    pTreeModelColumnAlbum = new Gtk::TreeModelColumn<Glib::ustring>,
-    pTreeModelColumnFileName = new Gtk::TreeModelColumn<Glib::ustring>;
-
-    pTreeModelColumnRecord1 = new Gtk::TreeModelColumnRecord;
-    pTreeModelColumnRecord1->add(*pTreeModelColumnId);
-    pTreeModelColumnRecord1->add(*pTreeModelColumnIcon);
-    pTreeModelColumnRecord1->add(*pTreeModelColumnTitle);
-    pTreeModelColumnRecord1->add(*pTreeModelColumnTime);
-    pTreeModelColumnRecord1->add(*pTreeModelColumnArtist);
-    pTreeModelColumnRecord1->add(*pTreeModelColumnAlbum);
-    pTreeModelColumnRecord1->add(*pTreeModelColumnFileName);
-
-    pListStore1 = Gtk::ListStore::create(*pTreeModelColumnRecord1);
-    pTreeView1->set_model(pListStore1);
+    // the rows are read from the library when they are drawn
+    pMusicListModel1 = MusicListModel::create(
+        library,
+        [this](TrackIndex i) { return AllMusicCopy->at(i)->pIcon; },
+        [this](int milliseconds) { return TimeString(milliseconds); });
+    pTreeModelColumnIcon = &pMusicListModel1->columns.icon;
+    pTreeModelColumnId = &pMusicListModel1->columns.id;
+    pTreeModelColumnTitle = &pMusicListModel1->columns.title;
+    pTreeModelColumnTime = &pMusicListModel1->columns.time;
+    pTreeModelColumnArtist = &pMusicListModel1->columns.artist;
+    pTreeModelColumnAlbum = &pMusicListModel1->columns.album;
+    pTreeModelColumnFileName = &pMusicListModel1->columns.file_name;
+
+    pTreeView1->set_model(pMusicListModel1);
     pTreeView1->append_column("", *pTreeModelColumnIcon);
     pTreeView1->append_column("Title", *pTreeModelColumnTitle);
     pTreeView1->append_column("Time", *pTreeModelColumnTime);
@@ -287,15 +285,14 @@ Gtk::ApplicationWindow *MyApplication::create_appwindow() {
     pTreeView1->append_column("Filename", *pTreeModelColumnFileName);
     for (int x = 0; x < pTreeView1->get_n_columns(); x++) {
         Gtk::TreeViewColumn *col = pTreeView1->get_column(x);
-        col->set_sizing(Gtk::TreeViewColumnSizing::TREE_VIEW_COLUMN_AUTOSIZE);
+        col->set_sizing(Gtk::TreeViewColumnSizing::TREE_VIEW_COLUMN_FIXED);
         col->set_alignment(0);
         col->set_sort_indicator(false);
         col->set_clickable(true);
         if (x) {
             col->set_expand(true);
             col->set_min_width(150);
-            col->set_sizing(
-                Gtk::TreeViewColumnSizing::TREE_VIEW_COLUMN_AUTOSIZE);
+            col->set_fixed_width(150);
             col->set_resizable(true);
         } else {
             col->set_resizable(false);
@@ -315,10 +312,21 @@ Gtk::ApplicationWindow *MyApplication::create_appwindow() {
             col->set_fixed_width(150);
         }
     }
+    // every row is as high as the first one, so only the rows that are
+    // visible are looked at (the columns have to be fixed for it)
+    pTreeView1->set_fixed_height_mode(true);
 
     refBuilder->get_widget("SearchEntry1", pSearchEntry1);
+    // connected before the completion is set, so the completion model is up
+    // to date by the time the completion looks at it
+    pSearchEntry1->signal_changed().connect(
+        sigc::mem_fun(*this, &MyApplication::on_SearchEntry1_changed));
+    pCompletionModel1 = MusicListModel::create(
+        library,
+        [this](TrackIndex i) { return AllMusicCopy->at(i)->pIcon; },
+        [this](int milliseconds) { return TimeString(milliseconds); });
     pEntryCompletion1 = Gtk::EntryCompletion::create();
-    pEntryCompletion1->set_model(pListStore1);
+    pEntryCompletion1->set_model(pCompletionModel1);
     pSearchEntry1->set_completion(pEntryCompletion1);
     pEntryCompletion1->set_text_column(*pTreeModelColumnTitle);
     pEntryCompletion1->set_match_func(
@@ -501,103 +509,255 @@ void MyApplication::MusicListChanged() {
     CurrentMusic = EmptyMusic;
     ChangeMusic();
     set_music_list();
-    update_tree_model();
-    for (int x = 0; x < pTreeView1->get_n_columns(); x++)
-        pTreeView1->get_column(x)->set_sort_indicator(false);
-    pTreeView1->get_column(TITLE)->set_sort_indicator(true);
-    pTreeView1->get_column(TITLE)->set_sort_order(
-        Gtk::SortType::SORT_ASCENDING);
-    SortColumn = TITLE;
-    SortOrder = Gtk::SortType::SORT_ASCENDING;
     resorting = false;
-
-    if (PlayMode == SHUFFLE_ON)
-        Shuffle();
 }
 
 void MyApplication::set_music_list() {
+    // whatever the previous scan still had to do is of no use anymore
+    scanner.reset();
+    cover_art.cancel();
+    rescanning = false;
+    rescanned.clear();
+    removed_music.clear();
+    rescan_pending = false;
     for (int x = 0; x < AllMusic->size(); x++)
         delete AllMusic->at(x);
     AllMusic->resize(0);
-    std::vector<std::filesystem::path> files_path = ListFiles::listfiles(
-        Directory, exts, true, ShowFileInSubfolders, false);
-    std::vector<Track> collected;
-    for (const std::filesystem::path &file_path : files_path) {
-        MusicInfoADT _music = new MusicInfoCDT;
-        std::string ext = file_path.extension().string();
-        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
-        _music->Extension = Glib::ustring(ext).lowercase();
-
-        _music->FileName = Glib::ustring(file_path.filename().string());
-        _music->FileName =
-            _music->FileName.substr(0, _music->FileName.size() - ext.length());
-        _music->SortFileName = _music->FileName.lowercase();
-        std::string FilePath = file_path.string();
-        std::replace(FilePath.begin(), FilePath.end(), '\\', '/');
-        _music->FilePath = Glib::ustring(FilePath);
-        _music->pIcon = select_icon(file_path);
-        std::string lrcfilepath =
-            file_path.parent_path().string() + "/" + _music->FileName + ".lrc";
-        if (std::filesystem::exists(lrcfilepath)) {
-            _music->LRC = true;
-            _music->LRCFilePath = lrcfilepath;
+    if (AllMusicCopy == nullptr)
+        AllMusicCopy = new std::vector<MusicInfoADT>;
+    else
+        AllMusicCopy->resize(0);
+    library.clear();
+    search_index.clear();
+    show_music_list({});
+    network_music.clear();
+    show_search_results();
+
+    // the network tracks are already known, they are shown right away
+    for (auto &r : network_tracks) {
+        add_network_music(r.first, r.second.track);
+    }
+
+    // the local files show up as the scanner gets to them, see
+    // on_scanner_progress
+    std::string directory = Directory;
+    bool recursive = ShowFileInSubfolders;
+    scanner = std::make_unique<LibraryScanner>(
+        store, directory,
+        [this, directory, recursive]() {
+            return ListFiles::listfiles(directory, exts, true, recursive,
+                                        false);
+        },
+        [this](const std::filesystem::path &file_path, const Track *stored) {
+            return describe_file(file_path, stored);
+        },
+        [this]() { scanner_dispatcher.emit(); });
+    watch_directory();
+}
+
+void MyApplication::rescan_music_list() {
+    if (scanner) {
+        // the scan that is going on may have looked at the files that changed
+        // already, so there is another one once it is over
+        rescan_pending = true;
+        return;
+    }
+    rescanning = true;
+    rescan_changed = false;
+    std::unordered_set<std::string> shown;
+    for (MusicInfoADT _music : *AllMusic) {
+        // network tracks are not in Directory
+        if (_music->FilePath != "Network") {
+            rescanned[_music->FilePath] = _music;
+            shown.insert(_music->FilePath);
         }
-        taglib_get_data(_music);
-        collected.push_back(convert_music_info_to_track(*_music));
-        AllMusic->push_back(_music);
     }
+    std::string directory = Directory;
+    bool recursive = ShowFileInSubfolders;
+    scanner = std::make_unique<LibraryScanner>(
+        store, directory,
+        [this, directory, recursive]() {
+            return ListFiles::listfiles(directory, exts, true, recursive,
+                                        false);
+        },
+        [this](const std::filesystem::path &file_path, const Track *stored) {
+            return describe_file(file_path, stored);
+        },
+        [this]() { scanner_dispatcher.emit(); }, std::move(shown));
+}
+
+void MyApplication::watch_directory() {
+    watcher.reset();
+    if (WatchDirectory) {
+        watcher = std::make_unique<FolderWatcher>(
+            std::string(Directory), ShowFileInSubfolders,
+            [this]() { watcher_dispatcher.emit(); });
+    }
+}
 
-    std::thread add_tracks_in_background(
-        [&collected, this]() { store.upsert_many(collected); });
+void MyApplication::add_to_music_list(MusicInfoADT _music) {
+    // the number is where it is in AllMusicCopy, like finish_music_list
+    // gives them out
+    _music->Id = AllMusicCopy->size();
+    AllMusic->push_back(_music);
+    AllMusicCopy->push_back(_music);
+    library.add(library_track(_music));
+    search_index.add(library, _music->Id);
+    pMusicListModel1->append(_music->Id);
+}
+
+void MyApplication::add_network_music(const std::string &key,
+                                      const Track &track) {
+    MusicInfoADT _music = new MusicInfoCDT;
+    std::string ext = std::filesystem::path(track.path).extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    _music->Extension = Glib::ustring(ext).lowercase();
+
+    _music->FileName =
+        Glib::ustring(std::filesystem::path(track.path).filename().string());
+    _music->FileName =
+        _music->FileName.substr(0, _music->FileName.size() - ext.length());
+    _music->FilePath = "Network";
+    _music->pIcon = select_icon(std::filesystem::path(track.path));
+    if (track.lrcfile != "") {
+        _music->LRC = true;
+        _music->LRCFilePath = track.lrcfile;
+    }
+    _music->DurationInMilliseconds = track.duration;
+    _music->Duration = track.duration / 1000;
+    _music->DurationString = TimeString(_music->DurationInMilliseconds);
 
-    for (auto &r : network_tracks) {
-        MusicInfoADT _music = new MusicInfoCDT;
-        std::string ext =
-            std::filesystem::path(r.second.track.path).extension().string();
-        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
-        _music->Extension = Glib::ustring(ext).lowercase();
-
-        _music->FileName = Glib::ustring(
-            std::filesystem::path(r.second.track.path).filename().string());
-        _music->FileName =
-            _music->FileName.substr(0, _music->FileName.size() - ext.length());
-        _music->SortFileName = _music->FileName.lowercase();
-        std::string FilePath = "Network";
-        std::replace(FilePath.begin(), FilePath.end(), '\\', '/');
-        _music->FilePath = Glib::ustring(FilePath);
-        _music->pIcon = select_icon(std::filesystem::path(r.second.track.path));
-        std::string lrcfilepath = r.second.track.lrcfile;
-        if (lrcfilepath != "") {
-            _music->LRC = true;
-            _music->LRCFilePath = lrcfilepath;
+    _music->Album = track.album;
+    _music->Artist = track.artist;
+    _music->Title = track.title;
+    _music->Checksum = key;
+    network_music[key] = _music;
+    add_to_music_list(_music);
+}
+
+void MyApplication::on_scanner_progress() {
+    if (!scanner) {
+        return;
+    }
+    // looked at before taking the tracks: once it says finished, every track
+    // is there to be taken
+    ScanProgress progress = scanner->progress();
+    for (const std::string &path : scanner->take_removed()) {
+        auto shown = rescanned.find(path);
+        if (shown != rescanned.end()) {
+            removed_music.push_back(shown->second);
+        }
+    }
+    for (const Track &t : scanner->take()) {
+        // a file that is on the list already changed, it stays where it is
+        auto shown = rescanned.find(t.path);
+        bool is_new = shown == rescanned.end();
+        MusicInfoADT _music = is_new ? new MusicInfoCDT : shown->second;
+        if (is_new) {
+            set_music_info_from_path(_music, t.path);
+            _music->pIcon = select_icon(std::filesystem::path(t.path));
         }
-        _music->DurationInMilliseconds = r.second.track.duration;
-        _music->Duration = r.second.track.duration / 1000;
-        _music->DurationString = TimeString(_music->DurationInMilliseconds);
+        _music->LRC = !t.lrcfile.empty();
+        _music->LRCFilePath = t.lrcfile;
+        set_music_info_from_track(_music, t);
+        // decoded in the background while the list fills up, so changing
+        // tracks doesn't wait for it (the files that were opened to describe
+        // them are cached already)
+        if (_music->CoverArt) {
+            cover_art.prefetch(_music->FilePath, _music->Extension);
+        }
+        if (is_new) {
+            add_to_music_list(_music);
+        } else {
+            library.set(_music->Id, library_track(_music));
+            search_index.add(library, _music->Id);
+        }
+        rescan_changed = true;
+    }
+    if (!progress.finished) {
+        pHeaderBar1->set_subtitle(Glib::ustring::compose(
+            "%1 (scanning, %2 of %3 files)", Directory, progress.described,
+            progress.files));
+        return;
+    }
+    scanner.reset();
+    pHeaderBar1->set_subtitle(Directory);
+    // a rescan where nothing changed leaves the list (and its order) alone
+    if (!rescanning || rescan_changed || !removed_music.empty()) {
+        remove_from_music_list(removed_music);
+        finish_music_list();
+    }
+    rescanning = false;
+    rescanned.clear();
+    removed_music.clear();
+    if (rescan_pending) {
+        rescan_pending = false;
+        rescan_music_list();
+    }
+}
 
-        _music->Album = r.second.track.album;
-        _music->Artist = r.second.track.artist;
-        _music->Title = r.second.track.title;
-        _music->SortTitle = _music->Title.lowercase();
-        _music->Checksum = r.second.track.checksum;
-        AllMusic->push_back(_music);
+void MyApplication::remove_from_music_list(
+    const std::vector<MusicInfoADT> &removed) {
+    if (removed.empty()) {
+        return;
+    }
+    std::unordered_set<MusicInfoADT> gone(removed.begin(), removed.end());
+    if (gone.contains(CurrentMusic)) {
+        PauseMusic();
+        CurrentMusic = EmptyMusic;
+        ChangeMusic();
+    }
+    if (gone.contains(SelectedMusic)) {
+        SelectedMusic = EmptyMusic;
+    }
+    // AllMusicCopy and the shuffled list are made again from AllMusic by
+    // finish_music_list
+    std::erase_if(*AllMusic,
+                  [&gone](MusicInfoADT _music) { return gone.contains(_music); });
+    for (MusicInfoADT _music : removed) {
+        delete _music;
     }
+}
 
-    if (AllMusicCopy == nullptr)
-        AllMusicCopy = new std::vector<MusicInfoADT>;
-    else
+void MyApplication::finish_music_list() {
+    resorting = true;
+    // the Ids only have to be given out again when tracks were taken off the
+    // list, the tracks added or changed since are already in the library
+    if (AllMusicCopy->size() != AllMusic->size()) {
         AllMusicCopy->resize(0);
-    SortMusicListByTitleAlphabeticalOrder();
-    for (int counter = 0; counter < AllMusic->size(); counter++) {
-        AllMusic->at(counter)->Id = counter;
-        AllMusicCopy->push_back(AllMusic->at(counter));
-    }
-    SortMusicListByDurationInMilliseconds();
-    SortMusicListByArtistAlphabeticalOrder();
-    SortMusicListByAlbumAlphabeticalOrder();
-    SortMusicListByFileNameAlphabeticalOrder();
+        library.clear();
+        library.reserve(AllMusic->size());
+        search_index.clear();
+        for (int counter = 0; counter < AllMusic->size(); counter++) {
+            MusicInfoADT _music = AllMusic->at(counter);
+            _music->Id = counter;
+            AllMusicCopy->push_back(_music);
+            library.add(library_track(_music));
+            search_index.add(library, counter);
+        }
+        // what it suggests is by the old Ids
+        show_search_results();
+    }
     SortMusicListByIndex(TITLE, Gtk::SortType::SORT_ASCENDING);
-    add_tracks_in_background.join();
+    update_tree_model(TITLE, Gtk::SortType::SORT_ASCENDING);
+    for (int x = 0; x < pTreeView1->get_n_columns(); x++)
+        pTreeView1->get_column(x)->set_sort_indicator(false);
+    pTreeView1->get_column(TITLE)->set_sort_indicator(true);
+    pTreeView1->get_column(TITLE)->set_sort_order(
+        Gtk::SortType::SORT_ASCENDING);
+    SortColumn = TITLE;
+    SortOrder = Gtk::SortType::SORT_ASCENDING;
+    resorting = false;
+
+    if (PlayMode == SHUFFLE_ON && rescanning) {
+        // a new order with the files there are now, but without changing
+        // what is playing like Shuffle does
+        AllMusicShuffled->resize(0);
+        AllMusicShuffledPos = 0;
+        AllMusicShuffledSize = 0;
+        ExtendAllMusicShuffled(true);
+    } else if (PlayMode == SHUFFLE_ON)
+        Shuffle();
 }
 
 Track MyApplication::convert_music_info_to_track(const MusicInfoCDT &m) {
@@ -608,21 +768,76 @@ Track MyApplication::convert_music_info_to_track(const MusicInfoCDT &m) {
     t.lrcfile = m.LRCFilePath;
     t.duration = m.DurationInMilliseconds;
     t.title = m.Title;
+    t.cover_art = m.CoverArt;
+    t.extension = m.Extension;
+    t.canonical_wav = m.CanonicalWAV;
     return t;
 }
 
-void MyApplication::update_tree_model() {
-    pListStore1->clear();
-    for (int counter = 0; counter < AllMusic->size(); counter++) {
-        Gtk::TreeModel::Row row = *(pListStore1->append());
-        row[*pTreeModelColumnId] = AllMusic->at(counter)->Id;
-        row[*pTreeModelColumnIcon] = AllMusic->at(counter)->pIcon;
-        row[*pTreeModelColumnTitle] = AllMusic->at(counter)->Title;
-        row[*pTreeModelColumnTime] = AllMusic->at(counter)->DurationString;
-        row[*pTreeModelColumnArtist] = AllMusic->at(counter)->Artist;
-        row[*pTreeModelColumnAlbum] = AllMusic->at(counter)->Album;
-        row[*pTreeModelColumnFileName] = AllMusic->at(counter)->FileName;
+void MyApplication::set_music_info_from_path(
+    MusicInfoADT _music, const std::filesystem::path &file_path) {
+    std::string ext = file_path.extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    _music->Extension = Glib::ustring(ext).lowercase();
+
+    _music->FileName = Glib::ustring(file_path.filename().string());
+    _music->FileName =
+        _music->FileName.substr(0, _music->FileName.size() - ext.length());
+    std::string FilePath = file_path.string();
+    std::replace(FilePath.begin(), FilePath.end(), '\\', '/');
+    _music->FilePath = Glib::ustring(FilePath);
+}
+
+Track MyApplication::describe_file(const std::filesystem::path &file_path,
+                                   const Track *stored) {
+    MusicInfoCDT music;
+    set_music_info_from_path(&music, file_path);
+    std::string lrcfilepath =
+        file_path.parent_path().string() + "/" + music.FileName + ".lrc";
+    if (std::filesystem::exists(lrcfilepath)) {
+        music.LRC = true;
+        music.LRCFilePath = lrcfilepath;
+    }
+    // only files that changed since they were stored are opened, once: the
+    // thumbnail comes with the tags, while the cache has room for it
+    if (stored) {
+        set_music_info_from_track(&music, *stored);
+    } else {
+        FileTags tags = read_file_tags(
+            music.FilePath, cover_art.has_room() ? COVER_ART_THUMBNAIL : 0);
+        set_music_info_from_tags(&music, tags);
+        cover_art.put(music.FilePath, tags.thumbnail);
     }
+    return convert_music_info_to_track(music);
+}
+
+// everything set_music_info_from_tags fills in, from the database instead
+void MyApplication::set_music_info_from_track(MusicInfoADT _music,
+                                              const Track &t) {
+    _music->Title = Glib::ustring(t.title);
+    _music->Album = Glib::ustring(t.album);
+    _music->Artist = Glib::ustring(t.artist);
+    _music->Duration = t.duration / 1000;
+    _music->DurationInMilliseconds = t.duration;
+    _music->DurationString = TimeString(_music->DurationInMilliseconds);
+    _music->CoverArt = t.cover_art;
+    _music->CanonicalWAV = t.canonical_wav;
+}
+
+void MyApplication::update_tree_model(TreeViewColumns column,
+                                      Gtk::SortType order) {
+    std::vector<TrackIndex> rows;
+    library.sort(library_column(column),
+                 order == Gtk::SortType::SORT_ASCENDING, rows);
+    show_music_list(std::move(rows));
+}
+
+void MyApplication::show_music_list(std::vector<TrackIndex> rows) {
+    // it is quicker for them to look at the model again than to be told
+    // where every row went
+    pTreeView1->unset_model();
+    pMusicListModel1->show(std::move(rows));
+    pTreeView1->set_model(pMusicListModel1);
 }
 
 void MyApplication::Shuffle() {
@@ -799,6 +1014,16 @@ void MyApplication::on_ButtonDialog2Save_clicked() {
     ShowFileInSubfolders = pCheckButton1->get_active();
     ShowFileFromNetwork = pCheckButton2->get_active();
     pDialog2->hide();
+    // the peers' databases are only fetched to show their files, searching
+    // doesn't need them (see search_peers)
+    if (ShowFileFromNetwork && !OriginalShowFileFromNetwork) {
+        for (auto &p : client->get_peers()) {
+            client->spawn(fetch_database(p.first));
+        }
+    } else if (!ShowFileFromNetwork && OriginalShowFileFromNetwork) {
+        // what searches find is found again when it is looked for
+        network_tracks.clear();
+    }
     if (OriginalShowFileInSubfolders != ShowFileInSubfolders ||
         OriginalShowFileFromNetwork != ShowFileFromNetwork || IpsChanged)
         MusicListChanged();
@@ -811,7 +1036,7 @@ void MyApplication::on_AboutDialog1_response(int response_id) {
         pAboutDialog1->hide();
 }
 
-void MyApplication::on_Reload_clicked() { MusicListChanged(); }
+void MyApplication::on_Reload_clicked() { rescan_music_list(); }
 
 void MyApplication::on_FileChooserButton1_selection_changed() {
     Directory = pFileChooserButton1->get_filename();
@@ -901,40 +1126,22 @@ void MyApplication::on_Adjustment1_changed() {
         ResetLyric();
 }
 
-void MyApplication::taglib_get_data(MusicInfoADT _music) {
-    TagLib::FileRef f(_music->FilePath.c_str());
-    _music->Title = Glib::ustring((!(f.tag()->title().to8Bit(true).empty())
-                                       ? f.tag()->title().to8Bit(true)
-                                       : "None"));
-    _music->SortTitle = _music->Title.lowercase();
-    _music->Album = Glib::ustring((!(f.tag()->album().to8Bit(true).empty())
-                                       ? f.tag()->album().to8Bit(true)
-                                       : "None"));
-    _music->Artist = Glib::ustring((!(f.tag()->artist().to8Bit(true).empty())
-                                        ? f.tag()->artist().to8Bit(true)
-                                        : "None"));
-    _music->Duration = f.audioProperties()->length();
-    _music->DurationInMilliseconds =
-        f.audioProperties()->lengthInMilliseconds();
+void MyApplication::set_music_info_from_tags(MusicInfoADT _music,
+                                             const FileTags &tags) {
+    _music->Title = Glib::ustring(tags.title.empty() ? "None" : tags.title);
+    _music->Album = Glib::ustring(tags.album.empty() ? "None" : tags.album);
+    _music->Artist = Glib::ustring(tags.artist.empty() ? "None" : tags.artist);
+    _music->Duration = tags.duration / 1000;
+    _music->DurationInMilliseconds = tags.duration;
     _music->DurationString = TimeString(_music->DurationInMilliseconds);
-    if (_music->Extension == ".mp3")
-        _music->CoverArt = !(dynamic_cast<TagLib::MPEG::File *>(f.file())
-                                 ->ID3v2Tag()
-                                 ->frameListMap()["APIC"]
-                                 .isEmpty());
-    else if (_music->Extension == ".m4a")
-        _music->CoverArt = !(dynamic_cast<TagLib::MP4::File *>(f.file())
-                                 ->tag()
-                                 ->item("covr")
-                                 .toCoverArtList()
-                                 .isEmpty());
-    else
-        _music->CoverArt = false;
+    _music->CoverArt = tags.cover_art;
 }
 
 void MyApplication::on_TreeViewColumn_Clicked(TreeViewColumns NewSortColumn) {
     TreeViewColumnClicked = true;
-    if (NewSortColumn != ICON) {
+    // the list is sorted by title again once the scan is over, so it is
+    // left as it is until then
+    if (NewSortColumn != ICON && !scanner) {
         resorting = true;
         Gtk::SortType NewSortOrder =
             (SortColumn == NewSortColumn
@@ -946,13 +1153,13 @@ void MyApplication::on_TreeViewColumn_Clicked(TreeViewColumns NewSortColumn) {
         SortMusicListByIndex(NewSortColumn, NewSortOrder);
         for (int x = 0; x < pTreeView1->get_n_columns(); x++)
             pTreeView1->get_column(x)->set_sort_indicator(false);
-        update_tree_model();
+        update_tree_model(NewSortColumn, NewSortOrder);
         pTreeView1->get_column(NewSortColumn)->set_sort_indicator(true);
         pTreeView1->get_column(NewSortColumn)->set_sort_order(NewSortOrder);
-        Gtk::TreeRow SelectedRow = pListStore1->children()[GetSortIndex(
+        Gtk::TreeRow SelectedRow = pMusicListModel1->children()[GetSortIndex(
             SelectedMusic, NewSortColumn, NewSortOrder)];
         pTreeSelection1->select(SelectedRow);
-        pTreeView1->scroll_to_row(pListStore1->get_path(SelectedRow));
+        pTreeView1->scroll_to_row(pMusicListModel1->get_path(SelectedRow));
         SortOrder = NewSortOrder;
         resorting = false;
     }
@@ -960,24 +1167,9 @@ void MyApplication::on_TreeViewColumn_Clicked(TreeViewColumns NewSortColumn) {
 
 int MyApplication::GetSortIndex(MusicInfoADT _music, TreeViewColumns SortColumn,
                                 Gtk::SortType SortOrder) {
-    int index = -1;
-    switch (SortColumn) {
-    case TITLE:
-        index = _music->SortTitleAlphIndex;
-        break;
-    case TIME:
-        index = _music->SortDurationInMillisecondsIndex;
-        break;
-    case ARTIST:
-        index = _music->SortArtistAlphIndex;
-        break;
-    case ALBUM:
-        index = _music->SortAlbumAlphIndex;
-        break;
-    case FILENAME:
-        index = _music->SortFileNameAlphIndex;
-        break;
-    }
+    int index = _music->Id < 0
+                    ? -1
+                    : library.position(library_column(SortColumn), _music->Id);
     return (SortOrder == Gtk::SortType::SORT_ASCENDING
                 ? index
                 : (AllMusicCopy->size() - 1 - index));
@@ -996,8 +1188,11 @@ void MyApplication::LoadMusic() {
     }
 
     if (CurrentMusic->Extension == ".wav" && CurrentMusic->CanonicalWAV)
-        if (!wav->openWavFile(CurrentMusic->FilePath.c_str()))
+        if (!wav->openWavFile(CurrentMusic->FilePath.c_str())) {
             CurrentMusic->CanonicalWAV = false;
+            // so it is not tried again next time
+            store.set_canonical_wav(CurrentMusic->FilePath, false);
+        }
 
     if (CurrentMusic->Extension != ".wav" || !CurrentMusic->CanonicalWAV) {
         Glib::ustring command =
@@ -1071,11 +1266,11 @@ void MyApplication::PauseMusic() {
     pButtonPlay1->set_active(false);
     SystemTogglingPlayButton = false;
     state = PAUSED;
+    // don't write to the pipeline, new segments are asked only until the
+    // buffer is full (see FileSharing::has_credit)
     fs.must_pause();
     pButtonPlay1->set_label("Play");
     pButtonPlay1_Img->set_from_resource("/my_app/start.png");
-    // don't write to the pipeline, and don't ask for new segments!
-    fs.pause_writing();
 
     if (IsPlaying && CurrentMusic->Id >= 0) {
         gst_element_set_state(pipeline, GST_STATE_PAUSED);
@@ -1174,164 +1369,46 @@ void MyApplication::PlayMusic() {
         PauseMusic();
 }
 
-void MyApplication::SortMusicListByIndex(TreeViewColumns SortColumn,
-                                         Gtk::SortType SortOrder) {
-    switch (SortColumn) {
-    case TITLE:
-        std::sort(AllMusic->begin(), AllMusic->end(),
-                  (SortOrder == Gtk::SortType::SORT_ASCENDING
-                       ? CompareByTitleAlphabeticalOrderIndexAscending
-                       : CompareByTitleAlphabeticalOrderIndexDescending));
-        break;
+LibraryTrack MyApplication::library_track(MusicInfoADT _music) {
+    return {.title = _music->Title.raw(),
+            .artist = _music->Artist.raw(),
+            .album = _music->Album.raw(),
+            .file_name = _music->FileName.raw(),
+            .path = _music->FilePath.raw(),
+            .duration = _music->DurationInMilliseconds};
+}
+
+Library::Column MyApplication::library_column(TreeViewColumns column) {
+    switch (column) {
     case TIME:
-        std::sort(AllMusic->begin(), AllMusic->end(),
-                  (SortOrder == Gtk::SortType::SORT_ASCENDING
-                       ? CompareByDurationInMillisecondsIndexAscending
-                       : CompareByDurationInMillisecondsIndexDescending));
-        break;
+        return Library::DURATION;
     case ARTIST:
-        std::sort(AllMusic->begin(), AllMusic->end(),
-                  (SortOrder == Gtk::SortType::SORT_ASCENDING
-                       ? CompareByArtistAlphabeticalOrderIndexAscending
-                       : CompareByArtistAlphabeticalOrderIndexDescending));
-        break;
+        return Library::ARTIST;
     case ALBUM:
-        std::sort(AllMusic->begin(), AllMusic->end(),
-                  (SortOrder == Gtk::SortType::SORT_ASCENDING
-                       ? CompareByAlbumAlphabeticalOrderIndexAscending
-                       : CompareByAlbumAlphabeticalOrderIndexDescending));
-        break;
+        return Library::ALBUM;
     case FILENAME:
-        std::sort(AllMusic->begin(), AllMusic->end(),
-                  (SortOrder == Gtk::SortType::SORT_ASCENDING
-                       ? CompareByFileNameAlphabeticalOrderIndexAscending
-                       : CompareByFileNameAlphabeticalOrderIndexDescending));
-        break;
+        return Library::FILE_NAME;
+    default:
+        return Library::TITLE;
     }
 }
 
-bool MyApplication::CompareByTitleAlphabeticalOrder(const MusicInfoADT &a,
-                                                    const MusicInfoADT &b) {
-    return (a->SortTitle < b->SortTitle);
-}
-
-void MyApplication::SortMusicListByTitleAlphabeticalOrder() {
-    std::sort(AllMusic->begin(), AllMusic->end(),
-              CompareByTitleAlphabeticalOrder);
-    for (int counter = 0; counter < AllMusic->size(); counter++)
-        AllMusic->at(counter)->SortTitleAlphIndex = counter;
-}
-
-bool MyApplication::CompareByTitleAlphabeticalOrderIndexAscending(
-    const MusicInfoADT &a, const MusicInfoADT &b) {
-    return (a->SortTitleAlphIndex < b->SortTitleAlphIndex);
-}
-
-bool MyApplication::CompareByTitleAlphabeticalOrderIndexDescending(
-    const MusicInfoADT &a, const MusicInfoADT &b) {
-    return (a->SortTitleAlphIndex > b->SortTitleAlphIndex);
-}
-
-bool MyApplication::CompareByDurationInMilliseconds(const MusicInfoADT &a,
-                                                    const MusicInfoADT &b) {
-    if (a->DurationInMilliseconds != b->DurationInMilliseconds)
-        return (a->DurationInMilliseconds < b->DurationInMilliseconds);
-    else
-        return CompareByTitleAlphabeticalOrder(a, b);
-}
-
-void MyApplication::SortMusicListByDurationInMilliseconds() {
-    std::sort(AllMusic->begin(), AllMusic->end(),
-              CompareByDurationInMilliseconds);
-    for (int counter = 0; counter < AllMusic->size(); counter++)
-        AllMusic->at(counter)->SortDurationInMillisecondsIndex = counter;
-}
-
-bool MyApplication::CompareByDurationInMillisecondsIndexAscending(
-    const MusicInfoADT &a, const MusicInfoADT &b) {
-    return (a->SortDurationInMillisecondsIndex <
-            b->SortDurationInMillisecondsIndex);
-}
-
-bool MyApplication::CompareByDurationInMillisecondsIndexDescending(
-    const MusicInfoADT &a, const MusicInfoADT &b) {
-    return (a->SortDurationInMillisecondsIndex >
-            b->SortDurationInMillisecondsIndex);
-}
-
-bool MyApplication::CompareByAlbumAlphabeticalOrder(const MusicInfoADT &a,
-                                                    const MusicInfoADT &b) {
-    if (a->Album != b->Album)
-        return (a->Album.lowercase()) < (b->Album.lowercase());
-    else
-        return CompareByTitleAlphabeticalOrder(a, b);
-}
-
-void MyApplication::SortMusicListByAlbumAlphabeticalOrder() {
-    std::sort(AllMusic->begin(), AllMusic->end(),
-              CompareByAlbumAlphabeticalOrder);
-    for (int counter = 0; counter < AllMusic->size(); counter++)
-        AllMusic->at(counter)->SortAlbumAlphIndex = counter;
-}
-
-bool MyApplication::CompareByAlbumAlphabeticalOrderIndexAscending(
-    const MusicInfoADT &a, const MusicInfoADT &b) {
-    return (a->SortAlbumAlphIndex < b->SortAlbumAlphIndex);
-}
-
-bool MyApplication::CompareByAlbumAlphabeticalOrderIndexDescending(
-    const MusicInfoADT &a, const MusicInfoADT &b) {
-    return (a->SortAlbumAlphIndex > b->SortAlbumAlphIndex);
-}
-
-bool MyApplication::CompareByArtistAlphabeticalOrder(const MusicInfoADT &a,
-                                                     const MusicInfoADT &b) {
-    if (a->Artist != b->Artist)
-        return (a->Artist.lowercase()) < (b->Artist.lowercase());
-    else
-        return CompareByAlbumAlphabeticalOrder(a, b);
-}
-
-void MyApplication::SortMusicListByArtistAlphabeticalOrder() {
-    std::sort(AllMusic->begin(), AllMusic->end(),
-              CompareByArtistAlphabeticalOrder);
-    for (int counter = 0; counter < AllMusic->size(); counter++)
-        AllMusic->at(counter)->SortArtistAlphIndex = counter;
-}
-
-bool MyApplication::CompareByArtistAlphabeticalOrderIndexAscending(
-    const MusicInfoADT &a, const MusicInfoADT &b) {
-    return (a->SortArtistAlphIndex < b->SortArtistAlphIndex);
-}
-
-bool MyApplication::CompareByArtistAlphabeticalOrderIndexDescending(
-    const MusicInfoADT &a, const MusicInfoADT &b) {
-    return (a->SortArtistAlphIndex > b->SortArtistAlphIndex);
-}
-
-bool MyApplication::CompareByFileNameAlphabeticalOrder(const MusicInfoADT &a,
-                                                       const MusicInfoADT &b) {
-    return (a->SortFileName < b->SortFileName);
-}
-
-void MyApplication::SortMusicListByFileNameAlphabeticalOrder() {
-    std::sort(AllMusic->begin(), AllMusic->end(),
-              CompareByFileNameAlphabeticalOrder);
-    for (int counter = 0; counter < AllMusic->size(); counter++)
-        AllMusic->at(counter)->SortFileNameAlphIndex = counter;
-}
-
-bool MyApplication::CompareByFileNameAlphabeticalOrderIndexAscending(
-    const MusicInfoADT &a, const MusicInfoADT &b) {
-    return (a->SortFileNameAlphIndex < b->SortFileNameAlphIndex);
-}
-
-bool MyApplication::CompareByFileNameAlphabeticalOrderIndexDescending(
-    const MusicInfoADT &a, const MusicInfoADT &b) {
-    return (a->SortFileNameAlphIndex > b->SortFileNameAlphIndex);
+void MyApplication::SortMusicListByIndex(TreeViewColumns SortColumn,
+                                         Gtk::SortType SortOrder) {
+    // sorted the first time the column is asked for, see Library
+    const std::vector<TrackIndex> &order =
+        library.order(library_column(SortColumn));
+    AllMusic->resize(0);
+    for (TrackIndex i : order) {
+        AllMusic->push_back(AllMusicCopy->at(i));
+    }
+    if (SortOrder == Gtk::SortType::SORT_DESCENDING) {
+        std::reverse(AllMusic->begin(), AllMusic->end());
+    }
 }
 
 bool MyApplication::timeout1() {
+    feed_player();
 
     if (IsPlaying) {
         if (GstVolumeChanged) {
@@ -1384,121 +1461,21 @@ bool MyApplication::timeout1() {
 }
 
 void MyApplication::DisplayCoverArtSidebar() {
-    if (CurrentMusic->CoverArt && CurrentMusic->Extension == ".mp3") {
-        auto file = TagLib::MPEG::File(CurrentMusic->FilePath.c_str());
-        auto AttachedPictureFrame =
-            (TagLib::ID3v2::AttachedPictureFrame *)*file.ID3v2Tag()
-                ->frameListMap()["APIC"]
-                .begin();
-        std::string CoverArtFileName;
-        if (AttachedPictureFrame->mimeType() == "image/jpeg")
-            CoverArtFileName = "CoverArt.jpg";
-        else if (AttachedPictureFrame->mimeType() == "image/png")
-            CoverArtFileName = "CoverArt.png";
-        std::ofstream fout(CoverArtFileName.c_str(),
-                           std::ios::out | std::ios::binary);
-        fout.write((const char *)AttachedPictureFrame->picture().data(),
-                   AttachedPictureFrame->picture().size());
-        fout.close();
-        pImageCoverArt1->set(Glib::RefPtr<Gdk::Pixbuf>(
-            Gdk::Pixbuf::create_from_file(CoverArtFileName)
-                ->scale_simple(100, 100, Gdk::InterpType::INTERP_BILINEAR)));
-        std::filesystem::remove(CoverArtFileName);
-    }
-
-    else if (CurrentMusic->CoverArt && CurrentMusic->Extension == ".m4a") {
-        TagLib::MP4::CoverArt CoverArt =
-            TagLib::MP4::File(CurrentMusic->FilePath.c_str())
-                .tag()
-                ->item("covr")
-                .toCoverArtList()
-                .front();
-        std::string CoverArtFileName;
-        switch (CoverArt.format()) {
-        case TagLib::MP4::CoverArt::Format::BMP:
-            CoverArtFileName = "CoverArt.bmp";
-            break;
-        case TagLib::MP4::CoverArt::Format::GIF:
-            CoverArtFileName = "CoverArt.gif";
-            break;
-        case TagLib::MP4::CoverArt::Format::JPEG:
-            CoverArtFileName = "CoverArt.jpeg";
-            break;
-        case TagLib::MP4::CoverArt::Format::PNG:
-            CoverArtFileName = "CoverArt.png";
-            break;
-        }
-        std::ofstream fout(CoverArtFileName.c_str(),
-                           std::ios::out | std::ios::binary);
-        fout.write(CoverArt.data().data(), CoverArt.data().size());
-        fout.close();
-        pImageCoverArt1->set(Glib::RefPtr<Gdk::Pixbuf>(
-            Gdk::Pixbuf::create_from_file(CoverArtFileName)
-                ->scale_simple(100, 100, Gdk::InterpType::INTERP_BILINEAR)));
-        std::filesystem::remove(CoverArtFileName);
-    }
-
-    else
-        pImageCoverArt1->set(CurrentMusic->pIcon);
+    // the scan has most likely decoded it already (see on_scanner_progress)
+    Glib::RefPtr<Gdk::Pixbuf> CoverArt;
+    if (CurrentMusic->CoverArt)
+        CoverArt = cover_art.get(CurrentMusic->FilePath, CurrentMusic->Extension);
+    pImageCoverArt1->set(CoverArt ? CoverArt : CurrentMusic->pIcon);
 }
 
 void MyApplication::DisplayCoverArtDialog1() {
-    if (SelectedMusic->CoverArt && SelectedMusic->Extension == ".mp3") {
-        auto file = TagLib::MPEG::File(SelectedMusic->FilePath.c_str());
-        auto AttachedPictureFrame =
-            (TagLib::ID3v2::AttachedPictureFrame *)*file.ID3v2Tag()
-                ->frameListMap()["APIC"]
-                .begin();
-        std::string CoverArtFileName;
-        if (AttachedPictureFrame->mimeType() == "image/jpeg")
-            CoverArtFileName = "CoverArt.jpg";
-        else if (AttachedPictureFrame->mimeType() == "image/png")
-            CoverArtFileName = "CoverArt.png";
-        std::ofstream fout(CoverArtFileName.c_str(),
-                           std::ios::out | std::ios::binary);
-        fout.write((const char *)AttachedPictureFrame->picture().data(),
-                   AttachedPictureFrame->picture().size());
-        fout.close();
-        pImageCoverArt2->set(Glib::RefPtr<Gdk::Pixbuf>(
-            Gdk::Pixbuf::create_from_file(CoverArtFileName)
-                ->scale_simple(400, 400, Gdk::InterpType::INTERP_BILINEAR)));
-        std::filesystem::remove(CoverArtFileName);
-    }
-
-    else if (SelectedMusic->CoverArt && SelectedMusic->Extension == ".m4a") {
-        TagLib::MP4::CoverArt CoverArt =
-            TagLib::MP4::File(SelectedMusic->FilePath.c_str())
-                .tag()
-                ->item("covr")
-                .toCoverArtList()
-                .front();
-        std::string CoverArtFileName;
-        switch (CoverArt.format()) {
-        case TagLib::MP4::CoverArt::Format::BMP:
-            CoverArtFileName = "CoverArt.bmp";
-            break;
-        case TagLib::MP4::CoverArt::Format::GIF:
-            CoverArtFileName = "CoverArt.gif";
-            break;
-        case TagLib::MP4::CoverArt::Format::JPEG:
-            CoverArtFileName = "CoverArt.jpeg";
-            break;
-        case TagLib::MP4::CoverArt::Format::PNG:
-            CoverArtFileName = "CoverArt.png";
-            break;
-        }
-        std::ofstream fout(CoverArtFileName.c_str(),
-                           std::ios::out | std::ios::binary);
-        fout.write(CoverArt.data().data(), CoverArt.data().size());
-        fout.close();
-        pImageCoverArt2->set(Glib::RefPtr<Gdk::Pixbuf>(
-            Gdk::Pixbuf::create_from_file(CoverArtFileName)
-                ->scale_simple(400, 400, Gdk::InterpType::INTERP_BILINEAR)));
-        std::filesystem::remove(CoverArtFileName);
-    }
-
-    else
-        pImageCoverArt2->set(SelectedMusic->pIcon);
+    // big, and only when the dialog is opened, so it is not cached
+    Glib::RefPtr<Gdk::Pixbuf> CoverArt;
+    if (SelectedMusic->CoverArt)
+        CoverArt = decode_cover_art(
+            read_cover_art(SelectedMusic->FilePath, SelectedMusic->Extension),
+            400);
+    pImageCoverArt2->set(CoverArt ? CoverArt : SelectedMusic->pIcon);
 }
 
 void MyApplication::on_ButtonDialog1Cancel_clicked() { pDialog1->hide(); }
@@ -1611,25 +1588,80 @@ void MyApplication::on_MessageDialog1_response(int response_id) {
 // also can I asynchronously add things to the completion list??
 bool MyApplication::on_EntryCompletion1_match(
     const Glib::ustring &key, const Gtk::TreeModel::const_iterator &iter) {
+    // the completion model only has the tracks that match, see
+    // on_SearchEntry1_changed
+    return bool(iter);
+}
+
+void MyApplication::on_SearchEntry1_changed() {
+    show_search_results();
+    // the peers are only asked once the typing stops, not on every key
+    peer_search_delay.disconnect();
+    Glib::ustring query = pSearchEntry1->get_text();
+    // the peers' stores can't find anything shorter than a trigram quickly
+    // (see Store::search)
+    if (query.size() < 3 ||
+        (peer_search && peer_search->query() == query.raw())) {
+        return;
+    }
+    peer_search_delay = Glib::signal_timeout().connect(
+        [this, query]() {
+            search_peers(query.raw());
+            return false;
+        },
+        PEER_SEARCH_DELAY_MS);
+}
+
+void MyApplication::show_search_results() {
+    std::string query = pSearchEntry1->get_text().raw();
+    std::vector<TrackIndex> matches;
+    search_index.search(library, query, matches);
+    // the files here first
+    auto network = std::stable_partition(
+        matches.begin(), matches.end(), [this](TrackIndex i) {
+            return AllMusicCopy->at(i)->FilePath != "Network";
+        });
+    std::vector<TrackIndex> found(network, matches.end());
+    matches.erase(network, matches.end());
+    // then the network tracks in the order the search ranks them, and the
+    // ones it doesn't know about (it was for another query, or the peer
+    // sent them with its database) after them
+    std::unordered_set<TrackIndex> ranked;
+    if (peer_search && peer_search->query() == query) {
+        for (const TrackWithOwners &r : peer_search->results()) {
+            auto it = network_music.find(track_hash(r.track, best_hash(r.track)));
+            if (it != network_music.end() && ranked.insert(it->second->Id).second) {
+                matches.push_back(it->second->Id);
+            }
+        }
+    }
+    for (TrackIndex i : found) {
+        if (!ranked.contains(i)) {
+            matches.push_back(i);
+        }
+    }
+    if (matches.size() > SEARCH_COMPLETIONS) {
+        matches.resize(SEARCH_COMPLETIONS);
+    }
+    pEntryCompletion1->unset_model();
+    pCompletionModel1->show(std::move(matches));
+    pEntryCompletion1->set_model(pCompletionModel1);
+}
 
-    // now here is the list of tracks that matches key, where can I add to the
-    // results? I can convert it to a MusicInfoCDT if needed
-    std::vector<Track> tracks = store.search(key);
-
-    if (iter) {
-        Gtk::TreeRow row = *iter;
-        if (Glib::ustring(row[*pTreeModelColumnTitle])
-                    .lowercase()
-                    .find(key.lowercase()) != Glib::ustring::npos ||
-            Glib::ustring(row[*pTreeModelColumnArtist])
-                    .lowercase()
-                    .find(key.lowercase()) != Glib::ustring::npos ||
-            Glib::ustring(row[*pTreeModelColumnAlbum])
-                    .lowercase()
-                    .find(key.lowercase()) != Glib::ustring::npos)
-            return true;
+void MyApplication::search_peers(const std::string &query) {
+    std::vector<peer_id> peers;
+    for (auto &p : client->get_peers()) {
+        peers.push_back(p.first);
+    }
+    if (peers.empty()) {
+        return;
+    }
+    // the coroutines of the previous search still hold on to it, and finish
+    // it, but nobody takes what it finds anymore
+    peer_search = std::make_shared<PeerSearch>(query, peers);
+    for (peer_id id : peers) {
+        client->spawn(search_peer(id, peer_search));
     }
-    return false;
 }
 
 bool MyApplication::on_EntryCompletion1_match_selected(
@@ -1860,7 +1892,8 @@ void MyApplication::start_client(uint16_t port) {
         port, [this](MessageWithOwner &t) { handle_message(t); },
         [this](peer_id id) { on_connect(id); },
         [this](peer_id id) { on_disconnect(id); },
-        [this]() { additional_cycle_hook(); });
+        // the player is fed on the main thread, see feed_player
+        []() {});
 }
 
 void MyApplication::handle_message(MessageWithOwner &t) {
@@ -1869,17 +1902,22 @@ void MyApplication::handle_message(MessageWithOwner &t) {
     case MessageType::GET_LYRICS:
         handle_get_lyrics(t);
         break;
-    case MessageType::RETURN_LYRICS:
-        handle_return_lyrics(t);
-        break;
-    case MessageType::NO_SUCH_LYRICS:
-        handle_no_such_lyrics(t);
-        break;
     case MessageType::GET_DATABASE:
         handle_get_database(t);
         break;
+    case MessageType::HELLO:
+        handle_hello(t);
+        break;
+    case MessageType::GET_TRACK_INFO:
+        handle_get_track_info(t);
+        break;
+    // the answers to our requests are handled by the coroutines that sent
+    // them (see fetch_database etc.), they never get here
+    case MessageType::RETURN_LYRICS:
+    case MessageType::NO_SUCH_LYRICS:
     case MessageType::RETURN_DATABASE:
-        handle_return_database(t);
+    case MessageType::RETURN_TRACK_INFO:
+    case MessageType::NO_SUCH_TRACK:
         break;
 
         // these messages are for streaming audio files
@@ -1898,20 +1936,12 @@ void MyApplication::handle_message(MessageWithOwner &t) {
     case MessageType::PREPARE_FILE_SHARING:
         handle_prepare_file_sharing(t);
         break;
-    case MessageType::PREPARED_FILE_SHARING:
-        handle_prepared_file_sharing(t);
-        break;
     case MessageType::GET_SEGMENT:
         handle_get_segment(t);
         break;
+    case MessageType::PREPARED_FILE_SHARING:
     case MessageType::RETURN_SEGMENT:
-        handle_return_segment(t);
-        break;
     case MessageType::NO_SUCH_SEGMENT:
-    // we also don't handle these two
-    case MessageType::GET_TRACK_INFO:
-    case MessageType::RETURN_TRACK_INFO:
-    case MessageType::NO_SUCH_TRACK:
         // these cases are just for sanity testing, they are also not used in
         // the real application
     case MessageType::PING:
@@ -1922,23 +1952,46 @@ void MyApplication::handle_message(MessageWithOwner &t) {
 }
 
 void MyApplication::on_connect(peer_id id) {
-    Message m(MessageType::GET_DATABASE);
+    Message m(MessageType::HELLO);
+    m << Hello{supported_hashes};
     client->push_message(id, m);
+    // only to show its files, searches ask it when they need to
+    if (ShowFileFromNetwork) {
+        client->spawn(fetch_database(id));
+    }
 }
 
-void MyApplication::on_disconnect(peer_id id) { remove_network_tracks(id); }
+void MyApplication::on_disconnect(peer_id id) {
+    peer_hashes.erase(id);
+    // its tracks go on the main thread, see on_network_tracks_arrived
+    {
+        std::lock_guard<std::mutex> lock(network_inbox_mutex);
+        departed_peers.push_back(id);
+    }
+    network_dispatcher.emit();
+}
+
+// NOTE: this is invoked when ANOTHER PEER tells you which hashes it knows
+void MyApplication::handle_hello(MessageWithOwner &t) {
+    Hello h;
+    t.msg >> h;
+    peer_hashes[t.id] = negotiate_hash(h.hashes);
+    std::cout << "Client " << t.id << " identifies files by "
+              << hash_name(peer_hashes[t.id]) << std::endl;
+}
 
 void MyApplication::ask_client_for_file_with_this_checksum(
     std::string checksum) {
     Message m(MessageType::PREPARE_FILE_SHARING);
     PrepareFileSharing pfs;
     pfs.name = checksum;
-    m << pfs;
     auto it = network_tracks.find(checksum);
     // no file in the network tracks has this checksum
     if (it == network_tracks.end()) {
         return;
     }
+    pfs.hash = best_hash(it->second.track);
+    m << pfs;
     for (auto &id : it->second.ids) {
         client->push_message(id, m);
     }
@@ -1947,10 +2000,10 @@ void MyApplication::ask_client_for_file_with_this_checksum(
 // NOTE: this handler is invoked when ANOTHER PEER is getting your database
 void MyApplication::handle_get_database(MessageWithOwner &t) {
     ReturnDatabase rd;
-    rd.tracks = store.read_all();
+    rd.tracks = store.read_all(PEER_TRACK_FIELDS);
     Message m(MessageType::RETURN_DATABASE);
     m << rd;
-    client->push_message(t.id, m);
+    client->reply(t, m);
     // now t.msg.tracks will have all the searched tracks from the peers
     // where should I put the tracks to?
 }
@@ -1960,23 +2013,25 @@ void MyApplication::handle_get_database(MessageWithOwner &t) {
 void MyApplication::handle_return_database(MessageWithOwner &t) {
     ReturnDatabase rd;
     t.msg >> rd;
-    std::cout << "Here are the results from client " << t.id << std::endl;
+    std::cout << "Got " << rd.tracks.size() << " tracks from client " << t.id
+              << std::endl;
+    // availability check: don't add it to network database if there is a
+    // file locally. the whole list is checked at once
+    std::vector<bool> has_same_file_locally = store.has_files(rd.tracks);
     // append the tracks from peer to the network tracks vector
-    for (auto &r : rd.tracks) {
-        std::cout << r << std::endl;
-        // availability check: don't add it to network database if there is a
-        // file locally
-        bool has_same_file_locally = store.has_checksum(r.checksum);
-        if (has_same_file_locally) {
+    for (size_t i = 0; i < rd.tracks.size(); i++) {
+        auto &r = rd.tracks[i];
+        if (has_same_file_locally[i]) {
             continue;
         }
         // also check
         // already has this track!
-        auto it = network_tracks.find(r.checksum);
+        const std::string &key = track_hash(r, best_hash(r));
+        auto it = network_tracks.find(key);
         if (it != network_tracks.end()) {
             it->second.ids.push_back(t.id);
         } else {
-            network_tracks[r.checksum] = {
+            network_tracks[key] = {
                 .ids = {t.id},
                 .track = r,
             };
@@ -1984,11 +2039,62 @@ void MyApplication::handle_return_database(MessageWithOwner &t) {
     }
 }
 
+void MyApplication::on_network_tracks_arrived() {
+    std::vector<MessageWithOwner> databases;
+    std::vector<peer_id> departed;
+    {
+        std::lock_guard<std::mutex> lock(network_inbox_mutex);
+        databases.swap(arrived_databases);
+        departed.swap(departed_peers);
+    }
+    for (MessageWithOwner &t : databases) {
+        handle_return_database(t);
+    }
+    for (peer_id id : departed) {
+        remove_network_tracks(id);
+    }
+    if (peer_search) {
+        std::vector<TrackWithOwners> found = peer_search->take();
+        std::vector<Track> tracks;
+        for (const TrackWithOwners &r : found) {
+            tracks.push_back(r.track);
+        }
+        // like the databases, what is here already is not a network track
+        std::vector<bool> has_same_file_locally = store.has_files(tracks);
+        for (size_t i = 0; i < found.size(); i++) {
+            if (has_same_file_locally[i]) {
+                continue;
+            }
+            const std::string &key = track_hash(tracks[i], best_hash(tracks[i]));
+            auto it = network_tracks.find(key);
+            if (it == network_tracks.end()) {
+                network_tracks[key] = found[i];
+                continue;
+            }
+            for (peer_id id : found[i].ids) {
+                if (std::find(it->second.ids.begin(), it->second.ids.end(),
+                              id) == it->second.ids.end()) {
+                    it->second.ids.push_back(id);
+                }
+            }
+        }
+    }
+    // everything that is not on the list yet goes to the end of it, it is
+    // sorted again with the rest next time
+    for (auto &r : network_tracks) {
+        if (!network_music.contains(r.first)) {
+            add_network_music(r.first, r.second.track);
+        }
+    }
+    show_search_results();
+}
+
 void MyApplication::remove_network_tracks(peer_id id) {
     for (auto it = network_tracks.begin(); it != network_tracks.end();) {
         // remove that peer id from the ids array
         it->second.ids.erase(
-            std::remove(it->second.ids.begin(), it->second.ids.end(), id));
+            std::remove(it->second.ids.begin(), it->second.ids.end(), id),
+            it->second.ids.end());
         // if the array has no ids, that means no peer owns that track
         // remove it
         if (it->second.ids.empty()) {
@@ -1999,42 +2105,29 @@ void MyApplication::remove_network_tracks(peer_id id) {
     }
 }
 
-// NOTE: this handler is invoked when ANOTHER PEER returns some track info to
-// you
-// void MyApplication::handle_return_track_info(MessageWithOwner &t) {
-//     ReturnTrackInfo ti;
-//     t.msg >> ti;
-//     // now t.msg.tracks will have all the searched tracks from the peers
-//     // where should I put the tracks to?
-// }
-
-// NOTE: this handler handles the case of a peer NOT HAVING THAT TRACK
-// in this case it does nothing
-// void MyApplication::handle_no_such_track(MessageWithOwner &t) {
-//     NoSuchTrack nt;
-//     t.msg >> nt;
-//     std::cout << nt.title << "is not owned by client " << t.id << std::endl;
-// }
-
-// NOTE: this handler is invoked when ANOTHER PEER asks you for a track
-// void MyApplication::handle_get_track_info(MessageWithOwner &t) {
-//     GetTrackInfo gti;
-//     t.msg >> gti;
-//     auto results = store.search(gti.title);
-//     if (results.empty()) {
-//         NoSuchTrack nst;
-//         Message m(MessageType::NO_SUCH_TRACK);
-//         nst.title = gti.title;
-//         m << nst;
-//         client->push_message(t.id, m);
-//     } else {
-//         Message m(MessageType::RETURN_TRACK_INFO);
-//         // message class allows pushing the vectors into it
-//         ReturnTrackInfo rti{.tracks = results, .title = gti.title};
-//         m << rti;
-//         client->push_message(t.id, m);
-//     }
-// }
+// NOTE: this handler is invoked when ANOTHER PEER searches for tracks
+// the answer is what the store finds (see Store::search), best ones can't be
+// told apart here so it is just the first ones
+void MyApplication::handle_get_track_info(MessageWithOwner &t) {
+    GetTrackInfo gti;
+    t.msg >> gti;
+    std::vector<Track> results = store.search(gti.title);
+    size_t limit = gti.limit == 0 || gti.limit > PEER_SEARCH_LIMIT
+                       ? PEER_SEARCH_LIMIT
+                       : gti.limit;
+    if (results.empty()) {
+        Message m(MessageType::NO_SUCH_TRACK);
+        m << NoSuchTrack{gti.title};
+        client->reply(t, m);
+        return;
+    }
+    if (results.size() > limit) {
+        results.resize(limit);
+    }
+    Message m(MessageType::RETURN_TRACK_INFO);
+    m << ReturnTrackInfo{.tracks = results, .title = gti.title};
+    client->reply(t, m);
+}
 
 // NOTE: this handler is nvoked when ANOTHER PEER asks you for lyrics
 void MyApplication::handle_get_lyrics(MessageWithOwner &t) {
@@ -2045,7 +2138,7 @@ void MyApplication::handle_get_lyrics(MessageWithOwner &t) {
         NoSuchLyrics nsl{gl.filename};
         Message m(MessageType::NO_SUCH_LYRICS);
         m << nsl;
-        client->push_message(t.id, m);
+        client->reply(t, m);
     } else {
         Message m(MessageType::RETURN_LYRICS);
         ReturnLyrics rl{
@@ -2053,7 +2146,7 @@ void MyApplication::handle_get_lyrics(MessageWithOwner &t) {
             .filename = gl.filename,
         };
         m << rl;
-        client->push_message(t.id, m);
+        client->reply(t, m);
     }
 }
 
@@ -2081,19 +2174,17 @@ void MyApplication::handle_no_such_lyrics(MessageWithOwner &t) {
 // see header file for more details
 bool MyApplication::start_file_sharing(const std::string &checksum) {
     fs.reset_sharing_file();
+    // the workers of the previous file see this and stop
+    int transfer = ++current_transfer;
     auto it = network_tracks.find(checksum);
     // can't find a file with this checksum
     if (it == network_tracks.end()) {
         return false;
     }
-    // preparing the message for each peer
-    PrepareFileSharing pfs;
-    pfs.name = checksum;
+    // download from every peer that has the file
     for (auto id : it->second.ids) {
-        Message m(MessageType::PREPARE_FILE_SHARING);
-        pfs.assigned_id_for_peer = fs.new_peer(id);
-        m << pfs;
-        client->push_message(id, m);
+        client->spawn(download_from_peer(id, fs.new_peer(id), it->second.track,
+                                         transfer));
     }
     return true;
 }
@@ -2105,7 +2196,7 @@ void MyApplication::handle_prepare_file_sharing(MessageWithOwner &t) {
     std::cout << "Client " << t.id << " wants file " << pfs.name << std::endl;
     // assigned_peer_id = pfs.assigned_id_for_peer; (not needed)
     Track local;
-    bool has_it = store.search_with_checksum(pfs.name, local);
+    bool has_it = store.search_with_checksum(pfs.name, local, pfs.hash);
     // there is not a single file with this checksum!
     // tell that peer I don't have that file!
     if (!has_it) {
@@ -2116,7 +2207,7 @@ void MyApplication::handle_prepare_file_sharing(MessageWithOwner &t) {
         nsf.assigned_id_for_peer = pfs.assigned_id_for_peer;
         Message m(MessageType::NO_SUCH_FILE);
         m << nsf;
-        client->push_message(t.id, m);
+        client->reply(t, m);
         return;
     }
     // if we have that file
@@ -2132,51 +2223,8 @@ void MyApplication::handle_prepare_file_sharing(MessageWithOwner &t) {
     pfss.bytes_per_chunk = cf.chunk_size;
     pfss.total_bytes = cf.size;
     m << pfss;
-    client->push_message(t.id, m);
-}
-// NOTE: this is invoked when ANOTHER PEER says he is ready to send
-// the file to you
-void MyApplication::handle_prepared_file_sharing(MessageWithOwner &t) {
-    // we know that the peer will engage in sharing that file
-    std::cout << "Client " << t.id << " is ready to send the file."
-              << std::endl;
-    PreparedFileSharing pps;
-    t.msg >> pps;
-    fs.set_segment_count(pps.total_segments);
-    fs.set_file_info(pps.bytes_per_chunk, pps.total_bytes);
-    Message m(MessageType::GET_SEGMENT);
-    GetSegment gps;
-    gps.segment_id = fs.get_next_segment_id();
-    gps.assigned_id_for_peer = pps.assigned_id_for_peer;
-    m << gps;
-    client->push_message(t.id, m);
-    std::cout << "Assigned id is " << pps.assigned_id_for_peer << std::endl;
-    fs.start_timeout(pps.assigned_id_for_peer);
+    client->reply(t, m);
 }
-
-// NOTE: this is when ANOTHER PEER returns you a segment
-void MyApplication::handle_return_segment(MessageWithOwner &t) {
-    ReturnSegment rps;
-    t.msg >> rps;
-    fs.end_timeout(rps.assigned_id_for_peer);
-    std::cout << "Segment " << rps.segment_id << "/"
-              << fs.get_segment_count() - 1 << " received from client " << t.id
-              << " share id: " << rps.assigned_id_for_peer << std::endl;
-    // put that into the queue
-    fs.push_segment(rps);
-    Message m(MessageType::GET_SEGMENT);
-    // all segments are returned, ending...
-    if (fs.all_segments_asked() || fs.paused()) {
-        return;
-    }
-    GetSegment gps;
-    gps.assigned_id_for_peer = rps.assigned_id_for_peer;
-    gps.segment_id = fs.get_next_segment_id();
-    m << gps;
-    fs.start_timeout(rps.assigned_id_for_peer);
-    client->push_message(t.id, m);
-}
-
 // NOTE: this is when ANOTHER PEER asks for a segment
 void MyApplication::handle_get_segment(MessageWithOwner &t) {
     GetSegment gps;
@@ -2196,6 +2244,7 @@ void MyApplication::handle_get_segment(MessageWithOwner &t) {
         nsps.segment_id = gps.segment_id;
         Message m(MessageType::NO_SUCH_SEGMENT);
         m << nsps;
+        client->reply(t, m);
         return;
     }
 
@@ -2205,26 +2254,161 @@ void MyApplication::handle_get_segment(MessageWithOwner &t) {
     rps.segment_id = gps.segment_id;
     rps.assigned_id_for_peer = gps.assigned_id_for_peer;
     m << rps;
-    client->push_message(t.id, m);
+    client->reply(t, m);
 }
 
-// do more stuff besides the main cycle
-void MyApplication::additional_cycle_hook() {
-    fs.should_pause();
+void MyApplication::feed_player() {
+    if (bfa == NULL) {
+        return;
+    }
+    write_ready_segments();
+    // the credit of the file transfer depends on how much the player holds
+    fs.set_player_buffered(bfa->getBufferedBytes());
+}
+
+void MyApplication::write_ready_segments() {
     fs.try_writing_segment([this](const ReturnSegment &rs, bool end) {
         segment_has_arrived(rs, end);
     });
-    // if some peer enters the waiting state
-    fs.if_idle([this](int assigned_peer_id) {
-        // it is enough
-        if (fs.all_segments_asked()) {
-            return;
+}
+
+asio::awaitable<void> MyApplication::fetch_database(peer_id id) {
+    auto reply =
+        co_await client->request(id, Message(MessageType::GET_DATABASE));
+    if (!reply) {
+        std::cout << "Client " << id << " did not return the database"
+                  << std::endl;
+        co_return;
+    }
+    // network_tracks belongs to the main thread, it takes it from here
+    {
+        std::lock_guard<std::mutex> lock(network_inbox_mutex);
+        arrived_databases.push_back(MessageWithOwner{std::move(*reply), id});
+    }
+    network_dispatcher.emit();
+}
+
+asio::awaitable<void> MyApplication::search_peer(
+    peer_id id, std::shared_ptr<PeerSearch> search) {
+    Message m(MessageType::GET_TRACK_INFO);
+    m << GetTrackInfo{.title = search->query(), .limit = PEER_SEARCH_LIMIT};
+    auto reply = co_await client->request(id, m, search->remaining());
+    if (!reply || reply->header.type != MessageType::RETURN_TRACK_INFO) {
+        // NO_SUCH_TRACK, or too late
+        search->give_up(id);
+        co_return;
+    }
+    ReturnTrackInfo rti;
+    *reply >> rti;
+    if (search->add(id, rti.tracks)) {
+        network_dispatcher.emit();
+    }
+}
+
+asio::awaitable<void> MyApplication::fetch_lyrics(peer_id id,
+                                                  std::string filename) {
+    Message m(MessageType::GET_LYRICS);
+    m << GetLyrics{filename};
+    auto reply = co_await client->request(id, m);
+    if (!reply) {
+        co_return;
+    }
+    MessageWithOwner t{std::move(*reply), id};
+    if (t.msg.header.type == MessageType::RETURN_LYRICS) {
+        handle_return_lyrics(t);
+    } else {
+        handle_no_such_lyrics(t);
+    }
+}
+
+asio::awaitable<void> MyApplication::download_from_peer(peer_id id,
+                                                        int assigned_id,
+                                                        Track track,
+                                                        int transfer) {
+    PrepareFileSharing pfs;
+    // ask for the file by the hash agreed on with this peer, if the track
+    // has that one
+    auto agreed = peer_hashes.find(id);
+    pfs.hash = agreed == peer_hashes.end() ? HashAlgorithm::MD5 : agreed->second;
+    if (track_hash(track, pfs.hash).empty()) {
+        pfs.hash = HashAlgorithm::MD5;
+    }
+    pfs.name = track_hash(track, pfs.hash);
+    pfs.assigned_id_for_peer = assigned_id;
+    Message m(MessageType::PREPARE_FILE_SHARING);
+    m << pfs;
+    auto reply = co_await client->request(id, m);
+    if (transfer != current_transfer) {
+        co_return;
+    }
+    // NO_SUCH_FILE or no answer at all, don't ask that peer again
+    if (!reply || reply->header.type != MessageType::PREPARED_FILE_SHARING) {
+        std::cout << "Client " << id << " cannot send the file." << std::endl;
+        fs.die_peer(assigned_id);
+        co_return;
+    }
+    // we know that the peer will engage in sharing that file
+    std::cout << "Client " << id << " is ready to send the file." << std::endl;
+    PreparedFileSharing pps;
+    *reply >> pps;
+    fs.set_segment_count(pps.total_segments);
+    // the bitrate decides how many bytes are a few seconds of audio
+    fs.set_file_info(pps.bytes_per_chunk, pps.total_bytes, track.duration);
+    // keep a few requests in flight, so the peer never waits for us
+    for (int i = 0; i < SEGMENT_WINDOW; i++) {
+        client->spawn(segment_worker(id, assigned_id, transfer));
+    }
+}
+
+asio::awaitable<void> MyApplication::segment_worker(peer_id id,
+                                                    int assigned_id,
+                                                    int transfer) {
+    asio::steady_timer wait(co_await asio::this_coro::executor);
+    while (transfer == current_transfer && !fs.is_peer_dead(assigned_id)) {
+        int segment_id = fs.next_segment_for(assigned_id);
+        if (segment_id == -1) {
+            // all segments are returned, ending...
+            if (fs.all_segments_received()) {
+                co_return;
+            }
+            // otherwise the buffer is full, or some requests are in flight
+            // that may time out and need someone to ask them again
+            asio::error_code ec;
+            wait.expires_after(100ms);
+            co_await wait.async_wait(
+                asio::redirect_error(asio::use_awaitable, ec));
+            continue;
         }
-        Message m(MessageType::GET_SEGMENT);
         GetSegment gps;
-        gps.segment_id = fs.get_next_segment_id();
-        gps.assigned_id_for_peer = assigned_peer_id;
+        gps.segment_id = segment_id;
+        gps.assigned_id_for_peer = assigned_id;
+        Message m(MessageType::GET_SEGMENT);
         m << gps;
-        client->push_message(fs.get_peer_id(assigned_peer_id), m);
-    });
+        fs.segment_requested(assigned_id, segment_id);
+        auto reply =
+            co_await client->request(id, m, fs.get_timeout(assigned_id));
+        if (transfer != current_transfer) {
+            co_return;
+        }
+        if (!reply || reply->header.type != MessageType::RETURN_SEGMENT) {
+            // another peer will ask for it
+            fs.segment_timed_out(assigned_id, segment_id);
+            continue;
+        }
+        ReturnSegment rps;
+        *reply >> rps;
+        // an answer with another segment in it is dropped, and the one that
+        // was asked for is asked again like when the peer doesn't answer
+        if (rps.segment_id != segment_id) {
+            fs.segment_timed_out(assigned_id, segment_id);
+            continue;
+        }
+        std::cout << "Segment " << rps.segment_id << "/"
+                  << fs.get_segment_count() - 1 << " received from client "
+                  << id << " share id: " << rps.assigned_id_for_peer
+                  << std::endl;
+        // put that into the queue, feed_player gives it to the player once
+        // it is in order
+        fs.push_segment(rps);
+    }
 }
@@ -10,6 +10,14 @@
 #include "message-type.h"
 #include "wav.h"
 #include "store.h"
+#include "library.h"
+#include "music-list-model.h"
+#include "search-index.h"
+#include "peer-search.h"
+#include "cover-art.h"
+#include "file-tags.h"
+#include "library-scanner.h"
+#include "folder-watcher.h"
 #include "application-client.h"
 #include "file-sharing.h"
 #include "chunked-file.h"
@@ -24,6 +32,8 @@
 #include <boost/regex.hpp>
 #include <fstream>
 #include <thread>
+#include <atomic>
+#include <mutex>
 #include <exception>
 
 #include <gtkmm.h>
@@ -43,10 +53,10 @@
 #include <taglib/id3v2tag.h>
 #include <taglib/tbytevector.h>
 
-struct TrackWithOwners {
-    std::vector<peer_id> ids;
-    Track track;
-};
+// how many tracks the search entry suggests at most
+#define SEARCH_COMPLETIONS 100
+// how long the search entry has to stay the same before the peers are asked
+#define PEER_SEARCH_DELAY_MS 250
 
 class MyApplication;
 
@@ -168,8 +178,8 @@ private:
     Gtk::TreeModelColumn<Glib::RefPtr<Gdk::Pixbuf>>* pTreeModelColumnIcon = nullptr;
     Gtk::TreeModelColumn<int>* pTreeModelColumnId = nullptr;
     Gtk::TreeModelColumn<Glib::ustring>* pTreeModelColumnTitle = nullptr, * pTreeModelColumnTime = nullptr, * pTreeModelColumnArtist = nullptr, * pTreeModelColumnAlbum = nullptr, * pTreeModelColumnFileName = nullptr;
-    Gtk::TreeModelColumnRecord* pTreeModelColumnRecord1 = nullptr;
-    Glib::RefPtr<Gtk::ListStore> pListStore1;
+    // the columns are the model's
+    Glib::RefPtr<MusicListModel> pMusicListModel1;
     Gtk::TreeView* pTreeView1 = nullptr;
     Glib::RefPtr<Gtk::TreeViewColumn> pTreeViewColumnIcon, pTreeViewColumnTitle, pTreeViewColumnTime, pTreeViewColumnArtist, pTreeViewColumnAlbum, pTreeViewColumnFileName;
     Glib::RefPtr<Gtk::TreeSelection> pTreeSelection1;
@@ -195,8 +205,28 @@ private:
 
     void SortMusicListByIndex(TreeViewColumns SortColumn, Gtk::SortType SortOrder);
 
+    // starts scanning Directory, the list fills up while it goes
     void set_music_list();
-    void update_tree_model();
+    // scans Directory again, but keeps the list and only changes what changed
+    // on disk since
+    void rescan_music_list();
+    // gives a music info a number and shows it at the end of the list
+    void add_to_music_list(MusicInfoADT _music);
+    // takes the files that are gone off the list (and stops them if they
+    // are playing)
+    void remove_from_music_list(const std::vector<MusicInfoADT>& removed);
+    // sorts the list once the scan is over
+    void finish_music_list();
+    // what the list is sorted and filtered on, track i is
+    // AllMusicCopy->at(i). tracks are added and set as the scanner finds
+    // them, it is only made again when some are taken off the list
+    Library library;
+    LibraryTrack library_track(MusicInfoADT _music);
+    static Library::Column library_column(TreeViewColumns column);
+    // shows the list sorted by column
+    void update_tree_model(TreeViewColumns column, Gtk::SortType order);
+    // shows these tracks in the list, the views are detached meanwhile
+    void show_music_list(std::vector<TrackIndex> rows);
 
     void on_ButtonShuffle1_clicked();
     void on_ButtonPlay1_clicked();
@@ -219,7 +249,8 @@ private:
     void on_VolumeButton1_Plus_clicked();
     void on_VolumeButton1_Minus_clicked();
     bool timeout1();
-    void taglib_get_data(MusicInfoADT _music);
+    // runs on the scanner's workers too
+    void set_music_info_from_tags(MusicInfoADT _music, const FileTags& tags);
     void ResetTreeViewColumnHeaders();
 
     void PlayMusic();
@@ -227,33 +258,6 @@ private:
     void ChangeMusic();
     void LoadMusic();
 
-    static bool CompareByTitleAlphabeticalOrder(const MusicInfoADT& a, const MusicInfoADT& b);
-    static bool CompareByTitleAlphabeticalOrderIndexAscending(const MusicInfoADT& a, const MusicInfoADT& b);
-    static bool CompareByTitleAlphabeticalOrderIndexDescending(const MusicInfoADT& a, const MusicInfoADT& b);
-    void SortMusicListByTitleAlphabeticalOrder();
-
-    static bool CompareByDurationInMilliseconds(const MusicInfoADT& a, const MusicInfoADT& b);
-    static bool CompareByDurationInMillisecondsIndexAscending(const MusicInfoADT& a, const MusicInfoADT& b);
-    static bool CompareByDurationInMillisecondsIndexDescending(const MusicInfoADT& a, const MusicInfoADT& b);
-    void SortMusicListByDurationInMilliseconds();
-
-
-    static bool CompareByArtistAlphabeticalOrder(const MusicInfoADT& a, const MusicInfoADT& b);
-    void SortMusicListByArtistAlphabeticalOrder();
-    static bool CompareByArtistAlphabeticalOrderIndexAscending(const MusicInfoADT& a, const MusicInfoADT& b);
-    static bool CompareByArtistAlphabeticalOrderIndexDescending(const MusicInfoADT& a, const MusicInfoADT& b);
-
-    static bool CompareByAlbumAlphabeticalOrder(const MusicInfoADT& a, const MusicInfoADT& b);
-    void SortMusicListByAlbumAlphabeticalOrder();
-    static bool CompareByAlbumAlphabeticalOrderIndexAscending(const MusicInfoADT& a, const MusicInfoADT& b);
-    static bool CompareByAlbumAlphabeticalOrderIndexDescending(const MusicInfoADT& a, const MusicInfoADT& b);
-
-    static bool CompareByFileNameAlphabeticalOrder(const MusicInfoADT& a, const MusicInfoADT& b);
-    void SortMusicListByFileNameAlphabeticalOrder();
-    static bool CompareByFileNameAlphabeticalOrderIndexAscending(const MusicInfoADT& a, const MusicInfoADT& b);
-    static bool CompareByFileNameAlphabeticalOrderIndexDescending(const MusicInfoADT& a, const MusicInfoADT& b);
-
-
     int GetSortIndex(MusicInfoADT _music, TreeViewColumns SortColumn, Gtk::SortType SortOrder);
 
     void on_AboutDialog1_response(int response_id);
@@ -265,6 +269,8 @@ private:
     void MusicListChanged();
     void DisplayCoverArtDialog1();
     void DisplayCoverArtSidebar();
+    // the thumbnails DisplayCoverArtSidebar shows
+    CoverArtCache cover_art;
     void ExtendAllMusicShuffled(bool CurrentMusicAtFront = false);
 
     void ShuffleOff();
@@ -282,6 +288,15 @@ private:
 
     void on_MessageDialog1_response(int response_id);
     bool on_EntryCompletion1_match(const Glib::ustring& key, const Gtk::TreeModel::const_iterator& iter);
+    // looks the text up in the index once, and shows what it finds, then
+    // asks the peers once it stops changing
+    void on_SearchEntry1_changed();
+    // what the search entry suggests: the matches here first, then what the
+    // peers found for it, best first
+    void show_search_results();
+    SearchIndex search_index;
+    // what the search entry suggests, the tracks that match
+    Glib::RefPtr<MusicListModel> pCompletionModel1;
     bool on_EntryCompletion1_match_selected(const Gtk::TreeModel::const_iterator& iter);
 
     void on_ButtonSettings1_clicked();
@@ -318,10 +333,16 @@ private:
     // storage and network related (members and methods)
     Store store;
     uint16_t port;
+    // wakes the main loop up when a peer sent tracks (its database, or what
+    // it found for peer_search), declared before client like
+    // scanner_dispatcher
+    Glib::Dispatcher network_dispatcher;
     std::unique_ptr<ApplicationClient> client;
     /*
      * it is a map of checksum to TrackWithOwners
-     * I am abusing the fact that md5 checksum has a very low collision probability
+     * the key is the best hash the track came with (see best_hash): its
+     * content id, or its md5 checksum if the peer didn't send one
+     * I am abusing the fact that both have a very low collision probability
      * the id field cannot be used since it comes from network databases
      * so that id is only used for their local database, but not this database
      * For example, if there is a track that looks like this:
@@ -356,10 +377,62 @@ private:
      * when a track has no ids associated in it (the id array is empty), it will
      * be automatically removed from the map, signifying that nobody owns that track
      * network_tracks.find("a345b678") == network_tracks.end()
+     *
+     * it is only touched on the main thread, what the peers send comes in
+     * through network_inbox
      */
     std::map<std::string, TrackWithOwners> network_tracks;
+    // the databases the peers returned and the peers that left, on the io
+    // threads, until on_network_tracks_arrived takes them
+    std::mutex network_inbox_mutex;
+    std::vector<MessageWithOwner> arrived_databases;
+    std::vector<peer_id> departed_peers;
+    // the network tracks on the list, by their key in network_tracks
+    std::unordered_map<std::string, MusicInfoADT> network_music;
+    // puts a network track on the list
+    void add_network_music(const std::string& key, const Track& track);
+    // takes what the peers sent, on the main thread
+    void on_network_tracks_arrived();
+    // the last search the peers were asked, and waiting for it
+    std::shared_ptr<PeerSearch> peer_search;
+    sigc::connection peer_search_delay;
+    void search_peers(const std::string& query);
+    // the hash each peer is asked for files by, agreed on with HELLO
+    // peers that never sent one are asked by md5
+    std::map<peer_id, HashAlgorithm> peer_hashes;
 
     Track convert_music_info_to_track(const MusicInfoCDT& m);
+    void set_music_info_from_track(MusicInfoADT _music, const Track& t);
+    // the fields of a music info that only depend on the file's path
+    void set_music_info_from_path(MusicInfoADT _music, const std::filesystem::path& file_path);
+
+    // wakes the main loop up when the scanner has something new for it
+    // (declared before scanner, so it is still there while the scanner stops)
+    Glib::Dispatcher scanner_dispatcher;
+    // the scan of Directory, while it is going on
+    std::unique_ptr<LibraryScanner> scanner;
+    // runs on the scanner's workers, so it must not touch any widget
+    Track describe_file(const std::filesystem::path& file_path, const Track* stored);
+    // takes what the scanner has, on the main thread
+    void on_scanner_progress();
+    // while rescanning: the local files the list had when it started, by path
+    bool rescanning = false;
+    std::unordered_map<std::string, MusicInfoADT> rescanned;
+    // the ones that are gone, taken off the list once the rescan is over
+    std::vector<MusicInfoADT> removed_music;
+    // whether the rescan found anything to change on the list
+    bool rescan_changed = false;
+    // something changed while a scan was going on, it may not have seen it
+    bool rescan_pending = false;
+
+    // rescan when something changes in Directory, instead of waiting for
+    // Reload (there is no check box for it in the settings yet)
+    bool WatchDirectory = true;
+    // like scanner_dispatcher, for the watcher
+    Glib::Dispatcher watcher_dispatcher;
+    std::unique_ptr<FolderWatcher> watcher;
+    // (re)starts watching Directory, as deep as the list goes
+    void watch_directory();
     void remove_network_tracks(peer_id id);
     // this will start the TCP client
     // port is the port he will listen to
@@ -368,10 +441,9 @@ private:
     void on_connect(peer_id id);
     void on_disconnect(peer_id id);
     void handle_message(MessageWithOwner &t);
+    void handle_hello(MessageWithOwner &t);
     void ask_client_for_file_with_this_checksum(std::string checksum);
-    // void handle_get_track_info(MessageWithOwner &t);
-    // void handle_return_track_info(MessageWithOwner &t);
-    // void handle_no_such_track(MessageWithOwner &t);
+    void handle_get_track_info(MessageWithOwner &t);
     void handle_get_lyrics(MessageWithOwner &t);
     void handle_return_lyrics(MessageWithOwner &t);
     void handle_no_such_lyrics(MessageWithOwner &t);
@@ -379,10 +451,32 @@ private:
     void handle_return_database(MessageWithOwner &t);
     // functions for sending files
     void handle_prepare_file_sharing(MessageWithOwner &t);
-    void handle_prepared_file_sharing(MessageWithOwner &t);
     void handle_get_segment(MessageWithOwner &t);
-    void handle_return_segment(MessageWithOwner &t);
-    void additional_cycle_hook();
+    // pass the segments that are next in order to segment_has_arrived
+    void write_ready_segments();
+    // gives the player what arrived and tells fs how much it holds, from
+    // timeout1: bfa is replaced on the main thread, so only it touches bfa
+    void feed_player();
+    /*
+     * these are coroutines, start them with client->spawn(...)
+     * each of them sends a request and waits for the reply in a straight line
+     */
+    // GET_DATABASE -> RETURN_DATABASE
+    asio::awaitable<void> fetch_database(peer_id id);
+    // GET_TRACK_INFO -> RETURN_TRACK_INFO / NO_SUCH_TRACK, into search
+    asio::awaitable<void> search_peer(peer_id id,
+                                      std::shared_ptr<PeerSearch> search);
+    // GET_LYRICS -> RETURN_LYRICS / NO_SUCH_LYRICS
+    asio::awaitable<void> fetch_lyrics(peer_id id, std::string filename);
+    // PREPARE_FILE_SHARING -> PREPARED_FILE_SHARING, then starts
+    // SEGMENT_WINDOW segment_workers for that peer
+    // the track is a copy, network_tracks can change while this waits
+    asio::awaitable<void> download_from_peer(peer_id id, int assigned_id,
+                                             Track track, int transfer);
+    // GET_SEGMENT -> RETURN_SEGMENT until all segments are asked
+    asio::awaitable<void> segment_worker(peer_id id, int assigned_id, int transfer);
+    // bumped by start_file_sharing, so the workers of the previous file stop
+    std::atomic<int> current_transfer = 0;
     /*
      * This function starts file sharing
      * Provide a checksum so that it knows who to ask for that file
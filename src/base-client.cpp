@@ -1,8 +1,10 @@
 #include "base-client.h"
 
-BaseClient::BaseClient(uint16_t port, std::chrono::milliseconds time)
-    : acceptor(ctx, tcp::endpoint(tcp::v4(), port)), resolver(ctx),
-      timer(ctx), cycle_time{time} {
+BaseClient::BaseClient(uint16_t port, std::chrono::milliseconds time,
+                       unsigned int threads)
+    : cycle_strand(asio::make_strand(ctx)),
+      acceptor(ctx, tcp::endpoint(tcp::v4(), port)), resolver(ctx),
+      timer(cycle_strand), cycle_time{time} {
     acceptor.set_option(tcp::acceptor::reuse_address(true));
     try {
         acceptor.listen();
@@ -10,16 +12,22 @@ BaseClient::BaseClient(uint16_t port, std::chrono::milliseconds time)
     }
     trap_signal();
     accept_socket();
-    worker = std::thread([this]() {
-        std::error_code ec;
-        ctx.run(ec);
-        if (ec) {
-            std::cout << "Running context: " << ec.message() << std::endl;
-        }
-    });
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (unsigned int i = 0; i < threads; i++) {
+        workers.emplace_back([this]() {
+            asio::error_code ec;
+            ctx.run(ec);
+            if (ec) {
+                std::cout << "Running context: " << ec.message() << std::endl;
+            }
+        });
+    }
 }
 
 BaseClient::~BaseClient() {
+    stop();
     // disconnect all sockets
     for (auto &p : peers) {
         asio::error_code ec;
@@ -30,9 +38,16 @@ BaseClient::~BaseClient() {
             std::cout << "a socket cannot be shutdown. just ignore him.";
         }
     }
+}
+
+void BaseClient::stop() {
     // context, you can stop now!
-    if (worker.joinable()) {
-        worker.join();
+    // stop the threads first so that no handler touches the sockets
+    ctx.stop();
+    for (auto &worker : workers) {
+        if (worker.joinable()) {
+            worker.join();
+        }
     }
 }
 
@@ -42,7 +57,7 @@ void BaseClient::trap_signal() {
     sigs.async_wait([&](asio::error_code ec, int signal) {
         if (!ec) {
             std::cout << "Signal received: " << signal << std::endl;
-            std::error_code ec1;
+            asio::error_code ec1;
             acceptor.cancel(ec1);
             timer.cancel(ec1);
         } else {
@@ -52,136 +67,157 @@ void BaseClient::trap_signal() {
 }
 
 void BaseClient::accept_socket() {
-    acceptor.async_accept([&](asio::error_code const &ec, tcp::socket socket) {
-        if (!ec) {
-            std::error_code remote_ec;
-            auto endpoint = socket.remote_endpoint(remote_ec);
-            if (remote_ec) {
-                return;
+    // every accepted socket gets a strand of its own
+    acceptor.async_accept(
+        asio::make_strand(ctx),
+        [this](asio::error_code const &ec, tcp::socket socket) {
+            if (!ec) {
+                asio::error_code remote_ec;
+                auto endpoint = socket.remote_endpoint(remote_ec);
+                if (remote_ec) {
+                    accept_socket();
+                    return;
+                }
+                std::cout << "[ACCEPT SOCKET] New session: " << endpoint
+                          << std::endl;
+                auto ptr = std::make_shared<tcp::socket>(std::move(socket));
+                peer_id id = add_to_peers(ptr);
+                // connection is established, now we can wait
+                // for messages from that socket
+                start_reading(ptr);
+                asio::post(cycle_strand, [this, id]() { on_connect(id); });
+                accept_socket();
+            } else {
+                std::cout << ec.message() << std::endl;
             }
-            std::cout << "[ACCEPT SOCKET] New session: " << endpoint
-                      << std::endl;
-            auto ptr = std::make_shared<tcp::socket>(std::move(socket));
-            add_to_peers(std::shared_ptr<tcp::socket>(ptr));
-            // connection is established, now we can wait
-            // for messages from that socket
-            start_reading(std::shared_ptr<tcp::socket>(ptr));
-            on_connect(current_id - 1);
-            accept_socket();
-        } else {
-            std::cout << ec.message() << std::endl;
-        }
-    });
+        });
 }
 
-void BaseClient::add_to_peers(std::shared_ptr<tcp::socket> socket) {
-    peers[current_id] = socket;
-    reverse[socket] = current_id;
+peer_id BaseClient::add_to_peers(std::shared_ptr<tcp::socket> socket) {
+    std::scoped_lock l(peers_mux);
+    peer_id id = current_id++;
+    peers[id] = socket;
+    reverse[socket] = id;
+    outgoing[id] = OutgoingQueue();
     if (socket->is_open()) {
         asio::error_code ec2;
         auto re = socket->remote_endpoint(ec2);
-        peer_ip_map[current_id] = ConnectionInfo{
+        peer_ip_map[id] = ConnectionInfo{
             .address = re.address().to_string(),
             .port = re.port(),
         };
     }
-    std::cout << "Added to peers with id " << current_id << std::endl;
-    current_id++;
+    std::cout << "Added to peers with id " << id << std::endl;
+    return id;
 }
 
 bool BaseClient::connect_to_peer(const std::string &host,
                                  const std::string &service) {
     std::cout << "Trying to connect to " << host << ":" << service << std::endl;
-    add_to_peers(std::make_shared<tcp::socket>(ctx));
-    auto &p = peers[current_id - 1];
-    std::error_code resolve_error;
+    asio::error_code resolve_error;
     auto endpoints = resolver.resolve(host, service, resolve_error);
     if (resolve_error) {
         std::cout << "Catched: " << resolve_error << std::endl;
         return false;
     }
-    asio::async_connect(*p, endpoints,
-                        [&, spec = (host + ":"s + service)](
-                            asio::error_code ec, tcp::endpoint endpoint) {
-                            std::cout << "[CONNECT TO PEER] specified: " << spec
-                                      << " " << ec.message();
-                            if (!ec) {
-                                asio::error_code ec2;
-                                auto re = p->remote_endpoint(ec2);
-                                std::cout << " actual: " << re;
-                                peer_ip_map[current_id - 1] = ConnectionInfo{
-                                    .address = re.address().to_string(),
-                                    .port = re.port(),
-                                };
-                                // connection is established, now we can wait
-                                // for messages from that socket
-                                start_reading(p);
-                                on_connect(current_id - 1);
-                            } else {
-                                peers.erase(peers.find(current_id - 1));
-                            }
-                            std::cout << std::endl;
-                        });
+    auto p = std::make_shared<tcp::socket>(asio::make_strand(ctx));
+    peer_id id = add_to_peers(p);
+    asio::async_connect(
+        *p, endpoints,
+        [this, p, id, spec = (host + ":"s + service)](asio::error_code ec,
+                                                      tcp::endpoint endpoint) {
+            std::cout << "[CONNECT TO PEER] specified: " << spec << " "
+                      << ec.message();
+            if (!ec) {
+                asio::error_code ec2;
+                auto re = p->remote_endpoint(ec2);
+                std::cout << " actual: " << re;
+                {
+                    std::scoped_lock l(peers_mux);
+                    peer_ip_map[id] = ConnectionInfo{
+                        .address = re.address().to_string(),
+                        .port = re.port(),
+                    };
+                }
+                // connection is established, now we can wait
+                // for messages from that socket
+                start_reading(p);
+                asio::post(cycle_strand, [this, id]() { on_connect(id); });
+            } else {
+                std::scoped_lock l(peers_mux);
+                peers.erase(id);
+                reverse.erase(p);
+                outgoing.erase(id);
+                peer_ip_map.erase(id);
+            }
+            std::cout << std::endl;
+        });
     return true;
 }
 
 void BaseClient::start_reading(std::shared_ptr<tcp::socket> socket) {
+    // every read has its own message, so two sockets never read into the
+    // same buffer
+    auto incoming = std::make_shared<Message>();
     // read the header first -- the lucky thing is that the header has fixed
     // size
-    asio::async_read(*socket,
-                     asio::buffer(&temp_msg.header, sizeof(MessageHeader)),
-                     [this, socket](asio::error_code ec, std::size_t len) {
-                         if (ec) {
-                             std::cout
-                                 << "[READ HEADER] Cannot read from peer: "
-                                 << ec.message() << std::endl;
-                             remove_socket(socket);
-                             return;
-                         }
-                         // check if the message contains a body, if yes, read
-                         // it if not just add the message to the queue
-                         std::cout << temp_msg << std::endl;
-                         // std::cout << "[READ HEADER] Read " << len
-                         //           << " bytes from peer." << std::endl;
-                         if (temp_msg.header.size > 0) {
-                             // std::cout << "[READ HEADER] Still has body to
-                             // read"
-                             //           << std::endl;
-                             temp_msg.body.resize(temp_msg.header.size);
-                             read_body(socket);
-                         } else {
-                             add_to_incoming(socket);
-                         }
-                     });
+    asio::async_read(
+        *socket, asio::buffer(&incoming->header, sizeof(MessageHeader)),
+        [this, socket, incoming](asio::error_code ec, std::size_t len) {
+            if (ec) {
+                std::cout << "[READ HEADER] Cannot read from peer: "
+                          << ec.message() << std::endl;
+                remove_socket(socket);
+                return;
+            }
+            // check if the message contains a body, if yes, read
+            // it if not just add the message to the queue
+            std::cout << *incoming << std::endl;
+            if (incoming->header.size > 0) {
+                incoming->body.resize(incoming->header.size);
+                read_body(socket, incoming);
+            } else {
+                add_to_incoming(socket, incoming);
+            }
+        });
 }
 
-void BaseClient::read_body(std::shared_ptr<tcp::socket> socket) {
+void BaseClient::read_body(std::shared_ptr<tcp::socket> socket,
+                           std::shared_ptr<Message> incoming) {
     // header size field indicates how many bytes the body is
     // we read exactly that many bytes from the socket
-    asio::async_read(*socket,
-                     asio::buffer(temp_msg.body.data(), temp_msg.header.size),
-                     [this, socket](asio::error_code ec, std::size_t len) {
-                         if (ec) {
-                             std::cout << "[READ BODY] Cannot read from peer: "
-                                       << ec.message() << std::endl;
-                             remove_socket(socket);
-                             return;
-                         }
-                         // std::cout << "[READ BODY] Read : " << len
-                         //           << " bytes from peer" << std::endl;
-                         add_to_incoming(socket);
-                     });
+    asio::async_read(
+        *socket, asio::buffer(incoming->body.data(), incoming->header.size),
+        [this, socket, incoming](asio::error_code ec, std::size_t len) {
+            if (ec) {
+                std::cout << "[READ BODY] Cannot read from peer: "
+                          << ec.message() << std::endl;
+                remove_socket(socket);
+                return;
+            }
+            add_to_incoming(socket, incoming);
+        });
 }
 
-void BaseClient::add_to_incoming(std::shared_ptr<tcp::socket> socket) {
-    // find the id of that socket with the reverse map
-    auto it = reverse.find(socket);
-    if (it == reverse.end()) {
-        std::cout << "This socket is not in the peer connections!" << std::endl;
-        return;
+void BaseClient::add_to_incoming(std::shared_ptr<tcp::socket> socket,
+                                 std::shared_ptr<Message> incoming) {
+    peer_id id;
+    {
+        // find the id of that socket with the reverse map
+        std::scoped_lock l(peers_mux);
+        auto it = reverse.find(socket);
+        if (it == reverse.end()) {
+            std::cout << "This socket is not in the peer connections!"
+                      << std::endl;
+            return;
+        }
+        id = it->second;
+    }
+    MessageWithOwner msg{std::move(*incoming), id};
+    // replies skip the queue, the request waiting for it is resumed right away
+    if (!complete_request(msg)) {
+        in_msgs.push_back(std::move(msg));
     }
-    in_msgs.push_back(MessageWithOwner{temp_msg, it->second});
-    temp_msg.reset();
     // prime the contxt again to read the next message for that socket
     start_reading(socket);
 }
@@ -192,13 +228,14 @@ void BaseClient::push_message(peer_id id, const Message &msg) {
 
 void BaseClient::broadcast(const Message &msg) {
     // loop through all the peers and send message
-    for (auto p : peers) {
+    for (auto p : get_peers()) {
         push_message(p.first, msg);
     }
 }
 
 std::vector<std::pair<peer_id, std::shared_ptr<tcp::socket>>>
 BaseClient::get_sockets() {
+    std::scoped_lock l(peers_mux);
     std::vector<std::pair<peer_id, std::shared_ptr<tcp::socket>>> v;
     for (auto p : peers) {
         v.push_back(p);
@@ -206,44 +243,72 @@ BaseClient::get_sockets() {
     return v;
 }
 
+void BaseClient::close_socket(std::shared_ptr<tcp::socket> socket) {
+    // sockets are not thread safe, so close it on its own strand
+    asio::post(socket->get_executor(), [socket]() {
+        asio::error_code ec;
+        socket->shutdown(tcp::socket::shutdown_send, ec);
+        socket->close(ec);
+    });
+}
+
 void BaseClient::remove_socket(peer_id id) {
-    auto it = peers.find(id);
-    if (it != peers.end()) {
-        auto rit = reverse.find(it->second);
+    std::shared_ptr<tcp::socket> socket;
+    {
+        std::scoped_lock l(peers_mux);
+        auto it = peers.find(id);
+        if (it == peers.end()) {
+            return;
+        }
+        socket = it->second;
+        reverse.erase(socket);
         peers.erase(it);
-        reverse.erase(rit);
-        asio::error_code ec;
-        it->second->shutdown(tcp::socket::shutdown_send, ec);
-        it->second->close(ec);
-        on_disconnect(id);
+        outgoing.erase(id);
+        peer_ip_map.erase(id);
+    }
+    close_socket(socket);
+    {
+        // nobody will answer the requests to that peer anymore
+        std::scoped_lock l(pending_mux);
+        for (auto &p : pending) {
+            if (p.second->peer == id) {
+                auto pr = p.second;
+                asio::post(pr->timer.get_executor(),
+                           [pr]() { pr->timer.cancel(); });
+            }
+        }
     }
+    asio::post(cycle_strand, [this, id]() { on_disconnect(id); });
 }
 
 void BaseClient::remove_socket(std::shared_ptr<tcp::socket> socket) {
-    auto it = reverse.find(socket);
-    if (it != reverse.end()) {
-        auto rit = peers.find(it->second);
-        reverse.erase(it);
-        peers.erase(rit);
-        asio::error_code ec;
-        socket->shutdown(tcp::socket::shutdown_send, ec);
-        socket->close(ec);
-        on_disconnect(it->second);
+    peer_id id;
+    {
+        std::scoped_lock l(peers_mux);
+        auto it = reverse.find(socket);
+        if (it == reverse.end()) {
+            return;
+        }
+        id = it->second;
     }
+    remove_socket(id);
 }
 
 void BaseClient::remove_socket_by_ip(const std::string &address,
                                      uint16_t port) {
-    auto index = peer_ip_map.end();
-    for (auto it = peer_ip_map.begin(); it != peer_ip_map.end(); it++) {
-        if (it->second.address == address && it->second.port == port) {
-            remove_socket(it->first);
-            index = it;
-            break;
+    peer_id id = 0;
+    {
+        std::scoped_lock l(peers_mux);
+        for (auto it = peer_ip_map.begin(); it != peer_ip_map.end(); it++) {
+            if (it->second.address == address && it->second.port == port) {
+                id = it->first;
+                break;
+            }
         }
     }
-    if (index != peer_ip_map.end()) {
-        peer_ip_map.erase(index);
+    // peer ids start from 1
+    if (id != 0) {
+        remove_socket(id);
     }
 }
 
@@ -268,84 +333,160 @@ void BaseClient::cycle() {
 }
 
 void BaseClient::start_writing() {
-    // base case
-    if (out_msgs.empty()) {
-        return;
-    }
-    asio::error_code ec2;
-    auto it = peers.find(out_msgs.front().id);
-    if (it == peers.end()) {
-        std::cout << "[START WRITING] The output message has invalid peer id."
-                  << std::endl;
-        // remove the invalid message
-        out_msgs.pop_front();
-        start_writing();
-        return;
+    std::vector<std::pair<peer_id, std::shared_ptr<tcp::socket>>> idle;
+    // start_writing can be called from several threads, the lock also makes
+    // sure only one of them pops from out_msgs at a time
+    std::unique_lock l(peers_mux);
+    while (!out_msgs.empty()) {
+        auto out = out_msgs.pop_front();
+        auto it = peers.find(out.id);
+        if (it == peers.end()) {
+            std::cout
+                << "[START WRITING] The output message has invalid peer id."
+                << std::endl;
+            // drop the invalid message
+            continue;
+        }
+        auto &queue = outgoing[out.id];
+        queue.msgs.push_back(std::move(out.msg));
+        // nobody is writing to that socket, start a new write chain
+        if (!queue.writing) {
+            queue.writing = true;
+            idle.push_back(*it);
+        }
     }
-    auto &socket = it->second;
-    auto remote = socket->remote_endpoint(ec2);
-    if (ec2) {
-        std::cout << "[START WRITING] Removed a peer from the peers "
-                     "collection as "
-                     "it is down"
-                  << std::endl;
-        remove_socket(out_msgs.front().id);
-        // this message cannot be sent, remove it
-        out_msgs.pop_front();
-        start_writing();
-        return;
+    l.unlock();
+    // each peer is written on its own strand, so a slow peer does not hold up
+    // the others and many uploads can run in parallel
+    for (auto &p : idle) {
+        asio::post(p.second->get_executor(),
+                   [this, p]() { write_next(p.first, p.second); });
     }
-    asio::async_write(
-        *socket,
-        asio::buffer(&out_msgs.front().msg.header, sizeof(MessageHeader)),
-        [this, socket](asio::error_code ec, size_t len) {
-            if (!ec) {
-                // std::cout << "[START WRITING] Finish writing header that is "
-                //           << len << " bytes " << std::endl;
-                if (out_msgs.front().msg.header.size > 0) {
-                    // std::cout << "[START WRITING] Still has body to write."
-                    //           << std::endl;
-                    write_body(socket);
-                    return;
-                }
-                // this time don't have to re-prime
-            } else {
-                // should I remove or not?
-                std::cout << "[START WRITING] Cannot write header to socket, "
-                             "removing connection."
-                          << std::endl;
-                remove_socket(out_msgs.front().id);
-            }
-            // no matter what, remove the message if it is not removed by
-            // write_body
-            out_msgs.pop_front();
-            start_writing();
-        });
 }
 
-void BaseClient::write_body(std::shared_ptr<tcp::socket> socket) {
+void BaseClient::write_next(peer_id id, std::shared_ptr<tcp::socket> socket) {
+    std::shared_ptr<Message> msg;
+    {
+        std::scoped_lock l(peers_mux);
+        auto it = outgoing.find(id);
+        // the peer is removed already
+        if (it == outgoing.end()) {
+            return;
+        }
+        if (it->second.msgs.empty()) {
+            it->second.writing = false;
+            return;
+        }
+        // the message has to live until the write finishes, even if the peer
+        // is removed in the meantime
+        msg = std::make_shared<Message>(std::move(it->second.msgs.front()));
+        it->second.msgs.pop_front();
+    }
+    // header and body are written in one go
+    std::array<asio::const_buffer, 2> buffers = {
+        asio::buffer(&msg->header, sizeof(MessageHeader)),
+        asio::buffer(msg->body.data(), msg->header.size),
+    };
     asio::async_write(
-        *socket,
-        asio::buffer(out_msgs.front().msg.body.data(),
-                     out_msgs.front().msg.header.size),
-        [this, socket](asio::error_code ec, std::size_t len) {
+        *socket, buffers,
+        [this, id, socket, msg](asio::error_code ec, std::size_t len) {
             if (ec) {
                 // should I remove or not?
-                std::cout << "[WRITING BODY] Cannot write body to socket, "
+                std::cout << "[START WRITING] Cannot write to socket, "
                              "removing connection."
                           << std::endl;
-                remove_socket(out_msgs.front().id);
-            } else {
-                // this is just for debugging, remove it later
-                // std::cout << "[WRITING BODY] Finish writing body that is "
-                //           << len << " bytes " << std::endl;
+                remove_socket(id);
+                return;
             }
-            // no matter what happens, remove that message
-            out_msgs.pop_front();
-            start_writing();
+            write_next(id, socket);
         });
 }
 
 std::map<peer_id, std::shared_ptr<tcp::socket>> BaseClient::get_peers() {
+    std::scoped_lock l(peers_mux);
     return peers;
 }
+
+asio::awaitable<std::optional<Message>>
+BaseClient::request(peer_id id, Message msg,
+                    std::chrono::milliseconds timeout) {
+    auto pr = std::make_shared<PendingRequest>(
+        co_await asio::this_coro::executor, id);
+    std::uint32_t correlation_id = next_correlation_id++;
+    // 0 means "not a request", skip it when the counter wraps around
+    if (correlation_id == 0) {
+        correlation_id = next_correlation_id++;
+    }
+    msg.header.correlation_id = correlation_id;
+    pr->timer.expires_after(timeout);
+    bool connected;
+    {
+        // both at once: a remove_socket either came first, or it finds the
+        // request in pending and cancels it
+        std::scoped_lock l(peers_mux, pending_mux);
+        connected = peers.find(id) != peers.end();
+        if (connected) {
+            pending[correlation_id] = pr;
+        }
+    }
+    if (!connected) {
+        co_return std::nullopt;
+    }
+    push_message(id, msg);
+    // don't wait for the next cycle
+    start_writing();
+    // the timer is cancelled by complete_request or remove_socket
+    asio::error_code ec;
+    co_await pr->timer.async_wait(asio::redirect_error(asio::use_awaitable, ec));
+    {
+        std::scoped_lock l(pending_mux);
+        pending.erase(correlation_id);
+    }
+    co_return std::move(pr->reply);
+}
+
+bool BaseClient::complete_request(MessageWithOwner &msg) {
+    if (msg.msg.header.reply_to == 0) {
+        return false;
+    }
+    std::shared_ptr<PendingRequest> pr;
+    {
+        std::scoped_lock l(pending_mux);
+        auto it = pending.find(msg.msg.header.reply_to);
+        if (it == pending.end() || it->second->peer != msg.id) {
+            // the request timed out already, nobody is waiting for it
+            std::cout << "[REQUEST] Dropping late reply "
+                      << msg.msg.header.reply_to << std::endl;
+            return true;
+        }
+        pr = it->second;
+    }
+    // the timer and the reply belong to the strand of the coroutine
+    asio::post(pr->timer.get_executor(),
+               [pr, reply = std::move(msg.msg)]() mutable {
+                   pr->reply = std::move(reply);
+                   pr->timer.cancel();
+               });
+    return true;
+}
+
+void BaseClient::reply(const MessageWithOwner &t, Message msg) {
+    msg.header.reply_to = t.msg.header.correlation_id;
+    push_message(t.id, msg);
+    start_writing();
+}
+
+void BaseClient::spawn(asio::awaitable<void> task) {
+    asio::co_spawn(cycle_strand, std::move(task),
+                   [](std::exception_ptr e) {
+                       if (!e) {
+                           return;
+                       }
+                       try {
+                           std::rethrow_exception(e);
+                       } catch (const std::exception &ex) {
+                           std::cout << "[SPAWN] Coroutine failed: "
+                                     << ex.what() << std::endl;
+                       }
+                   });
+}
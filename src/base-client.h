@@ -3,13 +3,20 @@
 
 #include "message.h"
 #include "tsqueue.h"
+#include <array>
 #include <asio.hpp>
+#include <atomic>
 #include <chrono>
+#include <deque>
 #include <iostream>
 #include <list>
 #include <map>
+#include <mutex>
+#include <optional>
 #include <string_view>
+#include <thread>
 #include <tuple>
+#include <vector>
 
 using asio::ip::tcp;
 using namespace std::literals;
@@ -21,17 +28,53 @@ struct ConnectionInfo {
     uint16_t port;
 };
 
+/*
+ * Messages waiting to be written to one peer.
+ * writing is true while a write chain is running on the socket's strand
+ */
+struct OutgoingQueue {
+    std::deque<Message> msgs;
+    bool writing = false;
+};
+
+/*
+ * A request that is waiting for its reply, see BaseClient::request
+ * the timer is cancelled when the reply arrives, reply stays empty if the
+ * request timed out or the peer is gone
+ */
+struct PendingRequest {
+    PendingRequest(asio::any_io_executor ex, peer_id id)
+        : timer(ex), peer(id) {}
+    asio::steady_timer timer;
+    peer_id peer;
+    std::optional<Message> reply;
+};
+
 /*
  * This represents a client in the peer-to-peer network.
  * It needs a port (so that it can listen to other peers)
  *
  * The constructor will start the cycle function (see below).
+ *
+ * The io context is run by a pool of threads. Every socket gets its own
+ * strand, so reads and writes of different peers can run on different cores,
+ * while the timer of cycle(), on_connect and on_disconnect all run on
+ * cycle_strand, so the handlers of subclasses never run at the same time.
  */
 class BaseClient {
   public:
-    BaseClient(uint16_t port, std::chrono::milliseconds cycle_time = 1000ms);
+    // threads: how many threads run the io context, 0 means one per core
+    BaseClient(uint16_t port, std::chrono::milliseconds cycle_time = 1000ms,
+               unsigned int threads = 0);
     ~BaseClient();
 
+    /*
+     * stop the io threads, no handler runs after this returns
+     * subclasses should call it in their destructor, so that the threads
+     * don't call their handlers while they are being destroyed
+     */
+    void stop();
+
     void push_message(peer_id id, const Message &msg);
 
     void remove_socket(peer_id id);
@@ -59,10 +102,38 @@ class BaseClient {
 
     std::map<peer_id, std::shared_ptr<tcp::socket>> get_peers();
 
+    /*
+     * send msg to a peer and wait for the message that answers it
+     * must be awaited in a coroutine started by spawn, for example
+     *
+     * auto reply = co_await request(id, Message(MessageType::GET_DATABASE));
+     * if (reply) { ... } // nullopt if timed out or the peer is gone
+     *
+     * many requests can be in flight at the same time, even to the same peer
+     */
+    asio::awaitable<std::optional<Message>>
+    request(peer_id id, Message msg, std::chrono::milliseconds timeout = 10s);
+
+    /*
+     * answer a request, the peer that sent t will get msg as the result
+     * of its request
+     */
+    void reply(const MessageWithOwner &t, Message msg);
+
+    /*
+     * run a coroutine on cycle_strand, so it never runs at the same time as
+     * handle_message
+     */
+    void spawn(asio::awaitable<void> task);
+
   protected:
     void accept_socket();
 
-    void add_to_peers(std::shared_ptr<tcp::socket> socket);
+    // returns the id given to that socket
+    peer_id add_to_peers(std::shared_ptr<tcp::socket> socket);
+
+    // shutdown and close the socket on its own strand
+    void close_socket(std::shared_ptr<tcp::socket> socket);
     /* this is the heart of the client
      * this will be called per N seconds (see constructor)
      * so messages can be sent (unimplmented)
@@ -81,22 +152,32 @@ class BaseClient {
     /*
      * Read the message body if there is one
      */
-    void read_body(std::shared_ptr<tcp::socket> socket);
+    void read_body(std::shared_ptr<tcp::socket> socket,
+                   std::shared_ptr<Message> incoming);
 
     /*
      * Pushed the read message into the in queue
      */
-    void add_to_incoming(std::shared_ptr<tcp::socket> socket);
+    void add_to_incoming(std::shared_ptr<tcp::socket> socket,
+                         std::shared_ptr<Message> incoming);
 
     /*
-     * Start writing the message to a socket
+     * Move the messages in out_msgs to the queue of their peers, and start
+     * writing to every peer that is not being written to already
      */
     void start_writing();
 
     /*
-     * Write the message body if there is one
+     * Write the next queued message (header and body) of that peer
+     * runs on the strand of the socket
+     */
+    void write_next(peer_id id, std::shared_ptr<tcp::socket> socket);
+
+    /*
+     * if msg answers one of our requests, hand it to that request
+     * returns false if it is an ordinary message
      */
-    void write_body(std::shared_ptr<tcp::socket> socket);
+    bool complete_request(MessageWithOwner &msg);
 
     /*
      * this is the HEART of the class
@@ -107,24 +188,33 @@ class BaseClient {
     virtual void handle_message(MessageWithOwner &msg) = 0;
 
     asio::io_context ctx;
+    // cycle, on_connect and on_disconnect are serialized on this strand
+    asio::strand<asio::io_context::executor_type> cycle_strand;
     // this accepts incoming connections
     tcp::acceptor acceptor;
     // these hold the list of incoming and outgoing connections
-    // std::vector<tcp::socket> clients, peers;
+    // they are touched by the io threads and the GUI thread, so every access
+    // has to lock peers_mux first
+    std::mutex peers_mux;
     std::map<peer_id, std::shared_ptr<tcp::socket>> peers;
     std::map<std::shared_ptr<tcp::socket>, peer_id> reverse;
     std::map<peer_id, ConnectionInfo> peer_ip_map;
+    std::map<peer_id, OutgoingQueue> outgoing;
     // resolves the hostname port to a valid endpoint
     tcp::resolver resolver;
     // the timeout function that calls cycle
     asio::high_resolution_timer timer;
     // priming the context
-    std::thread worker;
+    std::vector<std::thread> workers;
     // storing outgoing messages
     ThreadSafeQueue<MessageWithOwner> out_msgs;
     ThreadSafeQueue<MessageWithOwner> in_msgs;
+    // guarded by peers_mux
     peer_id current_id = 1;
-    Message temp_msg;
+    // requests waiting for a reply, by correlation id
+    std::mutex pending_mux;
+    std::map<std::uint32_t, std::shared_ptr<PendingRequest>> pending;
+    std::atomic<std::uint32_t> next_correlation_id = 1;
     std::chrono::milliseconds cycle_time;
 };
 
@@ -0,0 +1,29 @@
+#include "../content-hash.h"
+#include <chrono>
+#include <gtest/gtest.h>
+#include <iostream>
+
+// how fast each algorithm hashes 1 GiB
+TEST(content_hash_benchmark, throughput) {
+    // hashed over and over, so the numbers are about the hash and not memory
+    // allocation or the disk
+    const size_t chunk = 64 << 20, total = (size_t)1 << 30;
+    std::string data(chunk, 'x');
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = (char)(i * 31 + (i >> 12));
+    }
+    for (auto a : supported_hashes) {
+        auto h = ContentHash::create(a);
+        auto start = std::chrono::steady_clock::now();
+        for (size_t done = 0; done < total; done += chunk) {
+            h->update((const uint8_t *)data.data(), chunk);
+        }
+        std::string digest = h->hex_digest();
+        std::chrono::duration<double> took =
+            std::chrono::steady_clock::now() - start;
+        EXPECT_EQ(digest.size(), 32);
+        std::cout << hash_name(a) << ": 1 GiB in " << took.count() << "s, "
+                  << (int)(total / (1 << 20) / took.count()) << " MB/s"
+                  << std::endl;
+    }
+}
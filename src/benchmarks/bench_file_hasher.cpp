@@ -0,0 +1,55 @@
+#include "../file-hasher.h"
+#include <chrono>
+#include <filesystem>
+#include <gtest/gtest.h>
+#include <iostream>
+#include <random>
+
+static void write_file(const std::filesystem::path &path,
+                       const std::string &content) {
+    FILE *fp = fopen(path.c_str(), "wb");
+    fwrite(content.data(), 1, content.size(), fp);
+    fclose(fp);
+}
+
+// how hashing a library scales with threads
+TEST(file_hasher_benchmark, library_throughput) {
+    const int files = 64, size = 2 << 20;
+    auto dir = std::filesystem::temp_directory_path() /
+               ("bench_file_hasher_" + std::to_string(std::random_device()()));
+    std::filesystem::create_directories(dir);
+    std::vector<std::string> paths;
+    std::string content(size, 'x');
+    for (int i = 0; i < files; i++) {
+        content[0] = (char)i;
+        auto path = dir / (std::to_string(i) + ".wav");
+        write_file(path, content);
+        paths.push_back(path);
+    }
+
+    auto mb_per_second = [&](int threads) {
+        // a new hasher each time, so nothing is cached
+        FileHasher h(threads);
+        auto start = std::chrono::steady_clock::now();
+        h.checksums(paths);
+        std::chrono::duration<double> took =
+            std::chrono::steady_clock::now() - start;
+        return (double)files * size / (1 << 20) / took.count();
+    };
+    int cores = FileHasher().get_threads();
+    double one = mb_per_second(1);
+    double all = mb_per_second(cores);
+    std::cout << "hashing " << files << " files: " << (int)one
+              << " MB/s with 1 thread, " << (int)all << " MB/s with " << cores
+              << " threads" << std::endl;
+
+    FileHasher h;
+    h.checksums(paths);
+    auto start = std::chrono::steady_clock::now();
+    h.checksums(paths);
+    std::chrono::duration<double, std::milli> cached =
+        std::chrono::steady_clock::now() - start;
+    std::cout << "rescanning them unchanged: " << cached.count() << "ms"
+              << std::endl;
+    std::filesystem::remove_all(dir);
+}
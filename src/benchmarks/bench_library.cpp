@@ -0,0 +1,133 @@
+#include "../library.h"
+#include <algorithm>
+#include <chrono>
+#include <gtest/gtest.h>
+#include <iostream>
+#include <memory>
+#include <random>
+
+// what the music list was before: a pointer per track, sorted by comparing
+// strings lowercased on the spot
+struct PointerTrack {
+    std::string title, artist, album, file_name, path, sort_title;
+    int duration;
+};
+
+static std::string lowercase(const std::string &s) {
+    std::string l = s;
+    std::transform(l.begin(), l.end(), l.begin(), ::tolower);
+    return l;
+}
+
+static bool pointer_by_artist(const PointerTrack *a, const PointerTrack *b) {
+    if (a->artist != b->artist) {
+        return lowercase(a->artist) < lowercase(b->artist);
+    }
+    if (a->album != b->album) {
+        return lowercase(a->album) < lowercase(b->album);
+    }
+    return a->sort_title < b->sort_title;
+}
+
+// how long sorting 100k tracks by artist takes, with a pointer per track like
+// the music list before, in a library, and merging a few changes into it
+TEST(library_benchmark, large_library_sort_and_filter) {
+    const int n = 100000;
+    std::mt19937 rng(3280);
+    auto word = [&rng](int length) {
+        std::string w;
+        for (int i = 0; i < length; i++) {
+            w.push_back((i == 0 ? 'A' : 'a') + rng() % 26);
+        }
+        return w;
+    };
+    std::vector<std::string> artists, albums;
+    for (int i = 0; i < 2000; i++) {
+        artists.push_back(word(6) + " " + word(8));
+    }
+    for (int i = 0; i < 8000; i++) {
+        albums.push_back(word(10));
+    }
+
+    Library library;
+    library.reserve(n);
+    std::vector<std::unique_ptr<PointerTrack>> owned;
+    std::vector<PointerTrack *> pointers;
+    for (int i = 0; i < n; i++) {
+        auto t = std::make_unique<PointerTrack>();
+        t->title = word(12) + " " + word(6);
+        t->sort_title = lowercase(t->title);
+        t->artist = artists[rng() % artists.size()];
+        t->album = albums[rng() % albums.size()];
+        t->file_name = word(16);
+        t->path = "/music/" + t->file_name + ".mp3";
+        t->duration = rng() % 600000;
+        library.add({.title = t->title,
+                     .artist = t->artist,
+                     .album = t->album,
+                     .file_name = t->file_name,
+                     .path = t->path,
+                     .duration = t->duration});
+        pointers.push_back(t.get());
+        owned.push_back(std::move(t));
+    }
+    // the pointers end up all over the heap, like after a scan
+    std::shuffle(pointers.begin(), pointers.end(), rng);
+
+    auto start = std::chrono::steady_clock::now();
+    std::sort(pointers.begin(), pointers.end(), pointer_by_artist);
+    double pointer_seconds = std::chrono::duration<double>(
+                                 std::chrono::steady_clock::now() - start)
+                                 .count();
+
+    // the first time is the one that sorts, after that it is kept
+    std::vector<TrackIndex> order;
+    start = std::chrono::steady_clock::now();
+    library.sort(Library::ARTIST, true, order);
+    double library_seconds = std::chrono::duration<double>(
+                                 std::chrono::steady_clock::now() - start)
+                                 .count();
+    ASSERT_EQ(order.size(), n);
+    for (int i = 1; i < n; i++) {
+        EXPECT_LE(lowercase(std::string(library.artist(order[i - 1]))),
+                  lowercase(std::string(library.artist(order[i]))));
+    }
+
+    // a rescan that changed a few tracks: they are merged into the order
+    // that is kept instead of sorting all of them again
+    for (int i = 0; i < 100; i++) {
+        TrackIndex changed = rng() % n;
+        PointerTrack &t = *owned[changed];
+        t.artist = artists[rng() % artists.size()];
+        library.set(changed, {.title = t.title,
+                              .artist = t.artist,
+                              .album = t.album,
+                              .file_name = t.file_name,
+                              .path = t.path,
+                              .duration = t.duration});
+    }
+    start = std::chrono::steady_clock::now();
+    const std::vector<TrackIndex> &merged = library.order(Library::ARTIST);
+    double merge_seconds = std::chrono::duration<double>(
+                               std::chrono::steady_clock::now() - start)
+                               .count();
+    ASSERT_EQ(merged.size(), n);
+    for (int i = 1; i < n; i++) {
+        EXPECT_LE(lowercase(std::string(library.artist(merged[i - 1]))),
+                  lowercase(std::string(library.artist(merged[i]))));
+    }
+
+    std::vector<TrackIndex> matches;
+    start = std::chrono::steady_clock::now();
+    library.filter("ab", matches);
+    double filter_seconds = std::chrono::duration<double>(
+                                std::chrono::steady_clock::now() - start)
+                                .count();
+    EXPECT_FALSE(matches.empty());
+
+    std::cout << n << " tracks by artist: " << pointer_seconds
+              << "s with a pointer per track, " << library_seconds
+              << "s in a library, " << merge_seconds
+              << "s after changing 100 of them. filtered in "
+              << filter_seconds << "s" << std::endl;
+}
@@ -0,0 +1,114 @@
+#include "../library-scanner.h"
+#include <chrono>
+#include <gtest/gtest.h>
+#include <iostream>
+#include <unordered_set>
+#include <random>
+#include <thread>
+
+using namespace testing;
+
+class LibraryScannerBenchmark : public Test {
+  protected:
+    void SetUp() override {
+        dir = std::filesystem::temp_directory_path() /
+              ("bench_library_scanner_" +
+               std::to_string(std::random_device()()));
+        std::filesystem::create_directories(dir);
+    }
+    void TearDown() override { std::filesystem::remove_all(dir); }
+
+    std::vector<std::filesystem::path> make_files(int count) {
+        std::vector<std::filesystem::path> files;
+        for (int i = 0; i < count; i++) {
+            auto path = dir / (std::to_string(i) + ".wav");
+            FILE *fp = fopen(path.c_str(), "w");
+            fprintf(fp, "song %d", i);
+            fclose(fp);
+            files.push_back(path);
+        }
+        return files;
+    }
+
+    // waits for the scan to finish, and returns everything it described
+    std::vector<Track> wait_for(LibraryScanner &scanner) {
+        std::vector<Track> tracks;
+        while (true) {
+            bool finished = scanner.progress().finished;
+            for (Track &t : scanner.take()) {
+                tracks.push_back(std::move(t));
+            }
+            if (finished) {
+                return tracks;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    std::filesystem::path dir;
+    Store store{true, ":memory:"};
+};
+
+static Track describe_by_name(const std::filesystem::path &file,
+                              const Track *stored) {
+    if (stored) {
+        return *stored;
+    }
+    return {.title = file.stem().string(), .path = file.string()};
+}
+
+// how long it takes until the first tracks can be shown, compared to the
+// whole scan
+TEST_F(LibraryScannerBenchmark, first_results_latency) {
+    auto files = make_files(2000);
+    auto start = std::chrono::steady_clock::now();
+    LibraryScanner scanner(
+        store, dir, [&]() { return files; },
+        [](const std::filesystem::path &file, const Track *stored) {
+            // about what taglib takes for a small file
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+            return describe_by_name(file, stored);
+        },
+        []() {});
+    while (scanner.progress().described == 0) {
+        std::this_thread::yield();
+    }
+    auto first_at = std::chrono::steady_clock::now();
+    wait_for(scanner);
+    std::chrono::duration<double, std::milli> to_first = first_at - start;
+    std::chrono::duration<double, std::milli> total =
+        std::chrono::steady_clock::now() - start;
+    std::cout << "first tracks after " << to_first.count()
+              << "ms, all of them after " << total.count() << "ms"
+              << std::endl;
+}
+
+// how long a rescan takes when nothing changed, for a library the size of a
+// large music collection
+TEST_F(LibraryScannerBenchmark, no_change_rescan_latency) {
+    auto files = make_files(50000);
+    std::unordered_set<std::string> shown;
+    auto start = std::chrono::steady_clock::now();
+    {
+        LibraryScanner first(
+            store, dir, [&]() { return files; }, describe_by_name, []() {});
+        for (Track &t : wait_for(first)) {
+            shown.insert(t.path);
+        }
+    }
+    std::chrono::duration<double> first_took =
+        std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    LibraryScanner again(
+        store, dir, [&]() { return files; }, describe_by_name, []() {},
+        shown);
+    auto tracks = wait_for(again);
+    std::chrono::duration<double> again_took =
+        std::chrono::steady_clock::now() - start;
+    EXPECT_TRUE(tracks.empty());
+    EXPECT_EQ(again.progress().unchanged, files.size());
+    std::cout << "first scan of " << files.size() << " files "
+              << first_took.count() << "s, rescan without changes "
+              << again_took.count() << "s" << std::endl;
+}
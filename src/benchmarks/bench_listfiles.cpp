@@ -0,0 +1,67 @@
+#include "../listfiles.h"
+#include <chrono>
+#include <filesystem>
+#include <gtest/gtest.h>
+#include <iostream>
+#include <random>
+
+static const std::vector<std::string> exts = {".mp3", ".wav", ".flac"};
+
+static void touch(const std::filesystem::path &path) {
+    FILE *fp = fopen(path.c_str(), "w");
+    fclose(fp);
+}
+
+// what listfiles used to do
+// (but without the ascii regex, which only made it slower)
+static std::vector<std::filesystem::path>
+listfiles_before(const std::string &_dir, const std::vector<std::string> &ext) {
+    std::vector<std::filesystem::path> listfiles;
+    for (const auto &entry : std::filesystem::recursive_directory_iterator(
+             std::filesystem::u8path(_dir))) {
+        bool fits = false;
+        for (const std::string &_ext : ext) {
+            if (entry.path().extension().string() == _ext) {
+                fits = true;
+            }
+        }
+        if (std::filesystem::is_regular_file(entry.path()) && fits) {
+            listfiles.push_back(entry.path());
+        }
+    }
+    return listfiles;
+}
+
+// how long listing a tree of 100k files takes now and how long it took
+// before (both with the tree in the page cache)
+TEST(listfiles_benchmark, large_tree_throughput) {
+    auto dir = std::filesystem::temp_directory_path() /
+               ("bench_listfiles_" + std::to_string(std::random_device()()));
+    // artists / albums / songs, and a cover in every album
+    for (int artist = 0; artist < 100; artist++) {
+        for (int album = 0; album < 10; album++) {
+            auto folder = dir / ("artist " + std::to_string(artist)) /
+                          ("album " + std::to_string(album));
+            std::filesystem::create_directories(folder);
+            for (int song = 0; song < 100; song++) {
+                touch(folder / ("song " + std::to_string(song) + ".mp3"));
+            }
+            touch(folder / "cover.jpg");
+        }
+    }
+    auto time = [](auto list) {
+        auto start = std::chrono::steady_clock::now();
+        size_t count = list().size();
+        std::chrono::duration<double, std::milli> took =
+            std::chrono::steady_clock::now() - start;
+        return std::make_pair(count, took.count());
+    };
+    auto before = time([&]() { return listfiles_before(dir.string(), exts); });
+    auto now = time([&]() {
+        return ListFiles::listfiles(dir.string(), exts, true, true);
+    });
+    EXPECT_EQ(before.first, now.first);
+    std::cout << now.first << " files in " << now.second << "ms, before "
+              << before.second << "ms" << std::endl;
+    std::filesystem::remove_all(dir);
+}
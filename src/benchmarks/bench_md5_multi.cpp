@@ -0,0 +1,57 @@
+#include "../md5-multi.h"
+#include <chrono>
+#include <gtest/gtest.h>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// the same bytes every time, different for every stream
+static std::string make_data(size_t size, int seed) {
+    std::string data(size, 0);
+    uint32_t x = seed * 2654435761u + 1;
+    for (auto &c : data) {
+        x = x * 1664525 + 1013904223;
+        c = (char)(x >> 24);
+    }
+    return data;
+}
+
+// how much faster a batch of files is hashed side by side than one after
+// another
+TEST(md5_multi_benchmark, throughput) {
+    const int count = 16;
+    const size_t size = 16 << 20;
+    std::vector<std::string> data;
+    std::vector<uint8_t *> inputs;
+    for (int i = 0; i < count; i++) {
+        data.push_back(make_data(size, i));
+    }
+    for (auto &d : data) {
+        inputs.push_back((uint8_t *)d.data());
+    }
+    auto mb_per_second = [&](auto hash) {
+        std::vector<MD5Context> ctxs(count);
+        std::vector<MD5Context *> ptrs;
+        for (auto &ctx : ctxs) {
+            md5Init(&ctx);
+            ptrs.push_back(&ctx);
+        }
+        auto start = std::chrono::steady_clock::now();
+        hash(ptrs);
+        std::chrono::duration<double> took =
+            std::chrono::steady_clock::now() - start;
+        return (double)count * size / (1 << 20) / took.count();
+    };
+    double one_by_one = mb_per_second([&](std::vector<MD5Context *> &ptrs) {
+        for (int i = 0; i < count; i++) {
+            md5Update(ptrs[i], inputs[i], size);
+        }
+    });
+    double side_by_side = mb_per_second([&](std::vector<MD5Context *> &ptrs) {
+        md5UpdateMany(ptrs.data(), inputs.data(), size, count);
+    });
+    std::cout << "md5 of " << count << " streams: " << (int)one_by_one
+              << " MB/s one by one, " << (int)side_by_side << " MB/s with "
+              << md5Lanes() << " lanes (" << side_by_side / one_by_one
+              << "x)" << std::endl;
+}
@@ -0,0 +1,85 @@
+#include "../search-index.h"
+#include <algorithm>
+#include <chrono>
+#include <gtest/gtest.h>
+#include <iostream>
+#include <random>
+
+// how long building the index for 100k tracks takes, and a keystroke with it
+// and row by row
+TEST(search_index_benchmark, keystroke_latency) {
+    const int n = 100000;
+    std::mt19937 rng(3280);
+    auto word = [&rng](int length) {
+        std::string w;
+        for (int i = 0; i < length; i++) {
+            w.push_back((i == 0 ? 'A' : 'a') + rng() % 26);
+        }
+        return w;
+    };
+    std::vector<std::string> artists, albums;
+    for (int i = 0; i < 2000; i++) {
+        artists.push_back(word(6) + " " + word(8));
+    }
+    for (int i = 0; i < 8000; i++) {
+        albums.push_back(word(10));
+    }
+    Library library;
+    library.reserve(n);
+    for (int i = 0; i < n; i++) {
+        library.add({.title = word(12) + " " + word(6),
+                     .artist = artists[rng() % artists.size()],
+                     .album = albums[rng() % albums.size()]});
+    }
+    // one that is really there, typed in one key at a time
+    std::string typed = std::string(library.artist(n / 2));
+
+    auto start = std::chrono::steady_clock::now();
+    SearchIndex index;
+    for (TrackIndex i = 0; i < n; i++) {
+        index.add(library, i);
+    }
+    double build_seconds = std::chrono::duration<double>(
+                               std::chrono::steady_clock::now() - start)
+                               .count();
+
+    // what the completion did before: for every row, every keystroke,
+    // lowercase the three fields and the key and look
+    auto lower = [](std::string s) {
+        std::transform(s.begin(), s.end(), s.begin(), ::tolower);
+        return s;
+    };
+    double row_seconds = 0, index_seconds = 0;
+    std::vector<TrackIndex> matches, expected;
+    for (size_t k = 1; k <= typed.size(); k++) {
+        std::string_view query = std::string_view(typed).substr(0, k);
+        start = std::chrono::steady_clock::now();
+        expected.clear();
+        for (TrackIndex i = 0; i < n; i++) {
+            std::string key = lower(std::string(query));
+            if (lower(std::string(library.title(i))).find(key) !=
+                    std::string::npos ||
+                lower(std::string(library.artist(i))).find(key) !=
+                    std::string::npos ||
+                lower(std::string(library.album(i))).find(key) !=
+                    std::string::npos) {
+                expected.push_back(i);
+            }
+        }
+        row_seconds += std::chrono::duration<double>(
+                           std::chrono::steady_clock::now() - start)
+                           .count();
+        start = std::chrono::steady_clock::now();
+        index.search(library, query, matches);
+        index_seconds += std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+        ASSERT_EQ(matches, expected) << query;
+    }
+    EXPECT_FALSE(matches.empty());
+    std::cout << "indexed " << n << " tracks in " << build_seconds
+              << "s. per keystroke, typing \"" << typed << "\": "
+              << row_seconds / typed.size() << "s row by row, "
+              << index_seconds / typed.size() << "s with the index"
+              << std::endl;
+}
@@ -0,0 +1,246 @@
+#include "../store.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <gtest/gtest.h>
+#include <iostream>
+#include <random>
+#include <thread>
+
+// somewhere in the temp directory, with a name of its own each run
+static std::filesystem::path temp_path(const std::filesystem::path &name) {
+    return std::filesystem::temp_directory_path() /
+           (name.stem().string() + "_" + std::to_string(std::random_device()()) +
+            name.extension().string());
+}
+
+static double ms(std::chrono::steady_clock::duration d) {
+    return std::chrono::duration<double, std::milli>(d).count();
+}
+
+// writes count small files into a fresh directory and returns their tracks
+static std::vector<Track> make_files(const std::filesystem::path &dir,
+                                     int count) {
+    std::filesystem::create_directories(dir);
+    std::vector<Track> tracks;
+    std::string content(4096, 'x');
+    for (int i = 0; i < count; i++) {
+        auto path = dir / (std::to_string(i) + ".wav");
+        content[0] = (char)i;
+        FILE *fp = fopen(path.c_str(), "w");
+        fwrite(content.data(), 1, content.size(), fp);
+        fclose(fp);
+        tracks.push_back({.title = std::to_string(i), .path = path.string()});
+    }
+    return tracks;
+}
+
+// a library of count tracks where every 1000th title has needle in it
+static void make_library(Store &s, int count) {
+    const char *artists[] = {"The Brothers Four", "Harry Belafonte",
+                             "Simon & Garfunkel", "Joan Baez"};
+    std::vector<Track> tracks;
+    for (int i = 0; i < count; i++) {
+        std::string title = "Song number " + std::to_string(i);
+        if (i % 1000 == 0) {
+            title += " needle";
+        }
+        // the files don't exist, a unique path keeps them apart
+        tracks.push_back({.album = "Album " + std::to_string(i / 12),
+                          .artist = artists[i % 4],
+                          .title = title,
+                          .path = "/nowhere/" + std::to_string(i)});
+    }
+    // create complains about every missing file
+    auto *cerr = std::cerr.rdbuf(nullptr);
+    s.upsert_many(tracks);
+    std::cerr.rdbuf(cerr);
+    std::cerr.clear();
+}
+
+// how much preparing the query each time costs, next to the cached statement
+// search_with_checksum uses (both go through the checksum index)
+TEST(store_benchmark, checksum_lookup_latency) {
+    const int tracks = 50, lookups = 20000;
+    auto file = temp_path("bench_store_lookup.db");
+    Store s(true, file.string());
+    for (int i = 0; i < tracks; i++) {
+        Track t = {.title = std::to_string(i), .checksum = std::to_string(i)};
+        s.create(t);
+    }
+
+    // what every call used to do: parse and plan the query each time
+    SQLite::Database db(file.string(), SQLite::OPEN_READWRITE);
+    int found = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < lookups; i++) {
+        SQLite::Statement q(db, "SELECT * FROM tracks "
+                                "WHERE checksum = :checksum ");
+        q.bind(":checksum", std::to_string(i % (tracks * 2)));
+        found += q.executeStep();
+    }
+    auto uncached = std::chrono::steady_clock::now() - start;
+
+    int found_cached = 0;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < lookups; i++) {
+        Track t;
+        found_cached +=
+            s.search_with_checksum(std::to_string(i % (tracks * 2)), t);
+    }
+    auto cached = std::chrono::steady_clock::now() - start;
+
+    EXPECT_EQ(found, found_cached);
+    std::cout << "search_with_checksum: " << ms(uncached) * 1000 / lookups
+              << "us/query prepared every time, " << ms(cached) * 1000 / lookups
+              << "us/query cached" << std::endl;
+    std::filesystem::remove(file);
+}
+
+// how long checking a 20k track database from a peer takes with a query per
+// track and with has_checksums, which answers from memory
+TEST(store_benchmark, merge_peer_database_latency) {
+    const int count = 20000;
+    auto file = temp_path("bench_store_merge.db");
+    Store s(true, file.string());
+    std::vector<Track> tracks;
+    std::vector<std::string> remote;
+    for (int i = 0; i < count; i++) {
+        tracks.push_back({.path = "/nowhere/" + std::to_string(i),
+                          .checksum = std::to_string(i * 2)});
+        remote.push_back(std::to_string(i));
+    }
+    // create complains about every missing file
+    auto *cerr = std::cerr.rdbuf(nullptr);
+    s.upsert_many(tracks);
+    std::cerr.rdbuf(cerr);
+    std::cerr.clear();
+
+    int per_query = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (auto &checksum : remote) {
+        Track t;
+        per_query += s.search_with_checksum(checksum, t);
+    }
+    auto queries = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    auto has = s.has_checksums(remote);
+    auto bulk = std::chrono::steady_clock::now() - start;
+
+    EXPECT_EQ(std::count(has.begin(), has.end(), true), per_query);
+    std::cout << "checking " << count << " remote tracks: " << ms(queries)
+              << "ms with a query each, " << ms(bulk) << "ms in one batch"
+              << std::endl;
+    std::filesystem::remove(file);
+}
+
+// the rows/sec of inserting a library one track at a time, in one batch, and
+// rescanning it when nothing changed
+TEST(store_benchmark, upsert_many_throughput) {
+    const int count = 2000;
+    auto dir = temp_path("bench_store_files");
+    auto file = temp_path("bench_store_upsert.db");
+    auto tracks = make_files(dir, count);
+    auto rate = [&](auto d) {
+        return count / std::chrono::duration<double>(d).count();
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    {
+        Store s(true, file.string());
+        auto copy = tracks;
+        for (auto &t : copy) {
+            s.upsert(t);
+        }
+    }
+    auto one_by_one = std::chrono::steady_clock::now() - start;
+
+    std::filesystem::remove(file);
+    Store s(true, file.string());
+    auto copy = tracks;
+    start = std::chrono::steady_clock::now();
+    EXPECT_EQ(s.upsert_many(copy), count);
+    auto batch = std::chrono::steady_clock::now() - start;
+
+    copy = tracks;
+    start = std::chrono::steady_clock::now();
+    EXPECT_EQ(s.upsert_many(copy), count);
+    auto rescan = std::chrono::steady_clock::now() - start;
+
+    std::cout << "upsert: " << (int)rate(one_by_one) << " rows/s one by one, "
+              << (int)rate(batch) << " rows/s batched, " << (int)rate(rescan)
+              << " rows/s rescanning unchanged files" << std::endl;
+    std::filesystem::remove_all(dir);
+    std::filesystem::remove(file);
+}
+
+// full text search over a large library, next to the LIKE search used before
+TEST(store_benchmark, search_large_library) {
+    const int count = 100000;
+    auto file = temp_path("bench_store_search.db");
+    Store s(true, file.string());
+    make_library(s, count);
+
+    auto start = std::chrono::steady_clock::now();
+    auto found = s.search("needle");
+    auto fts = std::chrono::steady_clock::now() - start;
+
+    // what search did before: LIKE on all three columns
+    SQLite::Database db(file.string(), SQLite::OPEN_READONLY);
+    SQLite::Statement q(db, "SELECT * FROM tracks "
+                            "WHERE album LIKE :album OR "
+                            "artist LIKE :artist OR "
+                            "title LIKE :title");
+    q.bind(":album", "%needle%");
+    q.bind(":artist", "%needle%");
+    q.bind(":title", "%needle%");
+    int like_found = 0;
+    start = std::chrono::steady_clock::now();
+    while (q.executeStep()) {
+        like_found++;
+    }
+    auto like = std::chrono::steady_clock::now() - start;
+
+    EXPECT_EQ(like_found, found.size());
+    std::cout << "search over " << count << " tracks: " << ms(fts)
+              << "ms full text, " << ms(like) << "ms LIKE" << std::endl;
+    std::filesystem::remove(file);
+}
+
+// how long the slowest read takes while a rescan of 30k tracks is being
+// written, next to how long the rescan takes
+TEST(store_benchmark, reads_while_writing) {
+    const int count = 30000;
+    auto file = temp_path("bench_store_readers.db");
+    Store s(true, file.string());
+    Track t = {.title = "Jamaica Farewell", .checksum = "334a"};
+    s.create(t);
+
+    std::atomic<bool> writing = true;
+    std::chrono::steady_clock::duration rescan_took;
+    std::thread rescan([&s, &writing, &rescan_took] {
+        auto start = std::chrono::steady_clock::now();
+        make_library(s, count);
+        rescan_took = std::chrono::steady_clock::now() - start;
+        writing = false;
+    });
+
+    int reads = 0;
+    std::chrono::steady_clock::duration slowest{};
+    while (writing) {
+        auto start = std::chrono::steady_clock::now();
+        Track found;
+        s.search_with_checksum("334a", found);
+        s.read_all(PEER_TRACK_FIELDS);
+        slowest = std::max(slowest, std::chrono::steady_clock::now() - start);
+        reads++;
+    }
+    rescan.join();
+
+    std::cout << reads << " reads while writing " << count << " tracks for "
+              << ms(rescan_took) << "ms, the slowest took " << ms(slowest)
+              << "ms" << std::endl;
+    std::filesystem::remove(file);
+}
@@ -7,14 +7,13 @@ BufferedAudio::BufferedAudio(std::string ext){
     std::string parse = (std::string)"appsrc name=myappsrc max-bytes=0 ! queue name=myqueue min-threshold-buffers=1 ! " + decoder.at(ext) + " ! audioconvert ! audioresample ! spectrum interval=50000000 bands=128 ! autoaudiosink";
     pipeline = gst_parse_launch(parse.c_str(), NULL);
     appsrc = gst_bin_get_by_name(GST_BIN(pipeline), "myappsrc");
-    GstElement *queue = gst_bin_get_by_name(GST_BIN(pipeline), "myqueue");
+    queue = gst_bin_get_by_name(GST_BIN(pipeline), "myqueue");
 
     GstAppSrcCallbacks cbs;
     cbs.need_data = &BufferedAudio::cb_need_data;
     gst_app_src_set_callbacks(GST_APP_SRC_CAST(appsrc), &cbs, this, NULL);
 
     g_signal_connect(queue, "underrun", G_CALLBACK(&BufferedAudio::on_queue_underrun), this);
-    gst_object_unref(GST_OBJECT(queue));
 
     gst_element_set_state (pipeline, GST_STATE_PLAYING);
 
@@ -29,6 +28,7 @@ BufferedAudio::~BufferedAudio(){
     data.clear();
 
     gst_object_unref(GST_OBJECT(appsrc));
+    gst_object_unref(GST_OBJECT(queue));
 
     if(pipeline != NULL){
         gst_element_set_state (pipeline, GST_STATE_NULL);
@@ -44,6 +44,7 @@ void BufferedAudio::pushBuffer(const char *cbuffer, guint32 size){
     char *buffer = new char[size + 1];
     std::copy_n(cbuffer, size, buffer);
     data.push_back(gst_buffer_new_wrapped(buffer, size));
+    data_bytes += size;
     if(pipeline_paused){
         gst_element_set_state (pipeline, GST_STATE_PLAYING);
         pipeline_paused = false;
@@ -57,12 +58,19 @@ void BufferedAudio::pushEOS(){
 
 void BufferedAudio::push_data(){
     if(!data.empty()){
+        data_bytes -= gst_buffer_get_size(data.front());
         gst_app_src_push_buffer(GST_APP_SRC(appsrc), data.front());
         data.pop_front();
     }else if(eos)
         gst_app_src_end_of_stream(GST_APP_SRC(appsrc));
 }
 
+guint64 BufferedAudio::getBufferedBytes(){
+    guint queued = 0;
+    g_object_get(queue, "current-level-bytes", &queued, NULL);
+    return data_bytes + gst_app_src_get_current_level_bytes(GST_APP_SRC(appsrc)) + queued;
+}
+
 void BufferedAudio::pause_pipeline(){
     if(data.empty()){
         gst_element_set_state (pipeline, GST_STATE_PAUSED);
@@ -4,6 +4,7 @@
 #include <gst/gst.h>
 #include <gst/app/gstappsrc.h>
 #include <algorithm>
+#include <atomic>
 #include <string>
 #include <deque>
 #include <map>
@@ -17,12 +18,16 @@ class BufferedAudio{
         GstElement *getPipeline();
         void pushBuffer(const char *buffer, guint32 size);
         void pushEOS();
+        // bytes pushed in but not decoded yet, i.e. buffered ahead of the playhead
+        guint64 getBufferedBytes();
 
     private:
         const static std::map<std::string, std::string> decoder;
 
         std::deque<GstBuffer *> data;
-        GstElement *pipeline, *appsrc;
+        // bytes in data, it is read by the network thread
+        std::atomic<guint64> data_bytes{0};
+        GstElement *pipeline, *appsrc, *queue;
         bool pipeline_paused, eos;
         
         void push_data();
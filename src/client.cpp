@@ -5,7 +5,7 @@ Client::Client(uint16_t port, const std::string &filename)
     cycle();
 }
 
-Client::~Client() {}
+Client::~Client() { stop(); }
 
 void Client::on_connect(peer_id id) {
     push_message(id, Message(MessageType::PING));
@@ -81,7 +81,7 @@ void Client::handle_get_track_info(MessageWithOwner &t) {
         NoSuchTrack nst;
         nst.title = gti.title;
         m << nst;
-        push_message(t.id, m);
+        reply(t, m);
         return;
     }
     auto results = s.search(gti.title);
@@ -92,14 +92,14 @@ void Client::handle_get_track_info(MessageWithOwner &t) {
         NoSuchTrack nst;
         nst.title = gti.title;
         m << nst;
-        push_message(t.id, m);
+        reply(t, m);
     } else {
         std::cout << "Found it. Tell peer that I do have it." << std::endl;
         Message m(MessageType::RETURN_TRACK_INFO);
         // message class allows pushing the vectors into it
         ReturnTrackInfo rti{.tracks = results, .title = gti.title};
         m << rti;
-        push_message(t.id, m);
+        reply(t, m);
     }
 }
 
@@ -122,7 +122,7 @@ void Client::handle_get_lyrics(MessageWithOwner &t) {
         nsl.filename = gl.filename;
         Message m(MessageType::NO_SUCH_LYRICS);
         m << nsl;
-        push_message(t.id, m);
+        reply(t, m);
     } else {
         Message m(MessageType::RETURN_LYRICS);
         ReturnLyrics rl{
@@ -130,7 +130,7 @@ void Client::handle_get_lyrics(MessageWithOwner &t) {
             .filename = gl.filename,
         };
         m << rl;
-        push_message(t.id, m);
+        reply(t, m);
     }
 }
 
@@ -174,44 +174,7 @@ void Client::handle_prepare_picture_sharing(MessageWithOwner &t) {
     pps2.total_segments = cf.total_segments;
     pps2.assigned_id_for_peer = assigned_peer_id;
     m << pps2;
-    push_message(t.id, m);
-}
-
-void Client::handle_prepared_picture_sharing(MessageWithOwner &t) {
-    // we know that the peer will engage in sharing that file
-    std::cout << "Client " << t.id << " is ready to send the file."
-              << std::endl;
-    PreparedFileSharing pps;
-    t.msg >> pps;
-    fs.set_segment_count(pps.total_segments);
-    Message m(MessageType::GET_SEGMENT);
-    GetSegment gps;
-    gps.segment_id = fs.get_next_segment_id();
-    m << gps;
-    push_message(t.id, m);
-    std::cout << "Assigned id is " << pps.assigned_id_for_peer << std::endl;
-    fs.start_timeout(pps.assigned_id_for_peer);
-}
-
-void Client::handle_return_picture_segment(MessageWithOwner &t) {
-    ReturnSegment rps;
-    t.msg >> rps;
-    fs.end_timeout(rps.assigned_id_for_peer);
-    std::cout << "Segment " << rps.segment_id << "/"
-              << fs.get_segment_count() - 1 << " received from client " << t.id
-              << " share id: " << rps.assigned_id_for_peer << std::endl;
-    fs.push_segment(rps);
-    std::cout << "Pushed segment to fs! " << std::endl;
-    Message m(MessageType::GET_SEGMENT);
-    // it is enough
-    if (fs.all_segments_asked()) {
-        return;
-    }
-    GetSegment gps;
-    gps.segment_id = fs.get_next_segment_id();
-    m << gps;
-    fs.start_timeout(rps.assigned_id_for_peer);
-    push_message(t.id, m);
+    reply(t, m);
 }
 
 void Client::handle_get_picture_segment(MessageWithOwner &t) {
@@ -232,13 +195,14 @@ void Client::handle_get_picture_segment(MessageWithOwner &t) {
         nsps.segment_id = gps.segment_id;
         Message m(MessageType::NO_SUCH_SEGMENT);
         m << nsps;
+        reply(t, m);
     } else {
         std::cout << "Giving the segment back to client " << t.id << std::endl;
         Message m(MessageType::RETURN_SEGMENT);
         rps.segment_id = gps.segment_id;
         rps.assigned_id_for_peer = assigned_peer_id;
         m << rps;
-        push_message(t.id, m);
+        reply(t, m);
     }
 }
 
@@ -266,24 +230,12 @@ void Client::handle_message(MessageWithOwner &t) {
     case MessageType::GET_TRACK_INFO:
         handle_get_track_info(t);
         break;
-    case MessageType::NO_SUCH_LYRICS:
-        handle_no_such_lyrics(t);
-        break;
     case MessageType::GET_LYRICS:
         handle_get_lyrics(t);
         break;
-    case MessageType::RETURN_LYRICS:
-        handle_return_lyrics(t);
-        break;
     case MessageType::PREPARE_FILE_SHARING:
         handle_prepare_picture_sharing(t);
         break;
-    case MessageType::PREPARED_FILE_SHARING:
-        handle_prepared_picture_sharing(t);
-        break;
-    case MessageType::RETURN_SEGMENT:
-        handle_return_picture_segment(t);
-        break;
     case MessageType::GET_SEGMENT:
         handle_get_picture_segment(t);
         break;
@@ -293,12 +245,24 @@ void Client::handle_message(MessageWithOwner &t) {
     case MessageType::RETURN_DATABASE:
         handle_return_database(t);
         break;
+    // answers to our requests go to the coroutine that is waiting for them
+    case MessageType::RETURN_LYRICS:
+    case MessageType::NO_SUCH_LYRICS:
+    case MessageType::PREPARED_FILE_SHARING:
+    case MessageType::RETURN_SEGMENT:
+    case MessageType::NO_SUCH_SEGMENT:
+        break;
+    // files are only asked for by path here, the hash does not matter
+    case MessageType::HELLO:
+        break;
     default:
         std::cout << "Message with unknown message type!" << std::endl;
     }
 }
 
-void Client::additional_cycle_hook() {
+void Client::additional_cycle_hook() { write_ready_segments(); }
+
+void Client::write_ready_segments() {
     // custom handler for writing a segment
     fs.try_writing_segment([this](const ReturnSegment &rps, bool end) {
         os.write(rps.body.data(), rps.body.size());
@@ -310,18 +274,6 @@ void Client::additional_cycle_hook() {
             }
         }
     });
-    // if some peer enters the waiting state
-    fs.if_idle([this](int assigned_peer_id) {
-        Message m(MessageType::GET_SEGMENT);
-        // it is enough
-        if (fs.all_segments_asked()) {
-            return;
-        }
-        GetSegment gps;
-        gps.segment_id = fs.get_next_segment_id();
-        m << gps;
-        push_message(fs.get_peer_id(assigned_peer_id), m);
-    });
 }
 
 void Client::start_file_sharing(const std::string &filename) {
@@ -358,7 +310,7 @@ void Client::handle_get_database(MessageWithOwner &t) {
               << std::endl;
     ReturnDatabase rd;
     Message m(MessageType::RETURN_DATABASE);
-    rd.tracks = s.read_all();
+    rd.tracks = s.read_all(PEER_TRACK_FIELDS);
     m << rd;
     push_message(t.id, m);
 }
@@ -371,3 +323,79 @@ void Client::handle_return_database(MessageWithOwner &t) {
         std::cout << t << std::endl;
     }
 }
+
+asio::awaitable<void> Client::fetch_lyrics(peer_id id, std::string filename) {
+    Message m(MessageType::GET_LYRICS);
+    m << GetLyrics{filename};
+    auto r = co_await request(id, m);
+    if (!r) {
+        std::cout << "Peer (" << id << ") did not answer." << std::endl;
+        co_return;
+    }
+    MessageWithOwner t{std::move(*r), id};
+    if (t.msg.header.type == MessageType::RETURN_LYRICS) {
+        handle_return_lyrics(t);
+    } else {
+        handle_no_such_lyrics(t);
+    }
+}
+
+asio::awaitable<void> Client::download_from_peer(peer_id id,
+                                                 PrepareFileSharing pfs) {
+    Message m(MessageType::PREPARE_FILE_SHARING);
+    m << pfs;
+    auto r = co_await request(id, m);
+    if (!r || r->header.type != MessageType::PREPARED_FILE_SHARING) {
+        std::cout << "Client " << id << " cannot send the file." << std::endl;
+        fs.die_peer(pfs.assigned_id_for_peer);
+        co_return;
+    }
+    // we know that the peer will engage in sharing that file
+    std::cout << "Client " << id << " is ready to send the file." << std::endl;
+    PreparedFileSharing pps;
+    *r >> pps;
+    fs.set_segment_count(pps.total_segments);
+    std::cout << "Assigned id is " << pps.assigned_id_for_peer << std::endl;
+    for (int i = 0; i < SEGMENT_WINDOW; i++) {
+        spawn(segment_worker(id, pps.assigned_id_for_peer));
+    }
+}
+
+asio::awaitable<void> Client::segment_worker(peer_id id, int assigned_id) {
+    asio::steady_timer wait(co_await asio::this_coro::executor);
+    while (!fs.is_peer_dead(assigned_id)) {
+        int segment_id = fs.next_segment_for(assigned_id);
+        if (segment_id == -1) {
+            // it is enough
+            if (fs.all_segments_received()) {
+                co_return;
+            }
+            // wait for the requests in flight, some may need to be retried
+            asio::error_code ec;
+            wait.expires_after(100ms);
+            co_await wait.async_wait(
+                asio::redirect_error(asio::use_awaitable, ec));
+            continue;
+        }
+        GetSegment gps;
+        gps.segment_id = segment_id;
+        gps.assigned_id_for_peer = assigned_id;
+        Message m(MessageType::GET_SEGMENT);
+        m << gps;
+        fs.segment_requested(assigned_id, segment_id);
+        auto r = co_await request(id, m, fs.get_timeout(assigned_id));
+        if (!r || r->header.type != MessageType::RETURN_SEGMENT) {
+            // another peer will ask for it
+            fs.segment_timed_out(assigned_id, segment_id);
+            continue;
+        }
+        ReturnSegment rps;
+        *r >> rps;
+        std::cout << "Segment " << rps.segment_id << "/"
+                  << fs.get_segment_count() - 1 << " received from client "
+                  << id << " share id: " << rps.assigned_id_for_peer
+                  << std::endl;
+        fs.push_segment(rps);
+        write_ready_segments();
+    }
+}
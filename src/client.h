@@ -31,14 +31,20 @@ class Client : public BaseClient {
     void handle_return_lyrics(MessageWithOwner &t);
     void handle_has_picture_file(MessageWithOwner &t);
     void handle_prepare_picture_sharing(MessageWithOwner &t);
-    void handle_prepared_picture_sharing(MessageWithOwner &t);
-    void handle_return_picture_segment(MessageWithOwner &t);
     void handle_get_picture_segment(MessageWithOwner &t);
     void handle_get_database(MessageWithOwner &t);
     void handle_return_database(MessageWithOwner &t);
 
+    // requests, these are coroutines so start them with spawn(...)
+    asio::awaitable<void> fetch_lyrics(peer_id id, std::string filename);
+    // asks for the file, then starts SEGMENT_WINDOW segment workers
+    asio::awaitable<void> download_from_peer(peer_id id,
+                                             PrepareFileSharing pfs);
+    asio::awaitable<void> segment_worker(peer_id id, int assigned_id);
+
     void cycle();
     void additional_cycle_hook();
+    void write_ready_segments();
     void start_file_sharing(const std::string &filename);
     FileSharing fs;
 
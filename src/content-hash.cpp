@@ -0,0 +1,75 @@
+#include "content-hash.h"
+#include "md5.h"
+#include "util.h"
+#include <algorithm>
+
+// only this file uses xxhash, so it is compiled in here instead of being
+// linked as a library
+#define XXH_INLINE_ALL
+#include <xxhash.h>
+
+std::string_view hash_name(HashAlgorithm a) {
+    switch (a) {
+    case HashAlgorithm::MD5:
+        return "md5";
+    case HashAlgorithm::XXH3_128:
+        return "xxh3-128";
+    }
+    return "???";
+}
+
+HashAlgorithm negotiate_hash(const std::vector<HashAlgorithm> &theirs) {
+    for (auto a : supported_hashes) {
+        if (std::find(theirs.begin(), theirs.end(), a) != theirs.end()) {
+            return a;
+        }
+    }
+    return HashAlgorithm::MD5;
+}
+
+class Md5Hash : public ContentHash {
+  public:
+    Md5Hash() { md5Init(&ctx); }
+    void update(const uint8_t *data, size_t size) override {
+        md5Update(&ctx, (uint8_t *)data, size);
+    }
+    std::string hex_digest() override {
+        md5Finalize(&ctx);
+        return to_hex_string(ctx.digest);
+    }
+
+  private:
+    MD5Context ctx;
+};
+
+// xxh3 picks the widest vector instructions the compiler targets (sse2 at
+// least on x86-64), and keeps up with memory bandwidth
+class Xxh3Hash : public ContentHash {
+  public:
+    Xxh3Hash() : state(XXH3_createState(), XXH3_freeState) {
+        XXH3_128bits_reset(state.get());
+    }
+    void update(const uint8_t *data, size_t size) override {
+        XXH3_128bits_update(state.get(), data, size);
+    }
+    std::string hex_digest() override {
+        // the canonical form is big endian, like the reference xxhsum prints
+        XXH128_canonical_t canonical;
+        XXH128_canonicalFromHash(&canonical, XXH3_128bits_digest(state.get()));
+        return to_hex_string(canonical.digest);
+    }
+
+  private:
+    // the state is large and wants 64 byte alignment, xxhash allocates it
+    std::unique_ptr<XXH3_state_t, decltype(&XXH3_freeState)> state;
+};
+
+std::unique_ptr<ContentHash> ContentHash::create(HashAlgorithm a) {
+    switch (a) {
+    case HashAlgorithm::MD5:
+        return std::make_unique<Md5Hash>();
+    case HashAlgorithm::XXH3_128:
+        return std::make_unique<Xxh3Hash>();
+    }
+    return nullptr;
+}
@@ -0,0 +1,51 @@
+#ifndef CONTENT_HASH_H
+#define CONTENT_HASH_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+ * the hashes a file's content can be identified by
+ * the values are sent to peers, never change one, add new ones at the end
+ */
+enum class HashAlgorithm : uint8_t {
+    // Track::checksum, what every version of the application speaks
+    MD5 = 1,
+    // Track::content_id, many times faster than md5 on the same data
+    XXH3_128 = 2,
+};
+
+// every algorithm this build can compute, the one it prefers first
+inline const std::vector<HashAlgorithm> supported_hashes = {
+    HashAlgorithm::XXH3_128, HashAlgorithm::MD5};
+
+std::string_view hash_name(HashAlgorithm a);
+
+// the algorithm to use with a peer that supports theirs: the first of
+// supported_hashes that they have too, MD5 if there is none
+// both sides get the same answer, so they don't have to agree on it again
+HashAlgorithm negotiate_hash(const std::vector<HashAlgorithm> &theirs);
+
+/*
+ * ContentHash: computes one hash of a stream of bytes, piece by piece
+ *
+ * auto h = ContentHash::create(HashAlgorithm::XXH3_128);
+ * h->update(data, size);
+ * h->update(more, more_size);
+ * std::string id = h->hex_digest();
+ */
+class ContentHash {
+  public:
+    static std::unique_ptr<ContentHash> create(HashAlgorithm a);
+    virtual ~ContentHash() = default;
+
+    virtual void update(const uint8_t *data, size_t size) = 0;
+    // the hash of everything given to update, as a lowercase hex string
+    // call it only once
+    virtual std::string hex_digest() = 0;
+};
+
+#endif
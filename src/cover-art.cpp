@@ -0,0 +1,176 @@
+#include "cover-art.h"
+#include <gdkmm/pixbufloader.h>
+#include <taglib/attachedpictureframe.h>
+#include <taglib/id3v2tag.h>
+#include <taglib/mp4coverart.h>
+#include <taglib/mp4file.h>
+#include <taglib/mp4tag.h>
+#include <taglib/mpegfile.h>
+
+bool has_cover_art(TagLib::File *file) {
+    if (auto mp3 = dynamic_cast<TagLib::MPEG::File *>(file)) {
+        return mp3->ID3v2Tag() &&
+               !mp3->ID3v2Tag()->frameList("APIC").isEmpty();
+    }
+    if (auto m4a = dynamic_cast<TagLib::MP4::File *>(file)) {
+        return m4a->tag() && m4a->tag()->contains("covr");
+    }
+    return false;
+}
+
+std::string read_cover_art(TagLib::File *file) {
+    if (auto mp3 = dynamic_cast<TagLib::MPEG::File *>(file)) {
+        if (!mp3->ID3v2Tag()) {
+            return "";
+        }
+        const TagLib::ID3v2::FrameList &frames =
+            mp3->ID3v2Tag()->frameList("APIC");
+        if (frames.isEmpty()) {
+            return "";
+        }
+        auto picture = (TagLib::ID3v2::AttachedPictureFrame *)frames.front();
+        return std::string(picture->picture().data(),
+                           picture->picture().size());
+    }
+    if (auto m4a = dynamic_cast<TagLib::MP4::File *>(file)) {
+        if (!m4a->tag() || !m4a->tag()->contains("covr")) {
+            return "";
+        }
+        TagLib::MP4::CoverArtList covers =
+            m4a->tag()->item("covr").toCoverArtList();
+        if (covers.isEmpty()) {
+            return "";
+        }
+        return std::string(covers.front().data().data(),
+                           covers.front().data().size());
+    }
+    return "";
+}
+
+std::string read_cover_art(const std::string &path,
+                           const std::string &extension) {
+    // without the audio properties, only the tags are needed
+    if (extension == ".mp3") {
+        TagLib::MPEG::File file(path.c_str(), false);
+        return read_cover_art(&file);
+    }
+    if (extension == ".m4a") {
+        TagLib::MP4::File file(path.c_str(), false);
+        return read_cover_art(&file);
+    }
+    return "";
+}
+
+Glib::RefPtr<Gdk::Pixbuf> decode_cover_art(const std::string &bytes,
+                                           int size) {
+    if (bytes.empty()) {
+        return {};
+    }
+    auto loader = Gdk::PixbufLoader::create();
+    // told before anything is decoded, so the decoder can scale as it goes
+    Gdk::PixbufLoader *l = loader.get();
+    loader->signal_size_prepared().connect(
+        [l, size](int width, int height) { l->set_size(size, size); });
+    try {
+        loader->write((const guint8 *)bytes.data(), bytes.size());
+        loader->close();
+    } catch (const Glib::Error &) {
+        return {};
+    }
+    return loader->get_pixbuf();
+}
+
+CoverArtCache::CoverArtCache(int size, size_t bytes)
+    : size(size), bytes(bytes), thumbnails(bytes), thread([this]() { run(); }) {}
+
+CoverArtCache::~CoverArtCache() {
+    {
+        std::lock_guard lock(mux);
+        stopping = true;
+    }
+    cv.notify_all();
+    thread.join();
+}
+
+Glib::RefPtr<Gdk::Pixbuf> CoverArtCache::get(const std::string &path,
+                                             const std::string &extension) {
+    {
+        std::lock_guard lock(mux);
+        if (auto *thumbnail = thumbnails.get(path)) {
+            return *thumbnail;
+        }
+    }
+    return load(path, extension);
+}
+
+void CoverArtCache::prefetch(const std::string &path,
+                             const std::string &extension) {
+    {
+        std::lock_guard lock(mux);
+        if (!fits() || thumbnails.contains(path)) {
+            return;
+        }
+        queue.emplace_back(path, extension);
+    }
+    cv.notify_all();
+}
+
+void CoverArtCache::put(const std::string &path,
+                        Glib::RefPtr<Gdk::Pixbuf> thumbnail) {
+    std::lock_guard lock(mux);
+    if (!thumbnail) {
+        thumbnails.erase(path);
+        return;
+    }
+    size_t bytes = thumbnail->get_rowstride() * thumbnail->get_height();
+    thumbnails.put(path, std::move(thumbnail), bytes);
+}
+
+bool CoverArtCache::has_room() {
+    std::lock_guard lock(mux);
+    return fits();
+}
+
+void CoverArtCache::cancel() {
+    std::lock_guard lock(mux);
+    queue.clear();
+}
+
+Glib::RefPtr<Gdk::Pixbuf> CoverArtCache::load(const std::string &path,
+                                              const std::string &extension) {
+    Glib::RefPtr<Gdk::Pixbuf> thumbnail =
+        decode_cover_art(read_cover_art(path, extension), size);
+    if (thumbnail) {
+        put(path, thumbnail);
+    }
+    return thumbnail;
+}
+
+bool CoverArtCache::fits() const {
+    // 4 bytes a pixel at most
+    return thumbnails.cost() + size_t(size) * size * 4 <= bytes;
+}
+
+void CoverArtCache::run() {
+    while (true) {
+        std::pair<std::string, std::string> file;
+        {
+            std::unique_lock lock(mux);
+            cv.wait(lock, [this]() { return stopping || !queue.empty(); });
+            if (stopping) {
+                return;
+            }
+            // the ones that did fit are not pushed out for the rest
+            if (!fits()) {
+                queue.clear();
+                continue;
+            }
+            file = std::move(queue.front());
+            queue.pop_front();
+            if (thumbnails.contains(file.first)) {
+                continue;
+            }
+        }
+        load(file.first, file.second);
+    }
+}
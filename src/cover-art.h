@@ -0,0 +1,86 @@
+#ifndef COVER_ART_H
+#define COVER_ART_H
+
+#include "lru-cache.h"
+#include <condition_variable>
+#include <deque>
+#include <gdkmm/pixbuf.h>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// how big the cover art next to the player is
+#define COVER_ART_THUMBNAIL 100
+// how much memory the thumbnails can take, about 500 of them
+#define COVER_ART_CACHE_BYTES (16 << 20)
+
+namespace TagLib {
+class File;
+}
+
+// the picture embedded in an audio file, empty if it has none
+// only mp3 (ID3v2 APIC) and m4a (covr) files are looked at
+std::string read_cover_art(const std::string &path,
+                           const std::string &extension);
+// the same, from a file that is open already
+std::string read_cover_art(TagLib::File *file);
+// whether it has one, without copying it
+bool has_cover_art(TagLib::File *file);
+// picture bytes decoded straight to size x size, without a file in between
+// (a jpeg is decoded at a smaller scale to begin with)
+// nullptr if they are not a picture
+Glib::RefPtr<Gdk::Pixbuf> decode_cover_art(const std::string &bytes,
+                                           int size);
+
+/*
+ * CoverArtCache: the thumbnails of the tracks' cover art, by file
+ *
+ * get decodes the thumbnails it doesn't have right away, and keeps them.
+ * prefetch has them decoded on the cache's own thread, so they are there by
+ * the time they are asked for. It stops when the cache is full, the ones
+ * that are used more are not pushed out for ones that may never be.
+ *
+ * CoverArtCache covers;
+ * // while scanning
+ * covers.prefetch(path, ".mp3");
+ * // when the track changes
+ * image->set(covers.get(path, ".mp3"));
+ */
+class CoverArtCache {
+  public:
+    CoverArtCache(int size = COVER_ART_THUMBNAIL,
+                  size_t bytes = COVER_ART_CACHE_BYTES);
+    // stops the thread, whatever is still to be prefetched is not
+    ~CoverArtCache();
+
+    // the thumbnail of the file, nullptr if it has no cover art
+    Glib::RefPtr<Gdk::Pixbuf> get(const std::string &path,
+                                  const std::string &extension);
+    void prefetch(const std::string &path, const std::string &extension);
+    // the file's thumbnail, decoded by someone who had the file open anyway
+    // (see read_file_tags), nullptr if it has none anymore
+    void put(const std::string &path, Glib::RefPtr<Gdk::Pixbuf> thumbnail);
+    // another thumbnail fits without pushing one out
+    bool has_room();
+    // drops what is still to be prefetched
+    void cancel();
+
+  private:
+    int size;
+    size_t bytes;
+    std::mutex mux;
+    std::condition_variable cv;
+    bool stopping = false;
+    // path and extension of the files to prefetch
+    std::deque<std::pair<std::string, std::string>> queue;
+    LruCache<std::string, Glib::RefPtr<Gdk::Pixbuf>> thumbnails;
+    std::thread thread;
+    void run();
+    // has_room, with mux held
+    bool fits() const;
+    // decodes the thumbnail and keeps it
+    Glib::RefPtr<Gdk::Pixbuf> load(const std::string &path,
+                                   const std::string &extension);
+};
+
+#endif
@@ -0,0 +1,214 @@
+#include "file-hasher.h"
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+
+FileHasher::FileHasher(int threads) : threads(threads) {
+    if (this->threads <= 0) {
+        this->threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    // every worker has md5Lanes() files open, each with a buffer. whole
+    // pages, for aligned_alloc and so the kernel can copy whole pages
+    size_t share = HASH_BUFFER_BUDGET / ((size_t)md5Lanes() * this->threads);
+    read_size = std::max<size_t>(
+        4096, std::min<size_t>(HASH_READ_SIZE, share / 4096 * 4096));
+}
+
+std::vector<std::optional<FileDigest>>
+FileHasher::hash_files(const std::vector<std::string> &paths,
+                       size_t read_size) {
+    struct File {
+        FILE *fp = nullptr;
+        std::unique_ptr<uint8_t, decltype(&free)> buffer{nullptr, free};
+        // how much of buffer the last read filled, and how much of that md5
+        // has had so far
+        size_t read = 0;
+        size_t hashed = 0;
+        MD5Context md5;
+        std::unique_ptr<ContentHash> xxh3;
+        bool done = false;
+        bool failed = false;
+    };
+    std::vector<File> files(paths.size());
+    for (size_t i = 0; i < paths.size(); i++) {
+        auto &f = files[i];
+        // binary mode, otherwise some platforms translate line endings
+        f.fp = fopen(paths[i].c_str(), "rb");
+        if (!f.fp) {
+            f.done = f.failed = true;
+            continue;
+        }
+        // the chunks are already large, stdio's own buffer would only add a
+        // copy
+        setvbuf(f.fp, nullptr, _IONBF, 0);
+        // page aligned, so the kernel can copy whole pages
+        f.buffer.reset((uint8_t *)aligned_alloc(4096, read_size));
+        if (!f.buffer) {
+            fclose(f.fp);
+            f.fp = nullptr;
+            f.done = f.failed = true;
+            continue;
+        }
+        md5Init(&f.md5);
+        f.xxh3 = ContentHash::create(HashAlgorithm::XXH3_128);
+    }
+
+    while (true) {
+        // the next chunk of every file that is not finished
+        std::vector<File *> reading;
+        for (auto &f : files) {
+            if (f.done) {
+                continue;
+            }
+            f.read = fread(f.buffer.get(), 1, read_size, f.fp);
+            f.hashed = 0;
+            f.xxh3->update(f.buffer.get(), f.read);
+            // a short read is the end of the file, or an error
+            if (f.read < read_size) {
+                f.done = true;
+                f.failed = ferror(f.fp);
+            }
+            reading.push_back(&f);
+        }
+        if (reading.empty()) {
+            break;
+        }
+        // md5 the chunks side by side, each round as many whole blocks as the
+        // shortest one has left, so every stream stays on a block boundary.
+        // the last few bytes of a file go on their own
+        while (true) {
+            std::vector<MD5Context *> ctxs;
+            std::vector<uint8_t *> inputs;
+            size_t common = read_size;
+            for (auto f : reading) {
+                size_t left = f->read - f->hashed;
+                if (left > 0 && left < 64) {
+                    md5Update(&f->md5, f->buffer.get() + f->hashed, left);
+                    f->hashed = f->read;
+                } else if (left > 0) {
+                    common = std::min(common, left - left % 64);
+                    ctxs.push_back(&f->md5);
+                    inputs.push_back(f->buffer.get() + f->hashed);
+                }
+            }
+            if (ctxs.empty()) {
+                break;
+            }
+            md5UpdateMany(ctxs.data(), inputs.data(), common, ctxs.size());
+            for (auto f : reading) {
+                if (f->read - f->hashed >= 64) {
+                    f->hashed += common;
+                }
+            }
+        }
+    }
+
+    std::vector<std::optional<FileDigest>> digests;
+    for (auto &f : files) {
+        if (f.fp) {
+            fclose(f.fp);
+        }
+        if (f.failed) {
+            digests.push_back(std::nullopt);
+            continue;
+        }
+        md5Finalize(&f.md5);
+        digests.push_back(
+            FileDigest{to_hex_string(f.md5.digest), f.xxh3->hex_digest()});
+    }
+    return digests;
+}
+
+bool FileHasher::cached(const std::string &path, Stamp &stamp, FileDigest &d) {
+    // one stat instead of one per field, it is done for every file of a scan
+    FileStamp now;
+    get_file_stamp(path, now);
+    stamp = {now.size, now.mtime};
+    std::lock_guard<std::mutex> lock(cache_mux);
+    auto it = cache.find(path);
+    if (it != cache.end() && it->second.stamp == stamp) {
+        d = it->second.digest;
+        return true;
+    }
+    return false;
+}
+
+void FileHasher::remember(const std::string &path, const Stamp &stamp,
+                          const FileDigest &d) {
+    std::lock_guard<std::mutex> lock(cache_mux);
+    cache[path] = {stamp, d};
+}
+
+FileDigest FileHasher::digest(const std::string &path) {
+    Stamp stamp;
+    FileDigest d;
+    if (cached(path, stamp, d)) {
+        return d;
+    }
+    auto hashed = hash_files({path}, read_size);
+    if (!hashed[0]) {
+        return {};
+    }
+    remember(path, stamp, *hashed[0]);
+    return *hashed[0];
+}
+
+std::vector<FileDigest>
+FileHasher::digests(const std::vector<std::string> &paths) {
+    std::vector<FileDigest> results(paths.size());
+    std::vector<Stamp> stamps(paths.size());
+    // the files that have to be read
+    std::vector<size_t> missing;
+    for (size_t i = 0; i < paths.size(); i++) {
+        if (!cached(paths[i], stamps[i], results[i])) {
+            missing.push_back(i);
+        }
+    }
+    // each worker takes the next few files nobody has taken yet, as many as
+    // md5 can hash side by side
+    size_t batch = md5Lanes();
+    std::atomic<size_t> next = 0;
+    auto work = [&]() {
+        for (size_t first = next.fetch_add(batch); first < missing.size();
+             first = next.fetch_add(batch)) {
+            size_t end = std::min(first + batch, missing.size());
+            std::vector<std::string> some;
+            for (size_t i = first; i < end; i++) {
+                some.push_back(paths[missing[i]]);
+            }
+            auto hashed = hash_files(some, read_size);
+            for (size_t i = first; i < end; i++) {
+                size_t at = missing[i];
+                if (hashed[i - first]) {
+                    results[at] = *hashed[i - first];
+                    remember(paths[at], stamps[at], results[at]);
+                }
+            }
+        }
+    };
+    int count = std::min<size_t>(threads, (missing.size() + batch - 1) / batch);
+    std::vector<std::thread> workers;
+    for (int i = 1; i < count; i++) {
+        workers.emplace_back(work);
+    }
+    // this thread is one of the workers too
+    work();
+    for (auto &w : workers) {
+        w.join();
+    }
+    return results;
+}
+
+std::string FileHasher::checksum(const std::string &path) {
+    return digest(path).checksum;
+}
+
+std::vector<std::string>
+FileHasher::checksums(const std::vector<std::string> &paths) {
+    std::vector<std::string> sums;
+    sums.reserve(paths.size());
+    for (auto &d : digests(paths)) {
+        sums.push_back(std::move(d.checksum));
+    }
+    return sums;
+}
@@ -0,0 +1,101 @@
+#ifndef FILE_HASHER_H
+#define FILE_HASHER_H
+
+#include "content-hash.h"
+#include "md5-multi.h"
+#include "util.h"
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+// how much of a file is read at once while hashing it
+#define HASH_READ_SIZE (1 << 20)
+// how much the workers of a FileHasher read into at once, all together.
+// with many cores and md5 lanes, each file is read in smaller chunks
+#define HASH_BUFFER_BUDGET (64 << 20)
+
+/*
+ * FileDigest: what a file's content is known by
+ */
+struct FileDigest {
+    // md5, for Track::checksum
+    std::string checksum;
+    // xxh3-128, for Track::content_id
+    std::string content_id;
+};
+
+/*
+ * FileHasher: computes the checksums of audio files
+ *
+ * Files are read in large binary chunks, and a batch of files is spread over
+ * a number of worker threads, so a library scan is limited by the disk and
+ * not by one core running md5.
+ * Each worker also reads md5Lanes() files at a time and runs their md5s side
+ * by side in the vector registers (see md5-multi.h).
+ * Every hash in FileDigest is computed in the same pass over the file.
+ *
+ * Every result is remembered together with the size and modification time the
+ * file had, so asking for the same unchanged file again does not read it.
+ *
+ * FileHasher h;
+ * // hash a whole library at once, the results are in the same order
+ * std::vector<std::string> sums = h.checksums(paths);
+ * // later, this is answered from the cache
+ * std::string sum = h.checksum(paths[0]);
+ */
+class FileHasher {
+  public:
+    // threads: how many workers hash files at the same time, 0 means one per
+    // core
+    FileHasher(int threads = 0);
+
+    // the md5 of the file as a hex string, "" if it can't be read
+    std::string checksum(const std::string &path);
+
+    // checksum for every path, using all the worker threads
+    std::vector<std::string> checksums(const std::vector<std::string> &paths);
+
+    // every hash of the file, empty strings if it can't be read
+    FileDigest digest(const std::string &path);
+    std::vector<FileDigest> digests(const std::vector<std::string> &paths);
+
+    int get_threads() { return threads; }
+    // how much of each file a worker reads at once
+    size_t get_read_size() { return read_size; }
+
+  private:
+    int threads;
+    // HASH_READ_SIZE, or less so every buffer fits in HASH_BUFFER_BUDGET
+    size_t read_size;
+
+    // what a file looked like when it was hashed
+    struct Stamp {
+        uintmax_t size;
+        int64_t mtime;
+        friend bool operator==(const Stamp &, const Stamp &) = default;
+    };
+    struct CachedDigest {
+        Stamp stamp;
+        FileDigest digest;
+    };
+    std::mutex cache_mux;
+    std::map<std::string, CachedDigest> cache;
+
+    // the cached digest of path if it did not change since, stamp is filled in
+    // for remember
+    bool cached(const std::string &path, Stamp &stamp, FileDigest &d);
+    void remember(const std::string &path, const Stamp &stamp,
+                  const FileDigest &d);
+
+    // reads every file once and hashes them together, nullopt for the ones
+    // that can't be read. at most md5Lanes() files are worth giving at once
+    // read_size: a multiple of 4096
+    static std::vector<std::optional<FileDigest>>
+    hash_files(const std::vector<std::string> &paths, size_t read_size);
+};
+
+#endif
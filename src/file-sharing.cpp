@@ -1,172 +1,210 @@
 #include "file-sharing.h"
+#include <algorithm>
+#include <cmath>
 
-FileSharing::FileSharing() {
-    pause = false;
-    worker = std::thread([this]() { ctx.run(); });
-}
-
-FileSharing::~FileSharing() {
-    if (worker.joinable()) {
-        worker.join();
-    }
-}
+FileSharing::FileSharing(Clock now) : now(now) {}
 
-void FileSharing::write_segment(const ReturnSegment &rps) {}
+FileSharing::~FileSharing() {}
 
 void FileSharing::try_writing_segment(
     std::function<void(const ReturnSegment &, bool)> write_segment) {
-    if (pause || hard_pause) {
+    std::scoped_lock l(mux);
+    if (hard_pause) {
         return;
     }
-    bool all_empty = true;
-    // try to write two segments if possible
-    for (int i = 0; i < 2; i++) {
-        // traverse through the list to see if there are in-order segments
-        // if yes write it to the output stream
-        for (auto &q : queue_buffer) {
-            if (q.empty()) {
-                continue;
-            }
-            all_empty = false;
-            auto &rps = q.front();
-            // std::cout << "RPS: " << rps.segment_id
-            //           << " | CWI: " << current_writing_id << std::endl;
-            if (rps.segment_id == current_writing_id) {
-                std::cout << "Writing " << rps.body.size()
-                          << " bytes to the file (" << current_byte << " to "
-                          << current_byte + rps.body.size() << ")"
-                          << " segment: " << rps.segment_id << "/"
-                          << total_segment_count - 1 << std::endl;
-                current_byte += rps.body.size();
-                bool end = ++current_writing_id >= total_segment_count;
-                write_segment(rps, end);
-                queue_current_bytes -= bytes_per_chunk;
-                q.pop();
-                // all requests needed are made, exit now
-                if (end) {
-                    return;
-                }
-            } else if (rps.segment_id < current_writing_id) {
-                // if current_writing_id is over already, drop that segment
-                // without writing
-                q.pop();
-            } else if (rps.segment_id > current_writing_id + status.size()) {
-                // also pop very high segment numbers since they block the
-                // queue!
-                q.pop();
-            }
-        }
-        if (all_empty) {
-            break;
+    while (ring.ready()) {
+        ReturnSegment rps = ring.pop();
+        std::cout << "Writing " << rps.body.size() << " bytes to the file ("
+                  << current_byte << " to " << current_byte + rps.body.size()
+                  << ") segment: " << rps.segment_id << "/"
+                  << total_segment_count - 1 << std::endl;
+        current_byte += rps.body.size();
+        bool end = ring.next_id() >= total_segment_count;
+        queue_current_bytes -= bytes_per_chunk;
+        write_segment(rps, end);
+        // all requests needed are made, exit now
+        if (end) {
+            return;
         }
-        all_empty = true;
     }
 }
 
-int FileSharing::get_next_assigned_id() { return ++current_assigned_id; }
+int FileSharing::get_next_assigned_id() {
+    std::scoped_lock l(mux);
+    return ++current_assigned_id;
+}
 
 void FileSharing::reset_sharing_file() {
+    std::scoped_lock l(mux);
     current_segment_id = -1;
     total_segment_count = 0;
     current_byte = 0;
     current_assigned_id = 0;
-    current_writing_id = 0;
     peer_map.clear();
     status.clear();
-    timeout_timers.clear();
-    pause = false;
+    timing.clear();
+    outstanding.clear();
+    retries.clear();
+    timed_out.clear();
     bytes_per_chunk = 0;
     queue_current_bytes = 0;
     total_bytes = 0;
+    byte_rate = 0;
+    player_buffered = 0;
     hard_pause = false;
     // also drop all the previous buffers
-    queue_buffer = std::vector<std::queue<ReturnSegment>>();
+    ring.reset();
     // open_file_for_writing();
 }
 
-bool FileSharing::paused() { return pause; }
-
 void FileSharing::push_segment(ReturnSegment rps) {
+    std::scoped_lock l(mux);
     if (!is_in_range(rps.assigned_id_for_peer)) {
         return;
     }
-    queue_current_bytes += bytes_per_chunk;
-    queue_buffer[rps.assigned_id_for_peer].push(rps);
+    // the id comes from the peer: one that is not in the file, or was never
+    // given out (so it is beyond the credit), would only make the ring grow
+    if (rps.segment_id < 0 || rps.segment_id >= total_segment_count ||
+        rps.segment_id > current_segment_id) {
+        return;
+    }
+    auto it = outstanding.find(rps.segment_id);
+    if (it != outstanding.end() &&
+        it->second.assigned_id == rps.assigned_id_for_peer) {
+        if (!it->second.retried) {
+            add_rtt_sample(rps.assigned_id_for_peer,
+                           std::chrono::duration_cast<std::chrono::milliseconds>(
+                               now() - it->second.sent_at));
+        }
+        outstanding.erase(it);
+    }
+    // the peer answered, only consecutive failures count
+    status[rps.assigned_id_for_peer] &= ~0b11;
+    // written already, or another peer sent it first
+    if (ring.put(std::move(rps))) {
+        queue_current_bytes += bytes_per_chunk;
+    }
 }
-int FileSharing::get_next_segment_id() { return ++current_segment_id; }
-
 bool FileSharing::all_segments_asked() {
-    return current_segment_id >= total_segment_count - 1;
+    std::scoped_lock l(mux);
+    return current_segment_id >= total_segment_count - 1 && retries.empty();
 }
 
-int FileSharing::get_segment_count() { return total_segment_count; }
+bool FileSharing::all_segments_received() {
+    std::scoped_lock l(mux);
+    return all_segments_asked() && outstanding.empty();
+}
 
-void FileSharing::set_segment_count(int t) { total_segment_count = t; }
+int FileSharing::get_segment_count() {
+    std::scoped_lock l(mux);
+    return total_segment_count;
+}
+
+void FileSharing::set_segment_count(int t) {
+    std::scoped_lock l(mux);
+    total_segment_count = t;
+}
 
 int FileSharing::new_peer(peer_id id) {
-    queue_buffer.push_back(std::queue<ReturnSegment>());
+    std::scoped_lock l(mux);
     status.push_back(0);
-    timeout_timers.push_back(asio::high_resolution_timer(ctx));
+    timing.push_back(PeerTiming());
     peer_map.push_back(id);
     return current_assigned_id++;
 }
 
-void FileSharing::start_timeout(int assigned_id) {
-    if (!is_in_range(assigned_id)) {
-        return;
+int FileSharing::next_segment_for(int assigned_id) {
+    std::scoped_lock l(mux);
+    for (auto it = retries.begin(); it != retries.end(); it++) {
+        bool others_alive = false;
+        for (int i = 0; i < status.size(); i++) {
+            if (i != it->from && !is_dead(status[i])) {
+                others_alive = true;
+                break;
+            }
+        }
+        if (it->from != assigned_id || !others_alive) {
+            int segment_id = it->segment_id;
+            retries.erase(it);
+            return segment_id;
+        }
     }
-    // try to wait for 10s
-    // if nothing is returned set the waiting bit to be true
-    timeout_timers[assigned_id].expires_from_now(10s);
-    timeout_timers[assigned_id].async_wait([&](asio::error_code ec) {
-        status[assigned_id] = increment_failure(status[assigned_id]);
-        // don't have this segment, it is over
-        current_writing_id++;
-    });
-}
-void FileSharing::end_timeout(int assigned_id) {
-    if (!is_in_range(assigned_id)) {
-        return;
+    if (current_segment_id >= total_segment_count - 1 || !has_credit()) {
+        return -1;
     }
-    timeout_timers[assigned_id].cancel();
+    return ++current_segment_id;
+}
+
+void FileSharing::segment_requested(int assigned_id, int segment_id) {
+    std::scoped_lock l(mux);
+    outstanding[segment_id] = OutstandingSegment{
+        .assigned_id = assigned_id,
+        .sent_at = now(),
+        .retried = timed_out.count(segment_id) > 0,
+    };
 }
 
-void FileSharing::if_idle(std::function<void(int)> handler) {
-    // don't do anything if paused
-    if (pause || hard_pause) {
+void FileSharing::segment_timed_out(int assigned_id, int segment_id) {
+    std::scoped_lock l(mux);
+    if (!is_in_range(assigned_id)) {
         return;
     }
-    for (int i = 0; i < status.size(); i++) {
-        // don't ask dead peers and those that are busy
-        if (!is_peer_dead(i) && is_peer_idle(i)) {
-            handler(i);
-            unset_peer_idle(i);
-        }
+    outstanding.erase(segment_id);
+    // it is already written (or skipped), no need to ask again
+    if (segment_id < ring.next_id()) {
+        return;
     }
+    status[assigned_id] = increment_failure(status[assigned_id]);
+    // the peer is slower than we thought, wait longer next time
+    timing[assigned_id].rto = std::min<std::chrono::milliseconds>(
+        timing[assigned_id].rto * 2, MAX_RTO);
+    retries.push_back(RetrySegment{segment_id, assigned_id});
+    timed_out.insert(segment_id);
 }
 
-int FileSharing::get_peer_id(int assigned_id) { return peer_map[assigned_id]; }
+std::chrono::milliseconds FileSharing::get_timeout(int assigned_id) {
+    std::scoped_lock l(mux);
+    if (!is_in_range(assigned_id)) {
+        return INITIAL_RTO;
+    }
+    return timing[assigned_id].rto;
+}
 
-void FileSharing::pause_writing() {
-    pause = true;
-    for (int i = 0; i < status.size(); i++) {
-        timeout_timers[i].cancel();
-        set_peer_idle(i);
+void FileSharing::add_rtt_sample(int assigned_id,
+                                 std::chrono::milliseconds rtt) {
+    auto &t = timing[assigned_id];
+    double r = rtt.count();
+    if (!t.has_sample) {
+        t.srtt = r;
+        t.rttvar = r / 2;
+        t.has_sample = true;
+    } else {
+        // rttvar first, it uses the old srtt
+        t.rttvar = 0.75 * t.rttvar + 0.25 * std::abs(t.srtt - r);
+        t.srtt = 0.875 * t.srtt + 0.125 * r;
     }
+    auto rto = std::chrono::milliseconds((long long)(t.srtt + 4 * t.rttvar));
+    t.rto = std::clamp<std::chrono::milliseconds>(rto, MIN_RTO, MAX_RTO);
+}
+
+int FileSharing::get_peer_id(int assigned_id) {
+    std::scoped_lock l(mux);
+    return peer_map[assigned_id];
 }
 
 void FileSharing::must_pause() {
+    std::scoped_lock l(mux);
     // no matter what you must pause sharing!!
     hard_pause = true;
     for (int i = 0; i < status.size(); i++) {
-        timeout_timers[i].cancel();
         set_peer_idle(i);
     }
 }
 
-void FileSharing::stop_must_pause() { hard_pause = false; }
-
-void FileSharing::resume_writing() { pause = false; }
+void FileSharing::stop_must_pause() {
+    std::scoped_lock l(mux);
+    hard_pause = false;
+}
 
 uint8_t FileSharing::increment_failure(uint8_t state) {
     uint8_t original_failure = state & 0b11;
@@ -187,24 +225,28 @@ bool FileSharing::is_dead(uint8_t state) { return (state & 0b1000) != 0; }
 bool FileSharing::is_idle(uint8_t state) { return (state & 0b100) != 0; }
 
 void FileSharing::increment_peer_failure(int assigned_id) {
+    std::scoped_lock l(mux);
     if (!is_in_range(assigned_id)) {
         return;
     }
     status[assigned_id] = increment_failure(status[assigned_id]);
 }
 void FileSharing::set_peer_idle(int assigned_id) {
+    std::scoped_lock l(mux);
     if (!is_in_range(assigned_id)) {
         return;
     }
     status[assigned_id] = set_idle(status[assigned_id]);
 }
 void FileSharing::unset_peer_idle(int assigned_id) {
+    std::scoped_lock l(mux);
     if (!is_in_range(assigned_id)) {
         return;
     }
     status[assigned_id] = unset_idle(status[assigned_id]);
 }
 void FileSharing::die_peer(int assigned_id) {
+    std::scoped_lock l(mux);
     if (!is_in_range(assigned_id)) {
         return;
     }
@@ -212,6 +254,7 @@ void FileSharing::die_peer(int assigned_id) {
 }
 
 bool FileSharing::is_peer_dead(int assigned_id) {
+    std::scoped_lock l(mux);
     if (!is_in_range(assigned_id)) {
         return false;
     }
@@ -219,6 +262,7 @@ bool FileSharing::is_peer_dead(int assigned_id) {
 }
 
 bool FileSharing::is_peer_idle(int assigned_id) {
+    std::scoped_lock l(mux);
     if (!is_in_range(assigned_id)) {
         return false;
     }
@@ -229,22 +273,33 @@ bool FileSharing::is_in_range(int assigned_id) {
     return assigned_id > -1 && assigned_id < current_assigned_id;
 }
 
-void FileSharing::should_pause() {
-    if (total_bytes == 0 || hard_pause) {
-        return;
-    }
-    // std::cout << "QCB: " << queue_current_bytes
-    //           << " | TB: " << total_bytes * 0.5 << " ("
-    //           << (double)queue_current_bytes / total_bytes * 100 << "%)"
-    //           << std::endl;
-    if ((double)queue_current_bytes > total_bytes * 0.5) {
-        pause_writing();
-    } else {
-        resume_writing();
+void FileSharing::set_file_info(int b, int t, int duration) {
+    std::scoped_lock l(mux);
+    bytes_per_chunk = b;
+    total_bytes = t;
+    byte_rate = duration > 0 ? t / (duration / 1000.0) : 0;
+}
+
+void FileSharing::set_player_buffered(std::size_t bytes) {
+    std::scoped_lock l(mux);
+    player_buffered = bytes;
+}
+
+std::size_t FileSharing::get_credit() {
+    std::scoped_lock l(mux);
+    std::size_t credit = UNKNOWN_RATE_BUFFER_BYTES;
+    if (byte_rate > 0) {
+        credit = std::min<std::size_t>(BUFFER_AHEAD_SECONDS * byte_rate,
+                                       MAX_BUFFER_BYTES);
     }
+    // always leave room for a full window, or a low bitrate file would be
+    // asked one segment at a time
+    return std::max<std::size_t>(credit, SEGMENT_WINDOW * bytes_per_chunk);
 }
 
-void FileSharing::set_file_info(int b, int t) {
-    bytes_per_chunk = b;
-    total_bytes = t;
+bool FileSharing::has_credit() {
+    std::scoped_lock l(mux);
+    std::size_t in_use = player_buffered + queue_current_bytes +
+                         outstanding.size() * bytes_per_chunk;
+    return in_use + bytes_per_chunk <= get_credit();
 }
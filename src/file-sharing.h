@@ -2,38 +2,109 @@
 #define PICTURE_SHARING_H
 
 #include "message-type.h"
-#include <asio.hpp>
+#include "segment-ring.h"
+#include <chrono>
+#include <deque>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <map>
+#include <mutex>
 #include <queue>
+#include <set>
 #include <vector>
 
 using namespace std::literals;
 
+// how many GET_SEGMENT requests can be in flight for one peer
+#define SEGMENT_WINDOW 4
+
+// flow control: how much audio to keep ahead of the playhead
+#define BUFFER_AHEAD_SECONDS 10
+// never buffer more than this, no matter how high the bitrate is
+#define MAX_BUFFER_BYTES (8 * 1024 * 1024)
+// used when the duration, hence the bitrate, of the file is unknown
+#define UNKNOWN_RATE_BUFFER_BYTES (2 * 1024 * 1024)
+
+// bounds of the retransmission timeout of a peer
+#define INITIAL_RTO 3s
+#define MIN_RTO 200ms
+#define MAX_RTO 10s
+
+/*
+ * Round trip time estimation of a peer (Jacobson/Karels, see RFC 6298)
+ * srtt is the smoothed round trip time, rttvar is its mean deviation, both in
+ * milliseconds
+ */
+struct PeerTiming {
+    double srtt = 0;
+    double rttvar = 0;
+    bool has_sample = false;
+    std::chrono::milliseconds rto = INITIAL_RTO;
+};
+
+/*
+ * A GET_SEGMENT request that has not been answered yet
+ */
+struct OutstandingSegment {
+    int assigned_id;
+    std::chrono::steady_clock::time_point sent_at;
+    // Karn's algorithm: the reply of a retried request is not a clean sample
+    bool retried;
+};
+
+/*
+ * A segment that timed out, waiting to be asked again
+ * from is the peer that failed to send it
+ */
+struct RetrySegment {
+    int segment_id;
+    int from;
+};
+
+/*
+ * The methods are called by the GUI thread and the client's io threads, so
+ * every public method locks mux first
+ */
 class FileSharing {
   public:
-    FileSharing();
+    typedef std::function<std::chrono::steady_clock::time_point()> Clock;
+    // the clock can be replaced in tests
+    FileSharing(Clock now = std::chrono::steady_clock::now);
     ~FileSharing();
     void reset_sharing_file();
 
-    // see if there is any segment in the queue, if there is
-    // call write_segment are written
+    // write every segment that is next in order, as soon as it is there
     void try_writing_segment(
         std::function<void(const ReturnSegment &, bool)> write_segment);
     int get_next_assigned_id();
 
+    // the segment has arrived, it also gives a round trip time sample
     void push_segment(ReturnSegment rps);
-    int get_next_segment_id();
+    // no new segments and no retries left to ask
     bool all_segments_asked();
+    // all asked and nothing is in flight anymore
+    bool all_segments_received();
     int get_segment_count();
     void set_segment_count(int t);
     int new_peer(peer_id id);
-    // give the peer 10 seconds to send the data back
-    void start_timeout(int assigned_id);
-    // if nothing, drop it
-    void end_timeout(int assigned_id);
-    // if the waiting flag is on for a peer, execute the handler
-    void if_idle(std::function<void(int)> handler);
+
+    /*
+     * the segment this peer should ask for next, -1 if there is none now
+     * segments that timed out come first, but a peer doesn't get back the
+     * segments it failed to send unless all other peers are dead
+     * new segments are only given out if there is credit left (see
+     * has_credit), retries are always given out since the player is waiting
+     * for them
+     */
+    int next_segment_for(int assigned_id);
+    // call right before the GET_SEGMENT request is sent
+    void segment_requested(int assigned_id, int segment_id);
+    // no answer within get_timeout, back off and ask someone else
+    void segment_timed_out(int assigned_id, int segment_id);
+    // how long to wait for a segment from that peer
+    std::chrono::milliseconds get_timeout(int assigned_id);
+
     int get_peer_id(int assigned_id);
 
     void increment_peer_failure(int assigned_id);
@@ -43,27 +114,33 @@ class FileSharing {
     bool is_peer_dead(int assigned_id);
     bool is_peer_idle(int assigned_id);
 
-    void pause_writing();
-    void resume_writing();
-    bool paused();
-    void set_file_info(int byte_per_chunk, int total_bytes);
-    void should_pause();
+    // duration is in milliseconds, 0 if unknown
+    void set_file_info(int byte_per_chunk, int total_bytes, int duration = 0);
+
+    /*
+     * Credit based flow control
+     * the credit is how many bytes may be in flight, in the queues here and
+     * in the player together: BUFFER_AHEAD_SECONDS of audio, at most
+     * MAX_BUFFER_BYTES, so the memory used does not depend on the file size
+     */
+    // how many bytes the player holds that it has not played yet
+    void set_player_buffered(std::size_t bytes);
+    std::size_t get_credit();
+    // is there room for one more segment
+    bool has_credit();
     void must_pause();
     void stop_must_pause();
 
   private:
-    std::vector<std::queue<ReturnSegment>> queue_buffer;
+    // segments arrive in any order, they leave the ring in order
+    SegmentRing ring;
     int current_segment_id = -1;
     int current_byte = 0;
-    int current_writing_id = 0;
     std::ofstream os;
     int current_assigned_id = 0;
-    int total_segment_count;
-    bool pause = false;
+    int total_segment_count = 0;
     bool hard_pause = false;
 
-    void write_segment(const ReturnSegment &rps);
-
     uint8_t increment_failure(uint8_t state);
     uint8_t set_idle(uint8_t state);
     uint8_t unset_idle(uint8_t state);
@@ -72,16 +149,27 @@ class FileSharing {
     bool is_idle(uint8_t state);
     bool is_in_range(int assigned_id);
 
+    // updates the estimation with a new round trip time
+    void add_rtt_sample(int assigned_id, std::chrono::milliseconds rtt);
+
     // this flag will be for peer if it is idling (the queue is full) or
     // the there is no response from the peer
     std::vector<uint8_t> status;
-    std::vector<asio::high_resolution_timer> timeout_timers;
-    asio::io_context ctx;
-    std::thread worker;
+    std::vector<PeerTiming> timing;
+    // by segment id
+    std::map<int, OutstandingSegment> outstanding;
+    std::deque<RetrySegment> retries;
+    // segments that timed out at least once
+    std::set<int> timed_out;
+    Clock now;
+    std::recursive_mutex mux;
     std::vector<int> peer_map;
-    int total_bytes;
-    int queue_current_bytes;
-    int bytes_per_chunk;
+    int total_bytes = 0;
+    int queue_current_bytes = 0;
+    int bytes_per_chunk = 0;
+    // bytes of audio per second, 0 if unknown
+    double byte_rate = 0;
+    std::size_t player_buffered = 0;
 };
 
 #endif
@@ -0,0 +1,30 @@
+#include "file-tags.h"
+#include "cover-art.h"
+#include <taglib/fileref.h>
+#include <taglib/tag.h>
+
+FileTags read_file_tags(const std::string &path, int thumbnail_size) {
+    FileTags tags;
+    TagLib::FileRef f(path.c_str());
+    if (f.isNull()) {
+        return tags;
+    }
+    if (TagLib::Tag *tag = f.tag()) {
+        tags.title = tag->title().to8Bit(true);
+        tags.artist = tag->artist().to8Bit(true);
+        tags.album = tag->album().to8Bit(true);
+    }
+    if (TagLib::AudioProperties *properties = f.audioProperties()) {
+        tags.duration = properties->lengthInMilliseconds();
+    }
+    // the picture is in the tags that were just read, the file is not
+    // opened again for it
+    if (thumbnail_size > 0) {
+        std::string picture = read_cover_art(f.file());
+        tags.cover_art = !picture.empty();
+        tags.thumbnail = decode_cover_art(picture, thumbnail_size);
+    } else {
+        tags.cover_art = has_cover_art(f.file());
+    }
+    return tags;
+}
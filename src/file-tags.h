@@ -0,0 +1,28 @@
+#ifndef FILE_TAGS_H
+#define FILE_TAGS_H
+
+#include <gdkmm/pixbuf.h>
+#include <string>
+
+/*
+ * what the music list needs from an audio file's tags, read in one go
+ * fields the file doesn't have are empty
+ */
+struct FileTags {
+    std::string title;
+    std::string artist;
+    std::string album;
+    // in milliseconds
+    int duration = 0;
+    bool cover_art = false;
+    // the cover art decoded to the size that was asked for, nullptr if the
+    // file has none or none was asked for
+    Glib::RefPtr<Gdk::Pixbuf> thumbnail;
+};
+
+// opens the file once, and reads everything in FileTags from it
+// thumbnail_size: how big the thumbnail is, 0 for none
+// it only touches the file, so workers can read many files at once
+FileTags read_file_tags(const std::string &path, int thumbnail_size = 0);
+
+#endif
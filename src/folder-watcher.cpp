@@ -0,0 +1,141 @@
+#include "folder-watcher.h"
+#include <chrono>
+#include <iostream>
+
+#ifdef __linux__
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+// everything that can make a file appear, change or disappear
+#define WATCHED_EVENTS                                                         \
+    (IN_CREATE | IN_CLOSE_WRITE | IN_ATTRIB | IN_DELETE | IN_MOVED_FROM |      \
+     IN_MOVED_TO)
+
+FolderWatcher::FolderWatcher(const std::filesystem::path &root, bool recursive,
+                             std::function<void()> changed)
+    : recursive(recursive), changed(std::move(changed)) {
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0 || pipe(stop_pipe) != 0) {
+        std::cerr << "can't watch " << root << " for changes" << std::endl;
+        if (fd >= 0) {
+            close(fd);
+            fd = -1;
+        }
+        return;
+    }
+    add_watches(root);
+    thread = std::thread([this]() { run(); });
+}
+
+FolderWatcher::~FolderWatcher() {
+    if (fd < 0) {
+        return;
+    }
+    char stop = 0;
+    if (write(stop_pipe[1], &stop, 1) != 1) {
+        std::cerr << "can't stop watching for changes" << std::endl;
+    }
+    thread.join();
+    close(stop_pipe[0]);
+    close(stop_pipe[1]);
+    close(fd);
+}
+
+void FolderWatcher::add_watches(const std::filesystem::path &folder) {
+    int wd = inotify_add_watch(fd, folder.c_str(), WATCHED_EVENTS | IN_ONLYDIR);
+    if (wd < 0) {
+        // most likely too many folders for fs.inotify.max_user_watches
+        std::cerr << "can't watch " << folder << " for changes" << std::endl;
+        return;
+    }
+    folders[wd] = folder;
+    if (!recursive) {
+        return;
+    }
+    std::error_code ec;
+    for (auto &entry : std::filesystem::directory_iterator(folder, ec)) {
+        if (entry.is_directory(ec) && !entry.is_symlink(ec)) {
+            add_watches(entry.path());
+        }
+    }
+}
+
+bool FolderWatcher::read_events() {
+    bool any = false;
+    // what inotify guarantees to be aligned for the events it writes
+    alignas(struct inotify_event) char buffer[4096];
+    while (true) {
+        ssize_t size = read(fd, buffer, sizeof(buffer));
+        if (size <= 0) {
+            return any;
+        }
+        for (char *p = buffer; p < buffer + size;) {
+            auto *event = (struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + event->len;
+            if (event->mask & IN_IGNORED) {
+                // the folder was removed, its watch went with it
+                folders.erase(event->wd);
+                continue;
+            }
+            if (event->mask & IN_Q_OVERFLOW) {
+                // some events were lost, but a rescan finds everything anyway
+                any = true;
+                continue;
+            }
+            auto folder = folders.find(event->wd);
+            if (folder == folders.end()) {
+                continue;
+            }
+            any = true;
+            // a folder that came in has to be watched too, along with
+            // whatever is in it already
+            if (recursive && (event->mask & IN_ISDIR) &&
+                (event->mask & (IN_CREATE | IN_MOVED_TO))) {
+                add_watches(folder->second / event->name);
+            }
+        }
+    }
+}
+
+void FolderWatcher::run() {
+    // when the last change was seen, while there is one to report
+    bool pending = false;
+    auto last_change = std::chrono::steady_clock::now();
+    while (true) {
+        int timeout = -1;
+        if (pending) {
+            auto waited = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - last_change);
+            timeout = std::max<int>(0, FOLDER_WATCH_DELAY_MS - waited.count());
+        }
+        struct pollfd fds[2] = {{fd, POLLIN, 0}, {stop_pipe[0], POLLIN, 0}};
+        int ready = poll(fds, 2, timeout);
+        if (fds[1].revents) {
+            return;
+        }
+        if (ready > 0 && (fds[0].revents & POLLIN)) {
+            if (read_events()) {
+                pending = true;
+                last_change = std::chrono::steady_clock::now();
+            }
+            continue;
+        }
+        if (ready == 0 && pending) {
+            pending = false;
+            changed();
+        }
+    }
+}
+
+#else
+
+// no inotify, nothing is ever reported
+FolderWatcher::FolderWatcher(const std::filesystem::path &root, bool recursive,
+                             std::function<void()> changed)
+    : recursive(recursive), changed(std::move(changed)) {}
+
+FolderWatcher::~FolderWatcher() {}
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef FOLDER_WATCHER_H
+#define FOLDER_WATCHER_H
+
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <thread>
+
+// how long the watcher waits for things to settle before it reports them, so
+// copying a whole album in is one change and not one per file
+#define FOLDER_WATCH_DELAY_MS 500
+
+/*
+ * FolderWatcher: tells when something changes in a folder
+ *
+ * Files that are added, written, removed or renamed in the folder (and in its
+ * subfolders, including the ones made later, if it is recursive) are noticed
+ * with inotify, without looking at the folder again. There is no way to ask
+ * what changed: the answer is a rescan, which only looks at what did (see
+ * LibraryScanner).
+ *
+ * FolderWatcher watcher(dir, true, [&]() { dispatcher.emit(); });
+ *
+ * changed is called from the watcher's own thread, once for every burst of
+ * changes. Where there is no inotify it is never called.
+ */
+class FolderWatcher {
+  public:
+    FolderWatcher(const std::filesystem::path &root, bool recursive,
+                  std::function<void()> changed);
+    // stops watching, changed is not called anymore once this returns
+    ~FolderWatcher();
+
+    // false if the folder can't be watched, then changes are only seen when
+    // the folder is scanned again
+    bool watching() { return fd >= 0; }
+
+  private:
+    bool recursive;
+    std::function<void()> changed;
+    // the inotify instance
+    int fd = -1;
+    // written to by the destructor, to wake the thread up
+    int stop_pipe[2] = {-1, -1};
+    // the folder each watch is on, only used by the thread after it started
+    std::map<int, std::filesystem::path> folders;
+
+    void add_watches(const std::filesystem::path &folder);
+    // reads the events there are, true if any of them is a change
+    bool read_events();
+    std::thread thread;
+    void run();
+};
+
+#endif
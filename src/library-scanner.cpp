@@ -0,0 +1,263 @@
+#include "library-scanner.h"
+#include <chrono>
+#include <unordered_map>
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         start)
+        .count();
+}
+
+// the stored track for file, nullptr if there is none
+// absolute: file's absolute path
+static const Track *
+find_stored(const std::unordered_map<std::string, Track> &known,
+            const std::filesystem::path &file, const std::string &absolute) {
+    // files are stored by their canonical path, which is the absolute path
+    // unless there is a link on the way. that one costs no system calls
+    auto it = known.find(absolute);
+    if (it != known.end()) {
+        return &it->second;
+    }
+    std::error_code ec;
+    std::filesystem::path abs = std::filesystem::canonical(file, ec);
+    if (ec) {
+        return nullptr;
+    }
+    it = known.find(abs.string());
+    return it == known.end() ? nullptr : &it->second;
+}
+
+LibraryScanner::LibraryScanner(Store &store, std::filesystem::path root,
+                               Lister list, Describer describe,
+                               std::function<void()> notify,
+                               std::unordered_set<std::string> shown,
+                               int threads)
+    : store(store), root(std::move(root)), list(std::move(list)),
+      describe(std::move(describe)), notify(std::move(notify)),
+      shown(std::move(shown)), threads(threads) {
+    if (this->threads <= 0) {
+        this->threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    scanning = std::thread([this]() { scan(); });
+}
+
+LibraryScanner::~LibraryScanner() {
+    cancel();
+    scanning.join();
+}
+
+void LibraryScanner::cancel() {
+    {
+        // so the storing stage can't miss it between checking and waiting
+        std::lock_guard lock(mux);
+        cancelled = true;
+    }
+    cv.notify_all();
+}
+
+std::vector<Track> LibraryScanner::take() {
+    std::lock_guard lock(mux);
+    std::vector<Track> taken;
+    taken.swap(described);
+    return taken;
+}
+
+std::vector<std::string> LibraryScanner::take_removed() {
+    std::lock_guard lock(mux);
+    std::vector<std::string> taken;
+    taken.swap(removed);
+    return taken;
+}
+
+ScanProgress LibraryScanner::progress() {
+    std::lock_guard lock(mux);
+    return current;
+}
+
+void LibraryScanner::scan() {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::filesystem::path> files = list();
+    // what was stored about each file last time, by absolute path
+    std::unordered_map<std::string, Track> known;
+    for (Track &t : store.read_all()) {
+        known[t.path] = std::move(t);
+    }
+    std::vector<std::string> absolute(files.size());
+    std::unordered_set<std::string> listed;
+    for (size_t i = 0; i < files.size(); i++) {
+        std::error_code ec;
+        absolute[i] = std::filesystem::absolute(files[i], ec).string();
+        listed.insert(absolute[i]);
+    }
+    // only files under the root can have been deleted by this scan's
+    // standards, the others may just be on a disk that is not there now
+    std::error_code ec;
+    std::string under = std::filesystem::canonical(root, ec).string() + "/";
+    for (auto &[path, t] : known) {
+        if (!ec && path.starts_with(under) && !listed.contains(path) &&
+            !std::filesystem::exists(path)) {
+            vanished.emplace(t.inode, t);
+        }
+    }
+    std::vector<std::string> gone;
+    if (!shown.empty()) {
+        std::unordered_set<std::string> names;
+        for (auto &file : files) {
+            names.insert(file.string());
+        }
+        for (auto &name : shown) {
+            if (!names.contains(name)) {
+                gone.push_back(name);
+            }
+        }
+    }
+    {
+        std::lock_guard lock(mux);
+        current.files = files.size();
+        current.listing_seconds = seconds_since(start);
+        removed = std::move(gone);
+    }
+    notify();
+
+    // stores what the workers describe while they are still at it
+    std::thread storing([this]() { store_batches(); });
+
+    auto describing_start = std::chrono::steady_clock::now();
+    std::atomic<size_t> next = 0;
+    auto work = [&]() {
+        for (size_t i = next++; i < files.size() && !cancelled; i = next++) {
+            const std::filesystem::path &file = files[i];
+            FileStamp stamp;
+            bool readable = get_file_stamp(file, stamp);
+            const Track *stored = find_stored(known, file, absolute[i]);
+            Track t, renamed_from;
+            // unchanged and renamed files are stored as they are already
+            bool changed = false, hand_back = true;
+            if (stored && readable && unchanged_since(*stored, stamp)) {
+                t = describe(file, stored);
+                // what describing a stored track can tell that the store
+                // can't: whether a lyrics file came or went next to it
+                bool same_lyrics = t.lrcfile.empty() == stored->lrcfile.empty();
+                hand_back = !same_lyrics || !shown.contains(file.string());
+            } else if (!stored && readable &&
+                       claim_renamed(stamp, renamed_from)) {
+                store.move_file(renamed_from.id, file.string());
+                t = describe(file, &renamed_from);
+            } else {
+                t = describe(file, nullptr);
+                changed = true;
+            }
+            bool first_new = false, batch_full = false;
+            {
+                std::lock_guard lock(mux);
+                if (hand_back) {
+                    first_new = described.empty();
+                    described.push_back(t);
+                }
+                if (changed) {
+                    to_store.push_back(std::move(t));
+                    batch_full = to_store.size() >= SCAN_BATCH;
+                } else if (stored) {
+                    current.unchanged++;
+                } else {
+                    current.renamed++;
+                }
+                current.described++;
+                current.describing_seconds = seconds_since(describing_start);
+            }
+            if (batch_full) {
+                cv.notify_all();
+            }
+            // take() gets everything there is, so one notification is
+            // enough until then
+            if (first_new) {
+                notify();
+            }
+        }
+    };
+    int count = std::min<size_t>(threads, files.size());
+    std::vector<std::thread> workers;
+    for (int i = 1; i < count; i++) {
+        workers.emplace_back(work);
+    }
+    // this thread is one of the workers too
+    work();
+    for (auto &w : workers) {
+        w.join();
+    }
+    {
+        std::lock_guard lock(mux);
+        describing_done = true;
+    }
+    cv.notify_all();
+    storing.join();
+
+    if (!cancelled && !vanished.empty()) {
+        auto removing_start = std::chrono::steady_clock::now();
+        std::vector<int> ids;
+        for (auto &v : vanished) {
+            ids.push_back(v.second.id);
+        }
+        int count = store.remove_many(ids);
+        std::lock_guard lock(mux);
+        current.removed = count;
+        current.storing_seconds += seconds_since(removing_start);
+    }
+
+    ScanProgress done;
+    {
+        std::lock_guard lock(mux);
+        current.finished = true;
+        done = current;
+    }
+    std::cout << "Scanned " << done.files << " files (" << done.unchanged
+              << " unchanged, " << done.renamed << " renamed, " << done.removed
+              << " removed): listing "
+              << done.listing_seconds << "s, describing "
+              << done.describing_seconds << "s, storing "
+              << done.storing_seconds << "s, " << seconds_since(start)
+              << "s in total" << (cancelled ? " (cancelled)" : "")
+              << std::endl;
+    notify();
+}
+
+bool LibraryScanner::claim_renamed(const FileStamp &stamp, Track &renamed) {
+    std::lock_guard lock(mux);
+    auto [first, last] = vanished.equal_range(stamp.inode);
+    for (auto it = first; it != last; it++) {
+        // a new file on the same inode could also be the old one's
+        // replacement, then it won't have the same size and time as well
+        if (unchanged_since(it->second, stamp)) {
+            renamed = std::move(it->second);
+            vanished.erase(it);
+            return true;
+        }
+    }
+    return false;
+}
+
+void LibraryScanner::store_batches() {
+    while (true) {
+        std::vector<Track> batch;
+        {
+            std::unique_lock lock(mux);
+            cv.wait(lock, [this]() {
+                return to_store.size() >= SCAN_BATCH || describing_done ||
+                       cancelled;
+            });
+            if (cancelled || (describing_done && to_store.empty())) {
+                return;
+            }
+            batch.swap(to_store);
+        }
+        auto start = std::chrono::steady_clock::now();
+        store.upsert_many(batch);
+        {
+            std::lock_guard lock(mux);
+            current.stored += batch.size();
+            current.storing_seconds += seconds_since(start);
+        }
+        notify();
+    }
+}
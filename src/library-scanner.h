@@ -0,0 +1,137 @@
+#ifndef LIBRARY_SCANNER_H
+#define LIBRARY_SCANNER_H
+
+#include "store.h"
+#include <atomic>
+#include <condition_variable>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// how many described tracks are stored in one transaction while scanning
+#define SCAN_BATCH 256
+
+/*
+ * how far a LibraryScanner has come
+ * the stages overlap: tracks are stored while others are still described
+ */
+struct ScanProgress {
+    // files found, 0 until listing them is over
+    size_t files = 0;
+    // how many of them have been dealt with (described, or found unchanged),
+    // and how many stored
+    size_t described = 0;
+    size_t stored = 0;
+    // files that are stored just like they are now, nothing was done for them
+    size_t unchanged = 0;
+    // files that are stored under another name, only their path was updated
+    size_t renamed = 0;
+    // stored files under the root that are gone, and were removed from the
+    // store at the end
+    size_t removed = 0;
+    // how long each stage took (so far), in seconds
+    double listing_seconds = 0;
+    double describing_seconds = 0;
+    double storing_seconds = 0;
+    // everything is stored, or the scan was cancelled
+    bool finished = false;
+};
+
+/*
+ * LibraryScanner: scans a music folder in the background
+ *
+ * The scan is a pipeline of three stages, each on its own threads:
+ * 1. list the files (and read what the database knew about them last time)
+ * 2. describe every file, on a pool of workers. files that did not change
+ *    since they were stored (see unchanged_since) are described from the
+ *    database instead of being opened again, and a new file that is a stored
+ *    one under another name only gets its path updated
+ * 3. store the tracks that are new or changed, SCAN_BATCH of them per
+ *    transaction
+ * Stored files under the root that are not there anymore are removed from the
+ * store at the end.
+ *
+ * A rescan can be told which files the caller already shows. Those are only
+ * handed back again if they changed, and the ones that are gone are handed
+ * back by take_removed, so a rescan where nothing changed hands back nothing.
+ *
+ * Nothing in here touches the interface. Whoever started the scan is told
+ * through notify (from the scanner's threads) that there is something new,
+ * and then takes the described tracks and looks at the progress from its own
+ * thread:
+ *
+ * LibraryScanner scanner(store, list, describe, [&]() { dispatcher.emit(); });
+ * // in the dispatcher's handler, on the main thread
+ * for (Track &t : scanner.take()) { ... }
+ * if (scanner.progress().finished) { ... }
+ */
+class LibraryScanner {
+  public:
+    // the files to scan, runs on the scanner's thread
+    typedef std::function<std::vector<std::filesystem::path>()> Lister;
+    // the track for a file, runs on the workers
+    // stored: what the database has for the file if it did not change since
+    // it was stored, nullptr otherwise
+    typedef std::function<Track(const std::filesystem::path &file,
+                                const Track *stored)>
+        Describer;
+
+    // starts scanning right away
+    // root: the folder list lists the files of
+    // shown: the files the caller has from an earlier scan, as list gave them
+    // threads: how many files are described at the same time, 0 means one
+    // per core
+    LibraryScanner(Store &store, std::filesystem::path root, Lister list,
+                   Describer describe, std::function<void()> notify,
+                   std::unordered_set<std::string> shown = {},
+                   int threads = 0);
+    // cancels the scan and waits for it
+    ~LibraryScanner();
+
+    // the tracks described since the last call, in no particular order
+    // these are every file that is not shown, or changed since it was
+    std::vector<Track> take();
+    // the shown files that are not there anymore (or were renamed, then the
+    // new name comes from take)
+    std::vector<std::string> take_removed();
+    ScanProgress progress();
+    // stops after the files that are being described right now
+    void cancel();
+
+  private:
+    Store &store;
+    std::filesystem::path root;
+    Lister list;
+    Describer describe;
+    std::function<void()> notify;
+    std::unordered_set<std::string> shown;
+    int threads;
+
+    std::mutex mux;
+    // wakes the storing stage up
+    std::condition_variable cv;
+    ScanProgress current;
+    // described but not taken yet
+    std::vector<Track> described;
+    std::vector<std::string> removed;
+    // described but not stored yet
+    std::vector<Track> to_store;
+    bool describing_done = false;
+    std::atomic<bool> cancelled = false;
+
+    // stored files under the root that were not listed and are gone, by inode
+    // the ones no new file turns out to be a rename of are removed at the end
+    std::unordered_multimap<uint64_t, Track> vanished;
+    // takes the vanished file the file with this stamp was renamed from
+    bool claim_renamed(const FileStamp &stamp, Track &renamed);
+
+    std::thread scanning;
+    void scan();
+    void store_batches();
+};
+
+#endif
@@ -0,0 +1,295 @@
+#include "library.h"
+#include <algorithm>
+#include <glib.h>
+#include <numeric>
+
+StringId StringPool::intern(std::string_view s) {
+    auto it = ids.find(std::string(s));
+    if (it != ids.end()) {
+        return it->second;
+    }
+    StringId id = strings.size();
+    it = ids.emplace(std::string(s), id).first;
+    strings.push_back(&it->first);
+    return id;
+}
+
+void StringPool::clear() {
+    ids.clear();
+    strings.clear();
+}
+
+static char fold(char c) {
+    return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+}
+
+Library::TextRef Library::append(std::string_view s) {
+    TextRef r = {(uint32_t)text.size(), (uint32_t)s.size()};
+    text.append(s);
+    return r;
+}
+
+Library::TextRef Library::append_key(std::string_view s) {
+    // folding can change the length, the key is not always as long as s
+    return append(key(s));
+}
+
+StringId Library::intern(std::string_view s) {
+    StringId id = strings.intern(s);
+    if (id == string_keys.size()) {
+        string_keys.push_back(append_key(s));
+        string_sort_keys.push_back(append(sort_key(s)));
+    }
+    return id;
+}
+
+void Library::set_columns(TrackIndex i, const LibraryTrack &t) {
+    titles[i] = append(t.title);
+    title_keys[i] = append_key(t.title);
+    title_sort_keys[i] = append(sort_key(t.title));
+    file_names[i] = append(t.file_name);
+    file_name_keys[i] = append_key(t.file_name);
+    file_name_sort_keys[i] = append(sort_key(t.file_name));
+    paths[i] = append(t.path);
+    artists[i] = intern(t.artist);
+    albums[i] = intern(t.album);
+    durations[i] = t.duration;
+}
+
+TrackIndex Library::add(const LibraryTrack &t) {
+    TrackIndex i = size();
+    for (auto *column : {&titles, &file_names, &paths, &title_keys,
+                         &file_name_keys, &title_sort_keys,
+                         &file_name_sort_keys}) {
+        column->emplace_back();
+    }
+    artists.emplace_back();
+    albums.emplace_back();
+    durations.emplace_back();
+    set_columns(i, t);
+    track_changed(i);
+    return i;
+}
+
+void Library::set(TrackIndex i, const LibraryTrack &t) {
+    set_columns(i, t);
+    track_changed(i);
+}
+
+void Library::track_changed(TrackIndex i) {
+    for (Sorted &s : sorted) {
+        if (s.sorted) {
+            s.pending.push_back(i);
+            s.positions.clear();
+        }
+    }
+}
+
+void Library::reserve(size_t tracks) {
+    for (auto *column : {&titles, &file_names, &paths, &title_keys,
+                         &file_name_keys, &title_sort_keys,
+                         &file_name_sort_keys}) {
+        column->reserve(tracks);
+    }
+    artists.reserve(tracks);
+    albums.reserve(tracks);
+    durations.reserve(tracks);
+}
+
+void Library::clear() {
+    text.clear();
+    for (auto *column : {&titles, &file_names, &paths, &title_keys,
+                         &file_name_keys, &title_sort_keys,
+                         &file_name_sort_keys, &string_keys,
+                         &string_sort_keys}) {
+        column->clear();
+    }
+    artists.clear();
+    albums.clear();
+    durations.clear();
+    strings.clear();
+    string_ranks.clear();
+    for (Sorted &s : sorted) {
+        s = Sorted();
+    }
+}
+
+void Library::rank_strings() const {
+    if (string_ranks.size() == strings.size()) {
+        return;
+    }
+    std::vector<StringId> by_key(strings.size());
+    std::iota(by_key.begin(), by_key.end(), 0);
+    std::sort(by_key.begin(), by_key.end(), [this](StringId a, StringId b) {
+        return view(string_sort_keys[a]) < view(string_sort_keys[b]);
+    });
+    string_ranks.resize(strings.size());
+    // strings with the same key get the same rank
+    uint32_t rank = 0;
+    for (size_t k = 0; k < by_key.size(); k++) {
+        if (k > 0 && view(string_sort_keys[by_key[k]]) !=
+                         view(string_sort_keys[by_key[k - 1]])) {
+            rank++;
+        }
+        string_ranks[by_key[k]] = rank;
+    }
+}
+
+bool Library::less(Column column, TrackIndex a, TrackIndex b) const {
+    // every comparison ends with the index, so there are no ties: merging
+    // into a kept order gives what sorting everything again would, and
+    // descending is the reverse of ascending
+    switch (column) {
+    case DURATION:
+        if (durations[a] != durations[b]) {
+            return durations[a] < durations[b];
+        }
+        break;
+    case ARTIST:
+        if (artists[a] != artists[b] &&
+            string_ranks[artists[a]] != string_ranks[artists[b]]) {
+            return string_ranks[artists[a]] < string_ranks[artists[b]];
+        }
+        [[fallthrough]];
+    case ALBUM:
+        if (albums[a] != albums[b] &&
+            string_ranks[albums[a]] != string_ranks[albums[b]]) {
+            return string_ranks[albums[a]] < string_ranks[albums[b]];
+        }
+        break;
+    case FILE_NAME: {
+        int c = view(file_name_sort_keys[a])
+                    .compare(view(file_name_sort_keys[b]));
+        return c != 0 ? c < 0 : a < b;
+    }
+    case TITLE:
+        break;
+    }
+    int c = view(title_sort_keys[a]).compare(view(title_sort_keys[b]));
+    return c != 0 ? c < 0 : a < b;
+}
+
+const std::vector<TrackIndex> &Library::order(Column column) const {
+    Sorted &s = sorted[column];
+    if (s.sorted && s.pending.empty()) {
+        return s.order;
+    }
+    // the ranks only grow apart when strings are added, so a kept order is
+    // still in order with the new ones
+    rank_strings();
+    auto by_column = [this, column](TrackIndex a, TrackIndex b) {
+        return less(column, a, b);
+    };
+    // merging is worth it while few tracks changed
+    if (!s.sorted || s.pending.size() > size() / 8) {
+        s.order.resize(size());
+        std::iota(s.order.begin(), s.order.end(), 0);
+        std::sort(s.order.begin(), s.order.end(), by_column);
+    } else {
+        is_pending.assign(size(), false);
+        for (TrackIndex i : s.pending) {
+            is_pending[i] = true;
+        }
+        // the tracks that were set are somewhere in the order already
+        std::erase_if(s.order, [this](TrackIndex i) { return is_pending[i]; });
+        size_t kept = s.order.size();
+        for (TrackIndex i = 0; i < size(); i++) {
+            if (is_pending[i]) {
+                s.order.push_back(i);
+            }
+        }
+        std::sort(s.order.begin() + kept, s.order.end(), by_column);
+        std::inplace_merge(s.order.begin(), s.order.begin() + kept,
+                           s.order.end(), by_column);
+    }
+    s.sorted = true;
+    s.pending.clear();
+    s.positions.clear();
+    return s.order;
+}
+
+uint32_t Library::position(Column column, TrackIndex i) const {
+    const std::vector<TrackIndex> &o = order(column);
+    std::vector<uint32_t> &positions = sorted[column].positions;
+    if (positions.size() != o.size()) {
+        positions.resize(o.size());
+        for (uint32_t k = 0; k < o.size(); k++) {
+            positions[o[k]] = k;
+        }
+    }
+    return positions[i];
+}
+
+void Library::sort(Column column, bool ascending,
+                   std::vector<TrackIndex> &out) const {
+    const std::vector<TrackIndex> &o = order(column);
+    if (ascending) {
+        out.assign(o.begin(), o.end());
+    } else {
+        out.assign(o.rbegin(), o.rend());
+    }
+}
+
+void Library::filter(std::string_view query,
+                     std::vector<TrackIndex> &matches) const {
+    matches.clear();
+    // the query is short, a small string does not allocate
+    std::string key = Library::key(query);
+    // each artist and album is looked at once, not once per track
+    string_matches.resize(strings.size());
+    for (StringId id = 0; id < strings.size(); id++) {
+        string_matches[id] =
+            view(string_keys[id]).find(key) != std::string_view::npos;
+    }
+    for (TrackIndex i = 0; i < size(); i++) {
+        if (string_matches[artists[i]] || string_matches[albums[i]] ||
+            view(title_keys[i]).find(key) != std::string_view::npos) {
+            matches.push_back(i);
+        }
+    }
+}
+
+bool Library::matches(TrackIndex i, std::string_view key) const {
+    for (TextRef r : {title_keys[i], string_keys[artists[i]],
+                      string_keys[albums[i]]}) {
+        if (view(r).find(key) != std::string_view::npos) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string Library::key(std::string_view s) {
+    // most of a music list is ascii, which is folded here without going
+    // through glib. text that isn't valid utf-8 can't be folded by glib, it
+    // only has its ascii letters folded
+    bool ascii = std::all_of(s.begin(), s.end(),
+                             [](char c) { return (unsigned char)c < 0x80; });
+    if (ascii || !g_utf8_validate(s.data(), s.size(), nullptr)) {
+        std::string key(s);
+        std::transform(key.begin(), key.end(), key.begin(), fold);
+        return key;
+    }
+    // what Glib::ustring::casefold does, without making a ustring first
+    gchar *folded = g_utf8_casefold(s.data(), s.size());
+    std::string key(folded);
+    g_free(folded);
+    return key;
+}
+
+std::string Library::sort_key(std::string_view s) {
+    std::string folded = key(s);
+    // glib only collates utf-8, what isn't is sorted as what
+    // g_utf8_make_valid makes of it
+    if (!g_utf8_validate(folded.data(), folded.size(), nullptr)) {
+        gchar *valid = g_utf8_make_valid(folded.data(), folded.size());
+        folded = valid;
+        g_free(valid);
+    }
+    // the comparison of Glib::ustring::compare (g_utf8_collate), made once
+    // per string instead of once per comparison
+    gchar *collated = g_utf8_collate_key(folded.data(), folded.size());
+    std::string key(collated);
+    g_free(collated);
+    return key;
+}
@@ -0,0 +1,190 @@
+#ifndef LIBRARY_H
+#define LIBRARY_H
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// where a track is in a Library, in the order they were added
+typedef uint32_t TrackIndex;
+// a string in a StringPool
+typedef uint32_t StringId;
+
+/*
+ * StringPool: keeps every distinct string once
+ *
+ * Artists and albums repeat a lot, so a track only keeps the id of its own,
+ * and comparing two of them starts with comparing two numbers.
+ */
+class StringPool {
+  public:
+    // the id of s, it is added the first time
+    StringId intern(std::string_view s);
+    const std::string &get(StringId id) const { return *strings[id]; }
+    size_t size() const { return strings.size(); }
+    void clear();
+
+  private:
+    std::unordered_map<std::string, StringId> ids;
+    // the keys of ids by id, they stay where they are while the map grows
+    std::vector<const std::string *> strings;
+};
+
+/*
+ * what a Library is given for each track
+ * the strings are copied, they don't have to outlive the call, but they can't
+ * be views into the library itself
+ */
+struct LibraryTrack {
+    std::string_view title;
+    std::string_view artist;
+    std::string_view album;
+    // without the extension
+    std::string_view file_name;
+    std::string_view path;
+    // in milliseconds
+    int duration = 0;
+};
+
+/*
+ * Library: the music list, one array per column
+ *
+ * The text of every track lives in one buffer and the rest in one array per
+ * field, so sorting or filtering walks a few contiguous arrays instead of
+ * following a pointer per track. Artists and albums are interned (see
+ * StringPool).
+ * Next to each text column there is its key (the text case folded, see key),
+ * which filter looks in, and its sort key (see sort_key), which the orders
+ * compare. Both are made once when the track (or, for artists and albums,
+ * the string) is added.
+ *
+ * Library library;
+ * TrackIndex i = library.add({.title = "Jamaica Farewell", ...});
+ * const std::vector<TrackIndex> &order = library.order(Library::ARTIST);
+ * // order[0] is the first track by artist, then album, then title
+ *
+ * A column is only sorted the first time its order is asked for, and the
+ * order is kept. Tracks that are added or set after that are merged into it
+ * the next time it is asked for, instead of sorting everything again.
+ * sort and filter write into a vector the caller keeps, so once it has
+ * grown to the size of the library they don't allocate anything.
+ * A Library is not safe to use from several threads at once, not even for
+ * reading, since reading can sort.
+ */
+class Library {
+  public:
+    // what a library can be sorted by, and how ties are broken
+    enum Column {
+        // then the order they were added in
+        TITLE,
+        // then title
+        DURATION,
+        // then album, then title
+        ARTIST,
+        // then title
+        ALBUM,
+        // then the order they were added in
+        FILE_NAME
+    };
+
+    TrackIndex add(const LibraryTrack &t);
+    // changes what track i is. its old text stays in the buffer until clear
+    void set(TrackIndex i, const LibraryTrack &t);
+    size_t size() const { return durations.size(); }
+    void reserve(size_t tracks);
+    void clear();
+
+    std::string_view title(TrackIndex i) const { return view(titles[i]); }
+    std::string_view artist(TrackIndex i) const {
+        return strings.get(artists[i]);
+    }
+    std::string_view album(TrackIndex i) const {
+        return strings.get(albums[i]);
+    }
+    std::string_view file_name(TrackIndex i) const {
+        return view(file_names[i]);
+    }
+    std::string_view path(TrackIndex i) const { return view(paths[i]); }
+    int duration(TrackIndex i) const { return durations[i]; }
+
+    // every track sorted by column, ascending
+    // it stays valid until the library changes
+    const std::vector<TrackIndex> &order(Column column) const;
+    // where track i is in order(column)
+    uint32_t position(Column column, TrackIndex i) const;
+    // every track sorted by column, descending is exactly the reverse of
+    // ascending
+    void sort(Column column, bool ascending,
+              std::vector<TrackIndex> &order) const;
+    // the tracks whose title, artist or album has query in it, ignoring case,
+    // in the order they were added
+    void filter(std::string_view query,
+                std::vector<TrackIndex> &matches) const;
+    // whether track i's title, artist or album has key in it
+    // key: what is looked for, made with key()
+    bool matches(TrackIndex i, std::string_view key) const;
+    // s the way it is compared: case folded, so upper and lower case compare
+    // the same in any script ("Édith" and "ÉDITH" have the same key)
+    static std::string key(std::string_view s);
+    // s the way it is sorted: key(s) as a collation key of the locale
+    // (g_utf8_collate_key), so "Émile" goes between "Apple" and "Zed".
+    // sort keys are compared byte by byte, like std::string does
+    static std::string sort_key(std::string_view s);
+
+  private:
+    // where a string is in text
+    struct TextRef {
+        uint32_t offset;
+        uint32_t size;
+    };
+    std::string text;
+    TextRef append(std::string_view s);
+    // appends key(s)
+    TextRef append_key(std::string_view s);
+    std::string_view view(TextRef r) const {
+        return std::string_view(text).substr(r.offset, r.size);
+    }
+
+    // puts t's text in the columns at i
+    void set_columns(TrackIndex i, const LibraryTrack &t);
+    StringId intern(std::string_view s);
+
+    // the columns, one element per track
+    std::vector<TextRef> titles, file_names, paths;
+    std::vector<TextRef> title_keys, file_name_keys;
+    std::vector<TextRef> title_sort_keys, file_name_sort_keys;
+    std::vector<StringId> artists, albums;
+    std::vector<int> durations;
+
+    // artists and albums, and their keys and sort keys by id
+    StringPool strings;
+    std::vector<TextRef> string_keys, string_sort_keys;
+    // the place of each string in the pool in sort key order, so artists and
+    // albums are compared as numbers. made again when the pool grew
+    mutable std::vector<uint32_t> string_ranks;
+    void rank_strings() const;
+    // for filter: whether each string in the pool matches
+    mutable std::vector<char> string_matches;
+
+    // whether a goes before b when sorted by column
+    bool less(Column column, TrackIndex a, TrackIndex b) const;
+    // a column's order, as far as it is known
+    struct Sorted {
+        bool sorted = false;
+        std::vector<TrackIndex> order;
+        // tracks added or set since order was sorted, they are not in it
+        std::vector<TrackIndex> pending;
+        // the place of each track in order, empty until asked for
+        std::vector<uint32_t> positions;
+    };
+    mutable std::array<Sorted, FILE_NAME + 1> sorted;
+    // for merging: which tracks are pending
+    mutable std::vector<char> is_pending;
+    // a track changed, every order that is kept has to place it again
+    void track_changed(TrackIndex i);
+};
+
+#endif
@@ -1,45 +1,166 @@
-// CSCI3280 Phase 1
-// Thomas
-
-#include "listfiles.h"
-
-boost::regex asciiRegex("[ -~]*");
-boost::smatch smatch;
-
-std::vector<std::filesystem::path> ListFiles::listfiles(const std::string& _dir, const std::vector<std::string>& ext, bool asciiOnly, bool recursive, bool verbose) {
-    std::filesystem::path dir = std::filesystem::u8path(_dir);
-    if (!std::filesystem::exists(dir) || !std::filesystem::is_directory(dir))
-        return {};
-    if (verbose)
-        std::cout << "Selected Directory Verified." << std::endl;
-
-    std::vector<std::filesystem::path> listfiles(0);
-
-    if (recursive) {
-        for (const std::filesystem::directory_entry& entry : std::filesystem::recursive_directory_iterator(dir))
-            if (std::filesystem::is_regular_file(entry.path()) && fit_ext(entry, ext) && (!asciiOnly || boost::regex_match(entry.path().string(), smatch, asciiRegex))) {
-                listfiles.push_back(entry.path());
-                if (verbose)
-                    std::cout << entry.path() << std::endl;
-            }
-    }
-    else {
-        for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(dir))
-            if (std::filesystem::is_regular_file(entry.path()) && fit_ext(entry, ext) && (!asciiOnly || boost::regex_match(entry.path().string(), smatch, asciiRegex))) {
-                listfiles.push_back(entry.path());
-                if (verbose)
-                    std::cout << entry.path() << std::endl;
-            }
-    }
-    if (verbose)
-        std::cout << listfiles.size() << " files found" << std::endl;
-
-    return listfiles;
-}
-
-bool ListFiles::fit_ext(const std::filesystem::directory_entry& entry, const std::vector<std::string>& ext) {
-    for (const std::string _ext : ext)
-        if (entry.path().extension().string() == _ext)
-            return true;
-    return false;
-}
\ No newline at end of file
+// CSCI3280 Phase 1
+// Thomas
+
+#include "listfiles.h"
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+std::vector<std::filesystem::path> ListFiles::listfiles(const std::string& _dir, const std::vector<std::string>& ext, bool asciiOnly, bool recursive, bool verbose) {
+    std::filesystem::path dir = std::filesystem::u8path(_dir);
+    std::error_code ec;
+    if (!std::filesystem::is_directory(dir, ec))
+        return {};
+    if (verbose)
+        std::cout << "Selected Directory Verified." << std::endl;
+
+    Extensions extensions;
+    for (std::string _ext : ext) {
+        std::transform(_ext.begin(), _ext.end(), _ext.begin(), ::tolower);
+        extensions.insert(_ext);
+    }
+
+    // plain strings until the end, a path is much more expensive to copy and compare
+    std::vector<std::string> found;
+    if (!recursive) {
+        list_folder(dir.string(), extensions, asciiOnly, found, nullptr);
+    }
+    else {
+        // the folders nobody has listed yet, every thread takes one at a time and adds the subfolders it finds
+        std::mutex mux;
+        std::condition_variable cv;
+        std::vector<std::string> pending = {dir.string()};
+        // how many threads are listing a folder right now, when it is 0 and nothing is pending everything is done
+        int busy = 0;
+        auto work = [&]() {
+            std::vector<std::string> files, subfolders;
+            std::unique_lock lock(mux);
+            while (true) {
+                cv.wait(lock, [&]() { return !pending.empty() || busy == 0; });
+                if (pending.empty())
+                    break;
+                std::string folder = std::move(pending.back());
+                pending.pop_back();
+                busy++;
+                lock.unlock();
+                list_folder(folder, extensions, asciiOnly, files, &subfolders);
+                lock.lock();
+                busy--;
+                pending.insert(pending.end(), std::make_move_iterator(subfolders.begin()), std::make_move_iterator(subfolders.end()));
+                subfolders.clear();
+                // there is something to take, or nothing will ever be again
+                cv.notify_all();
+            }
+            found.insert(found.end(), std::make_move_iterator(files.begin()), std::make_move_iterator(files.end()));
+        };
+        int count = std::clamp<int>(std::thread::hardware_concurrency(), 1, LISTFILES_MAX_THREADS);
+        std::vector<std::thread> threads;
+        for (int i = 1; i < count; i++)
+            threads.emplace_back(work);
+        work();
+        for (std::thread& thread : threads)
+            thread.join();
+    }
+
+    std::vector<std::filesystem::path> listfiles(found.begin(), found.end());
+    if (verbose) {
+        for (const std::filesystem::path& path : listfiles)
+            std::cout << path << std::endl;
+        std::cout << listfiles.size() << " files found" << std::endl;
+    }
+
+    return listfiles;
+}
+
+#ifdef __linux__
+
+void ListFiles::list_folder(const std::string& dir, const Extensions& ext, bool asciiOnly, std::vector<std::string>& files, std::vector<std::string>* subfolders) {
+    // a folder that can't be read is left out, not the whole listing
+    int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+        return;
+    DIR* folder = fdopendir(fd);
+    if (!folder) {
+        close(fd);
+        return;
+    }
+    std::string prefix = dir.ends_with('/') ? dir : dir + "/";
+    bool ascii_folder = is_ascii(prefix);
+    // readdir reads the entries many at a time (getdents64), and each one comes with its type, so only links (and
+    // file systems that don't say) cost a stat
+    while (struct dirent* entry = readdir(folder)) {
+        const char* name = entry->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+            continue;
+        unsigned char type = entry->d_type;
+        // the name is the cheapest test, so it comes first for files
+        bool fits = fit_ext(name, ext) && (!asciiOnly || (ascii_folder && is_ascii(name)));
+        if (type == DT_UNKNOWN || (type == DT_LNK && fits)) {
+            struct stat st;
+            // links to files are followed, links to folders are not (like recursive_directory_iterator)
+            int flags = type == DT_UNKNOWN ? AT_SYMLINK_NOFOLLOW : 0;
+            if (fstatat(fd, name, &st, flags) != 0)
+                continue;
+            type = S_ISREG(st.st_mode) ? DT_REG : S_ISDIR(st.st_mode) ? DT_DIR : DT_LNK;
+        }
+        if (type == DT_DIR && subfolders)
+            subfolders->push_back(prefix + name);
+        else if (type == DT_REG && fits)
+            files.push_back(prefix + name);
+    }
+    closedir(folder);
+}
+
+#else
+
+void ListFiles::list_folder(const std::string& dir, const Extensions& ext, bool asciiOnly, std::vector<std::string>& files, std::vector<std::string>* subfolders) {
+    // no fdopendir and fstatat, but the entries still come with their type, so again only links cost a stat
+    std::error_code ec;
+    std::filesystem::directory_iterator it(dir, ec);
+    bool ascii_folder = is_ascii(dir);
+    for (; !ec && it != std::filesystem::directory_iterator(); it.increment(ec)) {
+        const std::filesystem::directory_entry& entry = *it;
+        std::string name = entry.path().filename().string();
+        bool fits = fit_ext(name.c_str(), ext) && (!asciiOnly || (ascii_folder && is_ascii(name)));
+        std::error_code type_ec;
+        // is_directory and is_regular_file follow links, so links are looked at first
+        if (entry.is_symlink(type_ec)) {
+            // links to files are followed, links to folders are not (like recursive_directory_iterator)
+            if (fits && entry.is_regular_file(type_ec))
+                files.push_back(entry.path().string());
+        }
+        else if (entry.is_directory(type_ec)) {
+            if (subfolders)
+                subfolders->push_back(entry.path().string());
+        }
+        else if (fits && entry.is_regular_file(type_ec))
+            files.push_back(entry.path().string());
+    }
+}
+
+#endif
+
+bool ListFiles::fit_ext(const char* name, const Extensions& ext) {
+    const char* dot = strrchr(name, '.');
+    // no extension, or only a dot at the start (a hidden file, which extension() says has none)
+    if (!dot || dot == name)
+        return false;
+    // extensions are short enough to not need an allocation
+    std::string lower(dot);
+    std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+    return ext.contains(lower);
+}
+
+bool ListFiles::is_ascii(const std::string& path) {
+    // what the "[ -~]*" regex used to match
+    return std::all_of(path.begin(), path.end(), [](char c) { return c >= ' ' && c <= '~'; });
+}
@@ -1,21 +1,32 @@
-// CSCI3280 Phase 1
-// Thomas
-
-#ifndef MYLISTFILES_H
-#define MYLISTFILES_H
-
-#include <filesystem>
-#include <vector>
-#include <string>
-#include <boost/regex.hpp>
-#include <iostream>
-
-class ListFiles {
-public:
-    static std::vector<std::filesystem::path> listfiles(const std::string& _dir, const std::vector<std::string>& ext = {}, bool asciiOnly = true, bool recursive = false, bool verbose = false);
-
-private:
-    static bool fit_ext(const std::filesystem::directory_entry& entry, const std::vector<std::string>& ext);
-};
-
-#endif /* MYLISTFILES_H */
\ No newline at end of file
+// CSCI3280 Phase 1
+// Thomas
+
+#ifndef MYLISTFILES_H
+#define MYLISTFILES_H
+
+#include <filesystem>
+#include <vector>
+#include <string>
+#include <unordered_set>
+#include <iostream>
+
+// at most how many threads list the subfolders of a recursive listing
+#define LISTFILES_MAX_THREADS 8
+
+class ListFiles {
+public:
+    // the regular files in _dir (and its subfolders if recursive) with one of the extensions in ext
+    // extensions are compared ignoring case, asciiOnly leaves out paths with anything but printable ascii
+    // subfolders are listed in parallel, the files come back in no particular order
+    static std::vector<std::filesystem::path> listfiles(const std::string& _dir, const std::vector<std::string>& ext = {}, bool asciiOnly = true, bool recursive = false, bool verbose = false);
+
+private:
+    // the extensions, lowercase
+    typedef std::unordered_set<std::string> Extensions;
+    static bool fit_ext(const char* name, const Extensions& ext);
+    static bool is_ascii(const std::string& path);
+    // lists one folder, the subfolders it has go to subfolders if it is not nullptr
+    static void list_folder(const std::string& dir, const Extensions& ext, bool asciiOnly, std::vector<std::string>& files, std::vector<std::string>* subfolders);
+};
+
+#endif /* MYLISTFILES_H */
@@ -0,0 +1,90 @@
+#ifndef LRU_CACHE_H
+#define LRU_CACHE_H
+
+#include <cstddef>
+#include <list>
+#include <unordered_map>
+
+/*
+ * LruCache: keeps values up to some total cost, and when a new one doesn't
+ * fit, drops the ones that were used least recently
+ *
+ * What a value costs is up to the caller (1 each by default, or its size in
+ * bytes), the capacity is in the same unit.
+ *
+ * LruCache<std::string, Picture> pictures(16 << 20);
+ * pictures.put(path, picture, picture.bytes());
+ * if (const Picture *p = pictures.get(path)) { ... }
+ *
+ * It is not thread safe, whoever shares one locks it.
+ */
+template <typename Key, typename Value> class LruCache {
+  public:
+    explicit LruCache(size_t capacity) : capacity(capacity) {}
+
+    // the value for key, nullptr if there is none
+    // it is now the most recently used, the pointer is good until the next
+    // put, erase or clear
+    const Value *get(const Key &key) {
+        auto it = at.find(key);
+        if (it == at.end()) {
+            return nullptr;
+        }
+        entries.splice(entries.begin(), entries, it->second);
+        return &it->second->value;
+    }
+
+    bool contains(const Key &key) const { return at.contains(key); }
+
+    // replaces what key had, a value that costs more than the whole capacity
+    // is not kept
+    void put(const Key &key, Value value, size_t cost = 1) {
+        erase(key);
+        if (cost > capacity) {
+            return;
+        }
+        while (used + cost > capacity) {
+            used -= entries.back().cost;
+            at.erase(entries.back().key);
+            entries.pop_back();
+        }
+        entries.push_front({key, std::move(value), cost});
+        at[key] = entries.begin();
+        used += cost;
+    }
+
+    void erase(const Key &key) {
+        auto it = at.find(key);
+        if (it == at.end()) {
+            return;
+        }
+        used -= it->second->cost;
+        entries.erase(it->second);
+        at.erase(it);
+    }
+
+    void clear() {
+        entries.clear();
+        at.clear();
+        used = 0;
+    }
+
+    size_t size() const { return entries.size(); }
+    size_t cost() const { return used; }
+    // nothing new goes in without something else going out
+    bool full() const { return used >= capacity; }
+
+  private:
+    struct Entry {
+        Key key;
+        Value value;
+        size_t cost;
+    };
+    size_t capacity;
+    size_t used = 0;
+    // the most recently used first
+    std::list<Entry> entries;
+    std::unordered_map<Key, typename std::list<Entry>::iterator> at;
+};
+
+#endif
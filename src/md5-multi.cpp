@@ -0,0 +1,192 @@
+#include "md5-multi.h"
+#include <algorithm>
+#include <vector>
+
+/*
+ * The same constants as md5.cpp, in the order the 64 operations of a block
+ * use them
+ */
+static const uint32_t S[] = {
+    7,  12, 17, 22, 7,  12, 17, 22, 7,  12, 17, 22, 7,  12, 17, 22,
+    5,  9,  14, 20, 5,  9,  14, 20, 5,  9,  14, 20, 5,  9,  14, 20,
+    4,  11, 16, 23, 4,  11, 16, 23, 4,  11, 16, 23, 4,  11, 16, 23,
+    6,  10, 15, 21, 6,  10, 15, 21, 6,  10, 15, 21, 6,  10, 15, 21};
+
+static const uint32_t K[] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a,
+    0xa8304613, 0xfd469501, 0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+    0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821, 0xf61e2562, 0xc040b340,
+    0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8,
+    0x676f02d9, 0x8d2a4c8a, 0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+    0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70, 0x289b7ec6, 0xeaa127fa,
+    0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92,
+    0xffeff47d, 0x85845dd1, 0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+    0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391};
+
+// runs nblocks blocks of each of the streams through md5Step
+// blocks[l] is where the blocks of ctxs[l] are, one after another
+typedef void (*BlocksKernel)(MD5Context **ctxs, uint8_t **blocks,
+                             size_t nblocks);
+
+struct Kernel {
+    int lanes;
+    BlocksKernel run;
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+
+// gcc's vector extensions, one stream per element
+typedef uint32_t u32x4 __attribute__((vector_size(16)));
+typedef uint32_t u32x8 __attribute__((vector_size(32)));
+typedef uint32_t u32x16 __attribute__((vector_size(64)));
+
+/*
+ * md5Step on N streams, stream l in lane l of every vector
+ * it is inlined into the kernels below, which are compiled for the
+ * instruction set that has registers of that width
+ */
+template <typename V, int N>
+__attribute__((always_inline)) inline void md5Blocks(MD5Context **ctxs,
+                                                     uint8_t **blocks,
+                                                     size_t nblocks) {
+    V a, b, c, d;
+    for (int l = 0; l < N; l++) {
+        a[l] = ctxs[l]->buffer[0];
+        b[l] = ctxs[l]->buffer[1];
+        c[l] = ctxs[l]->buffer[2];
+        d[l] = ctxs[l]->buffer[3];
+    }
+    for (size_t n = 0; n < nblocks; n++) {
+        // word j of every stream's block, x86 is little endian like md5
+        V input[16];
+        for (int j = 0; j < 16; j++) {
+            for (int l = 0; l < N; l++) {
+                uint32_t word;
+                memcpy(&word, blocks[l] + n * 64 + j * 4, 4);
+                input[j][l] = word;
+            }
+        }
+        V aa = a, bb = b, cc = c, dd = d;
+#pragma GCC unroll 64
+        for (int i = 0; i < 64; i++) {
+            V e;
+            int j;
+            if (i < 16) {
+                e = (bb & cc) | (~bb & dd);
+                j = i;
+            } else if (i < 32) {
+                e = (bb & dd) | (cc & ~dd);
+                j = ((i * 5) + 1) % 16;
+            } else if (i < 48) {
+                e = bb ^ cc ^ dd;
+                j = ((i * 3) + 5) % 16;
+            } else {
+                e = cc ^ (bb | ~dd);
+                j = (i * 7) % 16;
+            }
+            V sum = aa + e + K[i] + input[j];
+            V temp = dd;
+            dd = cc;
+            cc = bb;
+            bb = bb + ((sum << S[i]) | (sum >> (32 - S[i])));
+            aa = temp;
+        }
+        a += aa;
+        b += bb;
+        c += cc;
+        d += dd;
+    }
+    for (int l = 0; l < N; l++) {
+        ctxs[l]->buffer[0] = a[l];
+        ctxs[l]->buffer[1] = b[l];
+        ctxs[l]->buffer[2] = c[l];
+        ctxs[l]->buffer[3] = d[l];
+    }
+}
+
+// every x86-64 cpu has sse2
+static void md5BlocksSse2(MD5Context **ctxs, uint8_t **blocks,
+                          size_t nblocks) {
+    md5Blocks<u32x4, 4>(ctxs, blocks, nblocks);
+}
+
+__attribute__((target("avx2"))) static void
+md5BlocksAvx2(MD5Context **ctxs, uint8_t **blocks, size_t nblocks) {
+    md5Blocks<u32x8, 8>(ctxs, blocks, nblocks);
+}
+
+__attribute__((target("avx512f"))) static void
+md5BlocksAvx512(MD5Context **ctxs, uint8_t **blocks, size_t nblocks) {
+    md5Blocks<u32x16, 16>(ctxs, blocks, nblocks);
+}
+
+static Kernel pickKernel() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return {16, md5BlocksAvx512};
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return {8, md5BlocksAvx2};
+    }
+    return {4, md5BlocksSse2};
+}
+
+#else
+
+// no vector kernel for this cpu, md5UpdateMany is md5Update in a loop
+static Kernel pickKernel() { return {1, nullptr}; }
+
+#endif
+
+static const Kernel &kernel() {
+    static const Kernel k = pickKernel();
+    return k;
+}
+
+int md5Lanes() { return kernel().lanes; }
+
+// the most lanes any kernel has
+#define MAX_LANES 16
+
+void md5UpdateMany(MD5Context **ctxs, uint8_t **inputs, size_t input_len,
+                   int count) {
+    const Kernel &k = kernel();
+    size_t nblocks = input_len / 64;
+    // the streams that are at a block boundary, only they can start with a
+    // whole block from the input
+    std::vector<int> aligned;
+    for (int i = 0; i < count; i++) {
+        if (k.lanes > 1 && nblocks > 0 && ctxs[i]->size % 64 == 0) {
+            aligned.push_back(i);
+        } else {
+            md5Update(ctxs[i], inputs[i], input_len);
+        }
+    }
+
+    for (size_t first = 0; first < aligned.size(); first += k.lanes) {
+        MD5Context *group[MAX_LANES];
+        uint8_t *blocks[MAX_LANES];
+        // lanes without a stream of their own hash a copy of the first one,
+        // and the result is thrown away
+        MD5Context spare[MAX_LANES];
+        int used = std::min<size_t>(k.lanes, aligned.size() - first);
+        for (int l = 0; l < k.lanes; l++) {
+            if (l < used) {
+                group[l] = ctxs[aligned[first + l]];
+                blocks[l] = inputs[aligned[first + l]];
+            } else {
+                spare[l] = *group[0];
+                group[l] = &spare[l];
+                blocks[l] = blocks[0];
+            }
+        }
+        k.run(group, blocks, nblocks);
+        // what is left is less than a block, md5Update keeps it for later
+        for (int l = 0; l < used; l++) {
+            group[l]->size += nblocks * 64;
+            md5Update(group[l], blocks[l] + nblocks * 64, input_len % 64);
+        }
+    }
+}
@@ -0,0 +1,26 @@
+// md5 of several independent streams at once, see md5.h for the single
+// stream version it has to agree with
+#ifndef MD5_MULTI_H
+#define MD5_MULTI_H
+
+#include "md5.h"
+
+/*
+ * How many streams md5UpdateMany hashes side by side on this cpu
+ * one 32 bit lane per stream in the widest vector registers it has:
+ * 16 with AVX-512, 8 with AVX2, 4 with SSE2, 1 on other cpus
+ */
+int md5Lanes();
+
+/*
+ * md5Update(ctxs[i], inputs[i], input_len) for every i < count
+ *
+ * Every stream gets the same amount of input. The whole 64 byte blocks of up
+ * to md5Lanes() streams go through the vector registers together, anything
+ * else (a block that is only partly there) goes through md5Update.
+ * The results are exactly what md5Update would give.
+ */
+void md5UpdateMany(MD5Context **ctxs, uint8_t **inputs, size_t input_len,
+                   int count);
+
+#endif
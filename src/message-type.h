@@ -46,7 +46,15 @@ enum class MessageType : std::uint32_t {
     NO_SUCH_FILE,
     GET_SEGMENT,
     RETURN_SEGMENT,
-    NO_SUCH_SEGMENT
+    NO_SUCH_SEGMENT,
+
+    // sent by both sides when they connect, says which hashes the sender
+    // can identify files by
+    HELLO
+};
+
+struct Hello {
+    std::vector<HashAlgorithm> hashes;
 };
 
 struct ReturnDatabase {
@@ -55,7 +63,10 @@ struct ReturnDatabase {
 
 // the body of MessageType::GET_TRACK_INFO
 struct GetTrackInfo {
+    // what to look for in the titles, artists and albums (see Store::search)
     std::string title;
+    // answer with this many tracks at most, 0 for the peer's own limit
+    uint32_t limit = 0;
 };
 
 struct ReturnTrackInfo {
@@ -92,6 +103,8 @@ struct PrepareFileSharing {
     std::string name;
     int assigned_id_for_peer;
     int dictated_segment_count = -1;
+    // when name is a checksum: which hash it is
+    HashAlgorithm hash = HashAlgorithm::MD5;
 };
 
 struct PreparedFileSharing {
@@ -170,6 +183,8 @@ constexpr std::string_view get_message_name(MessageType mt) {
         return "GET_DATABASE";
     case MessageType::RETURN_DATABASE:
         return "RETURN_DATABASE";
+    case MessageType::HELLO:
+        return "HELLO";
     default:
         return "???";
     }
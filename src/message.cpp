@@ -16,6 +16,8 @@ void Message::reset() {
     body.clear();
     header.size = 0;
     header.type = MessageType::NOTHING;
+    header.correlation_id = 0;
+    header.reply_to = 0;
 }
 
 Message &operator<<(Message &m, const std::string &d) {
@@ -42,23 +44,23 @@ Message &operator>>(Message &m, std::string &d) {
 
 Message &operator<<(Message &m, const Track &d) {
     m << d.id << d.album << d.artist << d.title << d.lrcfile << d.path
-      << d.duration << d.checksum << d.filesize;
+      << d.duration << d.checksum << d.filesize << d.content_id;
     return m;
 }
 
 Message &operator>>(Message &m, Track &d) {
-    m >> d.filesize >> d.checksum >> d.duration >> d.path >> d.lrcfile >>
+    m >> d.content_id >> d.filesize >> d.checksum >> d.duration >> d.path >> d.lrcfile >>
         d.title >> d.artist >> d.album >> d.id;
     return m;
 }
 
 Message &operator<<(Message &m, const GetTrackInfo &d) {
-    m << d.title;
+    m << d.title << d.limit;
     return m;
 }
 
 Message &operator>>(Message &m, GetTrackInfo &d) {
-    m >> d.title;
+    m >> d.limit >> d.title;
     return m;
 }
 
@@ -136,11 +138,13 @@ Message &operator>>(Message &m, NoSuchLyrics &d) {
 MessageHeader::MessageHeader(MessageType t) : type(t) {}
 
 Message &operator<<(Message &m, const PrepareFileSharing &d) {
-    m << d.name << d.assigned_id_for_peer << d.dictated_segment_count;
+    m << d.name << d.assigned_id_for_peer << d.dictated_segment_count
+      << d.hash;
     return m;
 }
 Message &operator>>(Message &m, PrepareFileSharing &d) {
-    m >> d.dictated_segment_count >> d.assigned_id_for_peer >> d.name;
+    m >> d.hash >> d.dictated_segment_count >> d.assigned_id_for_peer >>
+        d.name;
     return m;
 }
 
@@ -199,3 +203,12 @@ Message &operator>>(Message &m, NoSuchFile &d) {
     m >> d.checksum >> d.assigned_id_for_peer;
     return m;
 }
+
+Message &operator<<(Message &m, const Hello &d) {
+    m << d.hashes;
+    return m;
+}
+Message &operator>>(Message &m, Hello &d) {
+    m >> d.hashes;
+    return m;
+}
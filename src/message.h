@@ -15,6 +15,10 @@
  * size gives the size of body (see Message)
  * it is of paramount importance to fill the size field correctly
  * or else the receiver will read the wrong amount of bytes
+ *
+ * correlation_id is set by BaseClient::request, a peer answering that request
+ * copies it into reply_to (see BaseClient::reply), so the reply can be matched
+ * with the request. Both are 0 for plain messages
  */
 class MessageHeader {
   public:
@@ -22,6 +26,8 @@ class MessageHeader {
 
     MessageType type;
     std::uint32_t size = 0;
+    std::uint32_t correlation_id = 0;
+    std::uint32_t reply_to = 0;
 };
 
 /*
@@ -164,6 +170,9 @@ class Message {
     friend Message &operator<<(Message &m, const NoSuchFile &d);
     friend Message &operator>>(Message &m, NoSuchFile &d);
 
+    friend Message &operator<<(Message &m, const Hello &d);
+    friend Message &operator>>(Message &m, Hello &d);
+
     MessageHeader header;
 };
 
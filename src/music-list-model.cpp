@@ -0,0 +1,149 @@
+#include "music-list-model.h"
+
+MusicListModel::MusicListModel(const Library &library, Icon icon,
+                               TimeText time_text)
+    : Glib::ObjectBase(typeid(MusicListModel)), Glib::Object(),
+      library(library), icon(std::move(icon)),
+      time_text(std::move(time_text)) {}
+
+Glib::RefPtr<MusicListModel>
+MusicListModel::create(const Library &library, Icon icon, TimeText time_text) {
+    return Glib::RefPtr<MusicListModel>(
+        new MusicListModel(library, std::move(icon), std::move(time_text)));
+}
+
+void MusicListModel::show(std::vector<TrackIndex> rows) {
+    this->rows = std::move(rows);
+    stamp++;
+}
+
+void MusicListModel::append(TrackIndex i) {
+    rows.push_back(i);
+    iterator iter;
+    set_iter(rows.size() - 1, iter);
+    Path path;
+    path.push_back(rows.size() - 1);
+    row_inserted(path, iter);
+}
+
+bool MusicListModel::set_iter(int row, iterator &iter) const {
+    if (row < 0 || size_t(row) >= rows.size()) {
+        return false;
+    }
+    iter.set_stamp(stamp);
+    iter.gobj()->user_data = GINT_TO_POINTER(row);
+    return true;
+}
+
+int MusicListModel::row_of(const iterator &iter) {
+    return GPOINTER_TO_INT(iter.gobj()->user_data);
+}
+
+// sets value to v, the type of value is the one of v
+template <class T>
+static void set_value(Glib::ValueBase &value, const T &v) {
+    Glib::Value<T> typed;
+    typed.init(Glib::Value<T>::value_type());
+    typed.set(v);
+    value.init(Glib::Value<T>::value_type());
+    value = typed;
+}
+
+static Glib::ustring text(std::string_view s) {
+    return Glib::ustring(s.begin(), s.end());
+}
+
+void MusicListModel::get_value_vfunc(const iterator &iter, int column,
+                                     Glib::ValueBase &value) const {
+    if (!iter_is_valid(iter)) {
+        return;
+    }
+    TrackIndex i = rows[row_of(iter)];
+    switch (column) {
+    case 0:
+        set_value(value, int(i));
+        break;
+    case 1:
+        set_value(value, icon(i));
+        break;
+    case 2:
+        set_value(value, text(library.title(i)));
+        break;
+    case 3:
+        set_value(value, time_text(library.duration(i)));
+        break;
+    case 4:
+        set_value(value, text(library.artist(i)));
+        break;
+    case 5:
+        set_value(value, text(library.album(i)));
+        break;
+    case 6:
+        set_value(value, text(library.file_name(i)));
+        break;
+    }
+}
+
+Gtk::TreeModelFlags MusicListModel::get_flags_vfunc() const {
+    return Gtk::TREE_MODEL_LIST_ONLY;
+}
+
+int MusicListModel::get_n_columns_vfunc() const { return columns.size(); }
+
+GType MusicListModel::get_column_type_vfunc(int index) const {
+    return index >= 0 && index < int(columns.size()) ? columns.types()[index]
+                                                     : G_TYPE_INVALID;
+}
+
+bool MusicListModel::iter_next_vfunc(const iterator &iter,
+                                     iterator &iter_next) const {
+    return iter_is_valid(iter) && set_iter(row_of(iter) + 1, iter_next);
+}
+
+// it is a list: the rows have no children, and the root has every row
+
+bool MusicListModel::iter_children_vfunc(const iterator &parent,
+                                         iterator &iter) const {
+    return false;
+}
+
+bool MusicListModel::iter_has_child_vfunc(const iterator &iter) const {
+    return false;
+}
+
+int MusicListModel::iter_n_children_vfunc(const iterator &iter) const {
+    return 0;
+}
+
+int MusicListModel::iter_n_root_children_vfunc() const { return rows.size(); }
+
+bool MusicListModel::iter_nth_child_vfunc(const iterator &parent, int n,
+                                          iterator &iter) const {
+    return false;
+}
+
+bool MusicListModel::iter_nth_root_child_vfunc(int n, iterator &iter) const {
+    return set_iter(n, iter);
+}
+
+bool MusicListModel::iter_parent_vfunc(const iterator &child,
+                                       iterator &iter) const {
+    return false;
+}
+
+Gtk::TreeModel::Path MusicListModel::get_path_vfunc(const iterator &iter) const {
+    Path path;
+    if (iter_is_valid(iter)) {
+        path.push_back(row_of(iter));
+    }
+    return path;
+}
+
+bool MusicListModel::get_iter_vfunc(const Path &path, iterator &iter) const {
+    return path.size() == 1 && set_iter(path[0], iter);
+}
+
+bool MusicListModel::iter_is_valid(const iterator &iter) const {
+    return iter.get_stamp() == stamp && row_of(iter) >= 0 &&
+           size_t(row_of(iter)) < rows.size();
+}
@@ -0,0 +1,107 @@
+#ifndef MUSIC_LIST_MODEL_H
+#define MUSIC_LIST_MODEL_H
+
+#include "library.h"
+#include <functional>
+#include <gtkmm.h>
+#include <vector>
+
+/*
+ * MusicListModel: the music list as a Gtk::TreeModel, read from a Library
+ *
+ * A ListStore keeps its own copy of every cell, so filling one with the whole
+ * library every time it was sorted took seconds. This model keeps one track
+ * index per row and nothing else: the cells are read from the library when
+ * the view asks for them, and in fixed height mode it only asks for the rows
+ * that are visible.
+ *
+ * auto model = MusicListModel::create(library, icon, time_text);
+ * view.set_model(model);
+ * view.append_column("Title", model->columns.title);
+ * // sorting it again
+ * std::vector<TrackIndex> rows;
+ * library.sort(Library::ARTIST, true, rows);
+ * view.unset_model();
+ * model->show(std::move(rows));
+ * view.set_model(model);
+ *
+ * show doesn't tell the views which row went where, they are detached while
+ * it is called and attached again after, which is cheaper for them than
+ * moving every row.
+ */
+class MusicListModel : public Glib::Object, public Gtk::TreeModel {
+  public:
+    struct Columns : public Gtk::TreeModelColumnRecord {
+        // the track's index in the library
+        Gtk::TreeModelColumn<int> id;
+        Gtk::TreeModelColumn<Glib::RefPtr<Gdk::Pixbuf>> icon;
+        Gtk::TreeModelColumn<Glib::ustring> title, time, artist, album,
+            file_name;
+        Columns() {
+            add(id);
+            add(icon);
+            add(title);
+            add(time);
+            add(artist);
+            add(album);
+            add(file_name);
+        }
+    };
+    // what the library doesn't have: a track's icon, and a duration as text
+    typedef std::function<Glib::RefPtr<Gdk::Pixbuf>(TrackIndex)> Icon;
+    typedef std::function<Glib::ustring(int milliseconds)> TimeText;
+
+    // library has to outlive the model
+    static Glib::RefPtr<MusicListModel>
+    create(const Library &library, Icon icon, TimeText time_text);
+
+    Columns columns;
+
+    // shows these tracks, row by row. the iterators there were are not valid
+    // anymore, and the views are not told (see above)
+    void show(std::vector<TrackIndex> rows);
+    // shows a track at the end, and tells the views
+    void append(TrackIndex i);
+    size_t size() const { return rows.size(); }
+
+  protected:
+    MusicListModel(const Library &library, Icon icon, TimeText time_text);
+
+    Gtk::TreeModelFlags get_flags_vfunc() const override;
+    int get_n_columns_vfunc() const override;
+    GType get_column_type_vfunc(int index) const override;
+    void get_value_vfunc(const iterator &iter, int column,
+                         Glib::ValueBase &value) const override;
+    bool iter_next_vfunc(const iterator &iter,
+                         iterator &iter_next) const override;
+    bool iter_children_vfunc(const iterator &parent,
+                             iterator &iter) const override;
+    bool iter_has_child_vfunc(const iterator &iter) const override;
+    int iter_n_children_vfunc(const iterator &iter) const override;
+    int iter_n_root_children_vfunc() const override;
+    bool iter_nth_child_vfunc(const iterator &parent, int n,
+                              iterator &iter) const override;
+    bool iter_nth_root_child_vfunc(int n, iterator &iter) const override;
+    bool iter_parent_vfunc(const iterator &child,
+                           iterator &iter) const override;
+    Path get_path_vfunc(const iterator &iter) const override;
+    bool get_iter_vfunc(const Path &path, iterator &iter) const override;
+    bool iter_is_valid(const iterator &iter) const override;
+
+  private:
+    const Library &library;
+    Icon icon;
+    TimeText time_text;
+    // the track on each row
+    std::vector<TrackIndex> rows;
+    // changes when rows do, so iterators from before can be told apart
+    int stamp = 1;
+
+    // points iter at row, false (and iter is not changed) if there is no
+    // such row
+    bool set_iter(int row, iterator &iter) const;
+    // the row iter points at
+    static int row_of(const iterator &iter);
+};
+
+#endif
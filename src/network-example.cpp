@@ -55,10 +55,10 @@ void get_lyrics_file(Client &c) {
     GetLyrics l;
     std::cout << "Enter a lrc filepath to get the lyrics: " << std::endl;
     std::cin >> l.filename;
-    Message m(MessageType::GET_LYRICS);
-    m << l;
     // maybe it is better to ask users that have that file than everyone
-    c.broadcast(m);
+    for (auto p : c.get_peers()) {
+        c.spawn(c.fetch_lyrics(p.first, l.filename));
+    }
 }
 
 void ask_for_picture_file(Client &c) {
@@ -66,7 +66,6 @@ void ask_for_picture_file(Client &c) {
     c.start_file_sharing("./interleaved.bmp");
     PrepareFileSharing pfs;
     for (auto p : c.get_peers()) {
-        Message m(MessageType::PREPARE_FILE_SHARING);
         pfs.assigned_id_for_peer = c.fs.new_peer(p.first);
         // change this path if you start the application in a different
         // directory
@@ -75,8 +74,7 @@ void ask_for_picture_file(Client &c) {
         sprintf(filename, "1-%d.bmp", pfs.assigned_id_for_peer + 1);
         path /= filename;
         pfs.name = path;
-        m << pfs;
-        c.push_message(p.first, m);
+        c.spawn(c.download_from_peer(p.first, pfs));
     }
 }
 
@@ -90,14 +88,12 @@ void ask_for_file(Client &c) {
     // only divide the file into 100 parts
     pfs.dictated_segment_count = 100;
     for (auto p : c.get_peers()) {
-        Message m(MessageType::PREPARE_FILE_SHARING);
         pfs.assigned_id_for_peer = c.fs.new_peer(p.first);
         // change this path if you start the application in a different
         // directory
         fs::path path(filepath);
         pfs.name = path;
-        m << pfs;
-        c.push_message(p.first, m);
+        c.spawn(c.download_from_peer(p.first, pfs));
     }
 }
 
@@ -0,0 +1,133 @@
+#include "peer-search.h"
+#include "library.h"
+#include <algorithm>
+
+PeerSearch::PeerSearch(std::string query, std::vector<peer_id> asked,
+                       std::chrono::milliseconds deadline)
+    : text(std::move(query)), key(Library::key(text)),
+      deadline(std::chrono::steady_clock::now() + deadline),
+      waiting(std::move(asked)) {}
+
+bool PeerSearch::expired() const {
+    return std::chrono::steady_clock::now() >= deadline;
+}
+
+std::chrono::milliseconds PeerSearch::remaining() const {
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - std::chrono::steady_clock::now());
+    return std::max(left, std::chrono::milliseconds(0));
+}
+
+bool PeerSearch::add(peer_id peer, const std::vector<Track> &tracks) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = std::find(waiting.begin(), waiting.end(), peer);
+    if (it == waiting.end() || expired()) {
+        return false;
+    }
+    waiting.erase(it);
+    for (const Track &t : tracks) {
+        std::string md5 = t.checksum.empty() ? "" : "md5:" + t.checksum;
+        std::string xxh = t.content_id.empty() ? "" : "xxh:" + t.content_id;
+        auto at = by_hash.end();
+        for (const std::string &h : {xxh, md5}) {
+            if (!h.empty() && at == by_hash.end()) {
+                at = by_hash.find(h);
+            }
+        }
+        size_t i;
+        if (at == by_hash.end()) {
+            i = found.size();
+            found.push_back({.ids = {peer}, .track = t});
+        } else {
+            i = at->second;
+            std::vector<peer_id> &ids = found[i].ids;
+            if (std::find(ids.begin(), ids.end(), peer) != ids.end()) {
+                continue;
+            }
+            // the track stays as the first peer sent it, so its best hash
+            // (which network_tracks is keyed by) doesn't change
+            ids.push_back(peer);
+        }
+        for (const std::string &h : {xxh, md5}) {
+            if (!h.empty()) {
+                by_hash.emplace(h, i);
+            }
+        }
+        if (std::find(changed.begin(), changed.end(), i) == changed.end()) {
+            changed.push_back(i);
+        }
+    }
+    return true;
+}
+
+void PeerSearch::give_up(peer_id peer) {
+    std::lock_guard<std::mutex> lock(mutex);
+    waiting.erase(std::remove(waiting.begin(), waiting.end(), peer),
+                  waiting.end());
+}
+
+bool PeerSearch::finished() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return waiting.empty() || expired();
+}
+
+std::vector<TrackWithOwners> PeerSearch::take() {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<TrackWithOwners> taken;
+    for (size_t i : changed) {
+        taken.push_back(found[i]);
+    }
+    changed.clear();
+    return taken;
+}
+
+int PeerSearch::rank(const Track &t) const {
+    std::string title = Library::key(t.title);
+    if (title == key) {
+        return 0;
+    }
+    if (title.starts_with(key)) {
+        return 1;
+    }
+    if (title.find(key) != std::string::npos) {
+        return 2;
+    }
+    if (Library::key(t.artist).find(key) != std::string::npos) {
+        return 3;
+    }
+    if (Library::key(t.album).find(key) != std::string::npos) {
+        return 4;
+    }
+    // the peer's store found it some other way (another case folding, its
+    // file name)
+    return 5;
+}
+
+std::vector<TrackWithOwners> PeerSearch::results() const {
+    std::vector<TrackWithOwners> sorted;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        sorted = found;
+    }
+    std::vector<int> ranks;
+    for (const TrackWithOwners &r : sorted) {
+        ranks.push_back(rank(r.track));
+    }
+    std::vector<size_t> order(sorted.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    // ties are left in the order they came in
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        if (ranks[a] != ranks[b]) {
+            return ranks[a] < ranks[b];
+        }
+        return sorted[a].ids.size() > sorted[b].ids.size();
+    });
+    std::vector<TrackWithOwners> ranked;
+    ranked.reserve(sorted.size());
+    for (size_t i : order) {
+        ranked.push_back(std::move(sorted[i]));
+    }
+    return ranked;
+}
@@ -0,0 +1,87 @@
+#ifndef PEER_SEARCH_H
+#define PEER_SEARCH_H
+
+#include "store-types.h"
+#include "util.h"
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// how long the peers have to answer a search, later answers are dropped
+#define PEER_SEARCH_DEADLINE_MS 2000
+// how many tracks a peer answers a search with at most
+#define PEER_SEARCH_LIMIT 200
+
+// a track from the network, and the peers that have it
+struct TrackWithOwners {
+    std::vector<peer_id> ids;
+    Track track;
+};
+
+/*
+ * PeerSearch: what the peers answered to one search
+ *
+ * Every peer that is asked answers from its own store (see Store::search).
+ * The same file from more than one peer is one result with all of them as
+ * owners: tracks are the same file if they have the same content id or the
+ * same md5 checksum, so a peer that only sends md5 still finds the others.
+ * Answers from peers that were not asked, or that come after the deadline,
+ * are dropped.
+ *
+ * The answers come in on the network thread and are looked at on the main
+ * one, so everything is behind a mutex:
+ *
+ * auto search = std::make_shared<PeerSearch>("belaf", peers);
+ * // for each peer, when it answers (or doesn't)
+ * search->add(id, tracks); / search->give_up(id);
+ * // on the main thread
+ * for (TrackWithOwners &t : search->take()) { ... }
+ * for (TrackWithOwners &t : search->results()) { ... } // best first
+ */
+class PeerSearch {
+  public:
+    PeerSearch(std::string query, std::vector<peer_id> asked,
+               std::chrono::milliseconds deadline =
+                   std::chrono::milliseconds(PEER_SEARCH_DEADLINE_MS));
+
+    const std::string &query() const { return text; }
+    // how long the peers still have, zero once the deadline has passed
+    std::chrono::milliseconds remaining() const;
+
+    // what peer answered, false if the answer was dropped
+    bool add(peer_id peer, const std::vector<Track> &tracks);
+    // peer will not answer (it has nothing, or it timed out)
+    void give_up(peer_id peer);
+    // every peer asked has answered or given up, or the deadline has passed
+    bool finished() const;
+
+    // the results that are new, or have new owners, since the last take
+    std::vector<TrackWithOwners> take();
+    // all the results so far, best first: the ones where the title is the
+    // query, starts with it, has it, then the ones where the artist or album
+    // has it, and among those the ones more peers have
+    std::vector<TrackWithOwners> results() const;
+
+  private:
+    std::string text;
+    // text, case folded (see Library::key)
+    std::string key;
+    std::chrono::steady_clock::time_point deadline;
+
+    mutable std::mutex mutex;
+    // the peers asked that have not answered yet
+    std::vector<peer_id> waiting;
+    std::vector<TrackWithOwners> found;
+    // index into found by "md5:" + checksum and "xxh:" + content id
+    std::unordered_map<std::string, size_t> by_hash;
+    // indexes into found that changed since the last take
+    std::vector<size_t> changed;
+
+    // lower is better, see results
+    int rank(const Track &t) const;
+    bool expired() const;
+};
+
+#endif
@@ -0,0 +1,59 @@
+#include "search-index.h"
+#include <algorithm>
+
+// the trigram at s[k], s[k + 1] and s[k + 2]
+static uint32_t trigram(std::string_view s, size_t k) {
+    return uint8_t(s[k]) << 16 | uint8_t(s[k + 1]) << 8 | uint8_t(s[k + 2]);
+}
+
+void SearchIndex::add(const Library &library, TrackIndex i) {
+    for (std::string_view field :
+         {library.title(i), library.artist(i), library.album(i)}) {
+        std::string key = Library::key(field);
+        for (size_t k = 0; k + 3 <= key.size(); k++) {
+            std::vector<TrackIndex> &tracks = postings[trigram(key, k)];
+            // tracks are mostly added in order, then this is the end
+            auto at = std::lower_bound(tracks.begin(), tracks.end(), i);
+            if (at == tracks.end() || *at != i) {
+                tracks.insert(at, i);
+            }
+        }
+    }
+}
+
+void SearchIndex::search(const Library &library, std::string_view query,
+                         std::vector<TrackIndex> &matches) const {
+    std::string key = Library::key(query);
+    if (key.size() < 3) {
+        library.filter(query, matches);
+        return;
+    }
+    matches.clear();
+    std::vector<const std::vector<TrackIndex> *> lists;
+    for (size_t k = 0; k + 3 <= key.size(); k++) {
+        auto it = postings.find(trigram(key, k));
+        if (it == postings.end()) {
+            return;
+        }
+        lists.push_back(&it->second);
+    }
+    // the shortest list has the fewest candidates, the others are only
+    // walked through as far as it goes
+    std::sort(lists.begin(), lists.end(),
+              [](auto *a, auto *b) { return a->size() < b->size(); });
+    lists.erase(std::unique(lists.begin(), lists.end()), lists.end());
+    std::vector<std::vector<TrackIndex>::const_iterator> at;
+    for (auto *list : lists) {
+        at.push_back(list->begin());
+    }
+    for (TrackIndex i : *lists[0]) {
+        bool in_all = true;
+        for (size_t l = 1; l < lists.size() && in_all; l++) {
+            at[l] = std::lower_bound(at[l], lists[l]->end(), i);
+            in_all = at[l] != lists[l]->end() && *at[l] == i;
+        }
+        if (in_all && library.matches(i, key)) {
+            matches.push_back(i);
+        }
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef SEARCH_INDEX_H
+#define SEARCH_INDEX_H
+
+#include "library.h"
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * SearchIndex: finds the tracks of a Library with some text in them, without
+ * looking at every track
+ *
+ * For every trigram (three bytes in a row) in a track's title, artist or
+ * album, case folded (see Library::key), the index has the tracks that have
+ * it. A query only looks at the tracks that have all of its trigrams, and
+ * checks those against the library, since having the trigrams doesn't mean
+ * having them in the right order. Queries shorter than a trigram are
+ * answered by Library::filter.
+ *
+ * SearchIndex index;
+ * for (TrackIndex i = 0; i < library.size(); i++) index.add(library, i);
+ * std::vector<TrackIndex> matches;
+ * index.search(library, "belaf", matches);
+ *
+ * The answers are the same as Library::filter's, in the same order.
+ */
+class SearchIndex {
+  public:
+    // indexes track i as it is in library now, call it again when it
+    // changes: what it was before is still indexed, but doesn't match anymore
+    // once it is checked
+    void add(const Library &library, TrackIndex i);
+    void clear() { postings.clear(); }
+
+    // the tracks whose title, artist or album has query in it, ignoring case,
+    // in the order they were added
+    void search(const Library &library, std::string_view query,
+                std::vector<TrackIndex> &matches) const;
+
+  private:
+    // the tracks that have each trigram, sorted
+    std::unordered_map<uint32_t, std::vector<TrackIndex>> postings;
+};
+
+#endif
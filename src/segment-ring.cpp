@@ -0,0 +1,66 @@
+#include "segment-ring.h"
+
+SegmentRing::SegmentRing(std::size_t capacity) {
+    std::size_t c = 1;
+    while (c < capacity) {
+        c <<= 1;
+    }
+    slots.resize(c);
+}
+
+void SegmentRing::reset(int first) {
+    for (auto &s : slots) {
+        s.reset();
+    }
+    head = 0;
+    next = first;
+    count = 0;
+}
+
+bool SegmentRing::put(ReturnSegment segment) {
+    if (segment.segment_id < next) {
+        return false;
+    }
+    std::size_t offset = segment.segment_id - next;
+    if (offset >= slots.size()) {
+        grow(offset + 1);
+    }
+    auto &slot = slots[(head + offset) & (slots.size() - 1)];
+    if (slot) {
+        return false;
+    }
+    slot = std::move(segment);
+    count++;
+    return true;
+}
+
+bool SegmentRing::ready() const { return slots[head].has_value(); }
+
+ReturnSegment SegmentRing::pop() {
+    ReturnSegment segment = std::move(*slots[head]);
+    slots[head].reset();
+    head = (head + 1) & (slots.size() - 1);
+    next++;
+    count--;
+    return segment;
+}
+
+int SegmentRing::next_id() const { return next; }
+
+std::size_t SegmentRing::size() const { return count; }
+
+std::size_t SegmentRing::capacity() const { return slots.size(); }
+
+void SegmentRing::grow(std::size_t min_capacity) {
+    std::size_t c = slots.size();
+    while (c < min_capacity) {
+        c <<= 1;
+    }
+    // unroll the ring so that the head is at slot 0 again
+    std::vector<std::optional<ReturnSegment>> bigger(c);
+    for (std::size_t i = 0; i < slots.size(); i++) {
+        bigger[i] = std::move(slots[(head + i) & (slots.size() - 1)]);
+    }
+    slots = std::move(bigger);
+    head = 0;
+}
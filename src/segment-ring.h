@@ -0,0 +1,56 @@
+#ifndef SEGMENT_RING_H
+#define SEGMENT_RING_H
+
+#include "message-type.h"
+#include <optional>
+#include <vector>
+
+/*
+ * Reassembly buffer for the segments of a file transfer
+ * Segments can be put in any order, they come out in order of segment id.
+ * Slot of segment s is (s - next_id()) positions after the head, so putting
+ * and popping are both O(1). The ring doubles when a segment lands beyond
+ * its end, which is rare since the credit of FileSharing bounds how far
+ * ahead segments are asked.
+ *
+ * For example:
+ * SegmentRing r;
+ * r.put(seg1); // r.ready() == false, still waiting for segment 0
+ * r.put(seg0); // r.ready() == true
+ * r.pop();     // seg0, then r.pop() gives seg1
+ */
+class SegmentRing {
+  public:
+    // capacity is rounded up to a power of two
+    SegmentRing(std::size_t capacity = 64);
+
+    // drop everything, the next segment to come out is first
+    void reset(int first = 0);
+
+    // false if the segment is written already or it is a duplicate
+    bool put(ReturnSegment segment);
+
+    // is the next segment in order here
+    bool ready() const;
+
+    // take the next segment in order, only call it if ready()
+    ReturnSegment pop();
+
+    // id of the segment that comes out next
+    int next_id() const;
+
+    // how many segments are held
+    std::size_t size() const;
+    std::size_t capacity() const;
+
+  private:
+    void grow(std::size_t min_capacity);
+
+    std::vector<std::optional<ReturnSegment>> slots;
+    // index of the slot of segment next
+    std::size_t head = 0;
+    int next = 0;
+    std::size_t count = 0;
+};
+
+#endif
@@ -5,14 +5,34 @@ bool operator==(const Track &lhs, const Track &rhs) {
             lhs.artist == rhs.artist && lhs.title == rhs.title &&
             lhs.lrcfile == rhs.lrcfile && lhs.path == rhs.path &&
             lhs.duration == rhs.duration && lhs.checksum == rhs.checksum &&
-            lhs.filesize == rhs.filesize);
+            lhs.filesize == rhs.filesize && lhs.mtime == rhs.mtime &&
+            lhs.inode == rhs.inode &&
+            lhs.cover_art == rhs.cover_art && lhs.extension == rhs.extension &&
+            lhs.canonical_wav == rhs.canonical_wav &&
+            lhs.content_id == rhs.content_id);
+}
+
+const std::string &track_hash(const Track &t, HashAlgorithm a) {
+    static const std::string none;
+    switch (a) {
+    case HashAlgorithm::MD5:
+        return t.checksum;
+    case HashAlgorithm::XXH3_128:
+        return t.content_id;
+    }
+    return none;
+}
+
+HashAlgorithm best_hash(const Track &t) {
+    return t.content_id.empty() ? HashAlgorithm::MD5 : HashAlgorithm::XXH3_128;
 }
 
 std::ostream &operator<<(std::ostream &os, const Track &t) {
     os << "For track " << t.id << ":"
        << "\nTitle: " << t.title << "\nAlbum: " << t.album
        << "\nArtist: " << t.artist << "\nDuration: " << t.duration
-       << "\nChecksum: " << t.checksum << "\nLyric File: " << t.lrcfile
+       << "\nChecksum: " << t.checksum << "\nContent ID: " << t.content_id
+       << "\nLyric File: " << t.lrcfile
        << "\nPath: " << t.path << std::endl;
     return os;
 }
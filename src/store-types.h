@@ -1,6 +1,8 @@
 #ifndef TYPE_H
 #define TYPE_H
 
+#include "content-hash.h"
+#include <cstdint>
 #include <iostream>
 #include <string>
 
@@ -26,12 +28,75 @@ struct Track {
     int duration = 0;
     // compute the file checksum before storing it into the database
     std::string checksum = "";
+    // the xxh3-128 of the audio file, computed together with checksum
+    // it is the id tracks are told apart by, checksum stays for peers that
+    // only know md5 (see negotiate_hash)
+    std::string content_id = "";
     // file size of the audio file
     int filesize = 0;
+    // last modification time of the audio file, together with filesize it
+    // tells a rescan whether the file needs to be hashed again
+    // it only means something on this machine, so it is not sent to peers
+    int64_t mtime = 0;
+    // the file's inode, so a rescan can tell a renamed file from a new one
+    // (0 means unknown), local like mtime
+    uint64_t inode = 0;
+    // the rest of what the music list shows, so it can be built without
+    // opening the audio files again
+    // does the file have embedded cover art?
+    bool cover_art = false;
+    // lowercase, with the dot
+    std::string extension = "";
+    // false once a .wav file turned out not to be one we can play directly
+    bool canonical_wav = true;
     // == can determine if the two track files are the "same"
     // "same" means all fields equal
     friend bool operator==(const Track &lhs, const Track &rhs);
     friend std::ostream &operator<<(std::ostream &os, const Track &t);
 };
 
+// the id of the track in algorithm a, "" if it does not have one
+const std::string &track_hash(const Track &t, HashAlgorithm a);
+// the best id the track has: the content id, or the checksum for tracks from
+// peers that don't send one
+HashAlgorithm best_hash(const Track &t);
+
+/*
+ * the columns of the tracks table, in the order queries select them
+ * a column's value is also its index in a query that selects every column
+ */
+enum class TrackColumn {
+    ID,
+    ALBUM,
+    ARTIST,
+    TITLE,
+    LRCFILE,
+    PATH,
+    DURATION,
+    CHECKSUM,
+    FILESIZE,
+    MTIME,
+    COVER_ART,
+    EXTENSION,
+    CANONICAL_WAV,
+    CONTENT_ID,
+    INODE,
+    COUNT
+};
+
+// a set of columns, one bit per TrackColumn
+typedef uint32_t TrackFields;
+
+constexpr TrackFields track_field(TrackColumn c) { return 1u << (int)c; }
+
+#define ALL_TRACK_FIELDS ((1u << (int)TrackColumn::COUNT) - 1)
+// what peers need to list and fetch our tracks, the other fields only mean
+// something in our database
+#define PEER_TRACK_FIELDS                                                      \
+    (track_field(TrackColumn::ALBUM) | track_field(TrackColumn::ARTIST) |      \
+     track_field(TrackColumn::TITLE) | track_field(TrackColumn::LRCFILE) |     \
+     track_field(TrackColumn::PATH) | track_field(TrackColumn::DURATION) |     \
+     track_field(TrackColumn::CHECKSUM) | track_field(TrackColumn::FILESIZE) | \
+     track_field(TrackColumn::CONTENT_ID))
+
 #endif
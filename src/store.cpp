@@ -1,28 +1,354 @@
 #include "store.h"
+#include <algorithm>
 
-Store::Store(bool drop_all, const std::string &filename)
-    : db(filename, SQLite::OPEN_CREATE | SQLite::OPEN_READWRITE) {
+// indexed by TrackColumn
+static const char *track_column_names[] = {
+    "id",       "album",    "artist",   "title",     "lrcfile",
+    "path",     "duration", "checksum", "filesize",  "mtime",
+    "cover_art", "extension", "canonical_wav", "content_id", "inode",
+};
+static_assert(sizeof(track_column_names) / sizeof(*track_column_names) ==
+              (int)TrackColumn::COUNT);
+
+// "SELECT <the columns in fields> FROM tracks"
+static std::string select_tracks(TrackFields fields = ALL_TRACK_FIELDS) {
+    std::string sql = "SELECT ";
+    bool first = true;
+    for (int c = 0; c < (int)TrackColumn::COUNT; c++) {
+        if (fields & track_field((TrackColumn)c)) {
+            sql += first ? "" : ", ";
+            sql += track_column_names[c];
+            first = false;
+        }
+    }
+    return sql + " FROM tracks ";
+}
+
+static bool has_column(SQLite::Database &db, const std::string &table,
+                       const std::string &column) {
+    SQLite::Statement q(db, "SELECT 1 FROM pragma_table_info(:table) "
+                            "WHERE name = :column");
+    q.bind(":table", table);
+    q.bind(":column", column);
+    return q.executeStep();
+}
+
+// the full text index used by search, kept up to date by triggers
+static void create_search_index(SQLite::Database &db) {
+    bool existed = db.tableExists("tracks_fts");
+    // the trigram tokenizer indexes every 3 characters, so a query matches
+    // anywhere inside a word like LIKE '%x%' did. it only stores the index,
+    // the text itself is read from tracks (external content)
+    db.exec("CREATE VIRTUAL TABLE IF NOT EXISTS tracks_fts USING fts5("
+            "title, artist, album, content='tracks', content_rowid='id', "
+            "tokenize='trigram')");
+    // external content tables have to be told about every change
+    db.exec("CREATE TRIGGER IF NOT EXISTS tracks_fts_insert "
+            "AFTER INSERT ON tracks BEGIN "
+            "INSERT INTO tracks_fts(rowid, title, artist, album) "
+            "VALUES (new.id, new.title, new.artist, new.album); "
+            "END");
+    db.exec("CREATE TRIGGER IF NOT EXISTS tracks_fts_delete "
+            "AFTER DELETE ON tracks BEGIN "
+            "INSERT INTO tracks_fts(tracks_fts, rowid, title, artist, album) "
+            "VALUES ('delete', old.id, old.title, old.artist, old.album); "
+            "END");
+    db.exec("CREATE TRIGGER IF NOT EXISTS tracks_fts_update "
+            "AFTER UPDATE ON tracks BEGIN "
+            "INSERT INTO tracks_fts(tracks_fts, rowid, title, artist, album) "
+            "VALUES ('delete', old.id, old.title, old.artist, old.album); "
+            "INSERT INTO tracks_fts(rowid, title, artist, album) "
+            "VALUES (new.id, new.title, new.artist, new.album); "
+            "END");
+    // tracks stored before the index existed
+    if (!existed) {
+        db.exec("INSERT INTO tracks_fts(tracks_fts) VALUES ('rebuild')");
+    }
+}
+
+/*
+ * every change ever made to the schema, in order
+ * PRAGMA user_version is how many of them a database has had, so opening it
+ * runs only the ones it is missing. never change one of them once it has been
+ * released, add a new one at the end instead
+ */
+struct Migration {
+    const char *description;
+    void (*run)(SQLite::Database &db);
+};
+
+static const Migration migrations[] = {
+    // databases from before user_version was used have some of these already,
+    // so the early ones check first
+    {"tracks table",
+     [](SQLite::Database &db) {
+         db.exec("CREATE TABLE IF NOT EXISTS tracks ("
+                 "id INTEGER PRIMARY KEY,"
+                 "album STRING, artist STRING, title STRING,"
+                 "lrcfile STRING, path INTEGER, duration INTEGER,"
+                 "checksum STRING, filesize INTEGER"
+                 ")");
+     }},
+    {"modification time",
+     [](SQLite::Database &db) {
+         if (!has_column(db, "tracks", "mtime")) {
+             db.exec("ALTER TABLE tracks ADD COLUMN mtime INTEGER DEFAULT 0");
+         }
+     }},
+    // every remote track is looked up by checksum, every scanned file by path
+    {"checksum and path indexes",
+     [](SQLite::Database &db) {
+         db.exec("CREATE INDEX IF NOT EXISTS tracks_checksum "
+                 "ON tracks(checksum)");
+         db.exec("CREATE INDEX IF NOT EXISTS tracks_path ON tracks(path)");
+     }},
+    {"full text index", create_search_index},
+    // what the music list needs besides the tags, so it can be built
+    // without opening the files
+    {"audio metadata",
+     [](SQLite::Database &db) {
+         db.exec("ALTER TABLE tracks ADD COLUMN cover_art INTEGER DEFAULT 0");
+         db.exec("ALTER TABLE tracks ADD COLUMN extension STRING DEFAULT ''");
+         db.exec(
+             "ALTER TABLE tracks ADD COLUMN canonical_wav INTEGER DEFAULT 1");
+         // the rows there are don't have it yet, so they must not look up
+         // to date to the next scan
+         db.exec("UPDATE tracks SET mtime = 0");
+     }},
+    // the faster hash tracks are identified by, see HashAlgorithm
+    {"content id",
+     [](SQLite::Database &db) {
+         db.exec("ALTER TABLE tracks ADD COLUMN content_id STRING DEFAULT ''");
+         db.exec("CREATE INDEX IF NOT EXISTS tracks_content_id "
+                 "ON tracks(content_id)");
+         // so the next scan hashes every file again and fills it in
+         db.exec("UPDATE tracks SET mtime = 0");
+     }},
+    // with size and mtime, what a rescan recognizes a file by even after it
+    // was renamed
+    {"inode",
+     [](SQLite::Database &db) {
+         db.exec("ALTER TABLE tracks ADD COLUMN inode INTEGER DEFAULT 0");
+         // so the next scan stores it for every file
+         db.exec("UPDATE tracks SET mtime = 0");
+     }},
+};
+
+#define SCHEMA_VERSION (int)(sizeof(migrations) / sizeof(*migrations))
+
+static int schema_version(SQLite::Database &db) {
+    SQLite::Statement q(db, "PRAGMA user_version");
+    q.executeStep();
+    return q.getColumn(0).getInt();
+}
+
+static bool create_tables(SQLite::Database &db, bool drop_all) {
+    // with a write ahead log a commit only appends to the log instead of
+    // rewriting pages and syncing twice, which is what makes rescans slow.
+    // it also lets the readers keep reading while something is written
+    // (in memory databases just keep their own journal mode)
+    db.exec("PRAGMA journal_mode = WAL");
+    db.exec("PRAGMA synchronous = NORMAL");
     if (drop_all) {
+        db.exec("DROP TABLE IF EXISTS tracks_fts");
         db.exec("DROP TABLE IF EXISTS tracks");
+        db.exec("PRAGMA user_version = 0");
         std::cout << "Tables dropped!" << std::endl;
     }
-    db.exec("CREATE TABLE IF NOT EXISTS tracks ("
-            "id INTEGER PRIMARY KEY,"
-            "album STRING, artist STRING, title STRING,"
-            "lrcfile STRING, path INTEGER, duration INTEGER,"
-            "checksum STRING, filesize INTEGER"
-            ")");
+    int version = schema_version(db);
+    if (version > SCHEMA_VERSION) {
+        std::cerr << "the database is from a newer version (schema "
+                  << version << "), things may not work" << std::endl;
+    }
+    for (; version < SCHEMA_VERSION; version++) {
+        // a migration and its version number go in together or not at all
+        SQLite::Transaction transaction(db);
+        migrations[version].run(db);
+        db.exec("PRAGMA user_version = " + std::to_string(version + 1));
+        transaction.commit();
+        std::cout << "Migrated to schema " << version + 1 << ": "
+                  << migrations[version].description << std::endl;
+    }
     std::cout << "Tables created!" << std::endl;
+    return true;
 }
-bool Store::create(Track &t, bool strict) {
 
-    SQLite::Statement q(db, "INSERT INTO tracks (album, artist, title, "
-                            "lrcfile, path, duration, checksum, filesize) "
-                            "VALUES (:album, :artist, :title, :lrcfile, :path, "
-                            ":duration, :checksum, :filesize)");
-    q.bind(":album", t.album);
-    q.bind(":artist", t.artist);
-    q.bind(":title", t.title);
+Store::Connection::Connection(const std::string &filename, bool writer,
+                              bool drop_all)
+    : db(filename,
+         writer ? SQLite::OPEN_CREATE | SQLite::OPEN_READWRITE
+                : SQLite::OPEN_READONLY,
+         STORE_BUSY_TIMEOUT_MS),
+      tables_created(writer && create_tables(db, drop_all)),
+      read_q(db, select_tracks() + "WHERE id = :id"),
+      search_q(db, select_tracks() + "WHERE album LIKE :album OR "
+                                     "artist LIKE :artist OR "
+                                     "title LIKE :title"),
+      fts_search_q(db, select_tracks() + "WHERE id IN ("
+                                         "SELECT rowid FROM tracks_fts "
+                                         "WHERE tracks_fts MATCH :query) "
+                                         "ORDER BY id"),
+      path_q(db, select_tracks() + "WHERE path = :path "),
+      checksum_q(db, select_tracks() + "WHERE checksum = :checksum "),
+      content_id_q(db, select_tracks() + "WHERE content_id = :content_id ") {}
+
+Store::Store(bool drop_all, const std::string &filename, int readers)
+    : writer(filename, true, drop_all),
+      insert_q(writer.db,
+               "INSERT INTO tracks (album, artist, title, "
+               "lrcfile, path, duration, checksum, filesize, mtime, "
+               "cover_art, extension, canonical_wav, content_id, inode) "
+               "VALUES (:album, :artist, :title, :lrcfile, :path, "
+               ":duration, :checksum, :filesize, :mtime, "
+               ":cover_art, :extension, :canonical_wav, :content_id, "
+               ":inode)"),
+      update_q(writer.db, "UPDATE tracks "
+                          "SET "
+                          "album = :album,"
+                          "artist = :artist,"
+                          "title = :title,"
+                          "lrcfile = :lrcfile,"
+                          "path = :path,"
+                          "duration = :duration,"
+                          "checksum = :checksum,"
+                          "filesize = :filesize,"
+                          "mtime = :mtime,"
+                          "cover_art = :cover_art,"
+                          "extension = :extension,"
+                          "canonical_wav = :canonical_wav,"
+                          "content_id = :content_id,"
+                          "inode = :inode "
+                          "WHERE id = :id"),
+      remove_q(writer.db, "DELETE FROM tracks "
+                          "WHERE id = :id"),
+      canonical_wav_q(writer.db, "UPDATE tracks "
+                                 "SET canonical_wav = :canonical_wav "
+                                 "WHERE path = :path"),
+      move_q(writer.db, "UPDATE tracks "
+                        "SET path = :path "
+                        "WHERE id = :id") {
+    // every connection to :memory: is a new empty database
+    if (filename != ":memory:" && !filename.empty()) {
+        for (int i = 0; i < readers; i++) {
+            this->readers.push_back(
+                std::make_unique<Connection>(filename, false, false));
+            idle_readers.push_back(this->readers.back().get());
+        }
+    }
+    load_checksums();
+}
+
+/*
+ * a connection to read from for as long as this lives
+ * waits until one of the readers is free, or takes the writer if there are no
+ * readers (in memory databases)
+ */
+class Store::Reader {
+  public:
+    Reader(Store &s) : s(s) {
+        if (s.readers.empty()) {
+            writer_lock = std::unique_lock(s.mutex);
+            c = &s.writer;
+            return;
+        }
+        std::unique_lock lock(s.readers_mux);
+        s.readers_cv.wait(lock, [&s] { return !s.idle_readers.empty(); });
+        c = s.idle_readers.back();
+        s.idle_readers.pop_back();
+    }
+    ~Reader() {
+        if (writer_lock.owns_lock()) {
+            return;
+        }
+        {
+            std::lock_guard lock(s.readers_mux);
+            s.idle_readers.push_back(c);
+        }
+        s.readers_cv.notify_one();
+    }
+    Connection &operator*() { return *c; }
+    Connection *operator->() { return c; }
+
+  private:
+    Store &s;
+    Connection *c;
+    std::unique_lock<std::recursive_mutex> writer_lock;
+};
+
+void Store::load_checksums() {
+    std::unordered_map<std::string, int> loaded_checksums, loaded_content_ids;
+    {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+        SQLite::Statement q(writer.db,
+                            "SELECT checksum, content_id FROM tracks");
+        while (q.executeStep()) {
+            std::string checksum = q.getColumn(0).getString();
+            std::string content_id = q.getColumn(1).getString();
+            if (!checksum.empty()) {
+                loaded_checksums[checksum]++;
+            }
+            if (!content_id.empty()) {
+                loaded_content_ids[content_id]++;
+            }
+        }
+    }
+    std::lock_guard lock(checksums_mux);
+    checksums = std::move(loaded_checksums);
+    content_ids = std::move(loaded_content_ids);
+}
+
+std::unordered_map<std::string, int> &Store::known_hashes(HashAlgorithm a) {
+    return a == HashAlgorithm::XXH3_128 ? content_ids : checksums;
+}
+
+void Store::remember_hashes(const Track &t) {
+    std::lock_guard lock(checksums_mux);
+    for (auto a : supported_hashes) {
+        // a track without a file, or one stored before it had this hash
+        if (!track_hash(t, a).empty()) {
+            known_hashes(a)[track_hash(t, a)]++;
+        }
+    }
+}
+
+void Store::forget_hashes(const Track &t) {
+    std::lock_guard lock(checksums_mux);
+    for (auto a : supported_hashes) {
+        auto &known = known_hashes(a);
+        auto it = known.find(track_hash(t, a));
+        if (it != known.end() && --it->second == 0) {
+            known.erase(it);
+        }
+    }
+}
+
+/*
+ * hands out one of the cached statements for a single use
+ * bindings from the previous use are cleared first, and the statement is reset
+ * when this goes out of scope so it does not keep a read transaction open
+ * (or keep the previous row around) while it sits in the cache
+ * the caller must hold the connection the statement belongs to
+ */
+class CachedQuery {
+  public:
+    CachedQuery(SQLite::Statement &q) : q(q) {
+        q.reset();
+        q.clearBindings();
+    }
+    ~CachedQuery() { q.reset(); }
+    SQLite::Statement *operator->() { return &q; }
+    SQLite::Statement &operator*() { return q; }
+
+  private:
+    SQLite::Statement &q;
+};
+
+bool Store::create(Track &t, bool strict) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    CachedQuery q(insert_q);
+    q->bind(":album", t.album);
+    q->bind(":artist", t.artist);
+    q->bind(":title", t.title);
 
     std::filesystem::path abs;
     if (!t.lrcfile.empty()) {
@@ -30,9 +356,9 @@ bool Store::create(Track &t, bool strict) {
             if (strict) {
                 return false;
             }
-            q.bind(":lrcfile", "");
+            q->bind(":lrcfile", "");
         }
-        q.bind(":lrcfile", abs.string());
+        q->bind(":lrcfile", abs.string());
     }
 
     if (!t.path.empty()) {
@@ -40,22 +366,42 @@ bool Store::create(Track &t, bool strict) {
             if (strict) {
                 return false;
             }
-            q.bind(":path", "");
+            q->bind(":path", "");
         } else {
             t.path = abs.string();
-            q.bind(":path", t.path);
-            t.filesize = get_file_size(t.path);
-            t.checksum.assign(checksum_of_track(t));
+            q->bind(":path", t.path);
+            set_stamp(t);
+            FileDigest d = digest_of_track(t);
+            t.checksum = d.checksum;
+            t.content_id = d.content_id;
         }
     }
-    q.bind(":duration", t.duration);
-    q.bind(":checksum", t.checksum);
-    q.bind(":filesize", t.filesize);
-    int nrows = q.exec();
+    q->bind(":duration", t.duration);
+    q->bind(":checksum", t.checksum);
+    q->bind(":filesize", t.filesize);
+    q->bind(":mtime", t.mtime);
+    q->bind(":cover_art", t.cover_art);
+    q->bind(":extension", t.extension);
+    q->bind(":canonical_wav", t.canonical_wav);
+    q->bind(":content_id", t.content_id);
+    q->bind(":inode", (int64_t)t.inode);
+    int nrows = q->exec();
+    if (nrows == 1) {
+        remember_hashes(t);
+    }
     return nrows ==
            1; // something is wrong if zero rows or more rows are affected
 }
 
+void Store::set_stamp(Track &t) {
+    // a file that can't be read has no stamp, so it never looks unchanged
+    FileStamp stamp;
+    get_file_stamp(t.path, stamp);
+    t.filesize = stamp.size;
+    t.mtime = stamp.mtime;
+    t.inode = stamp.inode;
+}
+
 bool Store::get_absolute_file(const std::string &name,
                               std::filesystem::path &path) {
     std::error_code ec;
@@ -71,48 +417,98 @@ bool Store::get_absolute_file(const std::string &name,
 }
 
 Track Store::read(int id) {
-    SQLite::Statement q(db, "SELECT * FROM tracks "
-                            "WHERE id = :id");
-    q.bind(":id", id);
-    bool has_row = q.executeStep();
+    Reader r(*this);
+    return read(*r, id);
+}
+
+Track Store::read(Connection &c, int id) {
+    CachedQuery q(c.read_q);
+    q->bind(":id", id);
+    bool has_row = q->executeStep();
     if (!has_row) {
         Track t = {.id = -1};
         return t;
     }
     Track t;
-    populate_track_from_get_column(q, t);
+    populate_track_from_get_column(*q, t);
     return t;
 }
 
-void Store::populate_track_from_get_column(SQLite::Statement &q, Track &t) {
-    int id = q.getColumn("id");
-    const char *album = q.getColumn("album");
-    const char *artist = q.getColumn("artist");
-    const char *title = q.getColumn("title");
-    const char *lrcfile = q.getColumn("lrcfile");
-    const char *path = q.getColumn("path");
-    int duration = q.getColumn("duration");
-    const char *checksum = q.getColumn("checksum");
-    int filesize = q.getColumn("filesize");
-
-    t.id = id;
-    t.album = std::string(album);
-    t.artist = std::string(artist);
-    t.title = std::string(title);
-    t.lrcfile = std::string(lrcfile);
-    t.path = std::string(path);
-    t.duration = duration;
-    t.checksum = std::string(checksum);
-    t.filesize = filesize;
-}
-
-std::vector<Track> Store::read_all() {
+void Store::populate_track_from_get_column(SQLite::Statement &q, Track &t,
+                                          TrackFields fields) {
+    // columns that are not selected don't take up an index
+    int index = 0;
+    for (int c = 0; c < (int)TrackColumn::COUNT; c++) {
+        if (!(fields & track_field((TrackColumn)c))) {
+            continue;
+        }
+        SQLite::Column column = q.getColumn(index++);
+        switch ((TrackColumn)c) {
+        case TrackColumn::ID:
+            t.id = column.getInt();
+            break;
+        case TrackColumn::ALBUM:
+            t.album = column.getString();
+            break;
+        case TrackColumn::ARTIST:
+            t.artist = column.getString();
+            break;
+        case TrackColumn::TITLE:
+            t.title = column.getString();
+            break;
+        case TrackColumn::LRCFILE:
+            t.lrcfile = column.getString();
+            break;
+        case TrackColumn::PATH:
+            t.path = column.getString();
+            break;
+        case TrackColumn::DURATION:
+            t.duration = column.getInt();
+            break;
+        case TrackColumn::CHECKSUM:
+            t.checksum = column.getString();
+            break;
+        case TrackColumn::FILESIZE:
+            t.filesize = column.getInt();
+            break;
+        case TrackColumn::MTIME:
+            t.mtime = column.getInt64();
+            break;
+        case TrackColumn::COVER_ART:
+            t.cover_art = column.getInt();
+            break;
+        case TrackColumn::EXTENSION:
+            t.extension = column.getString();
+            break;
+        case TrackColumn::CANONICAL_WAV:
+            t.canonical_wav = column.getInt();
+            break;
+        case TrackColumn::CONTENT_ID:
+            t.content_id = column.getString();
+            break;
+        case TrackColumn::INODE:
+            t.inode = column.getInt64();
+            break;
+        case TrackColumn::COUNT:
+            break;
+        }
+    }
+}
+
+std::vector<Track> Store::read_all(TrackFields fields) {
+    Reader r(*this);
+    // one statement per set of fields anybody asked for
+    auto it = r->read_all_q.find(fields);
+    if (it == r->read_all_q.end()) {
+        it = r->read_all_q.try_emplace(fields, r->db, select_tracks(fields))
+                 .first;
+    }
     std::vector<Track> tracks;
-    SQLite::Statement q(db, "SELECT * FROM tracks");
-    while (q.executeStep()) {
+    CachedQuery q(it->second);
+    while (q->executeStep()) {
         Track t;
-        populate_track_from_get_column(q, t);
-        tracks.push_back(t);
+        populate_track_from_get_column(*q, t, fields);
+        tracks.push_back(std::move(t));
     }
     return tracks;
 }
@@ -124,29 +520,22 @@ bool Store::update(int id, Track &t, bool strict) {
             return false;
         }
     }
-    SQLite::Statement q(db, "UPDATE tracks "
-                            "SET "
-                            "album = :album,"
-                            "artist = :artist,"
-                            "title = :title,"
-                            "lrcfile = :lrcfile,"
-                            "path = :path,"
-                            "duration = :duration,"
-                            "checksum = :checksum,"
-                            "filesize = :filesize "
-                            "WHERE id = :id");
-    q.bind(":album", t.album);
-    q.bind(":artist", t.artist);
-    q.bind(":title", t.title);
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    CachedQuery q(update_q);
+    // the hashes it had before, for the in memory sets
+    Track old = read(writer, id);
+    q->bind(":album", t.album);
+    q->bind(":artist", t.artist);
+    q->bind(":title", t.title);
 
     if (!t.lrcfile.empty()) {
         if (!get_absolute_file(t.path, abs)) {
             if (strict) {
                 return false;
             }
-            q.bind(":lrcfile", "");
+            q->bind(":lrcfile", "");
         } else {
-            q.bind(":lrcfile", abs.string());
+            q->bind(":lrcfile", abs.string());
         }
     }
 
@@ -156,111 +545,282 @@ bool Store::update(int id, Track &t, bool strict) {
 
                 return false;
             }
-            q.bind(":path", "");
+            q->bind(":path", "");
         }
-        q.bind(":path", abs.string());
+        q->bind(":path", abs.string());
         // calculate new checksum
         // if the file changes, the checksum changes
         // if it is not the value is still the same
-        t.checksum = checksum_of_track(t);
+        FileDigest d = digest_of_track(t);
+        t.checksum = d.checksum;
+        t.content_id = d.content_id;
+        set_stamp(t);
+    }
+    q->bind(":duration", t.duration);
+    q->bind(":checksum", t.checksum);
+    q->bind(":filesize", t.filesize);
+    q->bind(":mtime", t.mtime);
+    q->bind(":cover_art", t.cover_art);
+    q->bind(":extension", t.extension);
+    q->bind(":canonical_wav", t.canonical_wav);
+    q->bind(":content_id", t.content_id);
+    q->bind(":inode", (int64_t)t.inode);
+    q->bind(":id", id);
+    int nrows = q->exec();
+    if (nrows == 1) {
+        forget_hashes(old);
+        remember_hashes(t);
     }
-    q.bind(":duration", t.duration);
-    q.bind(":checksum", t.checksum);
-    q.bind(":filesize", t.filesize);
-    q.bind(":id", id);
-    int nrows = q.exec();
     return nrows == 1;
 }
 
 bool Store::remove(int id) {
-    SQLite::Statement q(db, "DELETE FROM tracks "
-                            "WHERE id = :id");
-    q.bind(":id", id);
-    int nrows = q.exec();
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    CachedQuery q(remove_q);
+    Track old = read(writer, id);
+    q->bind(":id", id);
+    int nrows = q->exec();
+    if (nrows == 1) {
+        forget_hashes(old);
+    }
     return nrows == 1;
 };
 
+int Store::remove_many(const std::vector<int> &ids) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    int count = 0;
+    try {
+        // one transaction, like upsert_many
+        SQLite::Transaction transaction(writer.db);
+        for (int id : ids) {
+            if (remove(id)) {
+                count++;
+            }
+        }
+        transaction.commit();
+    } catch (...) {
+        // rolled back by now, so the checksums it forgot are still there
+        load_checksums();
+        throw;
+    }
+    return count;
+}
+
+bool Store::move_file(int id, const std::string &path) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    CachedQuery q(move_q);
+    q->bind(":path", stored_path(path));
+    q->bind(":id", id);
+    return q->exec() == 1;
+}
+
+bool Store::set_canonical_wav(const std::string &path, bool canonical) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    CachedQuery q(canonical_wav_q);
+    q->bind(":canonical_wav", canonical);
+    q->bind(":path", stored_path(path));
+    return q->exec() > 0;
+}
+
+// number of characters, not bytes, in a utf-8 string
+static size_t utf8_length(const std::string &str) {
+    return std::count_if(str.begin(), str.end(),
+                         [](char c) { return (c & 0xC0) != 0x80; });
+}
+
 std::vector<Track> Store::search(const std::string &str) {
+    Reader r(*this);
+    if (utf8_length(str) < 3) {
+        // trigrams can't match anything shorter than 3 characters
+        return search_with_like(*r, str);
+    }
+    // the whole string as one fts5 phrase, so nothing in it is read as
+    // query syntax. quotes are escaped by doubling them
+    std::string phrase = "\"";
+    for (char c : str) {
+        phrase += c;
+        if (c == '"') {
+            phrase += c;
+        }
+    }
+    phrase += "\"";
+
     std::vector<Track> tracks;
-    SQLite::Statement q(db, "SELECT * FROM tracks "
-                            "WHERE album LIKE :album OR "
-                            "artist LIKE :artist OR "
-                            "title LIKE :title");
+    CachedQuery q(r->fts_search_q);
+    q->bind(":query", phrase);
+    while (q->executeStep()) {
+        Track t;
+        populate_track_from_get_column(*q, t);
+        tracks.push_back(t);
+    }
+    return tracks;
+}
+
+std::vector<Track> Store::search_with_like(Connection &c,
+                                           const std::string &str) {
+    std::vector<Track> tracks;
+    CachedQuery q(c.search_q);
     char *sandwiched = new char[str.size() + 15];
     snprintf(sandwiched, str.size() + 15, "%%%s%%", str.c_str());
-    q.bind(":album", sandwiched);
-    q.bind(":artist", sandwiched);
-    q.bind(":title", sandwiched);
+    q->bind(":album", sandwiched);
+    q->bind(":artist", sandwiched);
+    q->bind(":title", sandwiched);
     delete[] sandwiched;
-    while (q.executeStep()) {
+    while (q->executeStep()) {
         Track t;
-        populate_track_from_get_column(q, t);
+        populate_track_from_get_column(*q, t);
         tracks.push_back(t);
     }
     return tracks;
 }
 
 bool Store::search_with_path(const std::string &str, Track &t) {
-    SQLite::Statement q(db, "SELECT * FROM tracks "
-                            "WHERE path = :path ");
-    q.bind(":path", str);
-    bool success = q.executeStep();
+    Reader r(*this);
+    return search_with_path(*r, str, t);
+}
+
+bool Store::search_with_path(Connection &c, const std::string &str, Track &t) {
+    CachedQuery q(c.path_q);
+    q->bind(":path", str);
+    bool success = q->executeStep();
     if (success) {
-        populate_track_from_get_column(q, t);
+        populate_track_from_get_column(*q, t);
     }
     return success;
 }
 
-bool Store::has_checksum(const std::string &str) {
-    SQLite::Statement q(db, "SELECT * FROM tracks "
-                            "WHERE checksum = :checksum ");
-    q.bind(":checksum", str);
-    bool success = q.executeStep();
-    return success;
+bool Store::has_checksum(const std::string &str, HashAlgorithm a) {
+    std::lock_guard lock(checksums_mux);
+    return known_hashes(a).contains(str);
 }
 
-bool Store::search_with_checksum(const std::string &str, Track &t) {
-    SQLite::Statement q(db, "SELECT * FROM tracks "
-                            "WHERE checksum = :checksum ");
-    q.bind(":checksum", str);
-    bool success = q.executeStep();
+std::vector<bool> Store::has_checksums(const std::vector<std::string> &strs,
+                                       HashAlgorithm a) {
+    std::lock_guard lock(checksums_mux);
+    auto &known = known_hashes(a);
+    std::vector<bool> has;
+    has.reserve(strs.size());
+    for (auto &str : strs) {
+        has.push_back(known.contains(str));
+    }
+    return has;
+}
+
+std::vector<bool> Store::has_files(const std::vector<Track> &tracks) {
+    std::lock_guard lock(checksums_mux);
+    std::vector<bool> has;
+    has.reserve(tracks.size());
+    for (auto &t : tracks) {
+        HashAlgorithm a = best_hash(t);
+        has.push_back(known_hashes(a).contains(track_hash(t, a)));
+    }
+    return has;
+}
+
+bool Store::search_with_checksum(const std::string &str, Track &t,
+                                 HashAlgorithm a) {
+    Reader r(*this);
+    bool by_content_id = a == HashAlgorithm::XXH3_128;
+    CachedQuery q(by_content_id ? r->content_id_q : r->checksum_q);
+    q->bind(by_content_id ? ":content_id" : ":checksum", str);
+    bool success = q->executeStep();
     if (success) {
-        populate_track_from_get_column(q, t);
+        populate_track_from_get_column(*q, t);
     }
     return success;
 }
 
 bool Store::upsert(Track &t, bool strict) {
-    // compute the checksum again to see if they differs
-    Track returned;
-    bool has = search_with_path(t.path, returned);
-    if (!has) {
-        return create(t);
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    Track stored;
+    bool has = search_with_path(writer, stored_path(t.path), stored);
+    return upsert(t, has ? &stored : nullptr, strict);
+}
+
+bool Store::upsert(Track &t, Track *stored, bool strict) {
+    if (!stored) {
+        return create(t, strict);
     }
     // if there is such file, just update it
+    t.id = stored->id;
     return update(t.id, t, strict);
 }
 
+bool unchanged_since(const Track &stored, const std::string &path) {
+    FileStamp stamp;
+    return get_file_stamp(path, stamp) && unchanged_since(stored, stamp);
+}
+
+bool unchanged_since(const Track &stored, const FileStamp &stamp) {
+    return stored.mtime != 0 && stored.mtime == stamp.mtime &&
+           stored.filesize == (int)stamp.size && stored.inode == stamp.inode;
+}
+
 int Store::upsert_many(std::vector<Track> &tracks, bool strict) {
-    int inserted = 0;
+    // hash every file that needs it first, all at once and without holding
+    // the writer. the upserts below then find the checksums in the cache
+    std::vector<std::string> to_hash;
+    for (auto &t : tracks) {
+        std::string path = stored_path(t.path);
+        std::error_code ec;
+        if (!std::filesystem::is_regular_file(path, ec)) {
+            continue;
+        }
+        Track stored;
+        if (!search_with_path(path, stored) || !unchanged_since(stored, path)) {
+            to_hash.push_back(path);
+        }
+    }
+    hasher.digests(to_hash);
+
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    // one transaction for the whole batch, so the log is synced once at the
+    // end instead of once per track
+    SQLite::Transaction transaction(writer.db);
+    // a failed batch is rolled back, so the checksums it added are wrong
+    struct ReloadUnlessCommitted {
+        Store *s;
+        bool committed = false;
+        ~ReloadUnlessCommitted() {
+            if (!committed) {
+                s->load_checksums();
+            }
+        }
+    } reload{this};
+    int count = 0;
     for (auto &t : tracks) {
-        bool good = upsert(t, strict);
-        if (good) {
-            inserted++;
+        std::string path = stored_path(t.path);
+        Track stored;
+        bool has = search_with_path(writer, path, stored);
+        if (has && unchanged_since(stored, path)) {
+            // the caller still gets what the database knows about the file
+            t.id = stored.id;
+            t.path = stored.path;
+            t.checksum = stored.checksum;
+            t.content_id = stored.content_id;
+            t.filesize = stored.filesize;
+            t.mtime = stored.mtime;
+            t.inode = stored.inode;
+            count++;
+            continue;
+        }
+        if (upsert(t, has ? &stored : nullptr, strict)) {
+            count++;
         }
     }
-    return inserted;
+    transaction.commit();
+    reload.committed = true;
+    return count;
 }
 
-std::string Store::checksum_of_track(Track &t) {
-    uint8_t result[16];
-    // md5.h only supports C-style files
-    FILE *fp = fopen(t.path.c_str(), "r");
-    md5File(fp, result);
-    std::vector<unsigned char> vec;
-    vec.resize(16);
-    for (int i = 0; i < 16; i++) {
-        vec.push_back(result[i]);
+std::string Store::stored_path(const std::string &path) {
+    // files that exist are stored with their absolute path
+    std::filesystem::path abs;
+    if (!path.empty() && std::filesystem::exists(path) &&
+        get_absolute_file(path, abs)) {
+        return abs.string();
     }
-    return to_hex_string(result);
+    return path;
 }
+
+FileDigest Store::digest_of_track(Track &t) { return hasher.digest(t.path); }
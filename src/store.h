@@ -1,16 +1,26 @@
 #ifndef STORE_H
 #define STORE_H
 
-#include "md5.h"
+#include "file-hasher.h"
 #include "store-types.h"
 #include "util.h"
 #include <SQLiteCpp/SQLiteCpp.h>
 #include <cstdio>
 #include <filesystem>
+#include <condition_variable>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <system_error>
+#include <unordered_map>
 #include <vector>
 
+// how many read only connections a Store keeps open next to the writer
+#define STORE_READERS 4
+// how long a connection waits for a lock held by another one before failing
+#define STORE_BUSY_TIMEOUT_MS 5000
+
 /*
  * Store class: provides a convenient way to store things to or take things from
  * the database. Underneath this class it executes the SQL query. There is no
@@ -29,13 +39,24 @@
  * s.create(t);
  *
  * All other methods are used similarly, with different return types.
+ *
+ * THREADS:
+ * A Store can be used from any number of threads. Everything that writes goes
+ * through one connection, one thread at a time. Everything that only reads
+ * borrows one of a few read only connections instead, so reads are not held
+ * up by a long write like a rescan (the database is in WAL mode, where
+ * readers see the last commit while a write is going on).
+ * An in memory database can't be opened twice, so there everything goes
+ * through the one connection.
  */
 class Store {
   public:
     // initialize the database
     // drop_all: should we drop all tables?
     // filename: which file should sqlite use?
-    Store(bool drop_all, const std::string &filename = "sqlite.db");
+    // readers: how many connections are kept open for reading
+    Store(bool drop_all, const std::string &filename = "sqlite.db",
+          int readers = STORE_READERS);
 
     // add one track into the database
     // return value indicates if it is successful or not
@@ -53,7 +74,8 @@ class Store {
     // get all tracks from the database
     // returns a vector full of tracks
     // if there is nothing in the datbase, the vector is empty
-    std::vector<Track> read_all();
+    // fields: which fields to read, the others keep their default values
+    std::vector<Track> read_all(TrackFields fields = ALL_TRACK_FIELDS);
 
     // update one track
     // return a boolean indicating if it is successful or not
@@ -65,36 +87,137 @@ class Store {
     // tracks that are not inserted before should not have a valid id
     bool upsert(Track &t, bool strict = false);
 
+    // upsert a whole batch in one transaction
+    // files that are unchanged since they were stored (see unchanged_since)
+    // are skipped, without hashing them again
+    // returns how many of the tracks are in the database afterwards
     int upsert_many(std::vector<Track> &tracks, bool strict = false);
 
+    // remember whether the file at path is a wav file that can be played
+    // directly, so it is not tried again next time
+    bool set_canonical_wav(const std::string &path, bool canonical);
+
     // delete one track (can't use the word delete in C++)
     // return a boolean indicating if it is successful or not
     bool remove(int id);
+    // remove a whole batch in one transaction
+    // returns how many of them were there
+    int remove_many(const std::vector<int> &ids);
+
+    // the file of track id was renamed to path, and did not change otherwise
+    // only the path is updated, nothing is read or hashed again
+    bool move_file(int id, const std::string &path);
 
     // search with text
-    // returns a vector of search results
+    // matches any part of the title, artist or album, ignoring case
+    // returns a vector of search results, ordered by id
     // if nothing is matched, the vector is empty
     std::vector<Track> search(const std::string &str);
 
     // search with file path
     bool search_with_path(const std::string &str, Track &t);
 
-    // search with file path
-    bool has_checksum(const std::string &str);
-    bool search_with_checksum(const std::string &str, Track &t);
+    // is there a local file with this checksum?
+    // a: which of the file's hashes str is, see HashAlgorithm
+    // answered from memory, no query is run
+    bool has_checksum(const std::string &str,
+                      HashAlgorithm a = HashAlgorithm::MD5);
+    // has_checksum for a whole batch, the results are in the same order
+    std::vector<bool> has_checksums(const std::vector<std::string> &strs,
+                                    HashAlgorithm a = HashAlgorithm::MD5);
+    // is there a local file with the same content as each of these tracks?
+    // each one is compared by the best hash it has (see best_hash)
+    std::vector<bool> has_files(const std::vector<Track> &tracks);
+    bool search_with_checksum(const std::string &str, Track &t,
+                              HashAlgorithm a = HashAlgorithm::MD5);
 
   private:
-    // the database handle for executing each query
-    // it should not be accessed outside this class
-    SQLite::Database db;
+    /*
+     * one connection to the database and the read queries prepared on it
+     * every query is compiled once and reused afterwards, so a call only pays
+     * for binding and stepping. the statements are declared after db so they
+     * are finalized before the connection is closed
+     */
+    struct Connection {
+        // writer: open it for writing and create the tables
+        Connection(const std::string &filename, bool writer, bool drop_all);
+        SQLite::Database db;
+        // only a member so that the tables exist before the statements below
+        // are prepared
+        bool tables_created;
+        SQLite::Statement read_q;
+        // projected read_all statements by the fields they select, prepared
+        // the first time those fields are asked for
+        std::map<TrackFields, SQLite::Statement> read_all_q;
+        SQLite::Statement search_q;
+        SQLite::Statement fts_search_q;
+        SQLite::Statement path_q;
+        SQLite::Statement checksum_q;
+        SQLite::Statement content_id_q;
+    };
+    // borrows a connection to read from, see the top of this file
+    class Reader;
+
+    // held by whoever uses the writer
+    std::recursive_mutex mutex;
+    Connection writer;
+    SQLite::Statement insert_q;
+    SQLite::Statement update_q;
+    SQLite::Statement remove_q;
+    SQLite::Statement canonical_wav_q;
+    SQLite::Statement move_q;
+
+    std::vector<std::unique_ptr<Connection>> readers;
+    // the readers nobody is using right now
+    std::mutex readers_mux;
+    std::condition_variable readers_cv;
+    std::vector<Connection *> idle_readers;
+
+    // how many tracks have each checksum and each content id, so peers'
+    // databases can be checked against ours without a query per track. they
+    // follow create, update and remove, and are loaded from the table again if
+    // a batch is rolled back
+    std::mutex checksums_mux;
+    std::unordered_map<std::string, int> checksums;
+    std::unordered_map<std::string, int> content_ids;
+    void load_checksums();
+    // the one of the two above for a, the caller holds checksums_mux
+    std::unordered_map<std::string, int> &known_hashes(HashAlgorithm a);
+    void remember_hashes(const Track &t);
+    void forget_hashes(const Track &t);
+
+    // the writer needs to see its own changes, so these can run on any
+    // connection
+    Track read(Connection &c, int id);
+    bool search_with_path(Connection &c, const std::string &str, Track &t);
+
+    // the old search, scans every row
+    // still used for queries that are too short for the full text index
+    std::vector<Track> search_with_like(Connection &c, const std::string &str);
+
+    // stored is the row with the same path, nullptr if there is none
+    bool upsert(Track &t, Track *stored, bool strict);
+    // the path a file is looked up with, absolute if the file exists
+    std::string stored_path(const std::string &path);
     // helper function that turns a column into Track struct
     // the consumer should executeStep first
-    void populate_track_from_get_column(SQLite::Statement &q, Track &t);
+    // fields: the columns the query selected, in TrackColumn order
+    void populate_track_from_get_column(SQLite::Statement &q, Track &t,
+                                        TrackFields fields = ALL_TRACK_FIELDS);
+    // fills in the size, modification time and inode t.path has now
+    void set_stamp(Track &t);
     // get absolute path of a file
     bool get_absolute_file(const std::string &name,
                            std::filesystem::path &path);
 
-    std::string checksum_of_track(Track &t);
+    // checksums of the audio files, remembered while they don't change
+    FileHasher hasher;
+    FileDigest digest_of_track(Track &t);
 };
 
+// the file at path is still the one stored was read from: the same size,
+// modification time and inode as when it was stored
+bool unchanged_since(const Track &stored, const std::string &path);
+bool unchanged_since(const Track &stored, const FileStamp &stamp);
+
 #endif
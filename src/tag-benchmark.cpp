@@ -0,0 +1,160 @@
+// how many files a second the music list can be described at, reading the
+// tags the way taglib_get_data used to and with read_file_tags
+// usage: tag-benchmark <music folder>
+#include "cover-art.h"
+#include "file-tags.h"
+#include "listfiles.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <taglib/attachedpictureframe.h>
+#include <taglib/fileref.h>
+#include <taglib/id3v2tag.h>
+#include <taglib/mp4coverart.h>
+#include <taglib/mp4file.h>
+#include <taglib/mp4tag.h>
+#include <taglib/mpegfile.h>
+
+// what taglib_get_data did for a file (with the null checks it didn't have,
+// so files without tags don't crash it)
+static FileTags old_tags(const std::filesystem::path &file) {
+    FileTags tags;
+    std::string ext = file.extension().string();
+    TagLib::FileRef f(file.c_str());
+    if (f.isNull() || !f.tag()) {
+        return tags;
+    }
+    tags.title = !f.tag()->title().to8Bit(true).empty()
+                     ? f.tag()->title().to8Bit(true)
+                     : "None";
+    tags.album = !f.tag()->album().to8Bit(true).empty()
+                     ? f.tag()->album().to8Bit(true)
+                     : "None";
+    tags.artist = !f.tag()->artist().to8Bit(true).empty()
+                      ? f.tag()->artist().to8Bit(true)
+                      : "None";
+    tags.duration = f.audioProperties()->lengthInMilliseconds();
+    if (ext == ".mp3" &&
+        dynamic_cast<TagLib::MPEG::File *>(f.file())->ID3v2Tag())
+        tags.cover_art = !(dynamic_cast<TagLib::MPEG::File *>(f.file())
+                               ->ID3v2Tag()
+                               ->frameListMap()["APIC"]
+                               .isEmpty());
+    else if (ext == ".m4a")
+        tags.cover_art = !(dynamic_cast<TagLib::MP4::File *>(f.file())
+                               ->tag()
+                               ->item("covr")
+                               .toCoverArtList()
+                               .isEmpty());
+    return tags;
+}
+
+// and what DisplayCoverArtSidebar did after it: open the file again, write the
+// picture out, and load it back
+static Glib::RefPtr<Gdk::Pixbuf>
+old_thumbnail(const std::filesystem::path &file) {
+    std::string ext = file.extension().string();
+    std::string picture;
+    if (ext == ".mp3") {
+        auto f = TagLib::MPEG::File(file.c_str());
+        auto frame = (TagLib::ID3v2::AttachedPictureFrame *)*f.ID3v2Tag()
+                         ->frameListMap()["APIC"]
+                         .begin();
+        picture.assign(frame->picture().data(), frame->picture().size());
+    } else if (ext == ".m4a") {
+        TagLib::MP4::CoverArt cover = TagLib::MP4::File(file.c_str())
+                                          .tag()
+                                          ->item("covr")
+                                          .toCoverArtList()
+                                          .front();
+        picture.assign(cover.data().data(), cover.data().size());
+    }
+    std::string name = "CoverArt.bin";
+    std::ofstream fout(name, std::ios::out | std::ios::binary);
+    fout.write(picture.data(), picture.size());
+    fout.close();
+    auto thumbnail = Gdk::Pixbuf::create_from_file(name)->scale_simple(
+        COVER_ART_THUMBNAIL, COVER_ART_THUMBNAIL,
+        Gdk::InterpType::INTERP_BILINEAR);
+    std::filesystem::remove(name);
+    return thumbnail;
+}
+
+template <class F>
+static void measure(const char *what,
+                    const std::vector<std::filesystem::path> &files,
+                    F describe) {
+    auto start = std::chrono::steady_clock::now();
+    size_t covers = 0;
+    for (auto &file : files) {
+        covers += describe(file);
+    }
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    std::cout << what << ": " << files.size() / seconds << " files/s ("
+              << covers << " with cover art)" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        std::cout << "usage: " << argv[0] << " <music folder>" << std::endl;
+        return 1;
+    }
+    Gdk::Pixbuf::get_formats(); // loads the pixbuf modules, not timed
+    auto files = ListFiles::listfiles(argv[1], {".mp3", ".m4a", ".wav",
+                                                ".ogg", ".flac"},
+                                      true, true, false);
+    std::cout << files.size() << " files" << std::endl;
+    // the first pass warms the page cache up for the others
+    measure("warming up", files, [](auto &file) {
+        return read_file_tags(file.string()).cover_art;
+    });
+
+    measure("tags, taglib_get_data", files,
+            [](auto &file) { return old_tags(file).cover_art; });
+    measure("tags, read_file_tags", files, [](auto &file) {
+        return read_file_tags(file.string()).cover_art;
+    });
+    measure("tags and thumbnail, taglib_get_data + temp file", files,
+            [](auto &file) {
+                FileTags tags = old_tags(file);
+                if (tags.cover_art) {
+                    tags.thumbnail = old_thumbnail(file);
+                }
+                return bool(tags.thumbnail);
+            });
+    measure("tags and thumbnail, read_file_tags", files, [](auto &file) {
+        return bool(
+            read_file_tags(file.string(), COVER_ART_THUMBNAIL).thumbnail);
+    });
+
+    // like the scanner's workers
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+    auto start = std::chrono::steady_clock::now();
+    std::atomic<size_t> next = 0;
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; i++) {
+        workers.emplace_back([&]() {
+            for (size_t k; (k = next++) < files.size();) {
+                read_file_tags(files[k].string(), COVER_ART_THUMBNAIL);
+            }
+        });
+    }
+    for (auto &w : workers) {
+        w.join();
+    }
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    std::cout << "tags and thumbnail, read_file_tags on " << threads
+              << " threads: " << files.size() / seconds << " files/s"
+              << std::endl;
+    return 0;
+}
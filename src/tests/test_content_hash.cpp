@@ -0,0 +1,50 @@
+#include "../content-hash.h"
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+using namespace testing;
+
+static std::string hash_of(HashAlgorithm a, const std::string &data) {
+    auto h = ContentHash::create(a);
+    h->update((const uint8_t *)data.data(), data.size());
+    return h->hex_digest();
+}
+
+TEST(content_hash, known_values) {
+    EXPECT_EQ(hash_of(HashAlgorithm::MD5, "abc"),
+              "900150983cd24fb0d6963f7d28e17f72");
+    EXPECT_EQ(hash_of(HashAlgorithm::MD5, ""),
+              "d41d8cd98f00b204e9800998ecf8427e");
+    // what xxhsum -H2 prints
+    EXPECT_EQ(hash_of(HashAlgorithm::XXH3_128, "abc"),
+              "06b05ab6733a618578af5f94892f3950");
+    EXPECT_EQ(hash_of(HashAlgorithm::XXH3_128, ""),
+              "99aa06d3014798d86001c324468d497f");
+}
+
+TEST(content_hash, pieces_hash_like_the_whole) {
+    std::string data(100000, 'x');
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = (char)(i * 7);
+    }
+    for (auto a : supported_hashes) {
+        auto h = ContentHash::create(a);
+        // odd sizes, so no piece lines up with a block
+        for (size_t at = 0; at < data.size(); at += 333) {
+            size_t n = std::min<size_t>(333, data.size() - at);
+            h->update((const uint8_t *)data.data() + at, n);
+        }
+        EXPECT_EQ(h->hex_digest(), hash_of(a, data)) << hash_name(a);
+    }
+}
+
+TEST(content_hash, negotiation) {
+    // both sides know both, the faster one wins
+    EXPECT_EQ(negotiate_hash(supported_hashes), HashAlgorithm::XXH3_128);
+    EXPECT_EQ(negotiate_hash({HashAlgorithm::MD5, HashAlgorithm::XXH3_128}),
+              HashAlgorithm::XXH3_128);
+    EXPECT_EQ(negotiate_hash({HashAlgorithm::MD5}), HashAlgorithm::MD5);
+    // nothing in common, or an algorithm from a newer version
+    EXPECT_EQ(negotiate_hash({}), HashAlgorithm::MD5);
+    EXPECT_EQ(negotiate_hash({(HashAlgorithm)200}), HashAlgorithm::MD5);
+}
@@ -1,10 +1,24 @@
 #include "../store.h"
+#include <fcntl.h>
 #include <filesystem>
+#include <future>
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
+#include <random>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
 
 using namespace testing;
 
+// somewhere in the temp directory for a test's files, with a name of its own
+// each run, ctest runs the tests side by side
+static std::filesystem::path temp_path(const std::filesystem::path &name) {
+    return std::filesystem::temp_directory_path() /
+           (name.stem().string() + "_" + std::to_string(std::random_device()()) +
+            name.extension().string());
+}
+
 TEST(db_test, get_empty_tracks) {
     Store s(true, ":memory:");
     auto entry = s.read_all();
@@ -193,3 +207,392 @@ TEST(db_test, search_with_checksum) {
     bool has = s.has_checksum("334a");
     EXPECT_EQ(has, true);
 }
+
+TEST(db_test, cached_statements_are_reused) {
+    Store s(true, ":memory:");
+    Track t = {.title = "Jamaica Farewell", .checksum = "334a"};
+    s.create(t);
+    // a lookup that stops at the first row must not leave the statement
+    // half way through for the next caller
+    for (int i = 0; i < 3; i++) {
+        Track found;
+        EXPECT_TRUE(s.search_with_checksum("334a", found));
+        EXPECT_EQ(found.title, "Jamaica Farewell");
+        EXPECT_FALSE(s.has_checksum("nope"));
+    }
+    // bindings from an earlier call must not leak into the next one
+    Track empty;
+    s.create(empty);
+    EXPECT_EQ(s.read(2).checksum, "");
+}
+
+// writes count small files into a fresh directory and returns their tracks
+static std::vector<Track> make_files(const std::filesystem::path &dir,
+                                     int count) {
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    std::vector<Track> tracks;
+    std::string content(4096, 'x');
+    for (int i = 0; i < count; i++) {
+        auto path = dir / (std::to_string(i) + ".wav");
+        content[0] = (char)i;
+        FILE *fp = fopen(path.c_str(), "w");
+        fwrite(content.data(), 1, content.size(), fp);
+        fclose(fp);
+        tracks.push_back({.title = std::to_string(i), .path = path.string()});
+    }
+    return tracks;
+}
+
+TEST(db_test, upsert_many_inserts_then_updates) {
+    auto dir = temp_path("test_db_upsert");
+    auto tracks = make_files(dir, 10);
+    Store s(true, ":memory:");
+    EXPECT_EQ(s.upsert_many(tracks), 10);
+    auto stored = s.read_all();
+    ASSERT_EQ(stored.size(), 10);
+    EXPECT_FALSE(stored[0].checksum.empty());
+    EXPECT_NE(stored[0].mtime, 0);
+    EXPECT_EQ(stored[0].filesize, 4096);
+
+    // the same files again: nothing new, and the ids are filled in
+    std::vector<Track> again;
+    for (auto &t : stored) {
+        again.push_back({.title = t.title, .path = t.path});
+    }
+    EXPECT_EQ(s.upsert_many(again), 10);
+    EXPECT_EQ(s.read_all().size(), 10);
+    EXPECT_EQ(again[3].id, stored[3].id);
+    EXPECT_EQ(again[3].checksum, stored[3].checksum);
+    std::filesystem::remove_all(dir);
+}
+
+TEST(db_test, upsert_many_rehashes_changed_files) {
+    auto dir = temp_path("test_db_rehash");
+    auto tracks = make_files(dir, 2);
+    Store s(true, ":memory:");
+    s.upsert_many(tracks);
+    std::string before = s.read(1).checksum;
+
+    // a different size is enough to notice, whatever the mtime says
+    FILE *fp = fopen(tracks[0].path.c_str(), "a");
+    fputs("more", fp);
+    fclose(fp);
+    std::vector<Track> rescan = {{.path = tracks[0].path},
+                                 {.path = tracks[1].path}};
+    EXPECT_EQ(s.upsert_many(rescan), 2);
+    Track changed = s.read(1);
+    EXPECT_EQ(s.read_all().size(), 2);
+    EXPECT_NE(changed.checksum, before);
+    EXPECT_EQ(changed.filesize, 4100);
+    std::filesystem::remove_all(dir);
+}
+
+TEST(db_test, search_follows_updates_and_removes) {
+    Store s(true, ":memory:");
+    Track t = {.album = "Try to Remember", .title = "Jamaica Farewell"};
+    s.create(t);
+    EXPECT_EQ(s.search("maica").size(), 1);
+    EXPECT_EQ(s.search("FAREWELL").size(), 1);
+
+    t.title = "Scarlet Ribbons";
+    s.update(1, t);
+    EXPECT_TRUE(s.search("maica").empty());
+    EXPECT_EQ(s.search("ribbon").size(), 1);
+
+    s.remove(1);
+    EXPECT_TRUE(s.search("ribbon").empty());
+    EXPECT_TRUE(s.search("Remember").empty());
+}
+
+TEST(db_test, search_with_odd_characters) {
+    Store s(true, ":memory:");
+    Track t = {.artist = "Guns N' Roses", .title = "\"Heroes\" (live)"};
+    s.create(t);
+    EXPECT_EQ(s.search("\"heroes\"").size(), 1);
+    EXPECT_EQ(s.search("N' R").size(), 1);
+    EXPECT_EQ(s.search("(live) OR").size(), 0);
+    // too short for the full text index
+    EXPECT_EQ(s.search("N'").size(), 1);
+    EXPECT_EQ(s.search("x").size(), 0);
+}
+
+// a library of count tracks where every 1000th title has needle in it
+static void make_library(Store &s, int count) {
+    const char *artists[] = {"The Brothers Four", "Harry Belafonte",
+                             "Simon & Garfunkel", "Joan Baez"};
+    std::vector<Track> tracks;
+    for (int i = 0; i < count; i++) {
+        std::string title = "Song number " + std::to_string(i);
+        if (i % 1000 == 0) {
+            title += " needle";
+        }
+        // the files don't exist, a unique path keeps them apart
+        tracks.push_back({.album = "Album " + std::to_string(i / 12),
+                          .artist = artists[i % 4],
+                          .title = title,
+                          .path = "/nowhere/" + std::to_string(i)});
+    }
+    // create complains about every missing file
+    auto *cerr = std::cerr.rdbuf(nullptr);
+    s.upsert_many(tracks);
+    std::cerr.rdbuf(cerr);
+    std::cerr.clear();
+}
+
+TEST(db_test, search_a_library) {
+    const int count = 5000;
+    Store s(true, ":memory:");
+    make_library(s, count);
+    auto found = s.search("needle");
+    ASSERT_EQ(found.size(), count / 1000);
+    EXPECT_EQ(found[0].title, "Song number 0 needle");
+    EXPECT_EQ(s.search("GARFUNKEL").size(), count / 4);
+    EXPECT_EQ(s.search("Album 332").size(), 12);
+}
+
+TEST(db_test, checksum_set_follows_changes) {
+    Store s(true, ":memory:");
+    Track a = {.checksum = "aaaa"}, b = {.checksum = "bbbb"};
+    s.create(a);
+    s.create(b);
+    // a copy of the same file
+    Track c = {.checksum = "aaaa"};
+    s.create(c);
+    EXPECT_THAT(s.has_checksums({"aaaa", "cccc", "bbbb"}),
+                ElementsAre(true, false, true));
+
+    b.checksum = "cccc";
+    s.update(2, b);
+    EXPECT_THAT(s.has_checksums({"bbbb", "cccc"}), ElementsAre(false, true));
+
+    // one copy is still there
+    s.remove(1);
+    EXPECT_TRUE(s.has_checksum("aaaa"));
+    s.remove(3);
+    EXPECT_FALSE(s.has_checksum("aaaa"));
+}
+
+TEST(db_test, checksum_set_is_loaded_from_disk) {
+    auto file = temp_path("test_db_reopen.db");
+    std::filesystem::remove(file);
+    {
+        Store s(true, file.string());
+        Track t = {.checksum = "334a"};
+        s.create(t);
+    }
+    Store s(false, file.string());
+    EXPECT_TRUE(s.has_checksum("334a"));
+    EXPECT_FALSE(s.has_checksum("334b"));
+    std::filesystem::remove(file);
+}
+
+TEST(db_test, read_all_with_some_fields) {
+    Store s(true, ":memory:");
+    Track t = {.album = "Try to Remember",
+               .artist = "The Brothers Four",
+               .title = "Jamaica Farewell",
+               .duration = 175000,
+               .checksum = "334a"};
+    s.create(t);
+
+    auto tracks = s.read_all(track_field(TrackColumn::CHECKSUM) |
+                             track_field(TrackColumn::TITLE));
+    ASSERT_EQ(tracks.size(), 1);
+    EXPECT_EQ(tracks[0].title, "Jamaica Farewell");
+    EXPECT_EQ(tracks[0].checksum, "334a");
+    // not selected, left alone
+    EXPECT_EQ(tracks[0].id, -1);
+    EXPECT_EQ(tracks[0].album, "");
+    EXPECT_EQ(tracks[0].duration, 0);
+
+    tracks = s.read_all(PEER_TRACK_FIELDS);
+    t.id = -1;
+    EXPECT_EQ(tracks[0], t);
+    // and everything again, with the statement that was there first
+    t.id = 1;
+    EXPECT_EQ(s.read_all()[0], t);
+}
+
+TEST(db_test, reads_are_answered_while_writing) {
+    auto dir = temp_path("test_db_readers");
+    std::filesystem::create_directories(dir);
+    Store s(true, (dir / "readers.db").string());
+    Track t = {.title = "Jamaica Farewell", .checksum = "334a"};
+    s.create(t);
+
+    // a rescan that stays in its transaction until the test lets it go: it
+    // hashes a fifo, so it waits for the test to write into it
+    auto fifo = dir / "stuck.wav";
+    ASSERT_EQ(mkfifo(fifo.c_str(), 0600), 0);
+    std::vector<Track> batch = {{.title = "Scarlet Ribbons",
+                                 .path = fifo.string()}};
+    std::thread rescan([&s, &batch] { s.upsert_many(batch); });
+    // the fifo can only be opened like this once the rescan is reading it
+    int fd;
+    while ((fd = open(fifo.c_str(), O_WRONLY | O_NONBLOCK)) < 0) {
+        std::this_thread::yield();
+    }
+
+    auto reads = std::async(std::launch::async, [&s] {
+        Track found;
+        bool has = s.search_with_checksum("334a", found);
+        // the batch is not committed yet, so only the first track is seen
+        EXPECT_TRUE(has);
+        EXPECT_EQ(s.read_all(PEER_TRACK_FIELDS).size(), 1);
+        EXPECT_TRUE(s.search("ribbons").empty());
+    });
+    // if they waited for the writer they would never be answered, it is not
+    // about how fast they are
+    EXPECT_EQ(reads.wait_for(std::chrono::seconds(30)),
+              std::future_status::ready);
+
+    write(fd, "x", 1);
+    close(fd);
+    rescan.join();
+    reads.wait();
+    EXPECT_EQ(s.read_all().size(), 2);
+    std::filesystem::remove_all(dir);
+}
+
+TEST(db_test, old_database_is_migrated) {
+    auto file = temp_path("test_db_old.db");
+    std::filesystem::remove(file);
+    {
+        // the schema before anything was versioned
+        SQLite::Database db(file.string(),
+                            SQLite::OPEN_CREATE | SQLite::OPEN_READWRITE);
+        db.exec("CREATE TABLE tracks ("
+                "id INTEGER PRIMARY KEY,"
+                "album STRING, artist STRING, title STRING,"
+                "lrcfile STRING, path INTEGER, duration INTEGER,"
+                "checksum STRING, filesize INTEGER)");
+        db.exec("INSERT INTO tracks (album, artist, title, lrcfile, path, "
+                "duration, checksum, filesize) VALUES ('Try to Remember', "
+                "'The Brothers Four', 'Jamaica Farewell', '', '', 175000, "
+                "'334a', 0)");
+    }
+    for (int i = 0; i < 2; i++) {
+        // the second time there is nothing left to do
+        Store s(false, file.string());
+        Track t = s.read(1);
+        EXPECT_EQ(t.title, "Jamaica Farewell");
+        EXPECT_EQ(t.mtime, 0);
+        EXPECT_EQ(t.cover_art, false);
+        EXPECT_EQ(t.extension, "");
+        EXPECT_EQ(t.canonical_wav, true);
+        // the full text index is built for the tracks that were there
+        EXPECT_EQ(s.search("farewell").size(), 1);
+        EXPECT_TRUE(s.has_checksum("334a"));
+    }
+    SQLite::Database db(file.string());
+    SQLite::Statement q(db, "PRAGMA user_version");
+    q.executeStep();
+    EXPECT_EQ(q.getColumn(0).getInt(), 7);
+    std::filesystem::remove(file);
+}
+
+TEST(db_test, audio_metadata_is_stored) {
+    auto dir = temp_path("test_db_metadata");
+    auto tracks = make_files(dir, 1);
+    tracks[0].cover_art = true;
+    tracks[0].extension = ".wav";
+    Store s(true, ":memory:");
+    s.upsert_many(tracks);
+    Track t = s.read(1);
+    EXPECT_EQ(t.cover_art, true);
+    EXPECT_EQ(t.extension, ".wav");
+    EXPECT_EQ(t.canonical_wav, true);
+
+    EXPECT_TRUE(s.set_canonical_wav(tracks[0].path, false));
+    EXPECT_EQ(s.read(1).canonical_wav, false);
+    EXPECT_FALSE(s.set_canonical_wav("/nowhere.wav", false));
+    std::filesystem::remove_all(dir);
+}
+
+TEST(db_test, content_ids_are_stored_and_known) {
+    auto dir = temp_path("test_db_content_id");
+    auto tracks = make_files(dir, 2);
+    Store s(true, ":memory:");
+    s.upsert_many(tracks);
+    Track t = s.read(1);
+    ASSERT_EQ(t.content_id.size(), 32);
+    EXPECT_NE(t.content_id, t.checksum);
+    EXPECT_EQ(t.content_id, tracks[0].content_id);
+
+    EXPECT_TRUE(s.has_checksum(t.content_id, HashAlgorithm::XXH3_128));
+    EXPECT_FALSE(s.has_checksum(t.content_id, HashAlgorithm::MD5));
+    Track found;
+    EXPECT_TRUE(
+        s.search_with_checksum(t.content_id, found, HashAlgorithm::XXH3_128));
+    EXPECT_EQ(found.path, t.path);
+
+    // remote tracks are compared by the best hash they have
+    Track by_content_id = {.checksum = "nope", .content_id = t.content_id};
+    Track by_checksum = {.checksum = t.checksum};
+    Track unknown = {.checksum = t.checksum, .content_id = "nope"};
+    EXPECT_THAT(s.has_files({by_content_id, by_checksum, unknown}),
+                ElementsAre(true, true, false));
+
+    s.remove(t.id);
+    EXPECT_FALSE(s.has_checksum(t.content_id, HashAlgorithm::XXH3_128));
+    std::filesystem::remove_all(dir);
+}
+
+TEST(db_test, file_stamp_agrees_with_the_other_helpers) {
+    auto dir = temp_path("test_db_stamp");
+    auto tracks = make_files(dir, 1);
+    FileStamp stamp;
+    ASSERT_TRUE(get_file_stamp(tracks[0].path, stamp));
+    EXPECT_EQ(stamp.size, get_file_size(tracks[0].path));
+    EXPECT_EQ(stamp.mtime, get_file_mtime(tracks[0].path));
+#ifdef __linux__
+    EXPECT_NE(stamp.inode, 0);
+#endif
+    EXPECT_FALSE(get_file_stamp(dir / "nothing.wav", stamp));
+    std::filesystem::remove_all(dir);
+}
+
+// only linux has the inode that tells a renamed file from a copy
+#ifdef __linux__
+TEST(db_test, renamed_files_keep_their_row) {
+    auto dir = temp_path("test_db_rename");
+    auto tracks = make_files(dir, 2);
+    Store s(true, ":memory:");
+    s.upsert_many(tracks);
+    Track before = s.read(1);
+    EXPECT_NE(before.inode, 0);
+
+    auto renamed = dir / "renamed.wav";
+    std::filesystem::rename(before.path, renamed);
+    // the file is still the same one, only the path changed
+    EXPECT_TRUE(unchanged_since(before, renamed.string()));
+    EXPECT_TRUE(s.move_file(before.id, renamed.string()));
+    Track after = s.read(1);
+    EXPECT_EQ(after.path, std::filesystem::canonical(renamed).string());
+    EXPECT_EQ(after.content_id, before.content_id);
+    EXPECT_EQ(after.inode, before.inode);
+
+    // a copy has the same size and content, but it is another file
+    auto copy = dir / "copy.wav";
+    std::filesystem::copy_file(renamed, copy);
+    std::filesystem::last_write_time(copy,
+                                     std::filesystem::last_write_time(renamed));
+    EXPECT_FALSE(unchanged_since(after, copy.string()));
+    std::filesystem::remove_all(dir);
+}
+#endif
+
+TEST(db_test, remove_many_forgets_the_checksums) {
+    auto dir = temp_path("test_db_remove_many");
+    auto tracks = make_files(dir, 3);
+    Store s(true, ":memory:");
+    s.upsert_many(tracks);
+    EXPECT_EQ(s.remove_many({1, 3, 42}), 2);
+    auto left = s.read_all();
+    ASSERT_EQ(left.size(), 1);
+    EXPECT_EQ(left[0].id, 2);
+    EXPECT_FALSE(s.has_checksum(tracks[0].checksum));
+    EXPECT_TRUE(s.has_checksum(tracks[1].checksum));
+    std::filesystem::remove_all(dir);
+}
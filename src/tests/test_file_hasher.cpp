@@ -0,0 +1,127 @@
+#include "../file-hasher.h"
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <random>
+
+using namespace testing;
+
+static void write_file(const std::filesystem::path &path,
+                       const std::string &content) {
+    FILE *fp = fopen(path.c_str(), "wb");
+    fwrite(content.data(), 1, content.size(), fp);
+    fclose(fp);
+}
+
+class FileHasherTest : public Test {
+  protected:
+    void SetUp() override {
+        // a name of its own each run, ctest runs the tests side by side
+        dir = std::filesystem::temp_directory_path() /
+              ("test_file_hasher_" + std::to_string(std::random_device()()));
+        std::filesystem::remove_all(dir);
+        std::filesystem::create_directories(dir);
+    }
+    void TearDown() override { std::filesystem::remove_all(dir); }
+    std::filesystem::path dir;
+};
+
+TEST_F(FileHasherTest, known_checksums) {
+    write_file(dir / "fox", "The quick brown fox jumps over the lazy dog");
+    write_file(dir / "empty", "");
+    FileHasher h;
+    EXPECT_EQ(h.checksum(dir / "fox"), "9e107d9d372bb6826bd81d3542a419d6");
+    EXPECT_EQ(h.checksum(dir / "empty"), "d41d8cd98f00b204e9800998ecf8427e");
+    EXPECT_EQ(h.checksum(dir / "missing"), "");
+
+    // the content id comes from the same read
+    FileDigest d = h.digest(dir / "fox");
+    EXPECT_EQ(d.checksum, "9e107d9d372bb6826bd81d3542a419d6");
+    EXPECT_EQ(d.content_id, "ddd650205ca3e7fa24a1cc2e3a8a7651");
+    EXPECT_EQ(h.digest(dir / "missing").content_id, "");
+}
+
+TEST_F(FileHasherTest, larger_than_one_read) {
+    // crosses a read boundary, with a byte that text mode could mangle
+    std::string content(HASH_READ_SIZE + 100, '\r');
+    content[HASH_READ_SIZE] = '\n';
+    write_file(dir / "big", content);
+
+    MD5Context ctx;
+    md5Init(&ctx);
+    md5Update(&ctx, (uint8_t *)content.data(), content.size());
+    md5Finalize(&ctx);
+
+    FileHasher h;
+    EXPECT_EQ(h.checksum(dir / "big"), to_hex_string(ctx.digest));
+}
+
+TEST_F(FileHasherTest, changed_files_are_hashed_again) {
+    auto path = dir / "song.wav";
+    write_file(path, "one");
+    FileHasher h;
+    std::string first = h.checksum(path);
+    EXPECT_EQ(h.checksum(path), first);
+
+    // a different size is noticed even within the same mtime tick
+    write_file(path, "three");
+    EXPECT_NE(h.checksum(path), first);
+}
+
+TEST_F(FileHasherTest, batch_matches_one_by_one) {
+    std::vector<std::string> paths;
+    for (int i = 0; i < 20; i++) {
+        auto path = dir / std::to_string(i);
+        write_file(path, std::string(i * 1000, 'a' + i));
+        paths.push_back(path);
+    }
+    paths.push_back(dir / "missing");
+
+    FileHasher parallel(4), serial(1);
+    auto sums = parallel.checksums(paths);
+    ASSERT_EQ(sums.size(), paths.size());
+    for (size_t i = 0; i < paths.size(); i++) {
+        EXPECT_EQ(sums[i], serial.checksum(paths[i]));
+    }
+    EXPECT_EQ(sums.back(), "");
+}
+
+TEST_F(FileHasherTest, batch_matches_md5) {
+    // read boundaries, block boundaries and the ends of files all fall in
+    // different places for each of them
+    std::vector<size_t> sizes = {
+        0, 1, 63, 64, 65, 1000, HASH_READ_SIZE - 1, HASH_READ_SIZE,
+        HASH_READ_SIZE + 63, 2 * HASH_READ_SIZE + 100};
+    std::vector<std::string> paths, expected;
+    for (size_t i = 0; i < sizes.size() * 2; i++) {
+        std::string content(sizes[i % sizes.size()], 0);
+        for (size_t j = 0; j < content.size(); j++) {
+            content[j] = (char)(j * 131 + i);
+        }
+        auto path = dir / std::to_string(i);
+        write_file(path, content);
+        paths.push_back(path);
+
+        MD5Context ctx;
+        md5Init(&ctx);
+        md5Update(&ctx, (uint8_t *)content.data(), content.size());
+        md5Finalize(&ctx);
+        expected.push_back(to_hex_string(ctx.digest));
+    }
+    FileHasher h(1);
+    EXPECT_EQ(h.checksums(paths), expected);
+}
+
+TEST_F(FileHasherTest, many_workers_read_less_at_once) {
+    FileHasher h(256);
+    EXPECT_LT(h.get_read_size(), HASH_READ_SIZE);
+    EXPECT_LE(h.get_read_size() * md5Lanes() * h.get_threads(),
+              HASH_BUFFER_BUDGET);
+    EXPECT_EQ(h.get_read_size() % 4096, 0);
+    // a few reads per file, and the hashes don't change
+    std::string content(3 * h.get_read_size() + 100, 0);
+    for (size_t j = 0; j < content.size(); j++) {
+        content[j] = (char)(j * 131);
+    }
+    write_file(dir / "large", content);
+    EXPECT_EQ(h.checksum(dir / "large"), FileHasher(1).checksum(dir / "large"));
+}
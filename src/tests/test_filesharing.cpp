@@ -1,22 +1,28 @@
 #include "../file-sharing.h"
+#include <climits>
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
 using namespace testing;
 
-TEST(test_filesharing, pausing_and_playing) {
+TEST(test_filesharing, nothing_is_written_while_paused) {
     FileSharing f;
     int id = f.new_peer(1);
-    EXPECT_EQ(f.paused(), false);
+    f.set_segment_count(1);
+    f.set_file_info(1, 1);
+    f.segment_requested(id, f.next_segment_for(id));
+    f.push_segment(ReturnSegment{0, id, {'a'}});
+    int written = 0;
+    auto write = [&](const ReturnSegment &rs, bool end) { written++; };
 
-    f.pause_writing();
-    EXPECT_EQ(f.paused(), true);
+    f.must_pause();
     EXPECT_EQ(f.is_peer_idle(id), true);
+    f.try_writing_segment(write);
+    EXPECT_EQ(written, 0);
 
-    f.resume_writing();
-    EXPECT_EQ(f.paused(), false);
-    f.if_idle([](int assigned_id) {});
-    EXPECT_EQ(f.is_peer_idle(id), false);
+    f.stop_must_pause();
+    f.try_writing_segment(write);
+    EXPECT_EQ(written, 1);
 }
 
 TEST(test_filesharing, make_it_die) {
@@ -28,3 +34,229 @@ TEST(test_filesharing, make_it_die) {
     f.increment_peer_failure(id);
     EXPECT_EQ(f.is_peer_dead(id), true);
 }
+
+TEST(test_filesharing, segments_of_a_peer_can_arrive_out_of_order) {
+    FileSharing f;
+    int id = f.new_peer(1);
+    f.set_segment_count(4);
+    f.set_file_info(1, 4);
+    for (int s = 0; s < 4; s++) {
+        f.segment_requested(id, f.next_segment_for(id));
+    }
+    // a retried segment arrives after the later ones
+    for (int s : {1, 3, 0, 2}) {
+        f.push_segment(ReturnSegment{s, id, {char('a' + s)}});
+    }
+    std::string written;
+    bool ended = false;
+    f.try_writing_segment([&](const ReturnSegment &rs, bool end) {
+        written += rs.body[0];
+        ended = end;
+    });
+    EXPECT_EQ(written, "abcd");
+    EXPECT_TRUE(ended);
+}
+
+TEST(test_filesharing, segments_that_were_not_asked_for_are_dropped) {
+    FileSharing f;
+    int id = f.new_peer(1);
+    f.set_segment_count(100);
+    f.set_file_info(1, 100);
+    int s = f.next_segment_for(id);
+    f.segment_requested(id, s);
+    f.push_segment(ReturnSegment{INT_MAX, id, {'x'}});
+    f.push_segment(ReturnSegment{100, id, {'x'}});
+    f.push_segment(ReturnSegment{-1, id, {'x'}});
+    // given out later, not yet
+    f.push_segment(ReturnSegment{s + 1, id, {'x'}});
+    f.push_segment(ReturnSegment{s, id, {'a'}});
+
+    std::string written;
+    f.try_writing_segment([&](const ReturnSegment &rs, bool end) {
+        written += rs.body[0];
+    });
+    EXPECT_EQ(written, "a");
+}
+
+// a clock that only moves when the test says so
+struct FakeClock {
+    std::chrono::steady_clock::time_point t;
+    FileSharing::Clock clock() {
+        return [this]() { return t; };
+    }
+};
+
+TEST(test_filesharing, timeout_follows_round_trip_time) {
+    FakeClock c;
+    FileSharing f(c.clock());
+    int id = f.new_peer(1);
+    f.set_segment_count(100);
+    EXPECT_EQ(f.get_timeout(id), INITIAL_RTO);
+
+    // first sample: srtt = 1000, rttvar = 500
+    int s = f.next_segment_for(id);
+    f.segment_requested(id, s);
+    c.t += 1000ms;
+    f.push_segment(ReturnSegment{s, id, {}});
+    EXPECT_EQ(f.get_timeout(id), 3000ms);
+
+    // a steady peer, the variance goes away
+    for (int i = 0; i < 50; i++) {
+        s = f.next_segment_for(id);
+        f.segment_requested(id, s);
+        c.t += 1000ms;
+        f.push_segment(ReturnSegment{s, id, {}});
+    }
+    EXPECT_LT(f.get_timeout(id), 1100ms);
+    EXPECT_GE(f.get_timeout(id), 1000ms);
+
+    // back off when it times out
+    auto before = f.get_timeout(id);
+    s = f.next_segment_for(id);
+    f.segment_requested(id, s);
+    f.segment_timed_out(id, s);
+    EXPECT_EQ(f.get_timeout(id), before * 2);
+    for (int i = 0; i < 10; i++) {
+        f.segment_timed_out(id, s);
+    }
+    EXPECT_EQ(f.get_timeout(id), MAX_RTO);
+}
+
+TEST(test_filesharing, timed_out_segment_goes_to_another_peer) {
+    FileSharing f;
+    int a = f.new_peer(1);
+    int b = f.new_peer(2);
+    f.set_segment_count(10);
+    EXPECT_EQ(f.next_segment_for(a), 0);
+    f.segment_requested(a, 0);
+    f.segment_timed_out(a, 0);
+    EXPECT_FALSE(f.all_segments_asked());
+    // a failed to send it, so a gets a new one and b gets the retry
+    EXPECT_EQ(f.next_segment_for(a), 1);
+    EXPECT_EQ(f.next_segment_for(b), 0);
+
+    // nobody else is alive, so a has to try again
+    f.segment_requested(b, 0);
+    f.segment_timed_out(b, 0);
+    f.die_peer(a);
+    EXPECT_EQ(f.next_segment_for(b), 0);
+}
+
+TEST(test_filesharing, lossy_peers_leave_no_holes) {
+    FakeClock c;
+    FileSharing f(c.clock());
+    const int count = 200;
+    f.set_segment_count(count);
+    f.set_file_info(1, count);
+    // a is fine, b loses every third reply, the third one never answers
+    std::vector<int> peers = {f.new_peer(1), f.new_peer(2), f.new_peer(3)};
+    std::vector<std::chrono::milliseconds> rtt = {50ms, 120ms, 80ms};
+    std::vector<int> requests(peers.size());
+    auto lost = [&](int p) {
+        return p == 2 || (p == 1 && requests[p] % 3 == 0);
+    };
+
+    std::vector<char> written;
+    for (int round = 0; round < 10000 && !f.all_segments_received(); round++) {
+        for (int p : peers) {
+            if (f.is_peer_dead(p)) {
+                continue;
+            }
+            int s = f.next_segment_for(p);
+            if (s == -1) {
+                continue;
+            }
+            requests[p]++;
+            f.segment_requested(p, s);
+            if (lost(p)) {
+                c.t += f.get_timeout(p);
+                f.segment_timed_out(p, s);
+            } else {
+                c.t += rtt[p];
+                f.push_segment(ReturnSegment{s, p, {char(s)}});
+            }
+        }
+        f.try_writing_segment([&](const ReturnSegment &rs, bool end) {
+            written.push_back(rs.body[0]);
+        });
+    }
+
+    ASSERT_EQ(written.size(), count);
+    for (int i = 0; i < count; i++) {
+        EXPECT_EQ(written[i], char(i));
+    }
+    EXPECT_TRUE(f.is_peer_dead(peers[2]));
+    EXPECT_FALSE(f.is_peer_dead(peers[0]));
+    EXPECT_FALSE(f.is_peer_dead(peers[1]));
+    // a steady 50ms peer ends up with the smallest timeout allowed
+    EXPECT_EQ(f.get_timeout(peers[0]), MIN_RTO);
+    EXPECT_LT(f.get_timeout(peers[1]), INITIAL_RTO);
+}
+
+// ask for new segments until there is no credit left
+static int ask_until_no_credit(FileSharing &f, int id) {
+    int asked = 0;
+    int s;
+    while ((s = f.next_segment_for(id)) != -1) {
+        f.segment_requested(id, s);
+        asked++;
+    }
+    return asked;
+}
+
+TEST(test_filesharing, credit_does_not_depend_on_file_size) {
+    const int chunk = 128 * 1024;
+    // the same bitrate (about 1.4 Mbit/s, a FLAC file), 5 and 50 minutes long
+    std::vector<int> asked;
+    for (int minutes : {5, 50}) {
+        FileSharing f;
+        int id = f.new_peer(1);
+        int duration = minutes * 60 * 1000;
+        int bytes = minutes * 60 * 176400;
+        f.set_segment_count(bytes / chunk + 1);
+        f.set_file_info(chunk, bytes, duration);
+        EXPECT_EQ(f.get_credit(), BUFFER_AHEAD_SECONDS * 176400);
+        asked.push_back(ask_until_no_credit(f, id));
+    }
+    EXPECT_EQ(asked[0], asked[1]);
+    EXPECT_EQ(asked[0], BUFFER_AHEAD_SECONDS * 176400 / chunk);
+}
+
+TEST(test_filesharing, credit_is_bounded) {
+    FileSharing f;
+    int id = f.new_peer(1);
+    // 100 MB/s, the credit is capped
+    f.set_segment_count(100000);
+    f.set_file_info(65536, 1000000000, 10000);
+    EXPECT_EQ(f.get_credit(), MAX_BUFFER_BYTES);
+    EXPECT_EQ(ask_until_no_credit(f, id), MAX_BUFFER_BYTES / 65536);
+
+    // a tiny file still gets a full window
+    FileSharing g;
+    id = g.new_peer(1);
+    g.set_segment_count(100);
+    g.set_file_info(1024, 100 * 1024, 600000);
+    EXPECT_EQ(g.get_credit(), SEGMENT_WINDOW * 1024);
+}
+
+TEST(test_filesharing, player_buffer_uses_up_credit) {
+    FileSharing f;
+    int id = f.new_peer(1);
+    f.set_segment_count(1000);
+    f.set_file_info(1000, 1000000, 100000);
+    // 10 kB/s, the credit is 100 kB
+    EXPECT_EQ(f.get_credit(), 100000);
+    f.set_player_buffered(95000);
+    EXPECT_EQ(ask_until_no_credit(f, id), 5);
+
+    // the player has played some, more can be asked
+    f.set_player_buffered(90000);
+    EXPECT_EQ(ask_until_no_credit(f, id), 5);
+
+    // a timed out segment is asked again even if there is no credit
+    f.segment_timed_out(id, 0);
+    f.set_player_buffered(100000);
+    f.die_peer(id);
+    EXPECT_FALSE(f.has_credit());
+    EXPECT_EQ(f.next_segment_for(id), 0);
+}
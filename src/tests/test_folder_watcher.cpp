@@ -0,0 +1,85 @@
+#include "../folder-watcher.h"
+#include <atomic>
+#include <chrono>
+#include <gtest/gtest.h>
+#include <random>
+
+using namespace testing;
+
+class FolderWatcherTest : public Test {
+  protected:
+    void SetUp() override {
+        // a name of its own each run, ctest runs the tests side by side
+        dir = std::filesystem::temp_directory_path() /
+              ("test_folder_watcher_" + std::to_string(std::random_device()()));
+        std::filesystem::remove_all(dir);
+        std::filesystem::create_directories(dir);
+    }
+    void TearDown() override { std::filesystem::remove_all(dir); }
+
+    void write_file(const std::filesystem::path &path) {
+        FILE *fp = fopen(path.c_str(), "w");
+        fprintf(fp, "song");
+        fclose(fp);
+    }
+
+    // waits until the watcher reported more than seen changes
+    bool changed_after(int seen) {
+        auto give_up =
+            std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (std::chrono::steady_clock::now() < give_up) {
+            if (changes > seen) {
+                return true;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return false;
+    }
+
+    std::filesystem::path dir;
+    std::atomic<int> changes = 0;
+};
+
+TEST_F(FolderWatcherTest, adds_removes_and_renames_are_seen) {
+    FolderWatcher watcher(dir, false, [&]() { changes++; });
+    ASSERT_TRUE(watcher.watching());
+    write_file(dir / "a.wav");
+    EXPECT_TRUE(changed_after(0));
+    std::filesystem::rename(dir / "a.wav", dir / "b.wav");
+    EXPECT_TRUE(changed_after(1));
+    std::filesystem::remove(dir / "b.wav");
+    EXPECT_TRUE(changed_after(2));
+}
+
+TEST_F(FolderWatcherTest, a_burst_of_changes_is_one_change) {
+    FolderWatcher watcher(dir, false, [&]() { changes++; });
+    for (int i = 0; i < 50; i++) {
+        write_file(dir / (std::to_string(i) + ".wav"));
+    }
+    EXPECT_TRUE(changed_after(0));
+    std::this_thread::sleep_for(
+        std::chrono::milliseconds(FOLDER_WATCH_DELAY_MS * 2));
+    EXPECT_EQ(changes, 1);
+}
+
+TEST_F(FolderWatcherTest, new_subfolders_are_watched_when_recursive) {
+    std::filesystem::create_directories(dir / "old");
+    FolderWatcher watcher(dir, true, [&]() { changes++; });
+    write_file(dir / "old" / "a.wav");
+    EXPECT_TRUE(changed_after(0));
+
+    std::filesystem::create_directories(dir / "new");
+    EXPECT_TRUE(changed_after(1));
+    int seen = changes;
+    write_file(dir / "new" / "b.wav");
+    EXPECT_TRUE(changed_after(seen));
+}
+
+TEST_F(FolderWatcherTest, subfolders_are_left_alone_otherwise) {
+    std::filesystem::create_directories(dir / "sub");
+    FolderWatcher watcher(dir, false, [&]() { changes++; });
+    write_file(dir / "sub" / "a.wav");
+    std::this_thread::sleep_for(
+        std::chrono::milliseconds(FOLDER_WATCH_DELAY_MS * 2));
+    EXPECT_EQ(changes, 0);
+}
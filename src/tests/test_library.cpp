@@ -0,0 +1,322 @@
+#include "../library.h"
+#include <algorithm>
+#include <clocale>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <memory>
+#include <random>
+
+using namespace testing;
+
+static TrackIndex add(Library &library, std::string title, std::string artist,
+                      std::string album, int duration = 0,
+                      std::string file_name = "") {
+    return library.add({.title = title,
+                        .artist = artist,
+                        .album = album,
+                        .file_name = file_name,
+                        .path = "/music/" + file_name + ".mp3",
+                        .duration = duration});
+}
+
+static std::vector<std::string> titles(const Library &library,
+                                       const std::vector<TrackIndex> &order) {
+    std::vector<std::string> t;
+    for (TrackIndex i : order) {
+        t.emplace_back(library.title(i));
+    }
+    return t;
+}
+
+TEST(StringPoolTest, same_string_same_id) {
+    StringPool pool;
+    StringId a = pool.intern("Harry Belafonte");
+    StringId b = pool.intern("Nina Simone");
+    EXPECT_NE(a, b);
+    EXPECT_EQ(pool.intern(std::string("Harry ") + "Belafonte"), a);
+    EXPECT_EQ(pool.get(b), "Nina Simone");
+    EXPECT_EQ(pool.size(), 2);
+    // growing the pool leaves the strings where they were
+    const std::string *first = &pool.get(a);
+    for (int i = 0; i < 1000; i++) {
+        pool.intern(std::to_string(i));
+    }
+    EXPECT_EQ(&pool.get(a), first);
+}
+
+TEST(LibraryTest, keeps_what_it_is_given) {
+    Library library;
+    TrackIndex i = library.add({.title = "Jamaica Farewell",
+                                .artist = "Harry Belafonte",
+                                .album = "Calypso",
+                                .file_name = "jamaica",
+                                .path = "/music/jamaica.mp3",
+                                .duration = 183000});
+    add(library, "Day-O", "Harry Belafonte", "Calypso");
+    EXPECT_EQ(i, 0);
+    EXPECT_EQ(library.size(), 2);
+    EXPECT_EQ(library.title(i), "Jamaica Farewell");
+    EXPECT_EQ(library.artist(i), "Harry Belafonte");
+    EXPECT_EQ(library.album(i), "Calypso");
+    EXPECT_EQ(library.file_name(i), "jamaica");
+    EXPECT_EQ(library.path(i), "/music/jamaica.mp3");
+    EXPECT_EQ(library.duration(i), 183000);
+    EXPECT_EQ(library.title(1), "Day-O");
+    library.clear();
+    EXPECT_EQ(library.size(), 0);
+}
+
+TEST(LibraryTest, sorts_by_each_column) {
+    Library library;
+    add(library, "b", "Zed", "one", 300, "3");
+    add(library, "A", "alpha", "two", 100, "1");
+    add(library, "c", "Alpha", "One", 100, "2");
+    add(library, "a", "zed", "One", 200, "0");
+    std::vector<TrackIndex> order;
+
+    // ignoring case, ties in the order they were added
+    library.sort(Library::TITLE, true, order);
+    EXPECT_THAT(titles(library, order), ElementsAre("A", "a", "b", "c"));
+    library.sort(Library::DURATION, true, order);
+    EXPECT_THAT(titles(library, order), ElementsAre("A", "c", "a", "b"));
+    // artist, then album, then title
+    library.sort(Library::ARTIST, true, order);
+    EXPECT_THAT(titles(library, order), ElementsAre("c", "A", "a", "b"));
+    library.sort(Library::ALBUM, true, order);
+    EXPECT_THAT(titles(library, order), ElementsAre("a", "b", "c", "A"));
+    library.sort(Library::FILE_NAME, true, order);
+    EXPECT_THAT(titles(library, order), ElementsAre("a", "A", "c", "b"));
+}
+
+TEST(LibraryTest, descending_is_the_reverse) {
+    Library library;
+    for (int i = 0; i < 100; i++) {
+        // plenty of ties
+        add(library, std::to_string(i % 7), "artist " + std::to_string(i % 3),
+            "album", i % 5 * 1000, std::to_string(i % 11));
+    }
+    for (auto column : {Library::TITLE, Library::DURATION, Library::ARTIST,
+                        Library::ALBUM, Library::FILE_NAME}) {
+        std::vector<TrackIndex> ascending, descending;
+        library.sort(column, true, ascending);
+        library.sort(column, false, descending);
+        std::reverse(descending.begin(), descending.end());
+        EXPECT_EQ(ascending, descending) << column;
+    }
+}
+
+TEST(LibraryTest, sorts_what_was_added_after_sorting) {
+    Library library;
+    add(library, "b", "Zed", "x");
+    std::vector<TrackIndex> order;
+    library.sort(Library::ARTIST, true, order);
+    add(library, "a", "Abba", "y");
+    library.sort(Library::ARTIST, true, order);
+    EXPECT_THAT(titles(library, order), ElementsAre("a", "b"));
+}
+
+TEST(LibraryTest, keeps_orders_in_step_with_changes) {
+    std::mt19937 rng(44);
+    auto track = [&rng](int i) {
+        // few distinct values, so there are plenty of ties, and artists
+        // that only differ in case
+        std::string artist = std::string(1, "aAbBc"[rng() % 5]) + "rtist";
+        return std::make_tuple(std::to_string(rng() % 20), artist,
+                               std::to_string(rng() % 4), int(rng() % 3),
+                               std::to_string(i % 9));
+    };
+    Library library;
+    std::vector<decltype(track(0))> tracks;
+    auto add_or_set = [&](size_t i) {
+        auto t = track(i);
+        auto &[title, artist, album, duration, file_name] = t;
+        LibraryTrack lt = {.title = title,
+                           .artist = artist,
+                           .album = album,
+                           .file_name = file_name,
+                           .path = file_name,
+                           .duration = duration};
+        if (i == tracks.size()) {
+            library.add(lt);
+            tracks.push_back(t);
+        } else {
+            library.set(i, lt);
+            tracks[i] = t;
+        }
+    };
+    const auto columns = {Library::TITLE, Library::DURATION, Library::ARTIST,
+                          Library::ALBUM, Library::FILE_NAME};
+    for (int i = 0; i < 200; i++) {
+        add_or_set(i);
+    }
+    for (int round = 0; round < 20; round++) {
+        // a few added and a few changed, so the orders are merged into
+        for (int k = 0; k < 5; k++) {
+            add_or_set(tracks.size());
+            add_or_set(rng() % tracks.size());
+        }
+        // what the orders should be: a library made from scratch
+        Library fresh;
+        for (auto &[title, artist, album, duration, file_name] : tracks) {
+            fresh.add({.title = title,
+                       .artist = artist,
+                       .album = album,
+                       .file_name = file_name,
+                       .path = file_name,
+                       .duration = duration});
+        }
+        for (auto column : columns) {
+            // only some of them are looked at every round
+            if ((round + column) % 3 == 0) {
+                continue;
+            }
+            const std::vector<TrackIndex> &order = library.order(column);
+            ASSERT_EQ(order, fresh.order(column)) << round << " " << column;
+            for (uint32_t k = 0; k < order.size(); k++) {
+                ASSERT_EQ(library.position(column, order[k]), k);
+            }
+        }
+    }
+}
+
+TEST(LibraryTest, filters_ignoring_case) {
+    Library library;
+    add(library, "Jamaica Farewell", "Harry Belafonte", "Calypso");
+    add(library, "Feeling Good", "Nina Simone", "I Put a Spell on You");
+    add(library, "Sinnerman", "Nina Simone", "Pastel Blues");
+    add(library, "Day-O", "Harry Belafonte", "Calypso");
+    std::vector<TrackIndex> matches;
+    library.filter("nina", matches);
+    EXPECT_THAT(matches, ElementsAre(1, 2));
+    library.filter("CALYPSO", matches);
+    EXPECT_THAT(matches, ElementsAre(0, 3));
+    library.filter("ee", matches);
+    EXPECT_THAT(matches, ElementsAre(1));
+    library.filter("in", matches);
+    EXPECT_THAT(matches, ElementsAre(1, 2));
+    library.filter("", matches);
+    EXPECT_THAT(matches, ElementsAre(0, 1, 2, 3));
+    library.filter("nothing like it", matches);
+    EXPECT_THAT(matches, IsEmpty());
+}
+
+TEST(LibraryTest, folds_case_beyond_ascii) {
+    Library library;
+    add(library, "La Vie en rose", "\u00c9dith Piaf", "Chansons");
+    add(library, "Non, je ne regrette rien", "\u00c9DITH PIAF",
+        "\u00c7a");
+    add(library, "Milord", "Zaz", "\u00e7a ira");
+    EXPECT_EQ(Library::key("\u00c9DITH"), Library::key("\u00e9dith"));
+    std::vector<TrackIndex> matches;
+    library.filter("\u00e9dith", matches);
+    EXPECT_THAT(matches, ElementsAre(0, 1));
+    library.filter("\u00c7A", matches);
+    EXPECT_THAT(matches, ElementsAre(1, 2));
+    // what isn't utf-8 only has its ascii letters folded
+    EXPECT_EQ(Library::key("AB\xff"), "ab\xff");
+}
+
+// sorting follows the locale, like the app does once gtk has set it up
+class CollatingLocale {
+  public:
+    CollatingLocale() : previous(std::setlocale(LC_ALL, nullptr)) {
+        for (const char *name : {"en_US.UTF-8", "en_GB.UTF-8", "de_DE.UTF-8",
+                                 "fr_FR.UTF-8"}) {
+            if (std::setlocale(LC_ALL, name)) {
+                found = true;
+                return;
+            }
+        }
+    }
+    ~CollatingLocale() { std::setlocale(LC_ALL, previous.c_str()); }
+    bool found = false;
+
+  private:
+    std::string previous;
+};
+
+TEST(LibraryTest, sorts_accented_letters_with_their_base_letter) {
+    CollatingLocale locale;
+    if (!locale.found) {
+        GTEST_SKIP() << "no locale that collates accented letters";
+    }
+    Library library;
+    add(library, "Zed", "Zed", "x", 0, "zed");
+    add(library, "\u00c9mile", "\u00d3lafur Arnalds", "x", 0, "\u00e9mile");
+    add(library, "Apple", "Adele", "x", 0, "apple");
+    std::vector<TrackIndex> order;
+    library.sort(Library::TITLE, true, order);
+    EXPECT_THAT(titles(library, order),
+                ElementsAre("Apple", "\u00c9mile", "Zed"));
+    library.sort(Library::ARTIST, true, order);
+    EXPECT_THAT(titles(library, order),
+                ElementsAre("Apple", "\u00c9mile", "Zed"));
+    library.sort(Library::FILE_NAME, true, order);
+    EXPECT_THAT(titles(library, order),
+                ElementsAre("Apple", "\u00c9mile", "Zed"));
+
+    // both are the same artist, so the album decides
+    library.clear();
+    add(library, "La Vie en rose", "\u00c9dith Piaf", "Chansons");
+    add(library, "Non, je ne regrette rien", "\u00c9DITH PIAF",
+        "\u00c7a");
+    add(library, "Milord", "Zaz", "\u00e7a ira");
+    library.sort(Library::ARTIST, true, order);
+    EXPECT_THAT(order, ElementsAre(1, 0, 2));
+}
+
+static bool in_artist_order(const Library &library,
+                            const std::vector<TrackIndex> &order) {
+    for (size_t i = 1; i < order.size(); i++) {
+        if (Library::sort_key(library.artist(order[i - 1])) >
+            Library::sort_key(library.artist(order[i]))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+TEST(LibraryTest, large_library_stays_in_order) {
+    const int n = 5000;
+    std::mt19937 rng(3280);
+    auto word = [&rng](int length) {
+        std::string w;
+        for (int i = 0; i < length; i++) {
+            w.push_back((i == 0 ? 'A' : 'a') + rng() % 26);
+        }
+        return w;
+    };
+    // short names, so many artists and albums share their first letters
+    Library library;
+    for (int i = 0; i < n; i++) {
+        add(library, word(12), word(2) + " " + word(3), word(3), 0, word(16));
+    }
+    std::vector<TrackIndex> order;
+    library.sort(Library::ARTIST, true, order);
+    ASSERT_EQ(order.size(), n);
+    EXPECT_TRUE(in_artist_order(library, order));
+
+    // a rescan that changed a few tracks, they are merged into the order
+    for (int i = 0; i < 100; i++) {
+        TrackIndex changed = rng() % n;
+        std::string title(library.title(changed));
+        std::string album(library.album(changed));
+        library.set(changed, {.title = title,
+                              .artist = word(2) + " " + word(3),
+                              .album = album});
+    }
+    const std::vector<TrackIndex> &merged = library.order(Library::ARTIST);
+    ASSERT_EQ(merged.size(), n);
+    EXPECT_TRUE(in_artist_order(library, merged));
+
+    std::vector<TrackIndex> matches;
+    library.filter("Ab", matches);
+    EXPECT_FALSE(matches.empty());
+    std::vector<TrackIndex> expected;
+    for (TrackIndex i = 0; i < n; i++) {
+        if (library.matches(i, Library::key("Ab"))) {
+            expected.push_back(i);
+        }
+    }
+    EXPECT_EQ(matches, expected);
+}
@@ -0,0 +1,211 @@
+#include "../library-scanner.h"
+#include <chrono>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <random>
+
+using namespace testing;
+
+class LibraryScannerTest : public Test {
+  protected:
+    void SetUp() override {
+        // a name of its own each run, ctest runs the tests side by side
+        dir = std::filesystem::temp_directory_path() /
+              ("test_library_scanner_" +
+               std::to_string(std::random_device()()));
+        std::filesystem::remove_all(dir);
+        std::filesystem::create_directories(dir);
+    }
+    void TearDown() override { std::filesystem::remove_all(dir); }
+
+    std::vector<std::filesystem::path> make_files(int count) {
+        std::vector<std::filesystem::path> files;
+        for (int i = 0; i < count; i++) {
+            auto path = dir / (std::to_string(i) + ".wav");
+            FILE *fp = fopen(path.c_str(), "w");
+            fprintf(fp, "song %d", i);
+            fclose(fp);
+            files.push_back(path);
+        }
+        return files;
+    }
+
+    // waits for the scan to finish, and returns everything it described
+    std::vector<Track> wait_for(LibraryScanner &scanner) {
+        std::vector<Track> tracks;
+        auto give_up =
+            std::chrono::steady_clock::now() + std::chrono::seconds(30);
+        while (std::chrono::steady_clock::now() < give_up) {
+            bool finished = scanner.progress().finished;
+            for (Track &t : scanner.take()) {
+                tracks.push_back(std::move(t));
+            }
+            if (finished) {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return tracks;
+    }
+
+    std::filesystem::path dir;
+    Store store{true, ":memory:"};
+};
+
+static Track describe_by_name(const std::filesystem::path &file,
+                              const Track *stored) {
+    if (stored) {
+        return *stored;
+    }
+    return {.title = file.stem().string(), .path = file.string()};
+}
+
+TEST_F(LibraryScannerTest, every_file_is_described_and_stored) {
+    // more than one batch
+    auto files = make_files(SCAN_BATCH * 2 + 10);
+    std::atomic<int> notified = 0;
+    LibraryScanner scanner(
+        store, dir, [&]() { return files; }, describe_by_name,
+        [&]() { notified++; });
+    auto tracks = wait_for(scanner);
+
+    EXPECT_EQ(tracks.size(), files.size());
+    ScanProgress p = scanner.progress();
+    EXPECT_EQ(p.files, files.size());
+    EXPECT_EQ(p.described, files.size());
+    EXPECT_EQ(p.stored, files.size());
+    EXPECT_GT(notified, 0);
+    auto stored = store.read_all();
+    ASSERT_EQ(stored.size(), files.size());
+    EXPECT_FALSE(stored[0].checksum.empty());
+}
+
+TEST_F(LibraryScannerTest, unchanged_files_come_from_the_store) {
+    auto files = make_files(20);
+    {
+        LibraryScanner first(
+            store, dir, [&]() { return files; }, describe_by_name, []() {});
+        wait_for(first);
+    }
+    // one of them changes
+    FILE *fp = fopen(files[3].c_str(), "a");
+    fprintf(fp, " and more");
+    fclose(fp);
+
+    std::atomic<int> opened = 0;
+    LibraryScanner second(
+        store, dir, [&]() { return files; },
+        [&](const std::filesystem::path &file, const Track *stored) {
+            if (!stored) {
+                opened++;
+                EXPECT_EQ(file, files[3]);
+            }
+            return describe_by_name(file, stored);
+        },
+        []() {});
+    auto tracks = wait_for(second);
+    EXPECT_EQ(tracks.size(), files.size());
+    EXPECT_EQ(opened, 1);
+    EXPECT_EQ(store.read_all().size(), files.size());
+}
+
+TEST_F(LibraryScannerTest, cancel_stops_early) {
+    auto files = make_files(200);
+    auto scanner = std::make_unique<LibraryScanner>(
+        store, dir, [&]() { return files; },
+        [](const std::filesystem::path &file, const Track *stored) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            return describe_by_name(file, stored);
+        },
+        []() {}, std::unordered_set<std::string>{}, 2);
+    while (scanner->progress().described == 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    scanner->cancel();
+    wait_for(*scanner);
+    EXPECT_TRUE(scanner->progress().finished);
+    EXPECT_LT(scanner->progress().described, files.size());
+    // the destructor does not wait for the rest either
+    scanner.reset();
+}
+
+TEST_F(LibraryScannerTest, rescan_hands_back_only_what_changed) {
+    auto files = make_files(10);
+    std::unordered_set<std::string> shown;
+    {
+        LibraryScanner first(
+            store, dir, [&]() { return files; }, describe_by_name, []() {});
+        for (Track &t : wait_for(first)) {
+            shown.insert(t.path);
+        }
+    }
+    ASSERT_EQ(shown.size(), 10);
+    // one changes, one is deleted and one is new
+    FILE *fp = fopen(files[3].c_str(), "a");
+    fprintf(fp, " and more");
+    fclose(fp);
+    std::filesystem::remove(files[5]);
+    std::string deleted = files[5].string();
+    files.erase(files.begin() + 5);
+    auto added = dir / "added.wav";
+    fp = fopen(added.c_str(), "w");
+    fprintf(fp, "new song");
+    fclose(fp);
+    files.push_back(added);
+
+    LibraryScanner second(
+        store, dir, [&]() { return files; }, describe_by_name, []() {},
+        shown);
+    auto tracks = wait_for(second);
+    std::vector<std::string> paths;
+    for (auto &t : tracks) {
+        paths.push_back(t.path);
+    }
+    EXPECT_THAT(paths, UnorderedElementsAre(files[3].string(), added.string()));
+    EXPECT_THAT(second.take_removed(), ElementsAre(deleted));
+    ScanProgress p = second.progress();
+    EXPECT_EQ(p.unchanged, 8);
+    EXPECT_EQ(p.removed, 1);
+    // the deleted file is gone from the store too
+    EXPECT_EQ(store.read_all().size(), 10);
+    Track t;
+    EXPECT_FALSE(store.search_with_path(
+        (std::filesystem::canonical(dir) / "5.wav").string(), t));
+}
+
+// renames are told apart by the inode, which only linux has
+#ifdef __linux__
+TEST_F(LibraryScannerTest, renamed_files_are_not_opened_again) {
+    auto files = make_files(5);
+    {
+        LibraryScanner first(
+            store, dir, [&]() { return files; }, describe_by_name, []() {});
+        wait_for(first);
+    }
+    Track before;
+    ASSERT_TRUE(store.search_with_path(
+        std::filesystem::canonical(files[2]).string(), before));
+    auto renamed = dir / "renamed.wav";
+    std::filesystem::rename(files[2], renamed);
+    files[2] = renamed;
+
+    std::atomic<int> opened = 0;
+    LibraryScanner second(
+        store, dir, [&]() { return files; },
+        [&](const std::filesystem::path &file, const Track *stored) {
+            if (!stored) {
+                opened++;
+            }
+            return describe_by_name(file, stored);
+        },
+        []() {});
+    wait_for(second);
+    EXPECT_EQ(opened, 0);
+    EXPECT_EQ(second.progress().renamed, 1);
+    EXPECT_EQ(second.progress().removed, 0);
+    Track after = store.read(before.id);
+    EXPECT_EQ(after.path, std::filesystem::canonical(renamed).string());
+    EXPECT_EQ(after.checksum, before.checksum);
+    EXPECT_EQ(store.read_all().size(), 5);
+}
+#endif
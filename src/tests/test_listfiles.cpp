@@ -0,0 +1,85 @@
+#include "../listfiles.h"
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <random>
+
+using namespace testing;
+
+static const std::vector<std::string> exts = {".mp3", ".wav", ".flac"};
+
+class ListFilesTest : public Test {
+  protected:
+    void SetUp() override {
+        // a name of its own each run, ctest runs the tests side by side
+        dir = std::filesystem::temp_directory_path() /
+              ("test_listfiles_" + std::to_string(std::random_device()()));
+        std::filesystem::remove_all(dir);
+        std::filesystem::create_directories(dir);
+    }
+    void TearDown() override { std::filesystem::remove_all(dir); }
+
+    void touch(const std::filesystem::path &path) {
+        std::filesystem::create_directories(path.parent_path());
+        FILE *fp = fopen(path.c_str(), "w");
+        fclose(fp);
+    }
+
+    // the names relative to dir, sorted to compare with
+    std::vector<std::string> names(
+        const std::vector<std::filesystem::path> &files) {
+        std::vector<std::string> relative;
+        for (auto &file : files) {
+            relative.push_back(file.lexically_relative(dir).string());
+        }
+        std::sort(relative.begin(), relative.end());
+        return relative;
+    }
+
+    std::filesystem::path dir;
+};
+
+TEST_F(ListFilesTest, missing_folder_is_empty) {
+    EXPECT_TRUE(ListFiles::listfiles((dir / "nowhere").string(), exts).empty());
+}
+
+TEST_F(ListFilesTest, extensions_ignore_case) {
+    touch(dir / "a.mp3");
+    touch(dir / "b.MP3");
+    touch(dir / "c.Flac");
+    touch(dir / "d.txt");
+    touch(dir / "mp3");
+    touch(dir / ".mp3");
+    EXPECT_THAT(names(ListFiles::listfiles(dir.string(), exts)),
+                ElementsAre("a.mp3", "b.MP3", "c.Flac"));
+}
+
+TEST_F(ListFilesTest, only_regular_files) {
+    touch(dir / "a.wav");
+    std::filesystem::create_directories(dir / "folder.wav");
+    std::filesystem::create_symlink(dir / "a.wav", dir / "link.wav");
+    std::filesystem::create_symlink(dir / "gone.wav", dir / "broken.wav");
+    // links to files are followed like before, broken ones are left out
+    EXPECT_THAT(names(ListFiles::listfiles(dir.string(), exts)),
+                ElementsAre("a.wav", "link.wav"));
+}
+
+TEST_F(ListFilesTest, ascii_only) {
+    touch(dir / "plain.mp3");
+    touch(dir / "caf\xc3\xa9.mp3");
+    EXPECT_THAT(names(ListFiles::listfiles(dir.string(), exts)),
+                ElementsAre("plain.mp3"));
+    EXPECT_EQ(ListFiles::listfiles(dir.string(), exts, false).size(), 2);
+}
+
+TEST_F(ListFilesTest, subfolders_only_when_recursive) {
+    touch(dir / "a.mp3");
+    touch(dir / "x" / "b.mp3");
+    touch(dir / "x" / "y" / "c.mp3");
+    touch(dir / "z" / "d.mp3");
+    // links to folders are not followed, like recursive_directory_iterator
+    std::filesystem::create_directory_symlink(dir / "x", dir / "link");
+    EXPECT_THAT(names(ListFiles::listfiles(dir.string(), exts)),
+                ElementsAre("a.mp3"));
+    EXPECT_THAT(names(ListFiles::listfiles(dir.string(), exts, true, true)),
+                ElementsAre("a.mp3", "x/b.mp3", "x/y/c.mp3", "z/d.mp3"));
+}
@@ -0,0 +1,74 @@
+#include "../lru-cache.h"
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <string>
+
+using namespace testing;
+
+TEST(test_lru_cache, drops_the_least_recently_used) {
+    LruCache<std::string, int> cache(3);
+    cache.put("a", 1);
+    cache.put("b", 2);
+    cache.put("c", 3);
+    // a is used, so b is the oldest now
+    ASSERT_NE(cache.get("a"), nullptr);
+    EXPECT_EQ(*cache.get("a"), 1);
+    cache.put("d", 4);
+
+    EXPECT_EQ(cache.size(), 3);
+    EXPECT_TRUE(cache.contains("a"));
+    EXPECT_FALSE(cache.contains("b"));
+    EXPECT_EQ(cache.get("b"), nullptr);
+    EXPECT_TRUE(cache.contains("c"));
+    EXPECT_TRUE(cache.contains("d"));
+    EXPECT_TRUE(cache.full());
+}
+
+TEST(test_lru_cache, keeps_to_the_total_cost) {
+    LruCache<std::string, std::string> cache(100);
+    cache.put("small", "s", 10);
+    cache.put("medium", "m", 40);
+    cache.put("large", "l", 50);
+    EXPECT_EQ(cache.cost(), 100);
+
+    // medium is the oldest once small is used, it is all that has to go
+    cache.get("small");
+    cache.put("more", "M", 40);
+    EXPECT_EQ(cache.cost(), 100);
+    EXPECT_TRUE(cache.contains("small"));
+    EXPECT_FALSE(cache.contains("medium"));
+    EXPECT_TRUE(cache.contains("large"));
+    EXPECT_TRUE(cache.contains("more"));
+
+    // and when more has to go, the oldest go first until it fits
+    cache.put("larger", "L", 60);
+    EXPECT_EQ(cache.cost(), 100);
+    EXPECT_EQ(cache.size(), 2);
+    EXPECT_TRUE(cache.contains("more"));
+    EXPECT_TRUE(cache.contains("larger"));
+
+    // it can never fit
+    cache.put("huge", "H", 101);
+    EXPECT_FALSE(cache.contains("huge"));
+    EXPECT_EQ(cache.size(), 2);
+    EXPECT_EQ(cache.cost(), 100);
+}
+
+TEST(test_lru_cache, put_replaces_and_erase_gives_the_cost_back) {
+    LruCache<int, int> cache(10);
+    cache.put(1, 1, 4);
+    cache.put(1, 2, 6);
+    EXPECT_EQ(cache.size(), 1);
+    EXPECT_EQ(cache.cost(), 6);
+    EXPECT_EQ(*cache.get(1), 2);
+
+    cache.erase(1);
+    cache.erase(2);
+    EXPECT_EQ(cache.size(), 0);
+    EXPECT_EQ(cache.cost(), 0);
+
+    cache.put(3, 3);
+    cache.clear();
+    EXPECT_EQ(cache.get(3), nullptr);
+    EXPECT_FALSE(cache.full());
+}
@@ -0,0 +1,117 @@
+#include "../md5-multi.h"
+#include "../util.h"
+#include <filesystem>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace testing;
+
+// the same bytes every time, different for every stream
+static std::string make_data(size_t size, int seed) {
+    std::string data(size, 0);
+    uint32_t x = seed * 2654435761u + 1;
+    for (auto &c : data) {
+        x = x * 1664525 + 1013904223;
+        c = (char)(x >> 24);
+    }
+    return data;
+}
+
+static std::string md5_of_file(const std::string &data) {
+    // a name of its own each run, ctest runs the tests side by side
+    auto path = std::filesystem::temp_directory_path() /
+                ("test_md5_multi_" + std::to_string(std::random_device()()));
+    FILE *fp = fopen(path.c_str(), "wb");
+    fwrite(data.data(), 1, data.size(), fp);
+    fclose(fp);
+    fp = fopen(path.c_str(), "rb");
+    uint8_t digest[16];
+    md5File(fp, digest);
+    fclose(fp);
+    std::filesystem::remove(path);
+    return to_hex_string(digest);
+}
+
+// hashes all of data with md5UpdateMany, piece bytes at a time
+static std::vector<std::string> md5_many(std::vector<std::string> &data,
+                                         size_t piece) {
+    std::vector<MD5Context> ctxs(data.size());
+    std::vector<MD5Context *> ptrs;
+    for (auto &ctx : ctxs) {
+        md5Init(&ctx);
+        ptrs.push_back(&ctx);
+    }
+    for (size_t at = 0; at < data[0].size(); at += piece) {
+        size_t n = std::min(piece, data[0].size() - at);
+        std::vector<uint8_t *> inputs;
+        for (auto &d : data) {
+            inputs.push_back((uint8_t *)d.data() + at);
+        }
+        md5UpdateMany(ptrs.data(), inputs.data(), n, data.size());
+    }
+    std::vector<std::string> sums;
+    for (auto &ctx : ctxs) {
+        md5Finalize(&ctx);
+        sums.push_back(to_hex_string(ctx.digest));
+    }
+    return sums;
+}
+
+TEST(md5_multi, same_as_md5_file) {
+    int lanes = md5Lanes();
+    std::cout << "md5 lanes on this cpu: " << lanes << std::endl;
+    // fewer streams than lanes, exactly as many, and some left over
+    for (int count : {1, 3, lanes, lanes + 3}) {
+        // empty, shorter than a block, on and off block boundaries
+        for (size_t size : {0, 1, 55, 56, 64, 100, 4096, 100000}) {
+            std::vector<std::string> data;
+            for (int i = 0; i < count; i++) {
+                data.push_back(make_data(size, i));
+            }
+            // pieces that do and don't line up with blocks
+            for (size_t piece : {64, 1000, 1 << 20}) {
+                auto sums = md5_many(data, piece);
+                for (int i = 0; i < count; i++) {
+                    ASSERT_EQ(sums[i], md5_of_file(data[i]))
+                        << count << " streams of " << size << " bytes in "
+                        << piece << " byte pieces, stream " << i;
+                }
+            }
+        }
+    }
+}
+
+TEST(md5_multi, streams_in_the_middle_of_a_block) {
+    // some streams already have part of a block, the others don't
+    int count = md5Lanes() + 1;
+    std::vector<MD5Context> ctxs(count), expected(count);
+    std::vector<MD5Context *> ptrs;
+    std::string head = make_data(10, 99);
+    for (int i = 0; i < count; i++) {
+        md5Init(&ctxs[i]);
+        if (i % 2) {
+            md5Update(&ctxs[i], (uint8_t *)head.data(), head.size());
+        }
+        expected[i] = ctxs[i];
+        ptrs.push_back(&ctxs[i]);
+    }
+    std::vector<std::string> data;
+    std::vector<uint8_t *> inputs;
+    for (int i = 0; i < count; i++) {
+        data.push_back(make_data(5000, i));
+    }
+    for (auto &d : data) {
+        inputs.push_back((uint8_t *)d.data());
+    }
+    md5UpdateMany(ptrs.data(), inputs.data(), 5000, count);
+    for (int i = 0; i < count; i++) {
+        md5Update(&expected[i], inputs[i], 5000);
+        md5Finalize(&expected[i]);
+        md5Finalize(&ctxs[i]);
+        EXPECT_EQ(to_hex_string(ctxs[i].digest),
+                  to_hex_string(expected[i].digest));
+    }
+}
@@ -40,6 +40,8 @@ TEST(test_msg, pushing_and_pulling_struct_with_string) {
         .artist = "Artist 1",
         .title = "Title",
         .lrcfile = "random path",
+        .checksum = "334a",
+        .content_id = "f00d",
     };
     Message m;
     m << expect;
@@ -89,6 +91,17 @@ TEST(test_msg, pushing_and_pulling_return_track_info) {
     EXPECT_THAT(actual.tracks, testing::ContainerEq(expect.tracks));
 }
 
+TEST(test_msg, pushing_and_pulling_get_track_info) {
+    GetTrackInfo expect{.title = "belafonte", .limit = 200};
+    Message m;
+    m << expect;
+    GetTrackInfo actual;
+    m >> actual;
+
+    EXPECT_EQ(actual.title, expect.title);
+    EXPECT_EQ(actual.limit, expect.limit);
+}
+
 TEST(test_msg, pushing_and_pulling_lrc) {
     Lrc expect("../src/tests/data/jamaica_farewell_first_verse.lrc");
     Message m;
@@ -102,3 +115,28 @@ TEST(test_msg, pushing_and_pulling_lrc) {
     EXPECT_EQ(actual.album, expect.album);
     EXPECT_EQ(actual.editor, expect.editor);
 }
+
+TEST(test_msg, pushing_and_pulling_hello) {
+    Message m(MessageType::HELLO);
+    m << Hello{supported_hashes};
+    Hello actual;
+    m >> actual;
+
+    EXPECT_EQ(actual.hashes, supported_hashes);
+    EXPECT_EQ(m.size(), 0);
+}
+
+TEST(test_msg, pushing_and_pulling_prepare_file_sharing) {
+    PrepareFileSharing expect = {.name = "f00d",
+                                 .assigned_id_for_peer = 3,
+                                 .hash = HashAlgorithm::XXH3_128};
+    Message m;
+    m << expect;
+    PrepareFileSharing actual;
+    m >> actual;
+
+    EXPECT_EQ(actual.name, expect.name);
+    EXPECT_EQ(actual.assigned_id_for_peer, 3);
+    EXPECT_EQ(actual.dictated_segment_count, -1);
+    EXPECT_EQ(actual.hash, HashAlgorithm::XXH3_128);
+}
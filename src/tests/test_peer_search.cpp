@@ -0,0 +1,90 @@
+#include "../peer-search.h"
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <thread>
+
+using namespace testing;
+
+static std::vector<std::string> titles(const std::vector<TrackWithOwners> &v) {
+    std::vector<std::string> t;
+    for (auto &r : v) {
+        t.push_back(r.track.title);
+    }
+    return t;
+}
+
+TEST(test_peer_search, same_file_from_many_peers_is_one_result) {
+    PeerSearch search("calypso", {1, 2, 3});
+    EXPECT_TRUE(search.add(1, {Track{.title = "Day-O", .checksum = "aa",
+                                     .content_id = "x1"},
+                               Track{.title = "Jamaica Farewell",
+                                     .checksum = "bb", .content_id = "x2"}}));
+    // an old peer that only knows md5
+    EXPECT_TRUE(search.add(2, {Track{.title = "Day-O", .checksum = "aa"}}));
+    EXPECT_TRUE(search.add(3, {Track{.title = "Jamaica Farewell",
+                                     .checksum = "bb", .content_id = "x2"}}));
+
+    auto results = search.results();
+    ASSERT_EQ(results.size(), 2);
+    for (auto &r : results) {
+        EXPECT_THAT(r.ids, SizeIs(2)) << r.track.title;
+    }
+    EXPECT_TRUE(search.finished());
+}
+
+TEST(test_peer_search, ranks_title_matches_first_then_owners) {
+    PeerSearch search("sun", {1, 2});
+    search.add(1, {Track{.title = "Sun", .checksum = "1"},
+                   Track{.title = "Island in the Sun", .checksum = "2"},
+                   Track{.title = "Sunny", .checksum = "3"},
+                   Track{.title = "Sunday", .checksum = "4"},
+                   Track{.album = "Sun Sessions", .title = "Moon",
+                         .checksum = "5"},
+                   Track{.artist = "Sun Ra", .title = "Moonlight",
+                         .checksum = "6"}});
+    search.add(2, {Track{.title = "Sunday", .checksum = "4"}});
+
+    EXPECT_THAT(titles(search.results()),
+                ElementsAre("Sun", "Sunday", "Sunny", "Island in the Sun",
+                            "Moonlight", "Moon"));
+}
+
+TEST(test_peer_search, take_hands_out_what_is_new_once) {
+    PeerSearch search("day", {1, 2});
+    search.add(1, {Track{.title = "Day-O", .checksum = "aa"}});
+    auto taken = search.take();
+    ASSERT_EQ(taken.size(), 1);
+    EXPECT_THAT(taken[0].ids, ElementsAre(1));
+    EXPECT_THAT(search.take(), IsEmpty());
+
+    // the same file again has a new owner
+    search.add(2, {Track{.title = "Day-O", .checksum = "aa"}});
+    taken = search.take();
+    ASSERT_EQ(taken.size(), 1);
+    EXPECT_THAT(taken[0].ids, ElementsAre(1, 2));
+}
+
+TEST(test_peer_search, drops_answers_nobody_waits_for) {
+    PeerSearch search("day", {1, 2}, std::chrono::milliseconds(50));
+    // not asked
+    EXPECT_FALSE(search.add(7, {Track{.title = "Day-O", .checksum = "aa"}}));
+    EXPECT_TRUE(search.add(1, {}));
+    // answered already
+    EXPECT_FALSE(search.add(1, {Track{.title = "Day-O", .checksum = "aa"}}));
+    EXPECT_FALSE(search.finished());
+    EXPECT_GT(search.remaining().count(), 0);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(60));
+    EXPECT_TRUE(search.finished());
+    EXPECT_EQ(search.remaining().count(), 0);
+    EXPECT_FALSE(search.add(2, {Track{.title = "Day-O", .checksum = "aa"}}));
+    EXPECT_THAT(search.results(), IsEmpty());
+}
+
+TEST(test_peer_search, peers_that_give_up_finish_it) {
+    PeerSearch search("day", {1, 2});
+    search.give_up(1);
+    EXPECT_FALSE(search.finished());
+    search.give_up(2);
+    EXPECT_TRUE(search.finished());
+}
@@ -0,0 +1,127 @@
+#include "../base-client.h"
+#include <future>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+/*
+ * answers every PING with a PONG that carries the same number back
+ * other messages are ignored, so requests for them time out
+ */
+class EchoClient : public BaseClient {
+  public:
+    EchoClient(uint16_t port) : BaseClient(port, 10ms, 2) { cycle(); }
+    ~EchoClient() { stop(); }
+
+    void on_connect(peer_id id) override { connected = true; }
+    void on_disconnect(peer_id id) override {}
+    void handle_message(MessageWithOwner &t) override {
+        if (t.msg.header.type != MessageType::PING) {
+            return;
+        }
+        int n;
+        t.msg >> n;
+        Message m(MessageType::PONG);
+        m << n;
+        reply(t, m);
+    }
+
+    std::atomic<bool> connected = false;
+};
+
+// connect a to b, and wait until both sides know about it
+static peer_id connect(EchoClient &a, EchoClient &b, const std::string &port) {
+    a.connect_to_peer("localhost", port);
+    for (int i = 0; i < 200 && !(a.connected && b.connected); i++) {
+        std::this_thread::sleep_for(10ms);
+    }
+    return a.get_peers().begin()->first;
+}
+
+// sends a PING with n and returns the number in the PONG, -1 if no reply
+static asio::awaitable<int> ping(EchoClient *c, peer_id id, int n,
+                                 std::chrono::milliseconds timeout) {
+    Message m(MessageType::PING);
+    m << n;
+    auto reply = co_await c->request(id, m, timeout);
+    if (!reply) {
+        co_return -1;
+    }
+    int got;
+    *reply >> got;
+    co_return got;
+}
+
+static asio::awaitable<void> ping_in_order(EchoClient *c, peer_id id,
+                                           std::promise<std::vector<int>> *p) {
+    std::vector<int> got;
+    for (int i = 0; i < 5; i++) {
+        got.push_back(co_await ping(c, id, i, 2s));
+    }
+    p->set_value(got);
+}
+
+TEST(test_request, replies_are_matched_with_requests) {
+    EchoClient a(41231), b(41232);
+    peer_id id = connect(a, b, "41232");
+    ASSERT_TRUE(a.connected && b.connected);
+
+    std::promise<std::vector<int>> result;
+    a.spawn(ping_in_order(&a, id, &result));
+    EXPECT_THAT(result.get_future().get(),
+                testing::ElementsAre(0, 1, 2, 3, 4));
+}
+
+static asio::awaitable<void> ping_and_count(EchoClient *c, peer_id id, int n,
+                                            std::atomic<int> *matched,
+                                            std::atomic<int> *done, int count,
+                                            std::promise<void> *finished) {
+    int got = co_await ping(c, id, n, 2s);
+    if (got == n) {
+        (*matched)++;
+    }
+    if (++(*done) == count) {
+        finished->set_value();
+    }
+}
+
+TEST(test_request, many_requests_in_flight) {
+    EchoClient a(41233), b(41234);
+    peer_id id = connect(a, b, "41234");
+    ASSERT_TRUE(a.connected && b.connected);
+
+    const int count = 32;
+    std::atomic<int> done = 0, matched = 0;
+    std::promise<void> finished;
+    for (int i = 0; i < count; i++) {
+        a.spawn(ping_and_count(&a, id, i, &matched, &done, count, &finished));
+    }
+    finished.get_future().get();
+    EXPECT_EQ(matched, count);
+}
+
+static asio::awaitable<void> ask_nothing(EchoClient *c, peer_id id,
+                                         std::promise<bool> *p) {
+    // nobody answers NOTHING
+    auto reply =
+        co_await c->request(id, Message(MessageType::NOTHING), 100ms);
+    p->set_value(reply.has_value());
+}
+
+TEST(test_request, unanswered_request_times_out) {
+    EchoClient a(41235), b(41236);
+    peer_id id = connect(a, b, "41236");
+    ASSERT_TRUE(a.connected && b.connected);
+
+    std::promise<bool> result;
+    auto start = std::chrono::steady_clock::now();
+    a.spawn(ask_nothing(&a, id, &result));
+    EXPECT_FALSE(result.get_future().get());
+    EXPECT_GE(std::chrono::steady_clock::now() - start, 100ms);
+}
+
+TEST(test_request, request_to_unknown_peer_fails) {
+    EchoClient a(41237);
+    std::promise<bool> result;
+    a.spawn(ask_nothing(&a, 42, &result));
+    EXPECT_FALSE(result.get_future().get());
+}
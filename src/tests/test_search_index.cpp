@@ -0,0 +1,115 @@
+#include "../search-index.h"
+#include <algorithm>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <random>
+
+using namespace testing;
+
+static void add(Library &library, SearchIndex &index, std::string title,
+                std::string artist, std::string album) {
+    TrackIndex i = library.add({.title = title,
+                                .artist = artist,
+                                .album = album,
+                                .file_name = title,
+                                .path = "/music/" + title + ".mp3"});
+    index.add(library, i);
+}
+
+class SearchIndexTest : public Test {
+  protected:
+    void SetUp() override {
+        add(library, index, "Jamaica Farewell", "Harry Belafonte", "Calypso");
+        add(library, index, "Feeling Good", "Nina Simone",
+            "I Put a Spell on You");
+        add(library, index, "Sinnerman", "Nina Simone", "Pastel Blues");
+        add(library, index, "Day-O", "Harry Belafonte", "Calypso");
+    }
+
+    std::vector<TrackIndex> search(std::string_view query) {
+        std::vector<TrackIndex> matches;
+        index.search(library, query, matches);
+        return matches;
+    }
+
+    Library library;
+    SearchIndex index;
+};
+
+TEST_F(SearchIndexTest, finds_title_artist_and_album_ignoring_case) {
+    EXPECT_THAT(search("SIMONE"), ElementsAre(1, 2));
+    EXPECT_THAT(search("calypso"), ElementsAre(0, 3));
+    EXPECT_THAT(search("farewell"), ElementsAre(0));
+    EXPECT_THAT(search("a spell"), ElementsAre(1));
+    EXPECT_THAT(search("nothing like it"), IsEmpty());
+}
+
+TEST_F(SearchIndexTest, trigrams_out_of_order_do_not_match) {
+    // "nne" and "erm" are both in "sinnerman", but not like this
+    EXPECT_THAT(search("nnerm"), ElementsAre(2));
+    EXPECT_THAT(search("ermnne"), IsEmpty());
+}
+
+TEST_F(SearchIndexTest, short_queries_are_filtered) {
+    EXPECT_THAT(search("ee"), ElementsAre(1));
+    EXPECT_THAT(search("o"), ElementsAre(0, 1, 2, 3));
+    EXPECT_THAT(search(""), ElementsAre(0, 1, 2, 3));
+}
+
+TEST_F(SearchIndexTest, finds_tracks_as_they_are_now) {
+    library.set(0, {.title = "Island in the Sun",
+                    .artist = "Harry Belafonte",
+                    .album = "Calypso"});
+    index.add(library, 0);
+    EXPECT_THAT(search("farewell"), IsEmpty());
+    EXPECT_THAT(search("sun"), ElementsAre(0));
+    EXPECT_THAT(search("calypso"), ElementsAre(0, 3));
+}
+
+TEST(SearchIndexLargeTest, answers_like_looking_at_every_row) {
+    const int n = 5000;
+    std::mt19937 rng(3280);
+    auto word = [&rng](int length) {
+        std::string w;
+        for (int i = 0; i < length; i++) {
+            w.push_back((i == 0 ? 'A' : 'a') + rng() % 26);
+        }
+        return w;
+    };
+    Library library;
+    SearchIndex index;
+    for (int i = 0; i < n; i++) {
+        library.add({.title = word(12) + " " + word(6),
+                     .artist = word(3) + " " + word(4),
+                     .album = word(5)});
+        index.add(library, i);
+    }
+    // one that is really there, typed in one key at a time
+    std::string typed = std::string(library.artist(n / 2));
+
+    // what the completion did before: for every row, every keystroke,
+    // lowercase the three fields and the key and look
+    auto lower = [](std::string s) {
+        std::transform(s.begin(), s.end(), s.begin(), ::tolower);
+        return s;
+    };
+    std::vector<TrackIndex> matches, expected;
+    for (size_t k = 1; k <= typed.size(); k++) {
+        std::string_view query = std::string_view(typed).substr(0, k);
+        std::string key = lower(std::string(query));
+        expected.clear();
+        for (TrackIndex i = 0; i < n; i++) {
+            if (lower(std::string(library.title(i))).find(key) !=
+                    std::string::npos ||
+                lower(std::string(library.artist(i))).find(key) !=
+                    std::string::npos ||
+                lower(std::string(library.album(i))).find(key) !=
+                    std::string::npos) {
+                expected.push_back(i);
+            }
+        }
+        index.search(library, query, matches);
+        ASSERT_EQ(matches, expected) << query;
+    }
+    EXPECT_FALSE(matches.empty());
+}
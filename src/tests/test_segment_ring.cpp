@@ -0,0 +1,112 @@
+#include "../segment-ring.h"
+#include <algorithm>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <numeric>
+#include <random>
+
+using namespace testing;
+
+static ReturnSegment segment(int id) {
+    return ReturnSegment{id, 0, std::vector<char>(1, char(id))};
+}
+
+// pops everything that is ready
+static std::vector<int> drain(SegmentRing &r) {
+    std::vector<int> out;
+    while (r.ready()) {
+        out.push_back(r.pop().segment_id);
+    }
+    return out;
+}
+
+TEST(test_segment_ring, in_order) {
+    SegmentRing r(4);
+    for (int i = 0; i < 10; i++) {
+        EXPECT_TRUE(r.put(segment(i)));
+        EXPECT_THAT(drain(r), ElementsAre(i));
+    }
+    EXPECT_EQ(r.next_id(), 10);
+    EXPECT_EQ(r.size(), 0);
+    // it never had to grow
+    EXPECT_EQ(r.capacity(), 4);
+}
+
+TEST(test_segment_ring, waits_for_the_gap) {
+    SegmentRing r(4);
+    r.put(segment(1));
+    r.put(segment(2));
+    EXPECT_FALSE(r.ready());
+    r.put(segment(0));
+    EXPECT_THAT(drain(r), ElementsAre(0, 1, 2));
+}
+
+TEST(test_segment_ring, drops_late_and_duplicate_segments) {
+    SegmentRing r(4);
+    r.put(segment(0));
+    drain(r);
+    EXPECT_FALSE(r.put(segment(0)));
+    EXPECT_TRUE(r.put(segment(2)));
+    EXPECT_FALSE(r.put(segment(2)));
+    EXPECT_EQ(r.size(), 1);
+}
+
+TEST(test_segment_ring, grows_when_segments_are_far_ahead) {
+    SegmentRing r(4);
+    // the head is not at slot 0 when it grows
+    r.put(segment(0));
+    r.put(segment(1));
+    r.pop();
+    for (int i = 100; i > 1; i--) {
+        r.put(segment(i));
+    }
+    EXPECT_GE(r.capacity(), 100);
+    std::vector<int> expect(100);
+    std::iota(expect.begin(), expect.end(), 1);
+    EXPECT_THAT(drain(r), ContainerEq(expect));
+}
+
+TEST(test_segment_ring, reset_starts_over) {
+    SegmentRing r;
+    r.put(segment(3));
+    r.reset(3);
+    EXPECT_EQ(r.size(), 0);
+    EXPECT_FALSE(r.ready());
+    r.put(segment(3));
+    EXPECT_THAT(drain(r), ElementsAre(3));
+}
+
+TEST(test_segment_ring, random_arrival_orders) {
+    const int count = 500;
+    for (unsigned seed = 0; seed < 50; seed++) {
+        std::mt19937 gen(seed);
+        std::vector<int> order(count);
+        std::iota(order.begin(), order.end(), 0);
+        // shuffle only within a window, like requests in flight do, and
+        // sometimes all of it
+        int window = seed % 5 == 0 ? count : 1 + gen() % 64;
+        for (int i = 0; i < count; i += window) {
+            std::shuffle(order.begin() + i,
+                         order.begin() + std::min(count, i + window), gen);
+        }
+        // some segments arrive twice
+        for (int i = 0; i < 20; i++) {
+            order.insert(order.begin() + gen() % order.size(),
+                         order[gen() % order.size()]);
+        }
+
+        SegmentRing r(8);
+        std::vector<int> out;
+        for (int id : order) {
+            r.put(segment(id));
+            // flush as soon as possible
+            for (int got : drain(r)) {
+                out.push_back(got);
+            }
+        }
+        std::vector<int> expect(count);
+        std::iota(expect.begin(), expect.end(), 0);
+        EXPECT_THAT(out, ContainerEq(expect)) << "seed " << seed;
+        EXPECT_EQ(r.size(), 0);
+    }
+}
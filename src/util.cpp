@@ -1,5 +1,10 @@
 #include "util.h"
 #include <algorithm>
+#include <chrono>
+
+#ifdef __linux__
+#include <sys/stat.h>
+#endif
 
 void rtrim(std::string &s) {
     s.erase(std::find_if(s.rbegin(), s.rend(),
@@ -23,6 +28,59 @@ uintmax_t get_file_size(const std::filesystem::path &path) {
     return UINTMAX_MAX;
 }
 
+int64_t get_file_mtime(const std::filesystem::path &path) {
+    auto err = std::error_code{};
+    auto time = std::filesystem::last_write_time(path, err);
+    if (err) {
+        return 0;
+    }
+    return time.time_since_epoch().count();
+}
+
+#ifdef __linux__
+
+bool get_file_stamp(const std::filesystem::path &path, FileStamp &stamp) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        return false;
+    }
+    stamp.size = st.st_size;
+    stamp.inode = st.st_ino;
+    // the same conversion last_write_time makes, so it can be compared with
+    // stamps from get_file_mtime
+    auto since_epoch = std::chrono::seconds(st.st_mtim.tv_sec) +
+                       std::chrono::nanoseconds(st.st_mtim.tv_nsec);
+    auto time = std::chrono::file_clock::from_sys(
+        std::chrono::sys_time<std::chrono::nanoseconds>(since_epoch));
+    stamp.mtime = std::chrono::time_point_cast<
+                      std::filesystem::file_time_type::duration>(time)
+                      .time_since_epoch()
+                      .count();
+    return true;
+}
+
+#else
+
+// no st_mtim, so it takes the two calls get_file_size and get_file_mtime make
+// there is no inode either, it stays 0 and a renamed file looks like a new one
+bool get_file_stamp(const std::filesystem::path &path, FileStamp &stamp) {
+    std::error_code ec;
+    uintmax_t size = std::filesystem::file_size(path, ec);
+    if (ec) {
+        return false;
+    }
+    auto time = std::filesystem::last_write_time(path, ec);
+    if (ec) {
+        return false;
+    }
+    stamp.size = size;
+    stamp.mtime = time.time_since_epoch().count();
+    stamp.inode = 0;
+    return true;
+}
+
+#endif
+
 char num_to_hex[16] = {'0', '1', '2', '3', '4', '5', '6', '7',
                        '8', '9', 'a', 'b', 'c', 'd', 'e', 'f'};
 
@@ -9,6 +9,24 @@ void rtrim(std::string &s);
 
 uintmax_t get_file_size(const std::filesystem::path &path);
 
+// modification time of a file as a plain number, 0 if it can't be read
+int64_t get_file_mtime(const std::filesystem::path &path);
+
+// what a rescan compares a file with what it was last time
+struct FileStamp {
+    uintmax_t size = 0;
+    // the same number get_file_mtime gives
+    int64_t mtime = 0;
+    // stays the same when the file is renamed or moved on the same disk
+    // only known on linux, 0 elsewhere
+    uint64_t inode = 0;
+};
+
+// all of it from one stat where there is st_mtim, false if the file can't be
+// read
+// symbolic links are followed, like get_file_size and get_file_mtime do
+bool get_file_stamp(const std::filesystem::path &path, FileStamp &stamp);
+
 std::string to_hex_string(uint8_t bytes[16]);
 
 #endif